@@ -0,0 +1,266 @@
+/*---------------------------------------------------------------------------*\
+
+  FILE........: channel.c
+
+  Channel simulator, see channel.h.
+
+  The fading taps are complex Gaussian noise at a low rate, shaped by a
+  Gaussian filter to the Doppler spectrum and interpolated up to Fs.  The
+  noise behind them is a hash of the sample number, so any block can work
+  out the taps it needs without the blocks before it.
+
+\*---------------------------------------------------------------------------*/
+
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "channel.h"
+
+#define CHANNEL_FADING_RATE 10          /* tap samples per Hz of Doppler spread */
+#define CHANNEL_FADING_TAPS 10          /* each side of the filter centre       */
+#define CHANNEL_MAX_PATHS   2
+
+struct channel {
+    struct channel_params p;
+    int      Fs;
+    float    signal_power;
+    float    sigma;                     /* of the noise, per real component  */
+    double   ratio;                     /* input samples per output sample   */
+    int      npaths;
+    int      delay;                     /* of the second path, samples       */
+    double   fading_step;               /* output samples per tap sample     */
+    float    h[2 * CHANNEL_FADING_TAPS + 1];
+};
+
+/* splitmix64 finaliser */
+static uint64_t channel_mix(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+static double channel_uniform(uint64_t x) {
+    return ((x >> 11) + 0.5) * (1.0 / 9007199254740992.0);
+}
+
+/* unit power complex Gaussian number n of a stream */
+static COMP channel_gaussian_at(uint64_t seed, int stream, int64_t n) {
+    uint64_t x = channel_mix(seed ^ channel_mix(((uint64_t)stream << 56) ^ (uint64_t)n));
+    double r = sqrt(-log(channel_uniform(x)));
+    double theta = 2.0 * M_PI * channel_uniform(channel_mix(x));
+    COMP w;
+
+    w.real = r * cos(theta);
+    w.imag = r * sin(theta);
+    return w;
+}
+
+/* tap n of a path, before interpolation */
+static COMP channel_tap(struct channel *ch, int path, int64_t n) {
+    COMP g = {0.0f, 0.0f}, w;
+    int k;
+
+    for (k = -CHANNEL_FADING_TAPS; k <= CHANNEL_FADING_TAPS; k++) {
+        w = channel_gaussian_at(ch->p.seed, path + 1, n - k);
+        g.real += ch->h[k + CHANNEL_FADING_TAPS] * w.real;
+        g.imag += ch->h[k + CHANNEL_FADING_TAPS] * w.imag;
+    }
+    return g;
+}
+
+/* first output sample at or after input sample n */
+static int64_t channel_first_out(struct channel *ch, int64_t n) {
+    int64_t m = (int64_t)ceil(n / ch->ratio);
+
+    while (m * ch->ratio < n)
+        m++;
+    while ((m - 1) * ch->ratio >= n)
+        m--;
+    return m;
+}
+
+struct channel *channel_create(const struct channel_params *p, int Fs, float signal_power, int bit_rate) {
+    struct channel *ch;
+    double sum = 0.0, t;
+    int k;
+
+    ch = (struct channel *)calloc(1, sizeof(struct channel));
+    if (ch == NULL)
+        return NULL;
+
+    ch->p = *p;
+    ch->Fs = Fs;
+    ch->signal_power = signal_power;
+    ch->ratio = 1.0 + p->ppm * 1E-6;
+    if (p->awgn) {
+        ch->sigma = sqrtf(signal_power * Fs / (bit_rate * powf(10.0f, p->ebno_db / 10.0f)) / 2.0f);
+        /* the real part has half the signal power, and its noise spreads over Fs/2 */
+        if (p->real)
+            ch->sigma /= sqrtf(2.0f);
+    }
+
+    ch->npaths = p->delay_ms > 0.0f ? 2 : 1;
+    ch->delay = (int)(p->delay_ms * Fs / 1000.0f + 0.5f);
+    if (p->fading_hz > 0.0f) {
+        /* Watterson spread is twice the standard deviation of the Doppler spectrum */
+        ch->fading_step = Fs / (CHANNEL_FADING_RATE * p->fading_hz);
+        for (k = -CHANNEL_FADING_TAPS; k <= CHANNEL_FADING_TAPS; k++) {
+            t = (double)k / CHANNEL_FADING_RATE;
+            ch->h[k + CHANNEL_FADING_TAPS] = exp(-2.0 * M_PI * M_PI * 0.25 * t * t);
+            sum += ch->h[k + CHANNEL_FADING_TAPS] * ch->h[k + CHANNEL_FADING_TAPS];
+        }
+        for (k = 0; k < 2 * CHANNEL_FADING_TAPS + 1; k++)
+            ch->h[k] /= sqrt(sum * ch->npaths);
+    }
+    return ch;
+}
+
+void channel_destroy(struct channel *ch) {
+    free(ch);
+}
+
+int channel_max_out(struct channel *ch, int n) {
+    return (int)ceil(n / ch->ratio) + 2;
+}
+
+float channel_get_rms(struct channel *ch) {
+    return sqrtf(ch->signal_power + 2.0f * ch->sigma * ch->sigma);
+}
+
+/* clock offset, by linear interpolation, returns the first output sample */
+static int channel_resample(struct channel *ch, COMP out[], const COMP in[], int n, int64_t start, int64_t *m0) {
+    int64_t m, m1;
+    double x, frac;
+    int i, nout;
+
+    *m0 = channel_first_out(ch, start);
+    m1 = channel_first_out(ch, start + n);
+    nout = m1 - *m0;
+    for (m = *m0; m < m1; m++) {
+        x = m * ch->ratio - start;
+        i = (int)x;
+        frac = x - i;
+        if (i + 1 >= n) {
+            out[m - *m0] = in[n - 1];
+        } else {
+            out[m - *m0].real = in[i].real + frac * (in[i + 1].real - in[i].real);
+            out[m - *m0].imag = in[i].imag + frac * (in[i + 1].imag - in[i].imag);
+        }
+    }
+    return nout;
+}
+
+/* backwards, so the delayed path still sees its input */
+static void channel_fade(struct channel *ch, COMP out[], int n, int64_t m0) {
+    COMP g[CHANNEL_MAX_PATHS][2], y, d, tap;
+    int64_t q, q_last = 0;
+    double u, frac;
+    int i, path, have = 0;
+
+    for (i = n - 1; i >= 0; i--) {
+        u = (m0 + i) / ch->fading_step;
+        q = (int64_t)floor(u);
+        frac = u - q;
+        if (!have || (q != q_last)) {
+            for (path = 0; path < ch->npaths; path++) {
+                if (have && (q == q_last - 1)) {
+                    g[path][1] = g[path][0];
+                } else {
+                    g[path][1] = channel_tap(ch, path, q + 1);
+                }
+                g[path][0] = channel_tap(ch, path, q);
+            }
+            q_last = q;
+            have = 1;
+        }
+
+        y.real = y.imag = 0.0f;
+        for (path = 0; path < ch->npaths; path++) {
+            if (path == 0) {
+                d = out[i];
+            } else if (i >= ch->delay) {
+                d = out[i - ch->delay];
+            } else {
+                continue;
+            }
+            tap.real = g[path][0].real + frac * (g[path][1].real - g[path][0].real);
+            tap.imag = g[path][0].imag + frac * (g[path][1].imag - g[path][0].imag);
+            y.real += tap.real * d.real - tap.imag * d.imag;
+            y.imag += tap.real * d.imag + tap.imag * d.real;
+        }
+        out[i] = y;
+    }
+}
+
+/* carrier offset and drift, the phase worked out afresh for each block */
+static void channel_shift(struct channel *ch, COMP out[], int n, int64_t m0) {
+    double t = (double)m0 / ch->Fs, cycles, ph_re, ph_im, w_re, w_im, dw_re, dw_im, re, a;
+    int i;
+
+    cycles = ch->p.freq_hz * t + 0.5 * ch->p.drift_hz_s * t * t;
+    a = 2.0 * M_PI * (cycles - floor(cycles));
+    ph_re = cos(a);
+    ph_im = sin(a);
+    a = 2.0 * M_PI * (ch->p.freq_hz + ch->p.drift_hz_s * (t + 0.5 / ch->Fs)) / ch->Fs;
+    w_re = cos(a);
+    w_im = sin(a);
+    a = 2.0 * M_PI * ch->p.drift_hz_s / ((double)ch->Fs * ch->Fs);
+    dw_re = cos(a);
+    dw_im = sin(a);
+
+    for (i = 0; i < n; i++) {
+        re = out[i].real * ph_re - out[i].imag * ph_im;
+        out[i].imag = out[i].real * ph_im + out[i].imag * ph_re;
+        out[i].real = re;
+
+        re = ph_re * w_re - ph_im * w_im;
+        ph_im = ph_re * w_im + ph_im * w_re;
+        ph_re = re;
+        re = w_re * dw_re - w_im * dw_im;
+        w_im = w_re * dw_im + w_im * dw_re;
+        w_re = re;
+    }
+}
+
+/* polar method, two Gaussians at a time */
+static void channel_awgn(struct channel *ch, COMP out[], int n, uint64_t block) {
+    uint64_t state = channel_mix(ch->p.seed ^ channel_mix(block)) | 1;
+    double u, v, s;
+    int i;
+
+    for (i = 0; i < n; i++) {
+        do {
+            state ^= state >> 12;
+            state ^= state << 25;
+            state ^= state >> 27;
+            u = 2.0 * channel_uniform(state * 0x2545f4914f6cdd1dULL) - 1.0;
+            state ^= state >> 12;
+            state ^= state << 25;
+            state ^= state >> 27;
+            v = 2.0 * channel_uniform(state * 0x2545f4914f6cdd1dULL) - 1.0;
+            s = u * u + v * v;
+        } while ((s >= 1.0) || (s == 0.0));
+        s = ch->sigma * sqrt(-2.0 * log(s) / s);
+        out[i].real += u * s;
+        out[i].imag += v * s;
+    }
+}
+
+int channel_process(struct channel *ch, COMP out[], const COMP in[], int n, int64_t start, uint64_t block) {
+    int64_t m0;
+    int nout;
+
+    assert(n > 0);
+    nout = channel_resample(ch, out, in, n, start, &m0);
+    if (ch->p.fading_hz > 0.0f)
+        channel_fade(ch, out, nout, m0);
+    if ((ch->p.freq_hz != 0.0f) || (ch->p.drift_hz_s != 0.0f))
+        channel_shift(ch, out, nout, m0);
+    if (ch->p.awgn)
+        channel_awgn(ch, out, nout, block);
+    return nout;
+}
@@ -0,0 +1,52 @@
+/*---------------------------------------------------------------------------*\
+
+  FILE........: channel.h
+
+  Channel simulator for testing the modem.  Applies, in order, a sample
+  clock offset, Watterson fading (one or two Rayleigh paths with a
+  Gaussian Doppler spectrum), a carrier offset with linear drift, and
+  AWGN at a given Eb/No.
+
+  Everything but the noise is a function of the absolute sample number,
+  so a long signal can be cut into blocks and each block put through the
+  channel on its own thread, and the joins are seamless apart from the
+  clock offset interpolation and the delayed path, which start from
+  silence at the first sample of each block.
+
+\*---------------------------------------------------------------------------*/
+
+#ifndef __CHANNEL__
+#define __CHANNEL__
+
+#include <stdint.h>
+#include "comp.h"
+
+struct channel_params {
+    int      awgn;                      /* add noise at ebno_db          */
+    float    ebno_db;
+    int      real;                      /* only the real part is used    */
+    float    freq_hz;                   /* carrier offset at sample 0    */
+    float    drift_hz_s;
+    float    ppm;                       /* sample clock offset           */
+    float    fading_hz;                 /* Doppler spread, 0 for none    */
+    float    delay_ms;                  /* of the second path, 0 for one */
+    uint64_t seed;
+};
+
+struct channel;
+
+/* signal_power of the input, and its bit rate, set the noise level for the Eb/No */
+struct channel *channel_create(const struct channel_params *p, int Fs, float signal_power, int bit_rate);
+void            channel_destroy(struct channel *ch);
+
+/* most output samples for n input samples */
+int   channel_max_out(struct channel *ch, int n);
+
+/* rms of the output, signal plus noise */
+float channel_get_rms(struct channel *ch);
+
+/* n input samples starting at absolute sample start, returns the number of
+   output samples, the noise comes from block */
+int   channel_process(struct channel *ch, COMP out[], const COMP in[], int n, int64_t start, uint64_t block);
+
+#endif
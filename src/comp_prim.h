@@ -133,10 +133,10 @@ static inline int comp_mag_gt(COMP a,COMP b){
  *   - gcc10 no likey static anaysis for some unknown
 */
 #include <float.h>
-inline static void comp_normalize(COMP a){
-    float av = cabsolute(a) + FLT_MIN;
-    a.real = a.real/av;
-    a.imag = a.imag/av;
+inline static void comp_normalize(COMP *a){
+    float av = cabsolute(*a) + FLT_MIN;
+    a->real = a->real/av;
+    a->imag = a->imag/av;
 }
 
 #endif
@@ -0,0 +1,307 @@
+/*---------------------------------------------------------------------------*\
+
+  FILE........: decimate.c
+
+  Sample rate converter, see decimate.h.
+
+  Samples go through the stages a block at a time, with I and Q in
+  separate arrays, so the filter loops are straight runs of floats the
+  compiler can vectorise.  The CIC works on 64 bit integers, so its
+  integrators wrap rather than lose precision to a DC offset, as in the
+  8 bit I/Q from an RTL-SDR.
+
+\*---------------------------------------------------------------------------*/
+
+#include <assert.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "decimate.h"
+
+#define DEC_BLOCK       4096            /* input samples per pass through the stages   */
+#define DEC_CIC_ORDER   4
+#define DEC_CIC_MIN     8               /* CIC output rate, in output rates at least    */
+#define DEC_CIC_MAX_R   64              /* R^4 * DEC_CIC_SCALE * 32767 fits in 63 bits */
+#define DEC_CIC_SCALE   65536.0f        /* float to CIC integer, for +/-1.0 input      */
+#define DEC_HB_TAPS     19              /* 0.5 at the centre, and 5 odd taps each side */
+#define DEC_HB_ODD      ((DEC_HB_TAPS + 1) / 4)
+#define DEC_RS_TAPS     16
+#define DEC_RS_PHASES   256
+#define DEC_RS_CUTOFF   0.45            /* of the lower of the two rates               */
+
+/* one half-band filter, decimating by 2 */
+struct dec_hb {
+    float    i[DEC_HB_TAPS - 1 + DEC_BLOCK];
+    float    q[DEC_HB_TAPS - 1 + DEC_BLOCK];
+    int      len;
+};
+
+struct decimator {
+    int      Fs_in;
+    int      Fs_out;
+    double   ratio;                     /* input samples per output sample   */
+
+    int      shift;                     /* mix by -shift_hz first            */
+    double   nco_step;                  /* radians per input sample          */
+    double   nco_phase;                 /* at the start of the next block    */
+    COMP     rot[DEC_BLOCK];            /* from the start of a block         */
+
+    int      cic_r;                     /* 1 for no CIC                      */
+    int      cic_count;
+    uint64_t integ_i[DEC_CIC_ORDER], integ_q[DEC_CIC_ORDER];
+    uint64_t comb_i[DEC_CIC_ORDER], comb_q[DEC_CIC_ORDER];
+    float    cic_gain;
+
+    int      nhb;
+    float    hb_centre;
+    float    hb_odd[DEC_HB_ODD];
+    struct dec_hb *hb;
+
+    int      resample;
+    double   rs_step;                   /* input samples per output sample   */
+    double   rs_t;                      /* of the next output, from rs_i[0]  */
+    float    rs_taps[DEC_RS_PHASES][DEC_RS_TAPS];
+    float    rs_i[DEC_RS_TAPS + DEC_BLOCK];
+    float    rs_q[DEC_RS_TAPS + DEC_BLOCK];
+    int      rs_len;
+
+    float    xi[DEC_BLOCK];             /* between stages                    */
+    float    xq[DEC_BLOCK];
+};
+
+static double dec_sinc(double x) {
+    return fabs(x) < 1E-9 ? 1.0 : sin(M_PI * x) / (M_PI * x);
+}
+
+/* -half <= x <= half */
+static double dec_blackman(double x, double half) {
+    return 0.42 + 0.5 * cos(M_PI * x / half) + 0.08 * cos(2.0 * M_PI * x / half);
+}
+
+static void dec_hb_design(struct decimator *d) {
+    double h[DEC_HB_TAPS], sum = 0.0;
+    int mid = DEC_HB_TAPS / 2, n, j;
+
+    for (n=0; n<DEC_HB_TAPS; n++) {
+        h[n] = 0.5 * dec_sinc(0.5 * (n - mid)) * dec_blackman(n - mid, mid + 1);
+        sum += h[n];
+    }
+    d->hb_centre = h[mid] / sum;
+    for (j=0; j<DEC_HB_ODD; j++)
+        d->hb_odd[j] = h[mid + 2*j + 1] / sum;
+}
+
+/* output at the middle of taps DEC_RS_TAPS/2 - 1 and DEC_RS_TAPS/2, plus the phase */
+static void dec_rs_design(struct decimator *d, double rate) {
+    double fc = DEC_RS_CUTOFF * (rate < d->Fs_out ? rate : d->Fs_out) / rate;
+    double h[DEC_RS_TAPS], sum, x;
+    int p, k;
+
+    for (p=0; p<DEC_RS_PHASES; p++) {
+        sum = 0.0;
+        for (k=0; k<DEC_RS_TAPS; k++) {
+            x = k - (DEC_RS_TAPS / 2 - 1) - (double)p / DEC_RS_PHASES;
+            h[k] = 2.0 * fc * dec_sinc(2.0 * fc * x) * dec_blackman(x, DEC_RS_TAPS / 2);
+            sum += h[k];
+        }
+        for (k=0; k<DEC_RS_TAPS; k++)
+            d->rs_taps[p][k] = h[k] / sum;
+    }
+}
+
+struct decimator *decimator_create(int Fs_in, int Fs_out, float shift_hz) {
+    struct decimator *d;
+    double rate = Fs_in;
+    int k;
+
+    assert((Fs_in > 0) && (Fs_out > 0));
+    d = (struct decimator *)calloc(1, sizeof(struct decimator));
+    if (d == NULL)
+        return NULL;
+
+    d->Fs_in = Fs_in;
+    d->Fs_out = Fs_out;
+    d->ratio = (double)Fs_in / Fs_out;
+
+    d->shift = shift_hz != 0.0f;
+    d->nco_step = -2.0 * M_PI * shift_hz / Fs_in;
+    for (k=0; k<DEC_BLOCK; k++) {
+        d->rot[k].real = cos(d->nco_step * k);
+        d->rot[k].imag = sin(d->nco_step * k);
+    }
+
+    d->cic_r = Fs_in / (DEC_CIC_MIN * Fs_out);
+    if (d->cic_r > DEC_CIC_MAX_R)
+        d->cic_r = DEC_CIC_MAX_R;
+    if (d->cic_r < 2)
+        d->cic_r = 1;
+    d->cic_gain = 1.0f / (powf(d->cic_r, DEC_CIC_ORDER) * DEC_CIC_SCALE);
+    rate /= d->cic_r;
+
+    while (rate >= 2.0 * Fs_out) {
+        rate /= 2.0;
+        d->nhb++;
+    }
+    dec_hb_design(d);
+    if (d->nhb) {
+        d->hb = (struct dec_hb *)calloc(d->nhb, sizeof(struct dec_hb));
+        if (d->hb == NULL) {
+            free(d);
+            return NULL;
+        }
+        for (k=0; k<d->nhb; k++)
+            d->hb[k].len = DEC_HB_TAPS - 1;
+    }
+
+    d->resample = fabs(rate - Fs_out) > 1E-6 * Fs_out;
+    d->rs_step = rate / Fs_out;
+    if (d->resample)
+        dec_rs_design(d, rate);
+    return d;
+}
+
+void decimator_destroy(struct decimator *d) {
+    free(d->hb);
+    free(d);
+}
+
+int decimator_max_out(struct decimator *d, int n) {
+    /* plus what can be waiting in the resampler */
+    return (int)ceil(n / d->ratio) + (int)ceil((DEC_RS_TAPS + 1) / d->rs_step) + 2;
+}
+
+/* 4th order, decimating by cic_r, on n samples in xi[] and xq[] */
+static int dec_cic(struct decimator *d, int n) {
+    uint64_t x, y, t;
+    int k, s, m = 0;
+
+    for (k=0; k<n; k++) {
+        x = (uint64_t)(int64_t)lrintf(d->xi[k] * DEC_CIC_SCALE);
+        y = (uint64_t)(int64_t)lrintf(d->xq[k] * DEC_CIC_SCALE);
+        for (s=0; s<DEC_CIC_ORDER; s++) {
+            x = d->integ_i[s] += x;
+            y = d->integ_q[s] += y;
+        }
+        if (++d->cic_count < d->cic_r)
+            continue;
+        d->cic_count = 0;
+        for (s=0; s<DEC_CIC_ORDER; s++) {
+            t = x - d->comb_i[s];
+            d->comb_i[s] = x;
+            x = t;
+            t = y - d->comb_q[s];
+            d->comb_q[s] = y;
+            y = t;
+        }
+        d->xi[m] = (float)(int64_t)x * d->cic_gain;
+        d->xq[m] = (float)(int64_t)y * d->cic_gain;
+        m++;
+    }
+    return m;
+}
+
+/* half-band hb, decimating by 2, on n samples in xi[] and xq[] */
+static int dec_halfband(struct decimator *d, struct dec_hb *hb, int n) {
+    const int mid = DEC_HB_TAPS / 2;
+    float si, sq;
+    int j, p, m = 0;
+
+    memcpy(&hb->i[hb->len], d->xi, sizeof(float) * n);
+    memcpy(&hb->q[hb->len], d->xq, sizeof(float) * n);
+    hb->len += n;
+
+    for (p=0; p+DEC_HB_TAPS<=hb->len; p+=2) {
+        si = d->hb_centre * hb->i[p + mid];
+        sq = d->hb_centre * hb->q[p + mid];
+        for (j=0; j<DEC_HB_ODD; j++) {
+            si += d->hb_odd[j] * (hb->i[p + mid - 2*j - 1] + hb->i[p + mid + 2*j + 1]);
+            sq += d->hb_odd[j] * (hb->q[p + mid - 2*j - 1] + hb->q[p + mid + 2*j + 1]);
+        }
+        d->xi[m] = si;
+        d->xq[m] = sq;
+        m++;
+    }
+
+    hb->len -= p;
+    memmove(hb->i, &hb->i[p], sizeof(float) * hb->len);
+    memmove(hb->q, &hb->q[p], sizeof(float) * hb->len);
+    return m;
+}
+
+/* polyphase resampler, on n samples in xi[] and xq[], into out[] */
+static int dec_resample(struct decimator *d, COMP out[], int n) {
+    const float *h;
+    float si, sq;
+    int base, k, m = 0;
+
+    memcpy(&d->rs_i[d->rs_len], d->xi, sizeof(float) * n);
+    memcpy(&d->rs_q[d->rs_len], d->xq, sizeof(float) * n);
+    d->rs_len += n;
+
+    while ((base = (int)d->rs_t) + DEC_RS_TAPS <= d->rs_len) {
+        h = d->rs_taps[(int)((d->rs_t - base) * DEC_RS_PHASES)];
+        si = sq = 0.0f;
+        for (k=0; k<DEC_RS_TAPS; k++) {
+            si += h[k] * d->rs_i[base + k];
+            sq += h[k] * d->rs_q[base + k];
+        }
+        out[m].real = si;
+        out[m].imag = sq;
+        m++;
+        d->rs_t += d->rs_step;
+    }
+
+    base = (int)d->rs_t;
+    if (base > d->rs_len)
+        base = d->rs_len;
+    d->rs_len -= base;
+    d->rs_t -= base;
+    memmove(d->rs_i, &d->rs_i[base], sizeof(float) * d->rs_len);
+    memmove(d->rs_q, &d->rs_q[base], sizeof(float) * d->rs_len);
+    return m;
+}
+
+int decimator_process(struct decimator *d, COMP out[], const COMP in[], int n) {
+    float pr, pi;
+    int k, s, m, nout = 0;
+
+    for (; n > 0; in += m, n -= m) {
+        m = n < DEC_BLOCK ? n : DEC_BLOCK;
+
+        if (d->shift) {
+            pr = cos(d->nco_phase);
+            pi = sin(d->nco_phase);
+            for (k=0; k<m; k++) {
+                float rr = pr * d->rot[k].real - pi * d->rot[k].imag;
+                float ri = pr * d->rot[k].imag + pi * d->rot[k].real;
+                d->xi[k] = in[k].real * rr - in[k].imag * ri;
+                d->xq[k] = in[k].real * ri + in[k].imag * rr;
+            }
+            d->nco_phase = fmod(d->nco_phase + d->nco_step * m, 2.0 * M_PI);
+        } else {
+            for (k=0; k<m; k++) {
+                d->xi[k] = in[k].real;
+                d->xq[k] = in[k].imag;
+            }
+        }
+
+        s = m;
+        if (d->cic_r > 1)
+            s = dec_cic(d, s);
+        for (k=0; k<d->nhb; k++)
+            s = dec_halfband(d, &d->hb[k], s);
+
+        if (d->resample) {
+            nout += dec_resample(d, &out[nout], s);
+        } else {
+            for (k=0; k<s; k++) {
+                out[nout + k].real = d->xi[k];
+                out[nout + k].imag = d->xq[k];
+            }
+            nout += s;
+        }
+    }
+    return nout;
+}
@@ -0,0 +1,30 @@
+/*---------------------------------------------------------------------------*\
+
+  FILE........: decimate.h
+
+  Sample rate converter for the receiver input, so I/Q from an SDR can be
+  decoded at its own rate.  The signal is shifted by -shift_hz, then taken
+  down in stages: a 4th order CIC for the large factors, half-band filters
+  by 2 while the rate is at least twice the output rate, and a polyphase
+  resampler for what is left.  Only the few kHz around 0 Hz that the
+  demod uses are kept free of aliases.
+
+\*---------------------------------------------------------------------------*/
+
+#ifndef __DECIMATE__
+#define __DECIMATE__
+
+#include "comp.h"
+
+struct decimator;
+
+struct decimator *decimator_create(int Fs_in, int Fs_out, float shift_hz);
+void              decimator_destroy(struct decimator *d);
+
+/* most output samples for n input samples */
+int               decimator_max_out(struct decimator *d, int n);
+
+/* n input samples, returns the number of output samples */
+int               decimator_process(struct decimator *d, COMP out[], const COMP in[], int n);
+
+#endif
@@ -42,9 +42,9 @@
 /* At large sample rates, there's not enough stack space to run the demod */
 #define DEMOD_ALLOC_STACK
 
-/* This is a flag for the freq. estimator to use a precomputed hann window table
-   On platforms with slow cosf, this will produce a substantial speedup at the cost of a small
-    amount of memory - otherwise a rectangular window will be used 
+/* This is a flag for the freq. estimator to window its FFTs, with tables from window.c
+   shared between the modems, at the cost of a small amount of memory - otherwise
+   a rectangular window will be used
 */
 #define USE_HANN_TABLE
 
@@ -62,12 +62,15 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 #include <math.h>
 
 #include "fsk.h"
 #include "comp_prim.h"
 #include "kiss_fftr.h"
 #include "modem_probe.h"
+#include "decimate.h"
+#include "window.h"
 
 /*---------------------------------------------------------------------------*\
 
@@ -211,6 +214,7 @@ struct FSK * fsk_create_hbr( int Fs, int Rs,int P,int M, int tx_f1, int tx_fs )
 	}
 	stats_init( fsk );
 	fsk->normalise_eye = 1;
+	fsk->perf = NULL;
 
 	return fsk;
 }
@@ -220,6 +224,26 @@ struct FSK * fsk_create_hbr( int Fs, int Rs,int P,int M, int tx_f1, int tx_fs )
 #define HORUS_MAX 4000
 #define HORUS_MIN_SPACING 100
 
+#define FSK_EST_BIN_HZ   12     /* estimator bins of this or less                */
+#define FSK_ZOOM_PASS    0.8f   /* of a zoomed rate clear of the filter skirts   */
+#define FSK_ZOOM_CHUNK   1024   /* samples into the zoom decimator at a time     */
+
+#define FSK_COMB_SUB     4      /* steps of the 4FSK tone spacing search per bin  */
+#define FSK_COMB_MIN_HZ  150    /* tone spacings searched, RFM9x at 183 Hz and    */
+#define FSK_COMB_MAX_HZ  350    /* RS41 at 265 Hz, with room either side          */
+
+#define FSK_TRACK_LOCK   4      /* frames of steady tones before following them  */
+#define FSK_TRACK_CHECK  8      /* frames between searches when first following  */
+#define FSK_TRACK_CHECK_MIN 2   /* and at least, for drifting tones              */
+#define FSK_TRACK_CHECK_MAX 32  /* and at most, for strong steady ones           */
+#define FSK_TRACK_GUARD  2      /* bins a followed tone may stray from a search  */
+#define FSK_TRACK_ON     0.17f  /* tone coherence to start following, 0.13 noise  */
+#define FSK_TRACK_OFF    0.15f  /* and to keep following                          */
+#define FSK_TRACK_STRONG 0.25f  /* for FSK_TRACK_CHECK_MAX, about 10 dB Eb/No     */
+#define FSK_TRACK_GAIN   0.25f  /* of the offset measured in a frame             */
+#define FSK_TRACK_AVG    0.25f  /* coherence averaging, per frame                */
+#define FSK_TRACK_DRIFT  0.02f  /* of the offset, into the drift per frame       */
+
 /*---------------------------------------------------------------------------*\
 
   FUNCTION....: fsk_create
@@ -233,6 +257,10 @@ struct FSK * fsk_create_hbr( int Fs, int Rs,int P,int M, int tx_f1, int tx_fs )
 \*---------------------------------------------------------------------------*/
 
 struct FSK * fsk_create( int Fs, int Rs,int M, int tx_f1, int tx_fs ) {
+	return fsk_create_engine( Fs, Rs, M, horus_P, tx_f1, tx_fs, FSK_ENGINE_MIXER );
+}
+
+struct FSK * fsk_create_engine( int Fs, int Rs,int M, int P, int tx_f1, int tx_fs, int engine ) {
 	struct FSK *fsk;
 	int i;
 	int Ndft = 0;
@@ -243,26 +271,29 @@ struct FSK * fsk_create( int Fs, int Rs,int M, int tx_f1, int tx_fs ) {
 	assert( Rs > 0 );
 	assert( tx_f1 > 0 );
 	assert( tx_fs > 0 );
-	assert( horus_P > 0 );
+	assert( P > 0 );
 	/* Ts (Fs/Rs) must be an integer */
 	assert( ( Fs % Rs ) == 0 );
 	/* Ts/P (Fs/Rs/P) must be an integer */
-	assert( ( ( Fs / Rs ) % horus_P ) == 0 );
+	assert( ( ( Fs / Rs ) % P ) == 0 );
 	assert( M == 2 || M == 4 );
+	assert( engine == FSK_ENGINE_MIXER || engine == FSK_ENGINE_STFT );
 
 	fsk = (struct FSK*) malloc( sizeof( struct FSK ) );
 	if ( fsk == NULL ) {
 		return NULL;
 	}
 
-	Ndft = 4096;
+	/* Bins of 12 Hz or less, 4096 at 48 kHz */
+	for ( Ndft = 64; Ndft * FSK_EST_BIN_HZ < Fs; Ndft *= 2 )
+		;
 
 	/* Set constant config parameters */
 	fsk->Fs = Fs;
 	fsk->Rs = Rs;
 	fsk->Ts = Fs / Rs;
 	fsk->burst_mode = 0;
-	fsk->P = horus_P;
+	fsk->P = P;
 	fsk->Nsym = FSK_DEFAULT_NSYM;
 	fsk->N = fsk->Nsym * fsk->Ts;
 	fsk->Ndft = Ndft;
@@ -275,6 +306,33 @@ struct FSK * fsk_create( int Fs, int Rs,int M, int tx_f1, int tx_fs ) {
 	fsk->est_min = HORUS_MIN;
 	fsk->est_max = HORUS_MAX;
 	fsk->est_space = HORUS_MIN_SPACING;
+	fsk->est_comb_min = FSK_COMB_MIN_HZ;
+	fsk->est_comb_max = FSK_COMB_MAX_HZ;
+	fsk->est_comb_start = 0;
+	fsk->est_comb_spacing = 0;
+	fsk->est_comb_score = 0;
+	fsk->est_rate = Fs;
+	fsk->est_bin0 = 0;
+	fsk->est_bins = Ndft / 2;
+	fsk->est_zoom = NULL;
+	fsk->est_blk = NULL;
+	fsk->est_fill = 0;
+#ifdef USE_HANN_TABLE
+	fsk->est_window = WINDOW_SINE;
+#else
+	fsk->est_window = WINDOW_RECT;
+#endif
+	fsk->est_win = NULL;
+	fsk->est_win_part = NULL;
+	fsk->est_tracking = 0;
+	fsk->est_track = 0;
+	fsk->est_count = 0;
+	fsk->est_every = FSK_TRACK_CHECK;
+	fsk->est_coh = 0;
+	fsk->est_df = 0;
+	fsk->est_searches = 0;
+	fsk->est_skipped = 0;
+	fsk->est_search_ns = 0;
 
 	/* Set up rx state */
 	for ( i = 0; i < M; i++ )
@@ -336,6 +394,25 @@ struct FSK * fsk_create( int Fs, int Rs,int M, int tx_f1, int tx_fs ) {
 	}
 	stats_init( fsk );
 	fsk->normalise_eye = 1;
+	fsk->perf = NULL;
+
+	/* Blocks of Ts/P zero padded to 4 times or more, so that reading a tone
+	   between the bins either side of it loses nothing measurable */
+	fsk->engine = engine;
+	fsk->stft_cfg = NULL;
+	fsk->stft_in = NULL;
+	fsk->stft_out = NULL;
+	for ( fsk->stft_n = 16; fsk->stft_n < 4 * ( fsk->Ts / P ); fsk->stft_n *= 2 )
+		;
+	if ( engine == FSK_ENGINE_STFT ) {
+		fsk->stft_cfg = kiss_fft_alloc( fsk->stft_n,0,NULL,NULL );
+		fsk->stft_in = (kiss_fft_cpx*)calloc( fsk->stft_n, sizeof( kiss_fft_cpx ) );
+		fsk->stft_out = (kiss_fft_cpx*)malloc( sizeof( kiss_fft_cpx ) * fsk->stft_n );
+		if ( fsk->stft_cfg == NULL || fsk->stft_in == NULL || fsk->stft_out == NULL ) {
+			fsk_destroy( fsk );
+			return NULL;
+		}
+	}
 
 	return fsk;
 }
@@ -367,7 +444,7 @@ static void stats_init( struct FSK *fsk ) {
 		for ( m = 0; m < M; m++ ) {
 			for ( j = 0; j < neyesamp; j++ ) {
 				assert( ( i * M + m ) < MODEM_STATS_ET_MAX );
-				fsk->stats->rx_eye[i * M + m][j] = 0;
+				fsk->eye_snap[i * M + m][j] = comp0();
 			}
 		}
 	}
@@ -421,25 +498,47 @@ void fsk_enable_burst_mode( struct FSK *fsk,int nsyms ) {
 void fsk_clear_estimators( struct FSK *fsk ) {
 	int i;
 	/* Clear freq estimator state */
-	for ( i = 0; i < ( fsk->Ndft / 2 ); i++ ) {
+	for ( i = 0; i < fsk->est_bins; i++ ) {
 		fsk->fft_est[i] = 0;
 	}
+	fsk->est_fill = 0;
+	/* Back to searching for the tones */
+	fsk->est_track = 0;
+	fsk->est_count = 0;
 	/* Reset timing diff correction */
 	fsk->nin = fsk->N;
 }
 
+void fsk_enable_tracking( struct FSK *fsk, int enable ) {
+	fsk->est_tracking = enable;
+	fsk->est_track = 0;
+	fsk->est_count = 0;
+}
+
 uint32_t fsk_nin( struct FSK *fsk ) {
 	return (uint32_t)fsk->nin;
 }
 
 void fsk_destroy( struct FSK *fsk ) {
+	window_put( fsk->est_win );
+	window_put( fsk->est_win_part );
+	if ( fsk->est_zoom )
+		decimator_destroy( fsk->est_zoom );
+	free( fsk->est_blk );
+	free( fsk->fft_est );
 	free( fsk->fft_cfg );
+	free( fsk->stft_cfg );
+	free( fsk->stft_in );
+	free( fsk->stft_out );
 	free( fsk->samp_old );
 	free( fsk->stats );
 	free( fsk );
 }
 
 void fsk_get_demod_stats( struct FSK *fsk, struct MODEM_STATS *stats ) {
+	float eye_max;
+	int i, j;
+
 	/* copy from internal stats, note we can't overwrite stats completely
 	   as it has other states rqd by caller, also we want a consistent
 	   interface across modem types for the freedv_api.
@@ -452,9 +551,26 @@ void fsk_get_demod_stats( struct FSK *fsk, struct MODEM_STATS *stats ) {
 
 	stats->neyesamp = fsk->stats->neyesamp;
 	stats->neyetr = fsk->stats->neyetr;
-	memcpy( stats->rx_eye, fsk->stats->rx_eye, sizeof( stats->rx_eye ) );
 	memcpy( stats->f_est, fsk->stats->f_est, fsk->mode * sizeof( float ) );
 
+	/* The eye diagram, from the samples the demod kept of its last frame */
+	eye_max = 0;
+	for ( i = 0; i < stats->neyetr; i++ ) {
+		for ( j = 0; j < stats->neyesamp; j++ ) {
+			stats->rx_eye[i][j] = cabsolute( fsk->eye_snap[i][j] );
+			if ( stats->rx_eye[i][j] > eye_max ) {
+				eye_max = stats->rx_eye[i][j];
+			}
+		}
+	}
+
+	if ( fsk->normalise_eye && ( eye_max > 0 ) ) {
+		/* Normalize eye to +/- 1 */
+		for ( i = 0; i < stats->neyetr; i++ )
+			for ( j = 0; j < stats->neyesamp; j++ )
+				stats->rx_eye[i][j] = stats->rx_eye[i][j] / eye_max;
+	}
+
 	/* these fields not used for FSK so set to something sensible */
 
 	stats->sync = 0;
@@ -462,10 +578,53 @@ void fsk_get_demod_stats( struct FSK *fsk, struct MODEM_STATS *stats ) {
 	stats->Nc = fsk->stats->Nc;
 }
 
+/*
+ * The bins of fft_est that fsk_est_block() fills, from lo up to hi, the rest are zero
+ */
+static void fsk_est_range( struct FSK *fsk, int *lo, int *hi ) {
+	*lo = ( fsk->est_min * fsk->Ndft ) / fsk->est_rate - fsk->est_bin0;
+	*hi = ( fsk->est_max * fsk->Ndft ) / fsk->est_rate - fsk->est_bin0 - 1;
+	*lo = *lo < 0 ? 0 : *lo;
+	*hi = *hi > fsk->est_bins ? fsk->est_bins : *hi;
+	*hi = *hi <= *lo ? *lo + 1 : *hi;
+}
+
+void fsk_get_spectrum( struct FSK *fsk, float spec[], int n, float *f_lo, float *f_hi ) {
+	float binw = (float)fsk->est_rate / (float)fsk->Ndft;
+	int lo, hi, a, b, i, k;
+	float max;
+
+	fsk_est_range( fsk, &lo, &hi );
+
+	for ( i = 0; i < n; i++ ) {
+		a = lo + ( i * ( hi - lo ) ) / n;
+		b = lo + ( ( i + 1 ) * ( hi - lo ) ) / n;
+		b = b <= a ? a + 1 : b;
+		max = 0;
+		for ( k = a; k < b; k++ ) {
+			if ( fsk->fft_est[k] > max ) {
+				max = fsk->fft_est[k];
+			}
+		}
+		spec[i] = max;
+	}
+
+	if ( f_lo )
+		*f_lo = ( lo + fsk->est_bin0 ) * binw;
+	if ( f_hi )
+		*f_hi = ( hi + fsk->est_bin0 ) * binw;
+}
+
 /*
  * Set the minimum and maximum frequencies at which the freq. estimator can find tones
  */
 void fsk_set_est_limits( struct FSK *fsk,int est_min, int est_max ) {
+	int Fs = fsk->Fs;
+	int dec, rate, Ndft, bins, centre, i;
+	struct decimator *zoom = NULL;
+	kiss_fft_cfg fft_cfg;
+	float *fft_est;
+	COMP *blk = NULL;
 
 	fsk->est_min = est_min;
 	if ( fsk->est_min < 0 ) {
@@ -473,89 +632,251 @@ void fsk_set_est_limits( struct FSK *fsk,int est_min, int est_max ) {
 	}
 
 	fsk->est_max = est_max;
+	if ( fsk->est_max > Fs / 2 ) {
+		fsk->est_max = Fs / 2;
+	}
+
+	/* Zoom by the largest power of 2 that leaves the band clear of aliases */
+	for ( dec = 1; ( Fs % ( 2 * dec ) == 0 ) &&
+	               ( fsk->est_max - fsk->est_min <= FSK_ZOOM_PASS * Fs / ( 2 * dec ) ); dec *= 2 )
+		;
+	rate = Fs / dec;
+	for ( Ndft = 64; Ndft * FSK_EST_BIN_HZ < rate; Ndft *= 2 )
+		;
+	bins = dec > 1 ? Ndft : Ndft / 2;
+	/* Middle of the band, rounded to a bin so that the zoomed bins are the unzoomed ones */
+	centre = ( ( fsk->est_min + fsk->est_max ) / 2 * Ndft + rate / 2 ) / rate;
+
+	fft_cfg = kiss_fft_alloc( Ndft,0,NULL,NULL );
+	fft_est = (float*)malloc( sizeof( float ) * bins );
+	if ( dec > 1 ) {
+		zoom = decimator_create( Fs, rate, (float)centre * rate / Ndft );
+		blk = (COMP*)malloc( sizeof( COMP ) * Ndft );
+	}
+	if ( !fft_cfg || !fft_est || ( ( dec > 1 ) && ( !zoom || !blk ) ) ) {
+		/* Keep the estimator as it was, searching between the new limits */
+		free( fft_cfg );
+		free( fft_est );
+		if ( zoom )
+			decimator_destroy( zoom );
+		free( blk );
+		return;
+	}
+	assert( !zoom || ( decimator_max_out( zoom, FSK_ZOOM_CHUNK ) <= FSK_ZOOM_CHUNK ) );
+
+	if ( fsk->est_zoom )
+		decimator_destroy( fsk->est_zoom );
+	free( fsk->est_blk );
+	free( fsk->fft_est );
+	free( fsk->fft_cfg );
+
+	for ( i = 0; i < bins; i++ )
+		fft_est[i] = 0;
+	fsk->Ndft = Ndft;
+	fsk->fft_cfg = fft_cfg;
+	fsk->fft_est = fft_est;
+	fsk->est_zoom = zoom;
+	fsk->est_blk = blk;
+	fsk->est_fill = 0;
+	fsk->est_rate = rate;
+	fsk->est_bins = bins;
+	/* Zoomed, the middle of the band is shifted to 0 Hz, and bin 0 is rate/2 below it */
+	fsk->est_bin0 = dec > 1 ? centre - Ndft / 2 : 0;
 }
 
-float add4bins(kiss_fft_cpx *fftout, int i, int j) {
-	return fftout[i].i + fftout[i+1].i + fftout[j].i + fftout[j+1].i;
+void fsk_set_est_window( struct FSK *fsk, int type ) {
+	window_put( fsk->est_win );
+	window_put( fsk->est_win_part );
+	fsk->est_win = NULL;
+	fsk->est_win_part = NULL;
+	fsk->est_window = type;
 }
 
-int bestof2bins(kiss_fft_cpx *fftout, int i) {
-	if (fftout[i].i > fftout[i+1].i)
+void fsk_set_est_spacing( struct FSK *fsk, int min_hz, int max_hz ) {
+	assert( min_hz > 0 && max_hz >= min_hz );
+	fsk->est_comb_min = min_hz;
+	fsk->est_comb_max = max_hz;
+}
+
+int bestof2bins(float *spec, int i) {
+	if (spec[i] > spec[i+1])
 		return i;
 	else
 		return i + 1;
 }
 
-
+/* quickselect, see fsk.h */
+float fsk_select( float x[], int n, int k ) {
+	int lo = 0, hi = n - 1, i, j;
+	float pivot, t;
+
+	while ( lo < hi ) {
+		pivot = x[( lo + hi ) / 2];
+		for ( i = lo, j = hi; i <= j; ) {
+			while ( x[i] < pivot ) i++;
+			while ( x[j] > pivot ) j--;
+			if ( i <= j ) {
+				t = x[i]; x[i] = x[j]; x[j] = t;
+				i++; j--;
+			}
+		}
+		if ( k <= j )
+			hi = j;
+		else if ( k >= i )
+			lo = i;
+		else
+			break;
+	}
+	return x[k];
+}
 
 /*
  * Comb Filter - we need to track 4 equispaced frequencies that are each 3db below the noise
  * This is, of course, impossible.
- * Known targets are RS41 (530Hz/2) or RFM9x (550Hz/3), so we look for 2 "peaks" 540Hz apart.
- * Working back from there to find 4fsk with 183 or  267 Hz shift.
+ * Every tone spacing from est_comb_min to est_comb_max Hz, in steps of 1/FSK_COMB_SUB bin,
+ * is tried at every start, and the comb with the most in the 2 bins about each tone wins.
+ * Known targets are RS41 (530Hz/2) or RFM9x (550Hz/3), and anything else in the range.
+ * The sums of neighbouring bins are made once, so each spacing is one straight run of 4 adds
+ * per start. Returns the best comb over 8 bins of noise, the median of the band, about 1 for
+ * noise, which is also left in est_comb_score with the start and spacing.
  */
-void comb_filter(struct FSK *fsk, int *freqi, kiss_fft_cpx *fftout) {
-	int Ndft, j, step, centre;
-	float peak, max;
+float comb_filter(struct FSK *fsk, int *freqi, float *spec) {
+	int bins = fsk->est_bins;
+	int sp_min = ( fsk->est_comb_min * fsk->Ndft * FSK_COMB_SUB ) / fsk->est_rate;
+	int sp_max = ( fsk->est_comb_max * fsk->Ndft * FSK_COMB_SUB ) / fsk->est_rate;
+	int lo, hi, sp, o1, o2, o3, j, k, best_j, best_sp, last, above;
+	float max, median, score;
+
+	#ifdef DEMOD_ALLOC_STACK
+	float *pair = (float*)alloca( sizeof( float ) * bins );
+	float *comb = (float*)alloca( sizeof( float ) * bins );
+	#else
+	float *pair = (float*)malloc( sizeof( float ) * bins );
+	float *comb = (float*)malloc( sizeof( float ) * bins );
+	if ( !pair || !comb ) {
+		free( pair );
+		free( comb );
+		return 0;
+	}
+	#endif
 
-	Ndft = fsk->Ndft;
-	step = 540 * Ndft / fsk->Fs; // 540/(48000/4096) => 46.1
+	fsk_est_range( fsk, &lo, &hi );
+	for ( j = lo; j < hi - 1; j++ )
+		pair[j] = spec[j] + spec[j + 1];
 
 	max = 0;
-	centre = step;
-	for ( j = step; j < Ndft / 4; j++ ) {
-		peak = add4bins(fftout, j, j+step);
-		if ( peak > max ) {
-			max = peak;
-			freqi[0] = bestof2bins(fftout, j);
-			freqi[1] = bestof2bins(fftout, j + step);
-			centre = j + (step + 1)/ 2;
+	best_j = lo;
+	best_sp = sp_min;
+	last = -1;
+	for ( sp = sp_min; sp <= sp_max; sp++ ) {
+		o1 = ( sp + FSK_COMB_SUB / 2 ) / FSK_COMB_SUB;
+		o2 = ( 2 * sp + FSK_COMB_SUB / 2 ) / FSK_COMB_SUB;
+		o3 = ( 3 * sp + FSK_COMB_SUB / 2 ) / FSK_COMB_SUB;
+		/* neighbouring spacings can round to the same bins */
+		if ( ( o1 << 20 | o2 << 10 | o3 ) == last )
+			continue;
+		last = o1 << 20 | o2 << 10 | o3;
+
+		above = 0;
+		for ( j = lo; j < hi - 1 - o3; j++ ) {
+			comb[j] = pair[j] + pair[j + o1] + pair[j + o2] + pair[j + o3];
+			above += comb[j] > max;
+		}
+		/* the starts are only searched when one beats the best so far */
+		if ( above ) {
+			for ( j = lo; j < hi - 1 - o3; j++ ) {
+				if ( comb[j] > max ) {
+					max = comb[j];
+					best_j = j;
+					best_sp = sp;
+				}
+			}
 		}
 	}
 
-	// Three options, RS41 left or right, or RFM9x between
-	peak = add4bins(fftout, centre, centre - step);
-		max = peak;
-		freqi[2] = bestof2bins(fftout, centre - step);
-		freqi[3] = bestof2bins(fftout, centre);
+	for ( k = 0; k < 4; k++ )
+		freqi[k] = bestof2bins( spec, best_j + ( k * best_sp + FSK_COMB_SUB / 2 ) / FSK_COMB_SUB );
 
-	peak = add4bins(fftout, centre, centre + step);
-	if (peak > max) {
-		max = peak;
-		freqi[2] = bestof2bins(fftout, centre);
-		freqi[3] = bestof2bins(fftout, centre + step);
-	}
+	memcpy( comb, &spec[lo], sizeof( float ) * ( hi - lo ) );
+	median = fsk_select( comb, hi - lo, ( hi - lo ) / 2 );
+	score = median > 0 ? max / ( 8 * median ) : 0;
+
+	fsk->est_comb_start = best_j + fsk->est_bin0;
+	fsk->est_comb_spacing = (float)best_sp * fsk->est_rate / ( fsk->Ndft * FSK_COMB_SUB );
+	fsk->est_comb_score = score;
 
-	step = (step + 2) / 6;		// 48/6 => 8 => 94 Hz
-	peak = add4bins(fftout, centre + step, centre - step);
-	if (peak > max) {
-		freqi[2] = bestof2bins(fftout, centre - step);
-		freqi[3] = bestof2bins(fftout, centre + step);
+	#ifndef DEMOD_ALLOC_STACK
+	free( pair );
+	free( comb );
+	#endif
+	return score;
+}
+
+
+/*
+ * The shared window table for a block of n samples, or NULL for none. Blocks are
+ * Ndft long but for the last of a frame, which has its own table.
+ */
+static const struct window *fsk_est_window( struct FSK *fsk, int n ) {
+	const struct window **w = ( n == fsk->Ndft ) ? &fsk->est_win : &fsk->est_win_part;
+
+	if ( ( fsk->est_window == WINDOW_RECT ) || ( n == 0 ) )
+		return NULL;
+	if ( ( *w == NULL ) || ( window_len( *w ) != n ) ) {
+		window_put( *w );
+		*w = window_get( fsk->est_window, n );
 	}
+	return *w;
 }
 
+/*
+ * Window and transform n samples, zero padded to Ndft, and mix the magnitudes of the
+ * bins between est_min and est_max into the averaged spectrum.
+ */
+static void fsk_est_block( struct FSK *fsk, COMP in[], int n, kiss_fft_cpx fftin[], kiss_fft_cpx fftout[] ) {
+	int Ndft = fsk->Ndft;
+	int shift = fsk->est_zoom ? Ndft / 2 : 0;	/* zoomed, the FFT starts at the middle of the band */
+	int f_min, f_max, i, k;
+	float mag;
+
+	/* We could reduce the integration period for strong signals, and extend it otherwise */
+	float tc = 0.03;
+
+	f_min  = ( fsk->est_min * Ndft ) / fsk->est_rate - fsk->est_bin0;
+	f_max  = ( fsk->est_max * Ndft ) / fsk->est_rate - fsk->est_bin0;
+
+	/* Copy FSK buffer into the FFT buffer, windowed and zero padded */
+	window_apply( fsk_est_window( fsk, n ), fftin, in, n, Ndft );
+
+	/* Do the FFT */
+	kiss_fft( fsk->fft_cfg,fftin,fftout );
+
+	/* Mix the magnitude of each freq slot back in with the previous blocks,
+	 * with zeros beyond the minimum and maximum */
+	for ( i = 0; i < fsk->est_bins; i++ ) {
+		k = ( i + shift ) & ( Ndft - 1 );
+		if ( ( i < f_min ) || ( i >= f_max - 1 ) )
+			mag = 0;
+		else
+			mag = sqrtf( ( fftout[k].r * fftout[k].r ) + ( fftout[k].i * fftout[k].i ) );
+		fsk->fft_est[i] = ( fsk->fft_est[i] * ( 1 - tc ) ) + ( mag * tc );
+	}
+}
 
 /*
- * Internal function to estimate the frequencies of the tones within a block of samples.
+ * Internal function to update the averaged spectrum from a block of samples.
  * This is split off because it is fairly complicated, needs a bunch of memory, and probably
  * takes more cycles than the rest of the demod.
+ * Zoomed, the samples are decimated to the band first, and go into whole FFTs that may
+ * span calls. Otherwise the block is cut into FFTs, the last one zero padded.
  * Parameters:
  * fsk - FSK struct from demod containing FSK config
- * fsk_in - block of samples in this demod cycles, must be nin long
- * freqs - Array for the estimated frequencies
- * M - number of frequency peaks to find
+ * fsk_in - block of samples in this demod cycles
+ * nin - number of samples in fsk_in
  */
-void fsk_demod_freq_est( struct FSK *fsk, COMP fsk_in[],float *freqs,int M ) {
+void fsk_est_spectrum( struct FSK *fsk, COMP fsk_in[], int nin ) {
 	int Ndft = fsk->Ndft;
-	int Fs = fsk->Fs;
-	int nin = fsk->nin;
-	size_t i,j;
-	float max;
-	float tc;
-	int imax;
-	kiss_fft_cfg fft_cfg = fsk->fft_cfg;
-	int freqi[M];
-	int f_min,f_max,f_zero;
+	int i, j, n, m;
 
 	/* Array to do complex FFT from using kiss_fft */
 	#ifdef DEMOD_ALLOC_STACK
@@ -569,80 +890,78 @@ void fsk_demod_freq_est( struct FSK *fsk, COMP fsk_in[],float *freqs,int M ) {
 	if (!fftin || !fftout)
 		goto cannot_fail;
 
-	f_min  = ( fsk->est_min * Ndft ) / Fs;
-	f_max  = ( fsk->est_max * Ndft ) / Fs;
-	f_zero = ( fsk->est_space * Ndft ) / Fs;
-
-	/* We could reduce the integration period for strong signals, and extend it otherwise */
-	tc = 0.03;
-
-	int samps;
-	int fft_samps;
-	int fft_loops = nin / Ndft + 1; // rounded up
-
-
-	// Default Nin is about half a second, or 6 loops of 48kHz / 4096 FFT
-	for ( j = 0; j < fft_loops; j++ ) {
-
-		samps = nin - j * Ndft;
-		fft_samps = ( samps >= Ndft ) ? Ndft : samps;
-
-		/* Copy FSK buffer into reals of FFT buffer and apply a hann window */
-		for ( i = 0; i < fft_samps; i++ ) {
-#ifdef USE_HANN_TABLE
-			float hann = sinf( M_PI * (float)(i) / (float)(fft_samps-1) );
-			fftin[i].r = hann * fsk_in[i + Ndft * j].real;
-			fftin[i].i = hann * fsk_in[i + Ndft * j].imag;
-#else
-			fftin[i].r = fsk_in[i + Ndft * j].real;
-			fftin[i].i = fsk_in[i + Ndft * j].imag;
-#endif
+	if ( fsk->est_zoom ) {
+		COMP dec[FSK_ZOOM_CHUNK];
+
+		for ( j = 0; j < nin; j += n ) {
+			n = ( nin - j < FSK_ZOOM_CHUNK ) ? nin - j : FSK_ZOOM_CHUNK;
+			m = decimator_process( fsk->est_zoom, dec, &fsk_in[j], n );
+			for ( i = 0; i < m; i++ ) {
+				fsk->est_blk[fsk->est_fill++] = dec[i];
+				if ( fsk->est_fill == Ndft ) {
+					fsk_est_block( fsk, fsk->est_blk, Ndft, fftin, fftout );
+					fsk->est_fill = 0;
+				}
+			}
 		}
-
-		/* Zero out the remaining slots on spare samples */
-		for (; i < Ndft; i++ ) {
-			fftin[i].r = 0;
-			fftin[i].i = 0;
+	} else {
+		// Default Nin is about a third of a second, or 4 loops of 12kHz / 1024 FFT
+		for ( j = 0; j < nin / Ndft + 1; j++ ) {	// rounded up
+			n = nin - j * Ndft;
+			fsk_est_block( fsk, &fsk_in[j * Ndft], n >= Ndft ? Ndft : n, fftin, fftout );
 		}
+	}
 
-		/* Do the FFT */
-		kiss_fft( fft_cfg,fftin,fftout );
+	modem_probe_samp_f( "t_fft_est",fsk->fft_est,fsk->est_bins );
 
-		/* Find the magnitude^2 of each freq slot and stash away in the real
-		* value, so this only has to be done once. Since we're only comparing
-		* these values and only need the mag of 2 points, we don't need to do
-		* a sqrt to each value */
-		for ( i = 0; i < Ndft / 2; i++ ) {
-			fftout[i].r = ( fftout[i].r * fftout[i].r ) + ( fftout[i].i * fftout[i].i ) ;
-		}
+cannot_fail:
+	#ifndef DEMOD_ALLOC_STACK
+	free( fftin );
+	free( fftout );
+	#endif
+	return;
+}
 
-		/* Zero out the minimum and maximum ends */
-		for ( i = 0; i < f_min; i++ ) {
-			fftout[i].r = 0;
-		}
-		for ( i = f_max - 1; i < Ndft / 2; i++ ) {
-			fftout[i].r = 0;
-		}
-		/* Mix back in with the previous fft block */
-		/* Copy new fft est into imag of fftout for frequency divination below */
-		for ( i = 0; i < Ndft / 2; i++ ) {
-			fsk->fft_est[i] = ( fsk->fft_est[i] * ( 1 - tc ) ) + ( sqrtf( fftout[i].r ) * tc );
-			fftout[i].i = fsk->fft_est[i];
-		}
-	}
+/*
+ * Find the M tone frequencies in the averaged spectrum, sorted low to high.
+ * The spectrum may belong to another modem instance with the same Fs and Ndft,
+ * which is how several demods share a single estimator.
+ * Parameters:
+ * fsk - FSK struct holding the averaged spectrum
+ * freqs - Array for the estimated frequencies
+ * M - number of frequency peaks to find
+ */
+void fsk_est_tones( struct FSK *fsk, float *freqs, int M ) {
+	int Ndft = fsk->Ndft;
+	int bins = fsk->est_bins;
+	size_t i,j;
+	float max;
+	int imax;
+	int freqi[M];
+	int f_min,f_max,f_zero;
 
-	modem_probe_samp_f( "t_fft_est",fsk->fft_est,Ndft / 2 );
+	/* Copy of the spectrum, peaks are blanked out as they are found */
+	#ifdef DEMOD_ALLOC_STACK
+	float *spec = (float*)alloca( sizeof( float ) * bins );
+	#else
+	float *spec = (float*)malloc( sizeof( float ) * bins );
+	if (!spec)
+		return;
+	#endif
+
+	memcpy( spec, fsk->fft_est, sizeof( float ) * bins );
+	f_zero = ( fsk->est_space * Ndft ) / fsk->est_rate;
 
 	if ( M == 4) {
-		comb_filter(fsk, freqi, fftout);
+		comb_filter(fsk, freqi, spec);
 
 	/* Find the M frequency peaks here */
 	} else for ( i = 0; i < M; i++ ) {
 		imax = 0;
 		max = 0;
-		for ( j = 0; j < Ndft / 2; j++ ) {
-			if ( fftout[j].i > max ) {
-				max = fftout[j].i;
+		for ( j = 0; j < bins; j++ ) {
+			if ( spec[j] > max ) {
+				max = spec[j];
 				imax = j;
 			}
 		}
@@ -650,9 +969,9 @@ void fsk_demod_freq_est( struct FSK *fsk, COMP fsk_in[],float *freqs,int M ) {
 		f_min = imax - f_zero;
 		f_min = f_min < 0 ? 0 : f_min;
 		f_max = imax + f_zero;
-		f_max = f_max > Ndft ? Ndft : f_max;
+		f_max = f_max > bins ? bins : f_max;
 		for ( j = f_min; j < f_max; j++ )
-			fftout[j].i = 0;
+			spec[j] = 0;
 
 		/* Stick the freq index on the list */
 		freqi[i] = imax;
@@ -676,20 +995,208 @@ void fsk_demod_freq_est( struct FSK *fsk, COMP fsk_in[],float *freqs,int M ) {
 
 	/* Convert freqs from indices to frequencies */
 	for ( i = 0; i < M; i++ ) {
-		freqs[i] = (float)( freqi[i] ) * ( (float)Fs / (float)Ndft );
+		freqs[i] = (float)( freqi[i] + fsk->est_bin0 ) * ( (float)fsk->est_rate / (float)Ndft );
 	}
 
-cannot_fail:
 	#ifndef DEMOD_ALLOC_STACK
-	free( fftin );
-	free( fftout );
+	free( spec );
 	#endif
-	return;
 }
 
-void fsk2_demod( struct FSK *fsk, uint8_t rx_bits[], float rx_sd[], COMP fsk_in[] ) {
+/*
+ * Every 4FSK tone set in the averaged spectrum, strongest first. The comb is searched
+ * again with the bins of each set found, and a symbol rate either side, set to the
+ * noise floor, so the scores of the later sets are against the same noise.
+ * The first set is always returned, as by fsk_est_tones(), the rest only while their
+ * comb_filter() score is at least min_score.
+ */
+int fsk_est_tone_sets( struct FSK *fsk, float freqs[][MODE_M_MAX], float scores[], int nmax, float min_score ) {
+	int Ndft = fsk->Ndft;
+	int bins = fsk->est_bins;
+	int guard = ( fsk->Rs * Ndft + fsk->est_rate - 1 ) / fsk->est_rate;
+	int freqi[MODE_M_MAX];
+	int n, i, lo, hi;
+	float score, floor;
+
+	#ifdef DEMOD_ALLOC_STACK
+	float *spec = (float*)alloca( sizeof( float ) * bins );
+	#else
+	float *spec = (float*)malloc( sizeof( float ) * bins );
+	if (!spec)
+		return 0;
+	#endif
+
+	fsk_est_range( fsk, &lo, &hi );
+	memcpy( spec, &fsk->fft_est[lo], sizeof( float ) * ( hi - lo ) );
+	floor = fsk_select( spec, hi - lo, ( hi - lo ) / 2 );
+
+	memcpy( spec, fsk->fft_est, sizeof( float ) * bins );
+	for ( n = 0; n < nmax; n++ ) {
+		score = comb_filter( fsk, freqi, spec );
+		if ( ( n > 0 ) && ( score < min_score ) )
+			break;
+		for ( i = 0; i < 4; i++ )
+			freqs[n][i] = (float)( freqi[i] + fsk->est_bin0 ) * ( (float)fsk->est_rate / (float)Ndft );
+		scores[n] = score;
+
+		lo = freqi[0] - guard;
+		lo = lo < 0 ? 0 : lo;
+		hi = freqi[3] + guard + 1;
+		hi = hi > bins ? bins : hi;
+		for ( i = lo; i < hi; i++ )
+			spec[i] = floor;
+	}
+
+	#ifndef DEMOD_ALLOC_STACK
+	free( spec );
+	#endif
+	return n;
+}
+
+/*
+ * Estimate the frequencies of the tones within a block of samples.
+ * Parameters:
+ * fsk - FSK struct from demod containing FSK config
+ * fsk_in - block of samples in this demod cycles, must be nin long
+ * freqs - Array for the estimated frequencies
+ * M - number of frequency peaks to find
+ */
+void fsk_demod_freq_est( struct FSK *fsk, COMP fsk_in[],float *freqs,int M ) {
+	uint64_t t0 = fsk->perf ? perf_now() : 0;
+
+	fsk_est_spectrum( fsk, fsk_in, fsk->nin );
+	fsk_est_tones( fsk, freqs, M );
+
+	if ( fsk->perf )
+		perf_add( &fsk->perf[PERF_EST], perf_now() - t0 );
+}
+
+/*
+ * Follow the tones from this frame's integrators. Each is a DFT over Ts at its tone,
+ * so the phase turned between samples a symbol apart is how far off the tone is, and
+ * the size of their sum against the power of the samples is how much tone there is.
+ * Moves fsk->est_f[] towards the tones while tracking, and decides when to start
+ * and stop tracking.
+ */
+static void fsk_track_tones( struct FSK *fsk, COMP *f_int[], float f_est[] ) {
+	int M = fsk->mode;
+	int P = fsk->P;
+	int n = ( fsk->Nsym + 1 ) * P;
+	float binw = (float)fsk->est_rate / (float)fsk->Ndft;
+	float coh = 0, pwr = 0, drift = 0, d;
+	int i, m, steady = 1;
+	COMP c;
+
+	for ( m = 0; m < M; m++ ) {
+		c = comp0();
+		for ( i = P; i < n; i++ ) {
+			c = cadd( c, cmult( f_int[m][i], cconj( f_int[m][i - P] ) ) );
+			pwr += ( f_int[m][i].real * f_int[m][i].real ) + ( f_int[m][i].imag * f_int[m][i].imag );
+		}
+		coh += cabsolute( c );
+
+		/* Hz the tone is above f_est[m] */
+		d = atan2f( c.imag, c.real ) * (float)fsk->Rs / ( 2 * M_PI );
+		if ( fsk->est_track ) {
+			fsk->est_f[m] += FSK_TRACK_GAIN * d + fsk->est_df;
+			drift += cabsolute( c ) * d;
+		} else {
+			if ( fabsf( f_est[m] - fsk->est_f[m] ) > binw )
+				steady = 0;
+			fsk->est_f[m] = f_est[m];
+		}
+	}
+	/* the tones drift together, so the drift follows their weighted mean offset */
+	if ( fsk->est_track && ( coh > 0 ) )
+		fsk->est_df += FSK_TRACK_DRIFT * drift / coh;
+	fsk->est_coh += FSK_TRACK_AVG * ( ( pwr > 0 ? coh / pwr : 0 ) - fsk->est_coh );
+
+	if ( fsk->est_track ) {
+		if ( fsk->est_coh < FSK_TRACK_OFF ) {
+			fsk->est_track = 0;
+			fsk->est_count = 0;
+		}
+	} else if ( steady && ( fsk->est_coh >= FSK_TRACK_ON ) ) {
+		if ( ++fsk->est_count >= FSK_TRACK_LOCK ) {
+			fsk->est_track = 1;
+			fsk->est_every = FSK_TRACK_CHECK;
+			fsk->est_count = fsk->est_every;
+			fsk->est_df = 0;
+		}
+	} else {
+		fsk->est_count = 0;
+	}
+}
+
+/*
+ * Frames to the next search while following, given how far the search just made found
+ * the tones from where they were followed. Doubled while the search agrees to a bin, up
+ * to a most that grows with the tone coherence from FSK_TRACK_CHECK to FSK_TRACK_CHECK_MAX.
+ * Searches of weak tones are noisy, and more of them only lose the tones more often, so
+ * it is only fewer than FSK_TRACK_CHECK when the drift could cross half the guard sooner.
+ */
+static int fsk_check_every( struct FSK *fsk, float dev ) {
+	float binw = (float)fsk->est_rate / (float)fsk->Ndft;
+	float a = ( fsk->est_coh - FSK_TRACK_ON ) / ( FSK_TRACK_STRONG - FSK_TRACK_ON );
+	float df = fabsf( fsk->est_df );
+	int every, most;
+
+	a = a < 0 ? 0 : ( a > 1 ? 1 : a );
+	most = FSK_TRACK_CHECK + (int)( a * ( FSK_TRACK_CHECK_MAX - FSK_TRACK_CHECK ) );
+	if ( df * most > FSK_TRACK_GUARD * binw / 2 )
+		most = (int)( FSK_TRACK_GUARD * binw / ( 2 * df ) );
+
+	every = dev > binw ? fsk->est_every : fsk->est_every * 2;
+	every = every > most ? most : every;
+	return every < FSK_TRACK_CHECK_MIN ? FSK_TRACK_CHECK_MIN : every;
+}
+
+/*
+ * Tones for the next frame: followed while tracking, with a search of the spectrum
+ * every fsk->est_every frames to check that they are still there.
+ */
+static void fsk_next_tones( struct FSK *fsk, COMP fsk_in[], float f_est[] ) {
+	float guard = FSK_TRACK_GUARD * (float)fsk->est_rate / (float)fsk->Ndft;
+	int M = fsk->mode;
+	uint64_t t0;
+	float dev;
+	int m;
+
+	if ( fsk->est_track && ( --fsk->est_count > 0 ) ) {
+		memcpy( f_est, fsk->est_f, sizeof( float ) * M );
+		fsk->est_skipped++;
+		return;
+	}
+
+	t0 = fsk->perf ? perf_now() : 0;
+	fsk_est_spectrum( fsk, fsk_in, fsk->nin );
+	fsk_est_tones( fsk, f_est, M );
+	fsk->est_searches++;
+	if ( fsk->perf )
+		fsk->est_search_ns += perf_now() - t0;
+
+	if ( fsk->est_track ) {
+		dev = 0;
+		for ( m = 0; m < M; m++ )
+			if ( fabsf( f_est[m] - fsk->est_f[m] ) > dev )
+				dev = fabsf( f_est[m] - fsk->est_f[m] );
+		if ( dev > guard ) {
+			fsk->est_track = 0;
+			fsk->est_count = 0;
+		} else {
+			fsk->est_every = fsk_check_every( fsk, dev );
+			fsk->est_count = fsk->est_every;
+			memcpy( f_est, fsk->est_f, sizeof( float ) * M );
+		}
+	}
+}
+
+/*
+ * Downconvert each tone and integrate over Ts at offsets of Ts/P.
+ * Each f_int[m] receives (nsym + 1) * P filtered and downsampled symbols.
+ */
+static void fsk_integrate( struct FSK *fsk, COMP fsk_in[], float f_est[], COMP *f_int[] ) {
 	int Ts = fsk->Ts;
-	int Rs = fsk->Rs;
 	int Fs = fsk->Fs;
 	int nsym = fsk->Nsym;
 	int nin = fsk->nin;
@@ -697,45 +1204,25 @@ void fsk2_demod( struct FSK *fsk, uint8_t rx_bits[], float rx_sd[], COMP fsk_in[
 	int Nmem = fsk->Nmem;
 	int M = fsk->mode;
 	size_t i,j,m,dc_i,cbuf_i;
-	float ft1;
 	int nstash = fsk->nstash;
 
-	COMP* f_int[M];     /* Filtered and downsampled symbol tones */
-	COMP t[M];          /* complex number temps */
-	COMP t_c;           /* another complex temp */
 	COMP phi_c[M];
-	COMP phi_ft;
 	int nold = Nmem - nin;
 
 	COMP dphi[M];
-	COMP dphift;
-	float rx_timing,norm_rx_timing,old_norm_rx_timing,d_norm_rx_timing,appm;
 	int using_old_samps;
 
 	COMP* sample_src;
 	COMP* f_intbuf_m;
 
-	float f_est[M],fc_avg,fc_tx;
-	float meanebno,stdebno,eye_max;
-	int neyesamp,neyeoffset;
-
 	#ifdef MODEMPROBE_ENABLE
 	char mp_name_tmp[20]; /* Temporary string for modem probe trace names */
 	#endif
 
-	//for(size_t jj = 0; jj<nin; jj++){
-	//    fprintf(stderr,"%f,j%f,",fsk_in[jj].real,fsk_in[jj].imag);
-	//}
-
 	/* Load up demod phases from struct */
 	for ( m = 0; m < M; m++ )
 		phi_c[m] = fsk->phi_c[m];
 
-	/* Estimate tone frequencies */
-	fsk_demod_freq_est( fsk,fsk_in,f_est,M );
-	modem_probe_samp_f( "t_f_est",f_est,M );
-
-
 	/* Allocate circular buffer for integration */
 	#ifdef DEMOD_ALLOC_STACK
 	f_intbuf_m = (COMP*) alloca( sizeof( COMP ) * Ts );
@@ -743,18 +1230,6 @@ void fsk2_demod( struct FSK *fsk, uint8_t rx_bits[], float rx_sd[], COMP fsk_in[
 	f_intbuf_m = (COMP*) malloc( sizeof( COMP ) * Ts );
 	#endif
 
-	/* allocate memory for the integrated samples */
-	for ( m = 0; m < M; m++ ) {
-		#ifdef DEMOD_ALLOC_STACK
-		/* allocate memory for the integrated samples */
-		/* Note: This must be kept after fsk_demod_freq_est for memory usage reasons */
-		f_int[m] = (COMP*) alloca( sizeof( COMP ) * ( nsym + 1 ) * P );
-
-		#else
-		f_int[m] = (COMP*) malloc( sizeof( COMP ) * ( nsym + 1 ) * P );
-		#endif
-	}
-
 	/* If this is the first run, we won't have any valid f_est */
 	/* TODO: add first_run flag to FSK to make negative freqs possible */
 	if ( fsk->f_est[0] < 1 ) {
@@ -794,7 +1269,7 @@ void fsk2_demod( struct FSK *fsk, uint8_t rx_bits[], float rx_sd[], COMP fsk_in[
 				using_old_samps = 0;
 
 				/* Recalculate delta-phi after switching to new sample source */
-				comp_normalize( phi_c[m] );
+				comp_normalize( &phi_c[m] );
 				dphi_m = comp_exp_j( 2 * M_PI * ( ( f_est_m ) / (float)( Fs ) ) );
 			}
 			/* Downconvert and place into integration buffer */
@@ -820,7 +1295,7 @@ void fsk2_demod( struct FSK *fsk, uint8_t rx_bits[], float rx_sd[], COMP fsk_in[
 					using_old_samps = 0;
 
 					/* Recalculate delta-phi after switching to new sample source */
-					comp_normalize( phi_c[m] );
+					comp_normalize( &phi_c[m] );
 					dphi_m = comp_exp_j( 2 * M_PI * ( ( f_est_m ) / (float)( Fs ) ) );
 				}
 				/* Downconvert and place into integration buffer */
@@ -862,6 +1337,162 @@ void fsk2_demod( struct FSK *fsk, uint8_t rx_bits[], float rx_sd[], COMP fsk_in[
 	/* Stash samples away in the old sample buffer for the next round of bit getting */
 	memcpy( (void*)&( fsk->samp_old[0] ),(void*)&( fsk_in[nin - nstash] ),sizeof( COMP ) * nstash );
 
+	#ifndef DEMOD_ALLOC_STACK
+	free( f_intbuf_m );
+	#endif
+}
+
+/*
+ * fsk_integrate() for FSK_ENGINE_STFT. The samples are cut into blocks of Ts/P,
+ * and one FFT of each serves every tone. A tone is read between the two bins either
+ * side of it, each turned back by the half block it is off the bin for, and on by the
+ * tone's phase at the start of the block, so the P blocks of an integrator add up as
+ * if mixed down. Real samples, as from audio, go two blocks to an FFT, one as the
+ * imaginary part.
+ */
+static void fsk_integrate_stft( struct FSK *fsk, COMP fsk_in[], float f_est[], COMP *f_int[] ) {
+	int Ts = fsk->Ts;
+	int Fs = fsk->Fs;
+	int nsym = fsk->Nsym;
+	int nin = fsk->nin;
+	int P = fsk->P;
+	int M = fsk->mode;
+	int H = Ts / P;
+	int Nfft = fsk->stft_n;
+	int nstash = fsk->nstash;
+	int nold = fsk->Nmem - nin;
+	int nblk = ( nsym + 2 ) * P - 1;    /* blocks spanned by ( nsym + 1 ) * P integrators */
+	kiss_fft_cpx *in = fsk->stft_in;
+	kiss_fft_cpx *out = fsk->stft_out;
+	COMP ph[M], dph[M];
+	COMP w[M][2];                       /* of the bins below and above each tone */
+	int bin[M][2];
+	COMP *blk;                          /* tone m of block b at b * M + m */
+	COMP *src;
+	int real, step, b, i, j, m, k, t, n;
+	float a, df;
+
+	#ifdef DEMOD_ALLOC_STACK
+	blk = (COMP*) alloca( sizeof( COMP ) * nblk * M );
+	#else
+	blk = (COMP*) malloc( sizeof( COMP ) * nblk * M );
+	#endif
+
+	if ( fsk->f_est[0] < 1 ) {
+		for ( m = 0; m < M; m++ )
+			fsk->f_est[m] = f_est[m];
+	}
+
+	for ( m = 0; m < M; m++ ) {
+		k = (int)floorf( f_est[m] * Nfft / Fs );
+		a = f_est[m] * Nfft / Fs - k;
+		for ( t = 0; t < 2; t++ ) {
+			df = f_est[m] - (float)( k + t ) * Fs / Nfft;
+			bin[m][t] = ( ( k + t ) % Nfft + Nfft ) % Nfft;
+			w[m][t] = fcmult( t ? a : 1 - a, comp_exp_j( -M_PI * df * ( H - 1 ) / Fs ) );
+		}
+		ph[m] = comp_exp_j( 0 );
+		dph[m] = comp_exp_j( -2 * M_PI * f_est[m] * H / Fs );
+	}
+
+	real = 1;
+	for ( n = 0; n < nold && real; n++ )
+		real = fsk->samp_old[nstash - nold + n].imag == 0;
+	for ( n = 0; n < nin && real; n++ )
+		real = fsk_in[n].imag == 0;
+	step = real ? 2 : 1;
+
+	/* The old samples, then the new, the rest of in[] stays zero */
+	for ( b = 0; b < nblk; b += step ) {
+		for ( j = 0; j < H; j++ ) {
+			n = b * H + j;
+			src = n < nold ? &fsk->samp_old[nstash - nold + n] : &fsk_in[n - nold];
+			in[j].r = src->real;
+			in[j].i = src->imag;
+			if ( real ) {
+				n += H;
+				src = n < nold ? &fsk->samp_old[nstash - nold + n] : &fsk_in[n - nold];
+				in[j].i = b + 1 < nblk ? src->real : 0;
+			}
+		}
+		kiss_fft( fsk->stft_cfg, in, out );
+		for ( m = 0; m < M; m++ ) {
+			COMP x = comp0(), y = comp0();
+			for ( t = 0; t < 2; t++ ) {
+				COMP z = { out[bin[m][t]].r, out[bin[m][t]].i };
+				if ( real ) {
+					/* Z(k) = X(k) + jY(k), and X, Y have conjugate symmetric spectra */
+					COMP zc = { out[( Nfft - bin[m][t] ) % Nfft].r, -out[( Nfft - bin[m][t] ) % Nfft].i };
+					COMP d = csub( z, zc );
+					COMP jy = { d.imag, -d.real };
+					x = cadd( x, cmult( fcmult( 0.5f, cadd( z, zc ) ), w[m][t] ) );
+					y = cadd( y, cmult( fcmult( 0.5f, jy ), w[m][t] ) );
+				} else {
+					x = cadd( x, cmult( z, w[m][t] ) );
+				}
+			}
+			blk[b * M + m] = cmult( x, ph[m] );
+			ph[m] = cmult( ph[m], dph[m] );
+			if ( real && ( b + 1 < nblk ) ) {
+				blk[( b + 1 ) * M + m] = cmult( y, ph[m] );
+				ph[m] = cmult( ph[m], dph[m] );
+			}
+		}
+	}
+
+	/* Each integrator is the last less its oldest block and plus a new one */
+	for ( m = 0; m < M; m++ ) {
+		float it_r = 0;
+		float it_i = 0;
+		for ( j = 0; j < P - 1; j++ ) {
+			it_r += blk[j * M + m].real;
+			it_i += blk[j * M + m].imag;
+		}
+		for ( i = 0; i < ( nsym + 1 ) * P; i++ ) {
+			it_r += blk[( i + P - 1 ) * M + m].real;
+			it_i += blk[( i + P - 1 ) * M + m].imag;
+			f_int[m][i].real = it_r;
+			f_int[m][i].imag = it_i;
+			it_r -= blk[i * M + m].real;
+			it_i -= blk[i * M + m].imag;
+		}
+		fsk->f_est[m] = f_est[m];
+	}
+
+	memcpy( (void*)&( fsk->samp_old[0] ),(void*)&( fsk_in[nin - nstash] ),sizeof( COMP ) * nstash );
+
+	#ifndef DEMOD_ALLOC_STACK
+	free( blk );
+	#endif
+}
+
+/*
+ * Timing recovery, symbol decisions and statistics from the tone integrators
+ */
+static void fsk_demod_core( struct FSK *fsk, uint8_t rx_bits[], float rx_sd[], COMP *f_int[], float f_est[] ) {
+	int Ts = fsk->Ts;
+	int Rs = fsk->Rs;
+	int nsym = fsk->Nsym;
+	int P = fsk->P;
+	int M = fsk->mode;
+	size_t i,j,m;
+	float ft1;
+
+	COMP t[M];          /* complex number temps */
+	COMP t_c;           /* another complex temp */
+	COMP phi_ft;
+
+	COMP dphift;
+	float rx_timing,norm_rx_timing,old_norm_rx_timing,d_norm_rx_timing,appm;
+
+	float fc_avg,fc_tx;
+	float meanebno,stdebno;
+	int neyesamp,neyeoffset;
+
+	#ifdef MODEMPROBE_ENABLE
+	char mp_name_tmp[20]; /* Temporary string for modem probe trace names */
+	#endif
+
 	/* Fine Timing Estimation */
 	/* Apply magic nonlinearity to f1_int and f2_int, shift down to 0,
 	 * extract angle */
@@ -1048,6 +1679,8 @@ void fsk2_demod( struct FSK *fsk, uint8_t rx_bits[], float rx_sd[], COMP fsk_in[
 	fsk->stats->foff = fc_tx - fc_avg;
 
 	/* Take a sample for the eye diagrams ---------------------------------- */
+	/* Only the integrator samples are kept, the traces are made from them by
+	   fsk_get_demod_stats(), if anyone asks */
 
 	/* due to oversample rate P, we have too many samples for eye
 	   trace.  So lets output a decimated version.  We use 2P
@@ -1079,25 +1712,11 @@ void fsk2_demod( struct FSK *fsk, uint8_t rx_bits[], float rx_sd[], COMP fsk_in[
 				ind = 2 * P * i + neyeoffset + j * neyesamp_dec;
 				assert( ( i * M + m ) < MODEM_STATS_ET_MAX );
 				assert( ind < ( nsym + 1 ) * P );
-				fsk->stats->rx_eye[i * M + m][j] = cabsolute( f_int[m][ind] );
+				fsk->eye_snap[i * M + m][j] = f_int[m][ind];
 			}
 		}
 	}
 
-	if ( fsk->normalise_eye ) {
-		eye_max = 0;
-		/* Normalize eye to +/- 1 */
-		for ( i = 0; i < M * eye_traces; i++ )
-			for ( j = 0; j < neyesamp; j++ )
-				if ( fabsf( fsk->stats->rx_eye[i][j] ) > eye_max ) {
-					eye_max = fabsf( fsk->stats->rx_eye[i][j] );
-				}
-
-		for ( i = 0; i < M * eye_traces; i++ )
-			for ( j = 0; j < neyesamp; j++ )
-				fsk->stats->rx_eye[i][j] = fsk->stats->rx_eye[i][j] / eye_max;
-	}
-
 	fsk->stats->nr = 0;
 	fsk->stats->Nc = 0;
 
@@ -1118,13 +1737,117 @@ void fsk2_demod( struct FSK *fsk, uint8_t rx_bits[], float rx_sd[], COMP fsk_in[
 		modem_probe_samp_f( mp_name_tmp,&f_est[m],1 );
 	}
 	#endif
+}
 
-	#ifndef DEMOD_ALLOC_STACK
+/*
+ * Allocate the tone integrators for one frame, (nsym + 1) * P samples per tone
+ */
+#ifdef DEMOD_ALLOC_STACK
+#define FSK_ALLOC_F_INT( f_int, fsk ) \
+	for ( m = 0; m < ( fsk )->mode; m++ ) \
+		( f_int )[m] = (COMP*) alloca( sizeof( COMP ) * ( ( fsk )->Nsym + 1 ) * ( fsk )->P )
+#define FSK_FREE_F_INT( f_int, fsk )
+#else
+#define FSK_ALLOC_F_INT( f_int, fsk ) \
+	for ( m = 0; m < ( fsk )->mode; m++ ) \
+		( f_int )[m] = (COMP*) malloc( sizeof( COMP ) * ( ( fsk )->Nsym + 1 ) * ( fsk )->P )
+#define FSK_FREE_F_INT( f_int, fsk ) \
+	for ( m = 0; m < ( fsk )->mode; m++ ) \
+		free( ( f_int )[m] )
+#endif
+
+void fsk2_demod( struct FSK *fsk, uint8_t rx_bits[], float rx_sd[], COMP fsk_in[] ) {
+	float f_est[MODE_M_MAX];
+	COMP* f_int[MODE_M_MAX];
+	size_t m;
+
+	if ( !fsk->est_tracking ) {
+		/* Estimate tone frequencies */
+		fsk_demod_freq_est( fsk,fsk_in,f_est,fsk->mode );
+		modem_probe_samp_f( "t_f_est",f_est,fsk->mode );
+
+		fsk2_demod_tones( fsk, rx_bits, rx_sd, fsk_in, f_est, NULL );
+		return;
+	}
+
+	uint64_t t0 = fsk->perf ? perf_now() : 0, t_est = 0;
+
+	fsk_next_tones( fsk, fsk_in, f_est );
+	modem_probe_samp_f( "t_f_est",f_est,fsk->mode );
+	if ( fsk->perf )
+		t_est = perf_now() - t0;
+
+	FSK_ALLOC_F_INT( f_int, fsk );
+	fsk2_demod_tones( fsk, rx_bits, rx_sd, fsk_in, f_est, f_int );
+
+	if ( fsk->perf )
+		t0 = perf_now();
+	fsk_track_tones( fsk, f_int, f_est );
+	if ( fsk->perf )
+		perf_add( &fsk->perf[PERF_EST], t_est + perf_now() - t0 );
+	FSK_FREE_F_INT( f_int, fsk );
+}
+
+void fsk2_demod_tones( struct FSK *fsk, uint8_t rx_bits[], float rx_sd[], COMP fsk_in[], float f_est[], COMP *f_int_out[] ) {
+	int M = fsk->mode;
+	size_t m;
+	COMP* f_int[M];     /* Filtered and downsampled symbol tones */
+
+	if ( f_int_out ) {
+		for ( m = 0; m < M; m++ )
+			f_int[m] = f_int_out[m];
+	} else {
+		/* Note: This must be kept after fsk_demod_freq_est for memory usage reasons */
+		FSK_ALLOC_F_INT( f_int, fsk );
+	}
+
+	uint64_t t0 = fsk->perf ? perf_now() : 0, t1 = 0;
+
+	if ( fsk->engine == FSK_ENGINE_STFT )
+		fsk_integrate_stft( fsk, fsk_in, f_est, f_int );
+	else
+		fsk_integrate( fsk, fsk_in, f_est, f_int );
+	if ( fsk->perf ) {
+		t1 = perf_now();
+		perf_add( &fsk->perf[PERF_INTEGRATE], t1 - t0 );
+	}
+	fsk_demod_core( fsk, rx_bits, rx_sd, f_int, f_est );
+	if ( fsk->perf )
+		perf_add( &fsk->perf[PERF_TIMING], perf_now() - t1 );
+
+	if ( !f_int_out ) {
+		FSK_FREE_F_INT( f_int, fsk );
+	}
+}
+
+void fsk2_demod_integrated( struct FSK *fsk, uint8_t rx_bits[], float rx_sd[], COMP fsk_in[], float f_est[], COMP *f_int[] ) {
+	int Ts = fsk->Ts;
+	int Fs = fsk->Fs;
+	int nin = fsk->nin;
+	int P = fsk->P;
+	int M = fsk->mode;
+	size_t m;
+
+	if ( fsk->f_est[0] < 1 ) {
+		for ( m = 0; m < M; m++ )
+			fsk->f_est[m] = f_est[m];
+	}
+
+	/* Spin the downmixers as far as fsk_integrate() would have done, so that
+	   a following frame integrated here picks up with a continuous phase */
 	for ( m = 0; m < M; m++ ) {
-		free( f_int[m] );
+		double cycles = ( ( Ts / P ) * (double)fsk->f_est[m] + ( nin - ( Ts / P ) ) * (double)f_est[m] ) / Fs;
+		cycles -= floor( cycles );
+		fsk->phi_c[m] = cmult( fsk->phi_c[m], comp_exp_j( 2 * M_PI * cycles ) );
+		fsk->f_est[m] = f_est[m];
 	}
-	free( f_intbuf_m );
-	#endif
+
+	memcpy( (void*)&( fsk->samp_old[0] ),(void*)&( fsk_in[nin - fsk->nstash] ),sizeof( COMP ) * fsk->nstash );
+
+	uint64_t t0 = fsk->perf ? perf_now() : 0;
+	fsk_demod_core( fsk, rx_bits, rx_sd, f_int, f_est );
+	if ( fsk->perf )
+		perf_add( &fsk->perf[PERF_TIMING], perf_now() - t0 );
 }
 
 void fsk_demod( struct FSK *fsk, uint8_t rx_bits[], COMP fsk_in[] ) {
@@ -1172,7 +1895,7 @@ void fsk_mod( struct FSK *fsk,float fsk_out[],uint8_t tx_bits[] ) {
 	}
 
 	/* Normalize TX phase to prevent drift */
-	comp_normalize( tx_phase_c );
+	comp_normalize( &tx_phase_c );
 
 	/* save TX phase */
 	fsk->tx_phase_c = tx_phase_c;
@@ -1216,7 +1939,7 @@ void fsk_mod_c( struct FSK *fsk,COMP fsk_out[],uint8_t tx_bits[] ) {
 	}
 
 	/* Normalize TX phase to prevent drift */
-	comp_normalize( tx_phase_c );
+	comp_normalize( &tx_phase_c );
 
 	/* save TX phase */
 	fsk->tx_phase_c = tx_phase_c;
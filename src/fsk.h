@@ -32,6 +32,10 @@
 #include "comp.h"
 #include "kiss_fftr.h"
 #include "modem_stats.h"
+#include "perf.h"
+
+struct decimator;
+struct window;
 
 #define FSK_DEFAULT_NSYM 30
 
@@ -42,6 +46,9 @@
 
 #define FSK_SCALE 16383
 
+#define FSK_ENGINE_MIXER 0  /* a mixer per tone, integrated over Ts at each of P offsets */
+#define FSK_ENGINE_STFT  1  /* an FFT every Ts/P samples for all the tones, see fsk_create_engine */
+
 struct FSK {
     /*  Static parameters set up by fsk_init */
     int Ndft;               /* buffer size for freq offset est fft */
@@ -59,12 +66,40 @@ struct FSK {
     int est_min;            /* Minimum frequency for freq. estimator */
     int est_max;            /* Maximum frequency for freq. estimaotr */
     int est_space;          /* Minimum frequency spacing for freq. estimator */
-    float* hann_table;		/* Precomputed or runtime computed hann window table */
+    int est_comb_min;       /* range of 4FSK tone spacings searched, Hz */
+    int est_comb_max;
+    int est_comb_start;     /* bin of the lowest tone of the last 4FSK search, */
+    float est_comb_spacing; /* the spacing found, Hz */
+    float est_comb_score;   /* and how far it stood above the noise, about 1 for none */
+    int est_tracking;       /* enables/disables following locked tones */
+    int est_track;          /* 1 while following the tones, 0 while searching */
+    int est_count;          /* frames locked, or to the next search when tracking */
+    int est_every;          /* frames between searches when tracking, adapted to the tones */
+    uint64_t est_searches;  /* frames the spectrum was searched in, when tracking is enabled */
+    uint64_t est_skipped;   /* and those it was not, as the tones were followed */
+    uint64_t est_search_ns; /* time taken by the searches, when perf is set */
+    float est_f[MODE_M_MAX];/* tones from the last search, or being followed */
+    float est_df;           /* drift of the followed tones, Hz per frame */
+    float est_coh;          /* tone coherence of the last frame, 0..1 */
+    int est_window;         /* WINDOW_ type of the freq. estimator FFTs */
+    const struct window *est_win;      /* shared table, Ndft long */
+    const struct window *est_win_part; /* and for a short last block */
+    int est_rate;           /* sample rate into the freq. estimator FFT */
+    int est_bin0;           /* fft_est[0] in bins from 0 Hz, negative when zoomed */
+    int est_bins;           /* bins in fft_est, Ndft/est_rate apart */
+    struct decimator *est_zoom; /* to the est_min..est_max band, or NULL for all of it */
+    COMP* est_blk;          /* zoomed samples waiting for a whole FFT */
+    int est_fill;
     
     /*  Parameters used by demod */
+    int engine;             /* FSK_ENGINE_ that makes the tone integrators */
     COMP phi_c[MODE_M_MAX];
     
     kiss_fft_cfg fft_cfg;   /* Config for KISS FFT, used in freq est */
+    kiss_fft_cfg stft_cfg;  /* FSK_ENGINE_STFT, stft_n point FFTs of Ts/P samples */
+    int stft_n;
+    kiss_fft_cpx *stft_in;  /* Ts/P samples then zeros */
+    kiss_fft_cpx *stft_out;
     float norm_rx_timing;   /* Normalized RX timing */
     
     COMP* samp_old;         /* Tail end of last batch of samples */
@@ -88,7 +123,9 @@ struct FSK {
     
     /*  modem statistic struct */
     struct MODEM_STATS *stats;
+    COMP eye_snap[MODEM_STATS_ET_MAX][MODEM_STATS_EYE_IND_MAX]; /* integrator samples for rx_eye */
     int normalise_eye;      /* enables/disables normalisation of eye diagram */
+    struct perf_timer *perf;/* PERF_STAGES stage timers, or NULL */
 };
 
 /*
@@ -101,6 +138,19 @@ struct FSK {
  */
 struct FSK * fsk_create(int Fs, int Rs, int M, int tx_f1, int tx_fs);
 
+/*
+ * As fsk_create, with P integrator offsets a symbol, where fsk_create has 8, and
+ * the engine that makes the tone integrators:
+ *
+ * FSK_ENGINE_MIXER - mixes each tone down, and integrates Ts samples at each offset
+ * FSK_ENGINE_STFT  - one FFT of every Ts/P samples, zero padded to at least 4 Ts/P
+ *                    points, serves all the tones; each integrator is the sum of
+ *                    the P blocks it spans, read between the bins either side of
+ *                    each tone.
+ *                    Its cost does not grow with P or M, the mixer's does with both.
+ */
+struct FSK * fsk_create_engine(int Fs, int Rs, int M, int P, int tx_f1, int tx_fs, int engine);
+
 /*
  * Create an FSK config/state struct from a set of config parameters
  * 
@@ -117,20 +167,52 @@ struct FSK * fsk_create_hbr(int Fs, int Rs, int P, int M, int tx_f1, int tx_fs);
 void fsk_set_nsym(struct FSK *fsk,int nsym);
 
 /*
- * Set the minimum and maximum frequencies at which the freq. estimator can find tones
+ * Set the minimum and maximum frequencies at which the freq. estimator can find tones.
+ * If they span a small part of the band, the estimator zooms in: the samples are
+ * shifted and decimated to just those frequencies, and a smaller FFT gives the same
+ * resolution.
  */
 void fsk_set_est_limits(struct FSK *fsk,int fmin, int fmax);
 
+/*
+ * Set the window on the freq. estimator FFTs, one of the WINDOW_ types in window.h.
+ * WINDOW_SINE by default.
+ */
+void fsk_set_est_window(struct FSK *fsk, int type);
+
+/*
+ * Set the range of 4FSK tone spacings the freq. estimator searches, in Hz.
+ * 150 to 350 by default, which covers the RS41 and RFM9x transmitters.
+ */
+void fsk_set_est_spacing(struct FSK *fsk, int min_hz, int max_hz);
+
 /* 
  * Clear the estimator states
  */
 void fsk_clear_estimators(struct FSK *fsk);
 
 /*
- * Fills MODEM_STATS struct with demod statistics
+ * Enable/disable tracking: once the tones have held still for a few frames,
+ * fsk2_demod() follows them from the tone integrators, and only searches the
+ * spectrum every est_every frames, or when the tones are lost. est_every
+ * starts at 8, and adapts from 2 to 32 with the strength and drift of the tones.
+ * Off by default.
+ */
+void fsk_enable_tracking(struct FSK *fsk, int enable);
+
+/*
+ * Fills MODEM_STATS struct with demod statistics. The eye diagram is made from the
+ * last frame here, rather than by the demod, so costs nothing unless asked for.
  */
 void fsk_get_demod_stats(struct FSK *fsk, struct MODEM_STATS *stats);
 
+/*
+ * The averaged spectrum of the freq. estimator from est_min to est_max, in n bins
+ * from *f_lo to *f_hi Hz. Each is the largest of the bins it covers, so narrow tones
+ * are not lost. f_lo and f_hi may be NULL.
+ */
+void fsk_get_spectrum(struct FSK *fsk, float spec[], int n, float *f_lo, float *f_hi);
+
 /*
  * Destroy an FSK state struct and free it's memory
  * 
@@ -200,6 +282,45 @@ void fsk_demod_sd(struct FSK *fsk, float rx_bits[],COMP fsk_in[]);
  */
 void fsk2_demod(struct FSK *fsk, uint8_t rx_bits[], float rx_sd[], COMP fsk_in[]);
 
+/*
+ * Frequency estimator, split so that one averaged spectrum can serve several demods.
+ * fsk_est_spectrum() averages nin samples into fsk->fft_est, fsk_est_tones() picks
+ * M tones from it. fsk_demod_freq_est() does both for nin = fsk_nin().
+ */
+void fsk_est_spectrum(struct FSK *fsk, COMP fsk_in[], int nin);
+void fsk_est_tones(struct FSK *fsk, float freqs[], int M);
+void fsk_demod_freq_est(struct FSK *fsk, COMP fsk_in[], float freqs[], int M);
+
+/*
+ * Several 4FSK signals in the one spectrum: up to nmax tone sets, strongest first,
+ * each with its comb_filter() score. The first is always returned, the others only
+ * if they score at least min_score. Returns the number of sets.
+ */
+int fsk_est_tone_sets(struct FSK *fsk, float freqs[][MODE_M_MAX], float scores[], int nmax, float min_score);
+
+/*
+ * 4FSK tone picker used by fsk_est_tones(), looks for 4 equally spaced tones, at any
+ * spacing set by fsk_set_est_spacing(), in the averaged spectrum spec[], and returns
+ * their bins in freqi[0..3]. The result is how far the tones stand above the noise.
+ */
+float comb_filter(struct FSK *fsk, int *freqi, float *spec);
+
+/* the k-th smallest of x[0..n-1], which are reordered, for the medians of spectra */
+float fsk_select(float x[], int n, int k);
+
+/*
+ * Demod with tone frequencies f_est[] supplied by an external estimator.
+ * If f_int is not NULL, it receives the M tone integrators for this frame,
+ * (Nsym+1)*P samples each, at Ts/P sample steps.
+ */
+void fsk2_demod_tones(struct FSK *fsk, uint8_t rx_bits[], float rx_sd[], COMP fsk_in[], float f_est[], COMP *f_int[]);
+
+/*
+ * Demod from tone integrators f_int[] computed elsewhere for tones f_est[],
+ * skipping the downconversion. fsk_in is only kept for the next frame.
+ */
+void fsk2_demod_integrated(struct FSK *fsk, uint8_t rx_bits[], float rx_sd[], COMP fsk_in[], float f_est[], COMP *f_int[]);
+
 /* enables/disables normalisation of eye diagram samples */
   
 void fsk_stats_normalise_eye(struct FSK *fsk, int normalise_enable);
@@ -18,33 +18,81 @@
 #include "global.h"
 
 struct TConfig Config;
-struct horus *hstates;
-int horus_mode = 0;
+struct horus_multi *hmulti;
 int audioIQ = 0;
-int max_demod_in = 0;
 
-/* It would be possible to run a single input through the decoder at two speeds */
+/* Pipeline: capture -> demod -> decode -> output.  Each stage has its own
+   thread, apart from output, which stays on the main thread with curses and
+   curl.  A stage's row in the stats is its input queue, and its busy time. */
+struct TStage
+{
+	const char *Name;
+	struct spsc *Input;
+	_Atomic uint64_t BusyNs;
+	uint64_t LastBusyNs;
+};
+
+static struct spsc audio_q, frame_q, packet_q, status_q;
+
+/* FEC results for the display, written by the decode thread */
+static _Atomic int BadCRC, Quality;
+static struct TStage Stages[] = {
+	{ "Capture", NULL },
+	{ "Demod", &audio_q },
+	{ "Decode", &frame_q },
+	{ "Output", &packet_q },
+};
+enum { STAGE_CAPTURE, STAGE_DEMOD, STAGE_DECODE, STAGE_OUTPUT, STAGE_COUNT };
+
+static int wake_pipe[2];	/* decode wakes the main thread */
+static int blocksize, paced;
+static double block_ms;
+static int input_format, input_samples, push_input;	/* push_input: samples go through horus_multi_push_samples() */
+
+/* Mode 4 runs a single input through the decoder at several speeds */
 int horus_init( int mode ) {
+	int modes[HORUS_MULTI_MAX_CHANNELS];
+	int nmodes = 1;
+
 	if (mode == 1)
-		horus_mode = HORUS_MODE_LDPC;
+		modes[0] = HORUS_MODE_LDPC;
 	else if (mode == 2)
-		horus_mode = HORUS_MODE_RTTY;
+		modes[0] = HORUS_MODE_RTTY;
 	else if (mode == 3)
-		horus_mode = HORUS_MODE_PITS;
-	else
-		horus_mode = HORUS_MODE_BINARY;
+		modes[0] = HORUS_MODE_PITS;
+	else if (mode == 4) {
+		modes[0] = HORUS_MODE_BINARY;
+		modes[1] = HORUS_MODE_LDPC;
+		modes[2] = HORUS_MODE_RTTY;
+		nmodes = 3;
+	} else
+		modes[0] = HORUS_MODE_BINARY;
 
-	hstates = horus_open( horus_mode );
-	if ( hstates == NULL ) {
+	hmulti = horus_multi_open( nmodes, modes );
+	if ( hmulti == NULL ) {
 		fprintf( stderr, "Couldn't open Horus API\n" );
 		return 0;
 	}
-	max_demod_in = horus_get_max_demod_in( hstates );
+	if ( !horus_multi_set_signals( hmulti, Config.Signals ) ) {
+		fprintf( stderr, "Can't decode %d signals in mode %d\n", Config.Signals, Config.Mode );
+		return 0;
+	}
+	horus_multi_set_low_latency( hmulti, Config.LowLatency );
+	if ( Config.Squelch && !horus_multi_set_squelch( hmulti, 1 ) ) {
+		fprintf( stderr, "Couldn't allocate the squelch\n" );
+		return 0;
+	}
+	if ( ( Config.InputRate != horus_get_Fs( horus_multi_get_channel( hmulti, 0 ) ) ) || Config.InputShift ) {
+		if ( !horus_multi_set_input_rate( hmulti, Config.InputRate, Config.InputShift ) ) {
+			fprintf( stderr, "Couldn't convert from %d Hz\n", Config.InputRate );
+			return 0;
+		}
+	}
 	return 1;
 }
 
 void horus_exit( void ) {
-	horus_close( hstates );
+	horus_multi_close( hmulti );
 }
 
 /* Converts a hex character to its integer value */
@@ -63,57 +111,44 @@ int unpack_hexdump(char src[], uint8_t dest[]) {
 	return count;
 }
 
-int horus_loop( uint8_t *packet ) {
-	int audiosize = sizeof( short ) * ( audioIQ ? 2 : 1 );
-	short demod_in[max_demod_in * ( audioIQ ? 2 : 1 )];
-	int max_ascii_out = horus_get_max_ascii_out_len( hstates ) | 1; // make sure it is an odd length
-	char ascii_out[max_ascii_out];
-	int len = 0;
+/* demodulate one horus_multi_nin() block of audio, and take the display stats */
+static void horus_block( short *demod_in, struct TStatus *status ) {
+	struct horus *hstates;
 
-	if ( fread( demod_in, audiosize, horus_nin( hstates ), stdin ) ==  horus_nin( hstates ) ) {
-		int result;
+	if ( push_input )
+		horus_multi_push_samples( hmulti, demod_in, input_samples, input_format );
+	else if ( audioIQ )
+		horus_multi_rx_comp( hmulti, demod_in );
+	else
+		horus_multi_rx( hmulti, demod_in );
 
-		if ( audioIQ ) {
-			result = horus_rx_comp( hstates, ascii_out, demod_in );
-		} else {
-			result = horus_rx( hstates, ascii_out, demod_in );
-		}
-
-		if ( result ) {
-			ascii_out[max_ascii_out - 1] = 0; // make sure it`s a string
-			if((horus_mode == HORUS_MODE_RTTY) || (horus_mode == HORUS_MODE_PITS))
-				len = sprintf((char *)packet, "%s\n", ascii_out);
-			else
-				len = unpack_hexdump(ascii_out, packet);
-		}
-	} else
-		return -1;
+	/* the first channel drives the display */
+	hstates = horus_multi_get_channel( hmulti, 0 );
 
 	uint8_t i, f1, f2, f3, f4;
 	struct MODEM_STATS stats;
 
 	horus_get_modem_extended_stats( hstates, &stats );
 
-	Config.freq = (int)(-0.1 * stats.foff) * 10;
-	Config.snr = (int)stats.snr_est - 10; // random scaling
-        Config.ppm = (int)stats.clock_offset;
+	status->freq = (int)(-0.1 * stats.foff) * 10;
+	status->snr = (int)stats.snr_est - 10; // random scaling
+	status->ppm = (int)stats.clock_offset;
 
 	for (i=0; i < WATERFALL_SIZE; i++)
-		Config.Waterfall[i] = 32; // " "
+		status->Waterfall[i] = 32; // " "
 	f1 = (uint8_t)(stats.f_est[0] / 37.0) - 25; // convert 5 KHz to 160 range
 	f2 = (uint8_t)(stats.f_est[1] / 37.0) - 25; // start at 1 kHz
-	Config.Waterfall[f1 >> 2] = 94; // "^"
-	Config.Waterfall[f2 >> 2] = 94;
-	Config.Waterfall[WATERFALL_SHOW] = 0;
-	if((horus_mode == HORUS_MODE_RTTY) || (horus_mode == HORUS_MODE_PITS))
-		return len;	// 2 fsk
+	status->Waterfall[f1 >> 2] = 94; // "^"
+	status->Waterfall[f2 >> 2] = 94;
+	status->Waterfall[WATERFALL_SHOW] = 0;
+	if(horus_get_mFSK( hstates ) == 2)
+		return;	// 2 fsk
 
 	f3 = (uint8_t)(stats.f_est[2] / 37.0) - 25; // 1Kh - 6kHz in 133hz steps
 	f4 = (uint8_t)(stats.f_est[3] / 37.0) - 25; // (160 >> 2) = 40 char display
-	Config.Waterfall[f3 >> 2] = 94;
-	Config.Waterfall[f4 >> 2] = 94;
-	Config.Waterfall[WATERFALL_SHOW] = 0;
-	return len;		// 4 fsk
+	status->Waterfall[f3 >> 2] = 94;
+	status->Waterfall[f4 >> 2] = 94;
+	status->Waterfall[WATERFALL_SHOW] = 0;
 }
 
 void LogMessage( const char *format, ... ) {
@@ -199,17 +234,24 @@ size_t write_data( void *buffer, size_t size, size_t nmemb, void *userp ) {
 }
 
 void ReadString( FILE *fp, char *keyword, char *Result, int Length, int NeedValue ) {
-	char line[100], *token, *value;
+	char line[200], *token, *value;
+	size_t length;
 
 	fseek( fp, 0, SEEK_SET );
 	*Result = '\0';
 
 	while ( fgets( line, sizeof( line ), fp ) != NULL )
 	{
+		length = strlen( line );
 		token = strtok( line, "= :\t" );
 		if ( token && ( strcasecmp( keyword, token ) == 0 ) ) {
-			value = strtok( NULL, ":= \t\n\r" );
-			strcpy( Result, value );
+			// value runs to the next space, so that it can hold a URL
+			value = token + strlen( token );
+			if ( value < line + length )
+				value += 1 + strspn( value + 1, "= :\t" );
+			value = strtok( value, " \t\n\r" );
+			if ( value )
+				snprintf( Result, Length, "%s", value );
 			return;
 		}
 	}
@@ -248,6 +290,7 @@ void LoadConfigFile() {
 	FILE *fp;
 	char *filename = "gateway.txt";
 	char Keyword[32];
+	char URL[128];
 	char Payload[PAYLOAD_SIZE];
 	int i;
 
@@ -256,6 +299,16 @@ void LoadConfigFile() {
 	Config.myLat = 52.0;
 	Config.myLon = -2.0;
 	Config.myAlt = 99.0;
+	strcpy( Config.HabitatURL, "http://habitat.habhub.org/habitat/_design/payload_telemetry/_update/add_listener/" );
+	Config.BatchURL[0] = '\0';
+	Config.BatchWindow = 0;
+	Config.UploadGzip = 0;
+	Config.LowLatency = 1;
+	Config.Squelch = 0;
+	Config.Signals = 1;
+	Config.InputRate = 48000;
+	Config.InputShift = 0;
+	strcpy( Config.InputFormat, "s16" );
 
 	if ( ( fp = fopen( filename, "r" ) ) == NULL ) {
 		printf( "\nFailed to open config file %s (error %d - %s).\nPlease check that it exists and has read permission.\n", filename, errno, strerror( errno ) );
@@ -276,6 +329,26 @@ void LoadConfigFile() {
 	ReadString( fp, "Altitude", Keyword, sizeof( Keyword ), 0 );
 	sscanf( Keyword, "%lf", &Config.myAlt );
 	Config.Mode = ReadInteger( fp, "Mode", 0, 0 );
+	ReadBoolean( fp, "LowLatency", 0, &Config.LowLatency );
+	ReadBoolean( fp, "Squelch", 0, &Config.Squelch );
+	Config.Signals = ReadInteger( fp, "Signals", 0, 1 );
+	Config.InputRate = ReadInteger( fp, "InputRate", 0, 48000 );
+	Config.InputShift = ReadInteger( fp, "InputShift", 0, 0 );
+	ReadString( fp, "InputFormat", Config.InputFormat, sizeof( Config.InputFormat ), 0 );
+	if ( !Config.InputFormat[0] )
+		strcpy( Config.InputFormat, "s16" );
+
+	ReadString( fp, "HabitatURL", URL, sizeof( URL ), 0 );
+	if ( URL[0] )
+		strcpy( Config.HabitatURL, URL );
+	ReadString( fp, "BatchURL", Config.BatchURL, sizeof( Config.BatchURL ), 0 );
+	Config.BatchWindow = ReadInteger( fp, "BatchWindow", 0, 0 );
+	ReadBoolean( fp, "UploadGzip", 0, &Config.UploadGzip );
+	Config.UploadConnections = ReadInteger( fp, "UploadConnections", 0, 4 );
+	ReadString( fp, "SpoolFile", Config.SpoolFile, sizeof( Config.SpoolFile ), 0 );
+	if ( !Config.SpoolFile[0] )
+		strcpy( Config.SpoolFile, "upload.spool" );
+	Config.SpoolRecords = ReadInteger( fp, "SpoolRecords", 0, 4096 );
 	for (i = 0; i < PAYLOAD_COUNT; i++) {
 		sprintf( Config.Payloads[i], "ID%d", i );
 		ReadString( fp, Config.Payloads[i], Payload, PAYLOAD_SIZE, 0);
@@ -298,7 +371,12 @@ void LogConfigFile(void) {
 		modestring = "RTTY100 7N2";
 	else if (Config.Mode == 3)
 		modestring = "RTTY300 8N2";
+	else if (Config.Mode == 4)
+		modestring = "Binary, 25Hz and RTTY100";
 	LogMessage( "Mode = %s\n", modestring );
+	if ( ( Config.BatchWindow > 0 ) && Config.BatchURL[0] )
+		LogMessage( "Upload: POST every %d ms to %s%s\n", Config.BatchWindow, Config.BatchURL,
+				Config.UploadGzip ? " (gzip)" : "" );
 
 	LogMessage("Payloads List:");
 	for (i = 0; i < PAYLOAD_COUNT; i++)
@@ -332,6 +410,9 @@ WINDOW * InitDisplay( void ) {
 
 	wrefresh( Config.Window );
 
+	Config.StatsWindow = newwin( 6, 48, 1, 36 );
+	wrefresh( Config.StatsWindow );
+
 	curs_set( 0 );
 
 	return mainwin;
@@ -415,204 +496,513 @@ uint16_t CRC16( char *ptr, size_t len ) {
 	return CRC;
 }
 
-uint8_t Message[258];
-int getPacket() {
-	int result;
-	result = horus_loop( &Message[1] );
-	if (result < 0) // EOF
+/* Turn a decoded packet into a telemetry sentence, returns 0 if it isn't one */
+int DecodePacket( uint8_t *Message, int Bytes, int mode, struct TTelemetry *t ) {
+	memset( t, 0, sizeof( struct TTelemetry ) );
+
+	if ((mode == HORUS_MODE_RTTY) || (mode == HORUS_MODE_PITS)) {	 /* UKHAS ASCII String */
+		t->Type = HORUS_MODE_RTTY;
+		snprintf( t->Sentence, sizeof( t->Sentence ), "%.*s\n", Bytes, (char *)Message );
+	} else if (Bytes == 16) {							/* Short 14 byte packet */
+		struct SBinaryPacket BinaryPacket;
+		char Data[90];
+		int position;
+	        unsigned hours, minutes, seconds;
+		int16_t user, temp, sats;
+		float volts;
+
+		t->Type = HORUS_MODE_LDPC;
+		memcpy( &BinaryPacket, Message, sizeof( BinaryPacket ) );
+		gray2bin( (uint8_t*)&BinaryPacket, sizeof BinaryPacket);
+
+		strcpy( t->Payload, Config.Payloads[0x1f & BinaryPacket.PayloadID] );
+		t->Counter = BinaryPacket.Counter;
+		t->Seconds = BinaryPacket.BiSeconds * 2;
+		hours =  (t->Seconds / 3600);
+		minutes =  (t->Seconds / 60) - (hours * 60);
+		seconds =  t->Seconds - (hours * 3600) - (minutes * 60);
+
+		position = ((int)(int8_t)BinaryPacket.Latitude[2] << 24) |
+				((uint8_t)BinaryPacket.Latitude[1] <<16) |
+				((uint8_t)BinaryPacket.Latitude[0] << 8);
+		t->Latitude = (double)position * 1.0e-7;
+		position = ((int)(int8_t)BinaryPacket.Longitude[2] << 24) |
+				((uint8_t)BinaryPacket.Longitude[1] <<16) |
+				((uint8_t)BinaryPacket.Longitude[0] << 8);
+		t->Longitude = (double)position * 1.0e-7 ;
+		t->Altitude = BinaryPacket.Altitude;
+		user = BinaryPacket.User;
+		sats = (user & 0x3) << 2;	// 0,4,8,12
+		temp = (int8_t)user >> 2;	//-32 to 31
+		volts = 5.0f / 255.0f * (float)BinaryPacket.Voltage;
+
+		{ // - Assume that checksum was confirmed by demod stage (?)
+			snprintf( Data, 90, "%s,%d,%02u:%02u:%02u,%1.5f,%1.5f,%u,0,%d,%d,%0.2f",
+					 t->Payload, t->Counter,
+					 hours, minutes, seconds,
+					 t->Latitude, t->Longitude,
+					 t->Altitude, //speed
+					 sats, temp, volts);
+			snprintf( t->Sentence, sizeof( t->Sentence ), "$$%s*%04X\n", Data, CRC16( Data, strlen( Data ) ) );
+		}
+	} else if (Bytes == 22) {							/* Horus Binary 22 byte packet */
+		struct TBinaryPacket BinaryPacket;
+		char Data[90];
+
+		t->Type = HORUS_MODE_BINARY;
+		memcpy( &BinaryPacket, Message, sizeof( BinaryPacket ) );
+
+		strcpy( t->Payload, Config.Payloads[0x1f & BinaryPacket.PayloadID] );
+
+		t->Seconds = BinaryPacket.Hours * 3600 +
+					 BinaryPacket.Minutes * 60 +
+					 BinaryPacket.Seconds;
+		t->Counter = BinaryPacket.Counter;
+#if 0
+		t->Latitude = ( 1e-7 ) * BinaryPacket.Latitude.i;
+		t->Longitude = ( 1e-7 ) * BinaryPacket.Longitude.i;
+#else
+		t->Latitude = (double)BinaryPacket.Latitude.f;
+		t->Longitude = (double)BinaryPacket.Longitude.f;
+#endif
+		t->Altitude = BinaryPacket.Altitude;
+
+		// if ( BinaryPacket.Checksum == CRC16( (char *)Message, sizeof( BinaryPacket ) - 2 ) ) {
+		{ // - Assume that checksum was confirmed by demod stage (?)
+			snprintf( Data, 90, "%s,%u,%02u:%02u:%02u,%1.5f,%1.5f,%u,%u,%u,%d,%1.2f",
+					 t->Payload,
+					 BinaryPacket.Counter,
+					 BinaryPacket.Hours,
+					 BinaryPacket.Minutes,
+					 BinaryPacket.Seconds,
+					 t->Latitude,
+					 t->Longitude,
+					 t->Altitude,
+					 BinaryPacket.Speed,
+					 BinaryPacket.Sats,
+					 BinaryPacket.Temp,
+					 5.0f / 255.0f * (float)BinaryPacket.BattVoltage );
+			snprintf( t->Sentence, sizeof( t->Sentence ), "$$%s*%04X\n", Data, CRC16( Data, strlen( Data ) ) );
+		}
+	} else
 		return 0;
-	Message[0] = (uint8_t)result;
 	return 1;
 }
 
+static double wall_now( void ) {
+	struct timespec ts;
+	clock_gettime( CLOCK_REALTIME, &ts );
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Log, upload and display one telemetry sentence, on the main thread */
+void OutputTelemetry( struct TTelemetry *t ) {
+	UpdatePayloadLOG( t->Sentence );
+	LogMessage( "%s", t->Sentence );
+	UploadTelemetryPacket( t->Sentence, (time_t)t->RxTime );
+	Config.Latency = wall_now() - t->FoundTime;
+
+	if ( t->Type == HORUS_MODE_RTTY ) {
+		ChannelPrintf( 3, 1, " RTTY  Telemetry                " );
+		// DoPositionCalcs();
+		Config.RTTYCount++;
+	} else {
+		if ( t->Type == HORUS_MODE_LDPC ) {
+			ChannelPrintf( 3, 1, " LDPC  Telemetry              " );
+			Config.LDPCCount++;
+		} else {
+			ChannelPrintf( 3, 1, "Binary Telemetry              " );
+			Config.BinaryCount++;
+		}
+		strcpy( Config.Payload, t->Payload );
+		Config.Counter = t->Counter;
+		Config.Seconds = t->Seconds;
+		Config.Latitude = t->Latitude;
+		Config.Longitude = t->Longitude;
+		Config.Altitude = t->Altitude;
+		DoPositionCalcs();
+	}
+	Config.LastPacketAt = time( NULL );
+}
+
+void StatsPrintf( int row, int column, const char *format, ... ) {
+	char Buffer[80];
+
+	va_list args;
+	va_start( args, format );
+	vsnprintf( Buffer, 48, format, args );
+	va_end( args );
+
+	mvwaddstr( Config.StatsWindow, row, column, Buffer );
+}
+
+/* queue depth, time waiting in the queue, and time busy, for each stage */
+void UpdateStats( void ) {
+	static uint64_t last_ns = 0;
+	struct spsc_stats qs;
+	uint64_t now = spsc_now_ns(), busy;
+	int i, percent;
+
+	StatsPrintf( 0, 1, "Stage   Queue  Wait ms avg   max Busy" );
+	for ( i = 0; i < STAGE_COUNT; i++ ) {
+		busy = atomic_load_explicit( &Stages[i].BusyNs, memory_order_relaxed );
+		percent = last_ns ? (int)( 100 * ( busy - Stages[i].LastBusyNs ) / ( now - last_ns + 1 ) ) : 0;
+		Stages[i].LastBusyNs = busy;
+
+		if ( Stages[i].Input == NULL ) {
+			spsc_get_stats( &audio_q, &qs );
+			StatsPrintf( i + 1, 1, "%-7s %llu blocks, %llu stalls   ", Stages[i].Name,
+					 (unsigned long long)qs.items, (unsigned long long)qs.full );
+			continue;
+		}
+		spsc_get_stats( Stages[i].Input, &qs );
+		StatsPrintf( i + 1, 1, "%-7s %2d/%-3d %9.1f %5.0f %3d%% ", Stages[i].Name,
+				 spsc_depth( Stages[i].Input ), spsc_size( Stages[i].Input ),
+				 qs.items ? 1e-6 * qs.wait_ns / qs.items : 0.0, 1e-6 * qs.wait_max_ns, percent );
+	}
+	last_ns = now;
+	wrefresh( Config.StatsWindow );
+}
+
+/* summary of the pipeline on exit */
+void PrintStats( void ) {
+	struct spsc_stats qs;
+	int i;
+
+	for ( i = STAGE_DEMOD; i < STAGE_COUNT; i++ ) {
+		spsc_get_stats( Stages[i].Input, &qs );
+		fprintf( stderr, "%-7s items %8llu  wait avg %7.2f max %7.1f ms  depth max %3d/%d  busy %7.2f s  input full %llu\n",
+				 Stages[i].Name, (unsigned long long)qs.items, qs.items ? 1e-6 * qs.wait_ns / qs.items : 0.0,
+				 1e-6 * qs.wait_max_ns, qs.depth_max, spsc_size( Stages[i].Input ),
+				 1e-9 * atomic_load( &Stages[i].BusyNs ), (unsigned long long)qs.full );
+	}
+}
+
+/* redraw screen every UI_REFRESH_MS */
+void UpdateDisplay( void ) {
+	uint32_t interval;
+	char *timescale = "s";
+
+	interval = time( NULL ) - Config.LastPacketAt;
+	if ( interval > 99 * 60 ) {
+		interval /= 60 * 60;
+		timescale = "h";
+	} else if ( interval > 99 ) {
+		interval /= 60;
+		timescale = "m";
+	}
+	ChannelPrintf(  4, 1, "%u%s since last packet, %.1fs latency   ", interval, timescale, Config.Latency );
+	ChannelPrintf(  5, 1, " RTTY  Rx: %3d   ", Config.RTTYCount );
+	ChannelPrintf(  6, 1, "Binary Rx: %3d   ", Config.BinaryCount );
+	ChannelPrintf(  7, 1, " LDPC  Rx: %3d   ", Config.LDPCCount );
+	ChannelPrintf(  8, 1, "Bad CRC: %3d, Quality: %d  ", BadCRC, Quality );
+	ChannelPrintf(  9, 1, "Est.SNR: %3d, PPM: %d    ", Config.snr, Config.ppm );
+	ChannelPrintf(  10, 1, "Uploads: %3d, Queue: %3d %4ds  ", curlUploads(), UploadQueueDepth(), UploadQueueAge() );
+	ChannelPrintf(  11, 1, "Frequency: %3d, Lost: %d   ", Config.freq, UploadDropped() );
+	ChannelPrintf(  12, 1, "%s  ", Config.Waterfall );
+	ChannelRefresh();	// redraw ncurses display
+	UpdateStats();
+}
+
+static long long ms_now( void ) {
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void stage_busy( int stage, uint64_t start ) {
+	atomic_fetch_add_explicit( &Stages[stage].BusyNs, spsc_now_ns() - start, memory_order_relaxed );
+}
+
+/* Read whole blocks of audio, a file is replayed at real time unless fast */
+static void *CaptureThread( void *arg ) {
+	uint8_t *block;
+	double next_block = ms_now();
+	long long wait;
+	int got, first = 1;
+	ssize_t n;
+
+	while ( ( block = spsc_write_wait( &audio_q ) ) ) {
+		for ( got = 0; got < blocksize; got += n ) {
+			n = read( STDIN_FILENO, &block[got], blocksize - got );
+			if ( ( n < 0 ) && ( errno == EINTR ) )
+				n = 0;
+			else if ( n <= 0 )
+				goto eof;
+		}
+		// the stream started a block before it was read, packet times count from there
+		if ( first ) {
+			horus_multi_set_start_time( hmulti, wall_now() - block_ms / 1000.0 );
+			first = 0;
+		}
+		spsc_push( &audio_q );
+
+		if ( paced ) {
+			next_block += block_ms;
+			if ( ( wait = (long long)next_block - ms_now() ) > 0 )
+				usleep( wait * 1000 );
+		}
+	}
+eof:
+	spsc_close( &audio_q );
+	return NULL;
+}
+
+/* Demodulate, and pass on the bits of each packet found */
+static void *DemodThread( void *arg ) {
+	struct horus_frame frame, *slot;
+	struct TStatus status;
+	uint64_t start;
+	uint8_t *block;
+
+	while ( ( block = spsc_read_wait( &audio_q ) ) ) {
+		start = spsc_now_ns();
+		horus_block( (short *)block, &status );
+		spsc_pop( &audio_q );
+		spsc_put( &status_q, &status, sizeof( status ) );	// display can miss one
+		stage_busy( STAGE_DEMOD, start );
+
+		while ( horus_multi_get_frame( hmulti, &frame ) ) {
+			if ( !( slot = spsc_write_wait( &frame_q ) ) )
+				break;
+			memcpy( slot, &frame, sizeof( frame ) );
+			spsc_push( &frame_q );
+		}
+	}
+	spsc_close( &frame_q );
+	return NULL;
+}
+
+static void wake_main( void ) {
+	if ( write( wake_pipe[1], "", 1 ) < 0 ) {
+		// already awake
+	}
+}
+
+/* FEC decode and check each packet, and make the telemetry sentence */
+static void *DecodeThread( void *arg ) {
+	struct horus_frame *frame;
+	struct TTelemetry t, *slot;
+	struct horus_packet_time rx;
+	uint8_t packet[256];
+	char *ascii_out;
+	uint64_t start;
+	int i, chan, mode, bad, Bytes, length = 0;
+
+	for ( i = 0; i < horus_multi_get_nchannels( hmulti ); i++ )
+		if ( horus_get_max_ascii_out_len( horus_multi_get_channel( hmulti, i ) ) > length )
+			length = horus_get_max_ascii_out_len( horus_multi_get_channel( hmulti, i ) );
+	ascii_out = (char *)malloc( length + 1 );
+
+	while ( ( frame = spsc_read_wait( &frame_q ) ) ) {
+		start = spsc_now_ns();
+		Bytes = 0;
+		chan = frame->chan;
+		mode = horus_get_mode( horus_multi_get_channel( hmulti, chan ) );
+		if ( horus_multi_decode( hmulti, frame, ascii_out, &rx ) ) {
+			/* only from a good packet, a failed frame may be another channel's noise */
+			Quality = horus_quality( horus_multi_get_channel( hmulti, chan ) );
+			if ( ( mode == HORUS_MODE_RTTY ) || ( mode == HORUS_MODE_PITS ) )
+				Bytes = snprintf( (char *)packet, sizeof( packet ), "%s", ascii_out );
+			else
+				Bytes = unpack_hexdump( ascii_out, packet );
+		}
+		spsc_pop( &frame_q );
+
+		bad = 0;
+		for ( i = 0; i < horus_multi_get_nchannels( hmulti ); i++ )
+			bad += horus_bad_crc( horus_multi_get_channel( hmulti, i ) );
+		BadCRC = bad;
+
+		if ( Bytes && DecodePacket( packet, Bytes, mode, &t ) ) {
+			t.RxTime = rx.time;
+			t.FoundTime = rx.found_time;
+			stage_busy( STAGE_DECODE, start );
+			if ( !( slot = spsc_write_wait( &packet_q ) ) )
+				break;
+			memcpy( slot, &t, sizeof( t ) );
+			spsc_push( &packet_q );
+			wake_main();
+		} else
+			stage_busy( STAGE_DECODE, start );
+	}
+	free( ascii_out );
+	spsc_close( &packet_q );
+	wake_main();
+	return NULL;
+}
+
+/* Output stage: everything decoded so far, and the latest display stats */
+static void ProcessOutput( void ) {
+	struct TTelemetry *t;
+	struct TStatus *status;
+	uint64_t start;
+
+	while ( ( t = spsc_read_slot( &packet_q ) ) ) {
+		start = spsc_now_ns();
+		OutputTelemetry( t );
+		spsc_pop( &packet_q );
+		stage_busy( STAGE_OUTPUT, start );
+	}
+
+	while ( ( status = spsc_read_slot( &status_q ) ) ) {
+		Config.freq = status->freq;
+		Config.snr = status->snr;
+		Config.ppm = status->ppm;
+		memcpy( Config.Waterfall, status->Waterfall, WATERFALL_SIZE );
+		spsc_pop( &status_q );
+	}
+}
+
 int main( int argc, char **argv ) {
-	uint8_t Bytes;
 	WINDOW * mainwin;
+	struct pollfd fds[1 + HF_MAX_SOCKETS];
+	struct stat st;
+	pthread_t capture, demod, decode;
+	sigset_t signals, old_signals;
+	int nfds, timeout, fast = 0, o, Fs, sample_bytes;
+	long long now, next_redraw;
+	char drain[64];
+
+	static struct option long_opts[] = {
+		{"fast", no_argument, 0, 'f'},
+		{"help", no_argument, 0, 'h'},
+		{0, 0, 0, 0}
+	};
+
+	while ( ( o = getopt_long( argc, argv, "hqf", long_opts, NULL ) ) != -1 ) {
+		switch(o) {
+		case 'q':
+			audioIQ = 1;
+			break;
+		case 'f':
+			fast = 1;
+			break;
+		default:
+		case 'h':
+			fprintf(stderr, "Horus Binary Gateway based on LoRa version.\n");
+			fprintf(stderr, "\tUsage: \"cat S16LE_48K.wav | gateway\"\n");
+			fprintf(stderr, "\t       \"  (resample audio to 48kHz)\"\n");
+			fprintf(stderr, "\tOption: [-q] uses stereo (iq) input.\n");
+			fprintf(stderr, "\tOption: [-f|--fast] reads a file as fast as possible, not at real time.\n");
+			fprintf(stderr, "\tConfig: Edit \"gateway.txt\" file.\n\n");
+			exit(0);
+		}
+	}
 
-	int o = getopt(argc,argv,"hq");
-	switch(o) {
-	case -1:
-		break;
-	case 'q':
-		audioIQ = 1;
-		break;
-	default:
-	case 'h':
-		fprintf(stderr, "Horus Binary Gateway based on LoRa version.\n");
-		fprintf(stderr, "\tUsage: \"cat S16LE_48K.wav | gateway\"\n");
-		fprintf(stderr, "\t       \"  (resample audio to 48kHz)\"\n");
-		fprintf(stderr, "\tOption: [-q] uses stereo (iq) input.\n");
-		fprintf(stderr, "\tConfig: Edit \"gateway.txt\" file.\n\n");
-		exit(0);
-	}
-
-	Message[0] = 0;
 	LoadConfigFile();
 
 	if (!horus_init(Config.Mode))
 		return -22;
+	horus_multi_set_deferred( hmulti, 1 );
+
+	/* audio is read in whole blocks, a file on stdin is replayed at real time unless fast */
+	Fs = horus_get_Fs( horus_multi_get_channel( hmulti, 0 ) );
+	if ( !strcmp( Config.InputFormat, "u8" ) ) {
+		input_format = HORUS_FORMAT_U8_IQ;
+		sample_bytes = 2;
+	} else if ( !strcmp( Config.InputFormat, "f32" ) ) {
+		input_format = audioIQ ? HORUS_FORMAT_F32_IQ : HORUS_FORMAT_F32;
+		sample_bytes = sizeof( float ) * ( audioIQ ? 2 : 1 );
+	} else {
+		input_format = audioIQ ? HORUS_FORMAT_S16_IQ : HORUS_FORMAT_S16;
+		sample_bytes = sizeof( short ) * ( audioIQ ? 2 : 1 );
+	}
+	push_input = ( input_format > HORUS_FORMAT_S16_IQ ) || ( Config.InputRate != Fs ) || Config.InputShift;
+	input_samples = (int)( (long long)horus_multi_nin( hmulti ) * Config.InputRate / Fs );
+	blocksize = input_samples * sample_bytes;
+	paced = !fast && !fstat( STDIN_FILENO, &st ) && S_ISREG( st.st_mode );
+	block_ms = 1000.0 * input_samples / Config.InputRate;
+
+	if ( !spsc_init( &audio_q, AUDIO_QUEUE, blocksize ) || !spsc_init( &frame_q, FRAME_QUEUE, sizeof( struct horus_frame ) )
+			|| !spsc_init( &packet_q, PACKET_QUEUE, sizeof( struct TTelemetry ) )
+			|| !spsc_init( &status_q, STATUS_QUEUE, sizeof( struct TStatus ) ) || pipe( wake_pipe ) )
+		return -12;
+	fcntl( wake_pipe[0], F_SETFL, O_NONBLOCK );
+	fcntl( wake_pipe[1], F_SETFL, O_NONBLOCK );
 
 	fprintf(stderr, "Usage: \"cat S16LE_48K.wav | gateway\" (use audio at 48kHz)\n");
 	fprintf(stderr, "Press Control-C to Quit, if there is no input file.\n");
-	if (!getPacket())
-		exit(0);  // supplied file shorter than 1s ?
 
-	curlInit();
+	curlInit( Config.UploadConnections );
 	mainwin = InitDisplay();
 	LogConfigFile(); // Cannot display results before this
+	UploadInit();
+
+	/* Control-C is handled on the main thread */
+	sigemptyset( &signals );
+	sigaddset( &signals, SIGINT );
+	sigaddset( &signals, SIGTERM );
+	pthread_sigmask( SIG_BLOCK, &signals, &old_signals );
+	pthread_create( &capture, NULL, CaptureThread, NULL );
+	pthread_create( &demod, NULL, DemodThread, NULL );
+	pthread_create( &decode, NULL, DecodeThread, NULL );
+	pthread_sigmask( SIG_SETMASK, &old_signals, NULL );
 
 	Config.LastPacketAt = time( NULL );
-	while ( getPacket() && !curl_terminated() )
+	next_redraw = ms_now();
+	while ( !curl_terminated() )
 	{
-		Bytes = Message[0];
-		Message[0] = 0;
-		if ( Bytes ) {
-			if ((horus_mode == HORUS_MODE_RTTY) || (horus_mode == HORUS_MODE_PITS)) {	 /* UKHAS ASCII String */
-				char *Sentence = (char *)&Message[1];
-				Sentence[Bytes] = 0;
-				UpdatePayloadLOG( Sentence );
-				LogMessage( "%s", Sentence );
-				UploadTelemetryPacket( Sentence );
-				// DoPositionCalcs();
-				ChannelPrintf( 3, 1, " RTTY  Telemetry                " );
-				Config.RTTYCount++;
-			} else if (Bytes == 16) {							/* Short 14 byte packet */
-				struct SBinaryPacket BinaryPacket;
-				char Data[90], Sentence[100];
-				int position;
-			        unsigned hours, minutes, seconds;
-				int16_t user, temp, sats;
-				float volts;
-
-				ChannelPrintf( 3, 1, " LDPC  Telemetry              " );
-				memcpy( &BinaryPacket, &Message[1], sizeof( BinaryPacket ) );
-				gray2bin( (uint8_t*)&BinaryPacket, sizeof BinaryPacket);
-
-				strcpy( Config.Payload, Config.Payloads[0x1f & BinaryPacket.PayloadID] );
-				Config.Counter = BinaryPacket.Counter;
-				Config.Seconds = BinaryPacket.BiSeconds * 2;
-				hours =  (Config.Seconds / 3600);
-				minutes =  (Config.Seconds / 60) - (hours * 60);
-				seconds =  Config.Seconds - (hours * 3600) - (minutes * 60);
-
-				position = ((int)(int8_t)BinaryPacket.Latitude[2] << 24) |
-						((uint8_t)BinaryPacket.Latitude[1] <<16) |
-						((uint8_t)BinaryPacket.Latitude[0] << 8);
-				Config.Latitude = (double)position * 1.0e-7;
-				position = ((int)(int8_t)BinaryPacket.Longitude[2] << 24) |
-						((uint8_t)BinaryPacket.Longitude[1] <<16) |
-						((uint8_t)BinaryPacket.Longitude[0] << 8);
-				Config.Longitude = (double)position * 1.0e-7 ;
-				Config.Altitude = BinaryPacket.Altitude;
-				user = BinaryPacket.User;
-				sats = (user & 0x3) << 2;	// 0,4,8,12
-				temp = (int8_t)user >> 2;	//-32 to 31
-				volts = 5.0f / 255.0f * (float)BinaryPacket.Voltage;
-
-				{ // - Assume that checksum was confirmed by demod stage (?)
-					snprintf( Data, 90, "%s,%d,%02u:%02u:%02u,%1.5f,%1.5f,%u,0,%d,%d,%0.2f",
-							 Config.Payload, Config.Counter,
-							 hours, minutes, seconds,
-							 Config.Latitude, Config.Longitude,
-							 Config.Altitude, //speed
-							 sats, temp, volts);
-					snprintf( Sentence, 100, "$$%s*%04X\n", Data, CRC16( Data, strlen( Data ) ) );
-				}
-
-				LogMessage( "%s", Sentence );
-				UploadTelemetryPacket( Sentence );
-				UpdatePayloadLOG( Sentence );
-				DoPositionCalcs();
-				Config.LDPCCount++;
-
-			} else if (Bytes == 22) {							/* Horus Binary 22 byte packet */
-				struct TBinaryPacket BinaryPacket;
-				char Data[90], Sentence[100];
-
-				ChannelPrintf( 3, 1, "Binary Telemetry              " );
-				memcpy( &BinaryPacket, &Message[1], sizeof( BinaryPacket ) );
-
-				strcpy( Config.Payload, Config.Payloads[0x1f & BinaryPacket.PayloadID] );
-
-				Config.Seconds = BinaryPacket.Hours * 3600 +
-								 BinaryPacket.Minutes * 60 +
-								 BinaryPacket.Seconds;
-				Config.Counter = BinaryPacket.Counter;
-#if 0
-				Config.Latitude = ( 1e-7 ) * BinaryPacket.Latitude.i;
-				Config.Longitude = ( 1e-7 ) * BinaryPacket.Longitude.i;
-#else
-				Config.Latitude = (double)BinaryPacket.Latitude.f;
-				Config.Longitude = (double)BinaryPacket.Longitude.f;
-#endif
-				Config.Altitude = BinaryPacket.Altitude;
-
-				// if ( BinaryPacket.Checksum == CRC16( (char *)&Message[1], sizeof( BinaryPacket ) - 2 ) ) {
-				{ // - Assume that checksum was confirmed by demod stage (?)
-					sprintf( Data, "%s,%u,%02u:%02u:%02u,%1.5f,%1.5f,%u,%u,%u,%d,%1.2f",
-							 Config.Payload,
-							 BinaryPacket.Counter,
-							 BinaryPacket.Hours,
-							 BinaryPacket.Minutes,
-							 BinaryPacket.Seconds,
-							 Config.Latitude,
-							 Config.Longitude,
-							 Config.Altitude,
-							 BinaryPacket.Speed,
-							 BinaryPacket.Sats,
-							 BinaryPacket.Temp,
-							 5.0f / 255.0f * (float)BinaryPacket.BattVoltage );
-					snprintf( Sentence, 100, "$$%s*%04X\n", Data, CRC16( Data, strlen( Data ) ) );
-
-					UploadTelemetryPacket( Sentence );
-					DoPositionCalcs();
-					Config.BinaryCount++;
-#if 0
-					sprintf( Sentence + strlen( Sentence ),
-							 "\tStats:%1.1lf,%1.1lf,%d,%d\n",
-							 Config.Distance,
-							 Config.Elevation,
-							 Config.rssi,
-							 Config.snr );
-#endif
-					UpdatePayloadLOG( Sentence );
-					LogMessage( "%s", Sentence );
-				}
-			}
-			Config.LastPacketAt = time( NULL );
-		}
+		now = ms_now();
+
+		/* wait for a packet, curl sockets, or the next redraw */
+		fds[0].fd = wake_pipe[0];
+		fds[0].events = POLLIN;
+		fds[0].revents = 0;
+		nfds = 1 + curlPollFds( &fds[1], HF_MAX_SOCKETS );
+
+		timeout = next_redraw - now;
+		if ( ( curlTimeout() >= 0 ) && ( curlTimeout() < timeout ) )
+			timeout = curlTimeout();
+		if ( timeout < 0 )
+			timeout = 0;
 
-		// redraw screen every second (horus loop rate)
-		uint32_t interval;
-		char *timescale = "s";
-
-		interval = time( NULL ) - Config.LastPacketAt;
-		if ( interval > 99 * 60 ) {
-			interval /= 60 * 60;
-			timescale = "h";
-		} else if ( interval > 99 ) {
-			interval /= 60;
-			timescale = "m";
+		if ( ( poll( fds, nfds, timeout ) < 0 ) && ( errno != EINTR ) )
+			break;
+
+		if ( fds[0].revents & POLLIN )
+			while ( read( wake_pipe[0], drain, sizeof( drain ) ) > 0 )
+				;
+
+		ProcessOutput();
+		if ( spsc_closed( &packet_q ) && !spsc_read_slot( &packet_q ) )
+			break;	// end of input has passed through the pipeline
+
+		curlEvents( &fds[1], nfds - 1 );
+		UploadTelemetryFlush( 0 );	// send batch when window has passed
+
+		if ( ms_now() >= next_redraw ) {
+			UpdateDisplay();
+			next_redraw = ms_now() + UI_REFRESH_MS;
 		}
-		ChannelPrintf(  4, 1, "%u%s since last packet   ", interval, timescale );
-		ChannelPrintf(  5, 1, " RTTY  Rx: %3d   ", Config.RTTYCount );
-		ChannelPrintf(  6, 1, "Binary Rx: %3d   ", Config.BinaryCount );
-		ChannelPrintf(  7, 1, " LDPC  Rx: %3d   ", Config.LDPCCount );
-		ChannelPrintf(  8, 1, "Bad CRC: %3d, Quality: %d  ", horus_bad_crc(), horus_quality() );
-		ChannelPrintf(  9, 1, "Est.SNR: %3d, PPM: %d    ", Config.snr, Config.ppm );
-		ChannelPrintf(  10, 1, "Uploads: %3d     ", curlUploads() );
-		ChannelPrintf(  11, 1, "Frequency: %3d   ", Config.freq );
-		ChannelPrintf(  12, 1, "%s  ", Config.Waterfall );
-		ChannelRefresh();	// redraw ncurses display
-		curlPush();		// Upload now
-		usleep( 200 * 1000 );	// short delay in case reading from file
 	}
 
 	LogMessage("Shutting down.\n");
-	curlPush();		// Upload now
-	usleep( 1500 * 1000 );	// very short delay for uploads
+	if ( curl_terminated() ) {
+		// stop the capture, the other stages finish what is queued
+		pthread_cancel( capture );
+		spsc_close( &audio_q );
+		spsc_close( &frame_q );
+		spsc_close( &packet_q );
+	}
+	pthread_join( capture, NULL );
+	pthread_join( demod, NULL );
+	pthread_join( decode, NULL );
+	ProcessOutput();
+
+	UploadTelemetryFlush( 1 );
+	// short wait for uploads, anything unfinished stays in the spool
+	for ( int i = 0; i < 30 && curlActive(); i++ ) {
+		curlWait( 100 );
+	}
 	CloseDisplay( mainwin );
+	PrintStats();
 	curlClean();
+	UploadClean();
 	horus_exit();
+	spsc_free( &audio_q );
+	spsc_free( &frame_q );
+	spsc_free( &packet_q );
+	spsc_free( &status_q );
 	return 0;
 }
@@ -20,23 +20,38 @@
 #include <time.h>
 #include <stdarg.h>
 #include <curses.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
 #include <math.h>
 
 #include "hiperfifo.h"
 #include "utils.h"
+#include "spsc.h"
 
 #define WATERFALL_SHOW  40 /* chars to display */
 #define WATERFALL_SIZE  64 /* size of buffer   */
 #define PAYLOAD_COUNT 32
+#define UI_REFRESH_MS 250  /* display redraw interval */
+#define AUDIO_QUEUE   64   /* pipeline queues, in items */
+#define FRAME_QUEUE   16
+#define PACKET_QUEUE  32
+#define STATUS_QUEUE  8
 #define PAYLOAD_SIZE  16
 
 struct TConfig
 {
 	char Tracker[16];
-	int EnableHabitat, EnableSSDV, Mode;
+	int EnableHabitat, EnableSSDV, Mode, LowLatency, Squelch, Signals;
+	int InputRate, InputShift;
+	char InputFormat[8];
+	char HabitatURL[128], BatchURL[128];
+	int BatchWindow, UploadGzip, UploadConnections;
+	char SpoolFile[128];
+	int SpoolRecords;
 	double myLat, myLon, myAlt;
 
-	WINDOW *Window;
+	WINDOW *Window, *StatsWindow;
 
 	unsigned int BinaryCount, LDPCCount, RTTYCount;
 	unsigned int BadCRCCount, UnknownCount;
@@ -45,12 +60,33 @@ struct TConfig
 	double Longitude, Latitude, Distance, Elevation;
 	unsigned int Altitude, PreviousAltitude, Satellites;
 	time_t LastPacketAt;
+	double Latency;			/* from the end of the last packet's audio to its output */
 	int rssi, snr, ppm, freq;
 	char Payloads[PAYLOAD_COUNT][PAYLOAD_SIZE];
 	char Waterfall[WATERFALL_SIZE];
 };
 extern struct TConfig Config;
 
+/* a decoded packet, passed from the decode stage to the output stage */
+struct TTelemetry
+{
+	int Type;			/* HORUS_MODE_RTTY, _BINARY or _LDPC */
+	char Sentence[256];
+	char Payload[PAYLOAD_SIZE];
+	uint32_t Counter, Seconds;
+	double Latitude, Longitude;
+	unsigned int Altitude;
+	double RxTime;			/* wall clock of the start of the packet */
+	double FoundTime;		/* and of the end of the audio it was found in */
+};
+
+/* modem stats for the display, from the demod stage */
+struct TStatus
+{
+	int snr, ppm, freq;
+	char Waterfall[WATERFALL_SIZE];
+};
+
 #pragma pack(push,1) 
 struct TBinaryPacket
 {
@@ -126,10 +126,12 @@ static int golay23_decode_no_tables(int c) {
 }
 #endif
 
+/* only builds the tables once, call before starting any threads */
 void golay23_init(void) {
 #ifdef RUN_TIME_TABLES
     int x, y, z;
-    inited = 1;
+    if (inited)
+        return;
     for (x = 0; x < 4096; x++) {
         encoding_table[x] = golay23_encode_no_tables(x);
     }
@@ -156,6 +158,7 @@ void golay23_init(void) {
             }
         }
     }
+    inited = 1;
 #endif
 }
 
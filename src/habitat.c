@@ -14,15 +14,13 @@
 #include <dirent.h>
 #include <math.h>
 #include <time.h>
+#include <sys/time.h>
 #include <curl/curl.h>
+#include <zlib.h>
 
 #include "global.h"
 #include "hiperfifo.h"
-
-size_t habitat_write_data( void *buffer, size_t size, size_t nmemb, void *userp ) {
-	// LogMessage("%s\n", (char *)buffer);
-	return size * nmemb;
-}
+#include "spool.h"
 
 void hash_to_hex( unsigned char *hash, char *line ) {
 	int idx;
@@ -36,80 +34,269 @@ void hash_to_hex( unsigned char *hash, char *line ) {
 	// LogMessage(line);
 }
 
-void UploadTelemetryPacket( char *Telemetry ) {
-	CURL *curl;
+/* Telemetry is kept in the spool until its upload is confirmed */
+static struct spool *spool = NULL;
+
+/* batch window starts when a new sentence arrives */
+static struct timeval batch_start;
+static int batch_waiting = 0;
+
+/* Uploads in flight, and the spool records they carry */
+#define UPLOAD_ACTIVE_MAX 20
+#define BATCH_RECORDS     64
+#define BATCH_SIZE        32768
+struct upload_job {
+	int count;
+	uint32_t seq[BATCH_RECORDS];
+};
 
+void UploadInit( void ) {
 	if ( !Config.EnableHabitat ) {
 		return;
 	}
 
-	if ( strlen( Telemetry ) > 160 ) {
-		return;
+	spool = spool_open( Config.SpoolFile, Config.SpoolRecords );
+	if ( !spool ) {
+		LogMessage( "Cannot open spool %s, uploads are not kept over restarts\n", Config.SpoolFile );
+		spool = spool_open( NULL, Config.SpoolRecords );
+	} else if ( spool_depth( spool ) ) {
+		LogMessage( "Replaying %d queued uploads\n", spool_depth( spool ) );
+	}
+}
+
+void UploadClean( void ) {
+	spool_close( spool );
+	spool = NULL;
+}
+
+int UploadQueueDepth( void ) {
+	return spool ? spool_depth( spool ) : 0;
+}
+
+int UploadQueueAge( void ) {
+	return spool ? spool_oldest_age( spool, time( NULL ) ) : 0;
+}
+
+int UploadDropped( void ) {
+	return spool ? spool_dropped( spool ) : 0;
+}
+
+/* Create the habitat listener json for a sentence, and its document ID */
+static void telemetry_json( const char *Telemetry, time_t created, char *doc_id, char *json, int json_size, int with_id ) {
+	char base64_data[300];
+	size_t base64_length;
+	SHA256_CTX ctx;
+	unsigned char hash[32];
+	char then[32], now[32];
+	time_t rawtime;
+
+	// Get formatted timestamps, of reception and upload
+	strftime( then, sizeof( then ), "%Y-%0m-%0dT%H:%M:%SZ", gmtime( &created ) );
+	time( &rawtime );
+	strftime( now, sizeof( now ), "%Y-%0m-%0dT%H:%M:%SZ", gmtime( &rawtime ) );
+
+	// Convert sentence to base64
+	base64_encode( (uint8_t *)Telemetry, strlen( Telemetry ), &base64_length, base64_data );
+	base64_data[base64_length] = '\0';
+
+	// Take SHA256 hash of the base64 version and express as hex.  This will be the document ID
+	sha256_init( &ctx );
+	sha256_update( &ctx, (uint8_t *)base64_data, base64_length );
+	sha256_final( &ctx, (uint8_t *)hash );
+	hash_to_hex( hash, doc_id );
+
+	// Create json with the base64 data in hex, the tracker callsign and the timestamps
+	snprintf( json, json_size,
+			  "{%s%s%s\"data\": {\"_raw\": \"%s\"},\"receivers\": {\"%s\": {\"time_created\": \"%s\",\"time_uploaded\": \"%s\"}}}",
+			  with_id ? "\"_id\": \"" : "",
+			  with_id ? doc_id : "",
+			  with_id ? "\"," : "",
+			  base64_data,
+			  Config.Tracker,
+			  then,
+			  now );
+}
+
+/* gzip a request body, returns the compressed length or -1 */
+static int gzip_body( char *in, int length, char *out, int out_size ) {
+	z_stream zs;
+	int rc;
+
+	memset( &zs, 0, sizeof( zs ) );
+	// windowBits + 16 writes a gzip header, rather than zlib
+	if ( deflateInit2( &zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY ) != Z_OK )
+		return -1;
+
+	zs.next_in = (Bytef *)in;
+	zs.avail_in = length;
+	zs.next_out = (Bytef *)out;
+	zs.avail_out = out_size;
+	rc = deflate( &zs, Z_FINISH );
+	length = zs.total_out;
+	deflateEnd( &zs );
+
+	return ( rc == Z_STREAM_END ) ? length : -1;
+}
+
+/* Upload finished: done, or back off and try again later.
+   A couchDB merge conflict (409) is retried at once. */
+static void upload_done( void *user, CURLcode res, long response ) {
+	struct upload_job *job = (struct upload_job *)user;
+	time_t now = time( NULL );
+	int i;
+
+	for ( i = 0; i < job->count; i++ ) {
+		if ( !spool ) {
+			break;
+		}
+		if ( res == CURLE_OK ) {
+			spool_done( spool, job->seq[i] );
+		} else {
+			spool_failed( spool, job->seq[i], now, response != 409 );
+		}
+	}
+	free( job );
+}
+
+/* POST a JSON array of the records that are due, returns the number sent */
+static int upload_batch( time_t now ) {
+	static char batch[BATCH_SIZE], gzipped[BATCH_SIZE + 64];
+	struct upload_job *job;
+	CURL *curl;
+	char doc_id[68], json[640];
+	uint32_t seq = 0;
+	int batch_len = 0, length;
+
+	job = (struct upload_job *)malloc( sizeof( struct upload_job ) );
+	if ( !job ) {
+		return 0;
 	}
+	job->count = 0;
 
-	/* get a curl handle */
-	curl = curl_easy_init();
-	if ( curl ) {
-		int length;
-		char url[150];
-		char base64_data[300];
-		size_t base64_length;
-		SHA256_CTX ctx;
-		unsigned char hash[32];
-		char doc_id[68];
-		char json[500], now[32];
-		time_t rawtime;
-		struct tm *tm;
-
-		// Get formatted timestamp
-		time( &rawtime );
-		tm = gmtime( &rawtime );
-		strftime( now, sizeof( now ), "%Y-%0m-%0dT%H:%M:%SZ", tm );
-
-		// So that the response to the curl PUT doesn't mess up my finely crafted display!
-		curl_easy_setopt( curl, CURLOPT_WRITEFUNCTION, habitat_write_data );
-
-		// Set the timeout
-		curl_easy_setopt( curl, CURLOPT_TIMEOUT, 30 );
-
-		// Avoid curl library bug that happens if above timeout occurs (sigh)
-		curl_easy_setopt( curl, CURLOPT_NOSIGNAL, 1 );
-
-		// Fail on http error 40x
-		curl_easy_setopt( curl, CURLOPT_FAILONERROR, 1 );
-
-		// Convert sentence to base64
-		length = strlen( Telemetry );
-		base64_encode( (uint8_t *)Telemetry, length, &base64_length, base64_data );
-		base64_data[base64_length] = '\0';
-
-		// Take SHA256 hash of the base64 version and express as hex.  This will be the document ID
-		sha256_init( &ctx );
-		sha256_update( &ctx, (uint8_t *)base64_data, base64_length );
-		sha256_final( &ctx, (uint8_t *)hash );
-		hash_to_hex( hash, doc_id );
-
-		// Create json with the base64 data in hex, the tracker callsign and the current timestamp
-		snprintf( json, sizeof( json ),
-				  "{\"data\": {\"_raw\": \"%s\"},\"receivers\": {\"%s\": {\"time_created\": \"%s\",\"time_uploaded\": \"%s\"}}}",
-				  base64_data,
-				  Config.Tracker,
-				  now,
-				  now );
-		// printf("\njson:%s\n",json);
-
-		// Set the URL that is about to receive our PUT
-		snprintf( url, sizeof( url ), "http://habitat.habhub.org/habitat/_design/payload_telemetry/_update/add_listener/%s", doc_id );
-
-		// PUT to http://habitat.habhub.org/habitat/_design/payload_telemetry/_update/add_listener/<doc_id>
-		//	with content-type application/json
+	while ( ( job->count < BATCH_RECORDS ) && !spool_next_due( spool, now, seq, &seq ) ) {
+		telemetry_json( spool_text( spool, seq ), spool_created( spool, seq ), doc_id, json, sizeof( json ), 1 );
+		length = strlen( json );
+		if ( batch_len + length + 2 >= BATCH_SIZE ) {
+			break;
+		}
+		batch[batch_len++] = job->count ? ',' : '[';
+		memcpy( &batch[batch_len], json, length );
+		batch_len += length;
+		job->seq[job->count++] = seq;
+	}
+
+	curl = job->count ? curlHandle() : NULL;
+	if ( !curl ) {
+		free( job );
+		return 0;
+	}
+
+	batch[batch_len++] = ']';
+	batch[batch_len] = '\0';
+
+	curl_easy_setopt( curl, CURLOPT_URL, Config.BatchURL );
+	curl_easy_setopt( curl, CURLOPT_POST, 1 );
+
+	length = Config.UploadGzip ? gzip_body( batch, batch_len, gzipped, sizeof( gzipped ) ) : -1;
+	if ( length > 0 ) {
+		curl_easy_setopt( curl, CURLOPT_HTTPHEADER, slist_gzip_headers );
+		curl_easy_setopt( curl, CURLOPT_POSTFIELDSIZE, (long)length );
+		curl_easy_setopt( curl, CURLOPT_COPYPOSTFIELDS, gzipped );
+	} else {
 		curl_easy_setopt( curl, CURLOPT_HTTPHEADER, slist_headers );
-		curl_easy_setopt( curl, CURLOPT_URL, url );
-		curl_easy_setopt( curl, CURLOPT_CUSTOMREQUEST, "PUT" );
-		curl_easy_setopt( curl, CURLOPT_COPYPOSTFIELDS, json );
+		curl_easy_setopt( curl, CURLOPT_POSTFIELDSIZE, (long)batch_len );
+		curl_easy_setopt( curl, CURLOPT_COPYPOSTFIELDS, batch );
+	}
+
+	for ( length = 0; length < job->count; length++ ) {
+		spool_inflight( spool, job->seq[length] );
+	}
+	curlQueue( curl, upload_done, job );
+	return job->count;
+}
+
+/* PUT one record, returns 1 if sent */
+static int upload_single( time_t now ) {
+	struct upload_job *job;
+	CURL *curl;
+	char url[250];
+	char doc_id[68];
+	char json[640];
+	uint32_t seq;
+
+	if ( spool_next_due( spool, now, 0, &seq ) ) {
+		return 0;
+	}
+	job = (struct upload_job *)malloc( sizeof( struct upload_job ) );
+	curl = job ? curlHandle() : NULL;
+	if ( !curl ) {
+		free( job );
+		return 0;
+	}
+	job->count = 1;
+	job->seq[0] = seq;
+
+	telemetry_json( spool_text( spool, seq ), spool_created( spool, seq ), doc_id, json, sizeof( json ), 0 );
+	// printf("\njson:%s\n",json);
+
+	// Set the URL that is about to receive our PUT
+	snprintf( url, sizeof( url ), "%s%s", Config.HabitatURL, doc_id );
 
-		// cleanup later
-		curlQueue( curl );
+	// PUT to http://habitat.habhub.org/habitat/_design/payload_telemetry/_update/add_listener/<doc_id>
+	//	with content-type application/json
+	curl_easy_setopt( curl, CURLOPT_HTTPHEADER, slist_headers );
+	curl_easy_setopt( curl, CURLOPT_URL, url );
+	curl_easy_setopt( curl, CURLOPT_CUSTOMREQUEST, "PUT" );
+	curl_easy_setopt( curl, CURLOPT_COPYPOSTFIELDS, json );
+
+	spool_inflight( spool, seq );
+	curlQueue( curl, upload_done, job );
+	return 1;
+}
+
+/* Start uploads of the spooled telemetry that is due.  New sentences wait
+   for the batch window to pass, unless force is set. */
+void UploadTelemetryFlush( int force ) {
+	struct timeval tv;
+	long elapsed;
+	time_t now;
+
+	if ( !spool ) {
+		return;
 	}
 
+	gettimeofday( &tv, NULL );
+	now = tv.tv_sec;
+
+	if ( ( Config.BatchWindow > 0 ) && Config.BatchURL[0] ) {
+		if ( batch_waiting && !force ) {
+			elapsed = ( tv.tv_sec - batch_start.tv_sec ) * 1000 + ( tv.tv_usec - batch_start.tv_usec ) / 1000;
+			if ( elapsed < Config.BatchWindow ) {
+				return;
+			}
+		}
+		batch_waiting = 0;
+		while ( ( curlActive() < UPLOAD_ACTIVE_MAX ) && upload_batch( now ) )
+			;
+	} else {
+		while ( ( curlActive() < UPLOAD_ACTIVE_MAX ) && upload_single( now ) )
+			;
+	}
+}
+
+void UploadTelemetryPacket( char *Telemetry, time_t created ) {
+	if ( !Config.EnableHabitat || !spool ) {
+		return;
+	}
+
+	if ( strlen( Telemetry ) > 160 ) {
+		return;
+	}
+
+	spool_append( spool, Telemetry, created );
+	if ( !batch_waiting ) {
+		gettimeofday( &batch_start, NULL );
+		batch_waiting = 1;
+	}
+	UploadTelemetryFlush( 0 );
 }
@@ -33,10 +33,35 @@
 #include <signal.h>
 
 #include "hiperfifo.h"
+#include "utils.h"
 
 CURLM *multi;
-struct curl_slist *slist_headers;
+struct curl_slist *slist_headers, *slist_gzip_headers;
 int running, uploads, retries, curl409;
+static int active;
+
+/* sockets and timeout that curl asks to be watched, for the caller's poll() */
+static struct {
+	curl_socket_t fd;
+	int what;
+} socks[HF_MAX_SOCKETS];
+static int nsocks;
+static long long timer_deadline = -1;	/* ms, monotonic clock */
+
+/* completion callback of a queued transfer */
+struct curl_job {
+	curl_done_fn done;
+	void *user;
+	CURL *easy;
+	int failed;
+	struct curl_job *next;		/* failed, to be removed */
+};
+static struct curl_job *failed_jobs;
+
+/* finished easy handles are kept for reuse, along with their connections */
+#define POOL_MAX 16
+static CURL *pool[POOL_MAX];
+static int pooled, pool_size;
 
 volatile int curl_terminate = 0;
 int curl_terminated(void) {
@@ -61,19 +86,117 @@ static void signal_handler( int sig ) {
 		exit(0);
 }
 
-void curlInit() {
+static long long ms_now( void ) {
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* CURLMOPT_SOCKETFUNCTION: keep the table of sockets to poll */
+static int sock_cb( CURL *easy, curl_socket_t s, int what, void *userp, void *socketp ) {
+	struct curl_job *job = NULL;
+	int i;
+
+	for ( i = 0; i < nsocks; i++ )
+		if ( socks[i].fd == s )
+			break;
+
+	if ( what == CURL_POLL_REMOVE ) {
+		if ( i < nsocks )
+			socks[i] = socks[--nsocks];
+	} else if ( i < nsocks ) {
+		socks[i].what = what;
+	} else if ( nsocks < HF_MAX_SOCKETS ) {
+		socks[nsocks].fd = s;
+		socks[nsocks++].what = what;
+	} else {
+		/* it would never be polled, and the transfer would hang, so it is
+		   failed once curl has returned */
+		curl_easy_getinfo( easy, CURLINFO_PRIVATE, (char **)&job );
+		if ( job && !job->failed ) {
+			LogMessage( "More than %d upload sockets, failing a transfer\n", HF_MAX_SOCKETS );
+			job->failed = 1;
+			job->next = failed_jobs;
+			failed_jobs = job;
+		}
+	}
+	return 0;
+}
+
+/* CURLMOPT_TIMERFUNCTION: curl wants a call after timeout_ms, or never if -1 */
+static int timer_cb( CURLM *m, long timeout_ms, void *userp ) {
+	timer_deadline = ( timeout_ms < 0 ) ? -1 : ms_now() + timeout_ms;
+	return 0;
+}
+
+/* connections is the number of keep-alive connections, and pooled easy handles */
+void curlInit( int connections ) {
 	curl_terminate = 0;
 	signal( SIGINT, signal_handler );
 	signal( SIGTERM, signal_handler );
 
+	if ( connections < 1 )
+		connections = 1;
+	if ( connections > POOL_MAX )
+		connections = POOL_MAX;
+	pool_size = connections;
+	pooled = 0;
+
 	curl_global_init( CURL_GLOBAL_ALL );
 	multi = curl_multi_init();
-	running = uploads = retries = curl409 = 0;
+	running = uploads = retries = curl409 = active = 0;
+
+	/* queue transfers on the open connections, rather than opening more */
+	curl_multi_setopt( multi, CURLMOPT_MAX_HOST_CONNECTIONS, (long)connections );
+	curl_multi_setopt( multi, CURLMOPT_MAXCONNECTS, (long)connections );
+
+	nsocks = 0;
+	failed_jobs = NULL;
+	timer_deadline = -1;
+	curl_multi_setopt( multi, CURLMOPT_SOCKETFUNCTION, sock_cb );
+	curl_multi_setopt( multi, CURLMOPT_TIMERFUNCTION, timer_cb );
 
 	slist_headers = NULL;
 	slist_headers = curl_slist_append( slist_headers, "Accept: application/json" );
 	slist_headers = curl_slist_append( slist_headers, "Content-Type: application/json" );
 	slist_headers = curl_slist_append( slist_headers, "charsets: utf-8" );
+
+	slist_gzip_headers = NULL;
+	slist_gzip_headers = curl_slist_append( slist_gzip_headers, "Accept: application/json" );
+	slist_gzip_headers = curl_slist_append( slist_gzip_headers, "Content-Type: application/json" );
+	slist_gzip_headers = curl_slist_append( slist_gzip_headers, "Content-Encoding: gzip" );
+}
+
+static size_t discard_data( void *buffer, size_t size, size_t nmemb, void *userp ) {
+	return size * nmemb;
+}
+
+/* Get an easy handle from the pool, with the options common to all uploads */
+CURL *curlHandle( void ) {
+	CURL *easy;
+
+	easy = pooled ? pool[--pooled] : curl_easy_init();
+	if ( !easy )
+		return NULL;
+
+	// So that the response doesn't mess up the display
+	curl_easy_setopt( easy, CURLOPT_WRITEFUNCTION, discard_data );
+	curl_easy_setopt( easy, CURLOPT_TIMEOUT, 30 );
+	// Avoid curl library bug that happens if above timeout occurs (sigh)
+	curl_easy_setopt( easy, CURLOPT_NOSIGNAL, 1 );
+	// Fail on http error 40x
+	curl_easy_setopt( easy, CURLOPT_FAILONERROR, 1 );
+	curl_easy_setopt( easy, CURLOPT_TCP_KEEPALIVE, 1 );
+	return easy;
+}
+
+/* Return an easy handle to the pool */
+static void curlRelease( CURL *easy ) {
+	if ( pooled < pool_size ) {
+		curl_easy_reset( easy );
+		pool[pooled++] = easy;
+	} else
+		curl_easy_cleanup( easy );
 }
 
 /* Die if we get a bad CURLMcode somewhere */
@@ -82,7 +205,7 @@ void mcode_or_die( const char *where, CURLMcode code ) {
 	CURLMcode rc = code;
 
 	if ( CURLM_CALL_MULTI_PERFORM == code ) {
-		rc = curl_multi_perform( multi, &running );
+		rc = curl_multi_socket_action( multi, CURL_SOCKET_TIMEOUT, 0, &running );
 	}
 
 	switch ( rc ) {
@@ -106,77 +229,94 @@ void mcode_or_die( const char *where, CURLMcode code ) {
 	exit( code );
 }
 
-static time_t lastretry = 0;
-void multi_retry( CURLcode res, CURL *easy ) {
-	time_t timenow;
-	long responseCode;
+static void curlFinish( CURL *easy, CURLcode res ) {
+	struct curl_job *job = NULL;
+	long responseCode = 0;
 
-	/* check for couchDB merge conflict */
-	if (res == CURLE_HTTP_RETURNED_ERROR) {
-		curl_easy_getinfo(easy, CURLINFO_RESPONSE_CODE, &responseCode);
-		if (responseCode == 409) {
-			/* resubmit with no limits */
-			curlQueue( easy );
-			curl409++;
-			return;
-		}
-	}
+	curl_easy_getinfo( easy, CURLINFO_PRIVATE, (char **)&job );
+	curl_easy_getinfo( easy, CURLINFO_RESPONSE_CODE, &responseCode );
 
-	timenow = time( NULL );
-	if ( ((res == CURLE_OPERATION_TIMEDOUT) || (res == CURLE_COULDNT_RESOLVE_HOST))
-								&& (timenow != lastretry)) {
-		/* resubmit with rate limits */
-		curlQueue( easy );
-		lastretry = timenow;
+	if ( res == CURLE_OK ) {
+		uploads++;
+	} else if ( ( res == CURLE_HTTP_RETURNED_ERROR ) && ( responseCode == 409 ) ) {
+		/* couchDB merge conflict */
+		curl409++;
+	} else {
 		retries++;
-		return;
-	} 
+	}
 
-	/* fail silently and remove handle */
-	curl_easy_cleanup( easy );
+	if ( job ) {
+		job->done( job->user, res, responseCode );
+		free( job );
+	}
+	curlRelease( easy );
+	active--;
 }
 
-/* Check for completed transfers, and remove their easy handles */
+/* Check for completed transfers, and remove their easy handles.  Those
+   failed by sock_cb go first, which also drops any message of theirs. */
 void check_multi_info() {
+	struct curl_job *job;
 	CURLMsg *msg;
 	int msgs_left;
 	CURL *easy;
 	CURLcode res;
 
+	while ( ( job = failed_jobs ) ) {
+		failed_jobs = job->next;
+		easy = job->easy;
+		curl_multi_remove_handle( multi, easy );
+		curlFinish( easy, CURLE_COULDNT_CONNECT );
+	}
+
 	while ( ( msg = curl_multi_info_read( multi, &msgs_left ) ) ) {
 		if ( msg->msg == CURLMSG_DONE ) {
 			easy = msg->easy_handle;
 			res = msg->data.result;
 			curl_multi_remove_handle( multi, easy );
-
-			if ( res == CURLE_OK ) {
-				curl_easy_cleanup( easy );
-				uploads++;
-			} else {
-				multi_retry( res, easy );
-			}
+			curlFinish( easy, res );
 		}
 	}
 }
 
+/* Transfers queued and not yet finished */
+int curlActive( void ) {
+	return active;
+}
 
-/* Add a new easy handle to the global curl_multi */
-void curlQueue( CURL *easy_handle ) {
+/* Add a new easy handle to the global curl_multi, done is called when it has finished */
+void curlQueue( CURL *easy_handle, curl_done_fn done, void *user ) {
+	struct curl_job *job;
 	CURLMcode rc;
 
 	if ( !easy_handle ) {
 		return;
 	}
 
-	/* drop messages if the queue is blocked */
+	job = (struct curl_job *)malloc( sizeof( struct curl_job ) );
+	if ( !job ) {
+		/* the caller still hears of it, so its records are tried again */
+		retries++;
+		done( user, CURLE_OUT_OF_MEMORY, 0 );
+		curlRelease( easy_handle );
+		return;
+	}
+	job->done = done;
+	job->user = user;
+	job->easy = easy_handle;
+	job->failed = 0;
+	curl_easy_setopt( easy_handle, CURLOPT_PRIVATE, job );
+	active++;
+
+	/* fail if the queue is blocked, so the caller can try again later */
 	if ( running >= 20 ) {
 		// first check if any have recently finished
-		rc = curl_multi_perform( multi, &running );
-		mcode_or_die( "curlQueue: curl_multi_perform", rc );
+		rc = curl_multi_socket_action( multi, CURL_SOCKET_TIMEOUT, 0, &running );
+		mcode_or_die( "curlQueue: curl_multi_socket_action", rc );
+		check_multi_info();
 	}
 	if ( running >= 30 ) {
-		// drop if still blocked
-		curl_easy_cleanup( easy_handle );
+		curlFinish( easy_handle, CURLE_AGAIN );
 		return;
 	}
 
@@ -184,20 +324,72 @@ void curlQueue( CURL *easy_handle ) {
 	mcode_or_die( "curlQueue: curl_multi_add_handle", rc );
 }
 
-void curlPush() {
+/* Fill in pollfds for the curl sockets, returns the number used */
+int curlPollFds( struct pollfd *fds, int max ) {
+	int i;
+
+	for ( i = 0; ( i < nsocks ) && ( i < max ); i++ ) {
+		fds[i].fd = socks[i].fd;
+		fds[i].events = ( ( socks[i].what & CURL_POLL_IN ) ? POLLIN : 0 ) |
+				( ( socks[i].what & CURL_POLL_OUT ) ? POLLOUT : 0 );
+		fds[i].revents = 0;
+	}
+	return i;
+}
+
+/* ms until curl wants its timer called, or -1 */
+int curlTimeout( void ) {
+	long long remain;
+
+	if ( timer_deadline < 0 )
+		return -1;
+	remain = timer_deadline - ms_now();
+	return ( remain < 0 ) ? 0 : (int)remain;
+}
+
+/* Pass poll() results, and any expired timeout, to curl */
+void curlEvents( struct pollfd *fds, int nfds ) {
 	CURLMcode rc;
+	int i, ev;
+
+	for ( i = 0; i < nfds; i++ ) {
+		if ( !fds[i].revents )
+			continue;
+		ev = ( ( fds[i].revents & POLLIN ) ? CURL_CSELECT_IN : 0 ) |
+		     ( ( fds[i].revents & POLLOUT ) ? CURL_CSELECT_OUT : 0 ) |
+		     ( ( fds[i].revents & ( POLLERR | POLLHUP ) ) ? CURL_CSELECT_ERR : 0 );
+		rc = curl_multi_socket_action( multi, fds[i].fd, ev, &running );
+		mcode_or_die( "curlEvents: curl_multi_socket_action", rc );
+	}
+
+	if ( curlTimeout() == 0 ) {
+		timer_deadline = -1;
+		rc = curl_multi_socket_action( multi, CURL_SOCKET_TIMEOUT, 0, &running );
+		mcode_or_die( "curlEvents: curl_multi_socket_action", rc );
+	}
 
 	// clear completed handles
 	check_multi_info();
+}
+
+/* Wait up to timeout_ms for curl only */
+void curlWait( int timeout_ms ) {
+	struct pollfd fds[HF_MAX_SOCKETS];
+	int nfds = curlPollFds( fds, HF_MAX_SOCKETS );
 
-	// start new handles
-	rc = curl_multi_perform( multi, &running );
-	mcode_or_die( "curlPush: curl_multi_perform", rc );
+	if ( ( curlTimeout() >= 0 ) && ( curlTimeout() < timeout_ms ) )
+		timeout_ms = curlTimeout();
+	if ( poll( fds, nfds, timeout_ms ) < 0 )
+		nfds = 0;
+	curlEvents( fds, nfds );
 }
 
 void curlClean() {
 	check_multi_info();
+	while ( pooled )
+		curl_easy_cleanup( pool[--pooled] );
 	curl_multi_cleanup( multi );
 	curl_slist_free_all(slist_headers);
+	curl_slist_free_all(slist_gzip_headers);
 	curl_global_cleanup();
 }
@@ -1,12 +1,22 @@
 #include <curl/curl.h>
+#include <poll.h>
 
-extern struct curl_slist *slist_headers;
+#define HF_MAX_SOCKETS 32	/* most sockets curl is polled on, transfers that need more fail */
+
+extern struct curl_slist *slist_headers, *slist_gzip_headers;
 
 int curl_terminated();
-void curlInit();
-void curlPush();
+void curlInit( int connections );
+CURL *curlHandle( void );
+int curlPollFds( struct pollfd *fds, int max );
+int curlTimeout( void );
+void curlEvents( struct pollfd *fds, int nfds );
+void curlWait( int timeout_ms );
 void curlClean();
-void curlQueue( CURL *easy_handle );
+/* called when a queued transfer has finished, response is the HTTP code */
+typedef void (*curl_done_fn)( void *user, CURLcode res, long response );
+void curlQueue( CURL *easy_handle, curl_done_fn done, void *user );
+int curlActive();
 int curlUploads();
 int curlRetries();
 int curlConflicts();
@@ -28,22 +28,31 @@
 */
 
 #include <assert.h>
+#include <math.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "horus_api.h"
 #include "fsk.h"
 #include "horus_l2.h"
+#include "decimate.h"
+#include "squelch.h"
+#include "comp_prim.h"
 
 #define MAX_UW_LENGTH                 (4*8)   /* With high FEC, (2^N) >> (N^BER)/BER! * BAUD */
-#define HORUS_API_VERSION                1    /* unique number that is bumped if API changes */
+#define HORUS_API_VERSION                2    /* unique number that is bumped if API changes */
 #define HORUS_BINARY_NUM_BITS          384    /* 48 byte ldpc is longer than 43 byte legacy  */
 #define HORUS_BINARY_NUM_PAYLOAD_BYTES  22    /* fixed number of bytes in legacy payload     */
 #define HORUS_MIN_PAYLOAD_BYTES         16    /* compact binary payload                      */
 #define HORUS_MAX_PAYLOAD_BYTES         32    /* extended binary payload - not implemented   */
 #define HORUS_LDPC_NUM_BITS            384    /* Maximum LDPC Telemetry data (16 * 3 * 8)    */
 #define RTTY_MAX_CHARS			80    /* may not be enough, but more adds latency    */
+#define HORUS_MAX_PENDING                4    /* unique words waiting for their packet       */
+#define HORUS_INPUT_BLOCK             4096    /* pushed samples converted at a time          */
 #define HORUS_BINARY_SAMPLERATE      48000    /* Should not want to change this              */
+#define HORUS_DECIMATION                 4    /* the demod runs at a quarter of the input rate */
+#define HORUS_DEMOD_SAMPLERATE       (HORUS_BINARY_SAMPLERATE / HORUS_DECIMATION)
 #define HORUS_BINARY_SYMBOLRATE        100
 #define HORUS_RTTY_SYMBOLRATE          100
 #define PITS_RTTY_SYMBOLRATE           300
@@ -51,15 +60,31 @@
 #define HORUS_BINARY_TS              (HORUS_BINARY_SAMPLERATE / HORUS_BINARY_SYMBOLRATE)
 #define HORUS_BINARY_NIN_MAX         (HORUS_BINARY_TS * (FSK_DEFAULT_NSYM + 2))
 #define HORUS_LDPC_NIN_MAX           (HORUS_BINARY_NIN_MAX * 4)                   /* 25 Hz */
+#define HORUS_DEMOD_NIN_MAX          (HORUS_LDPC_NIN_MAX / HORUS_DECIMATION)
+#define HORUS_PREROLL_SAMPLES        (4 * HORUS_DEMOD_SAMPLERATE)  /* kept while the squelch is closed */
 #define HORUS_MAX_FREQUENCY           4000    /* Narrow bandpass for lower speed modes     */
+#define HORUS_MULTI_DETECT            1.3f    /* comb score of another 4FSK signal, noise is about 1 */
+#define HORUS_MULTI_CONFIRM              3    /* frames in a row it is seen in before it is followed */
+#define HORUS_MULTI_SIGNAL_TOL         100    /* Hz its lowest tone may move from one frame to the next */
+#define HORUS_MULTI_SIGNAL_HOLD      (20 * HORUS_DEMOD_SAMPLERATE)  /* followed after it was last seen */
 #define RTTY_7N2			 1    /* RTTY select between between 8n1 and 7n2   */
 #define RTTY_8N2		       0,1    /* 8N2 has extra databit and second stop bit */
 
+/* conversion of input samples to the demod rate */
+struct horus_input {
+    struct decimator *dec;
+    COMP        in[HORUS_INPUT_BLOCK];
+    COMP       *out;
+};
+
+static struct horus_input *horus_input_open(int Fs_in, int Fs, float shift_hz);
+static void horus_input_close(struct horus_input *input);
+
 struct horus {
     int         mode;
     int         verbose;
     struct FSK *fsk;                 /* states for FSK modem                */
-    int         Fs;                  /* sample rate in Hz                   */
+    int         Fs;                  /* input sample rate in Hz             */
     int         mFSK;                /* number of FSK tones                 */
     int         Rs;                  /* symbol rate in Hz                   */
     int         uw[MAX_UW_LENGTH];   /* unique word bits mapped to +/-1     */
@@ -73,6 +98,38 @@ struct horus {
     int         rx_bits_len;         /* length of rx_bits buffer            */
     int         crc_ok;              /* most recent packet checksum results */
     int         total_payload_bits;  /* num bits rx-ed in last RTTY packet  */
+    _Atomic int found_uw;            /* packets found                       */
+    _Atomic int good_crc;            /* and how many passed their CRC       */
+    _Atomic int errors;              /* % of bits corrected in last packet  */
+    struct horus_ldpc_state ldpc;    /* prediction from the last good packet*/
+    _Atomic uint64_t ldpc_decodes;   /* atomic, as written by the decoder   */
+    _Atomic uint64_t ldpc_iterations;
+    uint64_t    sample_pos;          /* input samples demodulated so far    */
+    double     *frame_start;         /* first sample of each frame in rx_bits[], newest first */
+    int         nframes;
+    double      start_time;          /* wall clock of the first sample      */
+    uint64_t    packet_sample;       /* unique word of the last packet      */
+    uint64_t    packet_found;        /* sample_pos when it was found        */
+    _Atomic uint64_t latency_samples; /* from the UW to decoding, good packets */
+    int         low_latency;         /* decode packets as soon as they are in */
+    int         pending_loc[HORUS_MAX_PENDING];
+    int         pending_type[HORUS_MAX_PENDING];
+    int         npending;
+    COMP       *push_buf;            /* at the demod rate, less than a frame */
+    int         push_len;
+    char       *push_out;            /* packets found by horus_push_samples */
+    horus_packet_callback callback;
+    void       *callback_state;
+    struct horus_input *dec;         /* Fs to the demod rate                */
+    struct horus_input *input;       /* when pushed at another sample rate  */
+    struct squelch *squelch;         /* or NULL                             */
+    COMP       *preroll;             /* while it is closed, from sample_pos */
+    int         preroll_len;
+    uint64_t    replay_end;          /* input samples in, while the preroll is demodulated */
+    struct perf_timer perf[PERF_STAGES];  /* time taken by each stage        */
+    uint64_t    perf_samples;        /* audio samples demodulated           */
+    uint64_t    perf_extra_ns;       /* time spent outside of PERF_FRAME    */
+    _Atomic uint64_t decode_ns;      /* by horus_multi_decode(), on its own thread */
 };
 
 /* Unique word for Horus RTTY 7 bit '$' character, 3 sync bits,
@@ -167,9 +224,14 @@ struct horus *horus_open (int mode) {
 	horus_l2_init();
     }
 
+    /* The tones are all below HORUS_MAX_FREQUENCY, so the demod runs at 12 kHz.
+       8 kHz would leave the decimation filters no room above the tones, and
+       300 baud would not be a whole number of samples. */
     hstates->rx_bits_len = hstates->max_packet_len;
-    hstates->fsk = fsk_create(hstates->Fs, hstates->Rs, hstates->mFSK, 1000, 1.2f*hstates->Rs);
-    hstates->fsk->est_max = HORUS_MAX_FREQUENCY;
+    hstates->fsk = fsk_create(HORUS_DEMOD_SAMPLERATE, hstates->Rs, hstates->mFSK, 1000, 1.2f*hstates->Rs);
+    fsk_set_est_limits(hstates->fsk, hstates->fsk->est_min, HORUS_MAX_FREQUENCY);
+    /* follow steady tones rather than searching for them every frame */
+    fsk_enable_tracking(hstates->fsk, 1);
 
     /* allocate enough room for one complete packet after the buffer that we search for a header  */
 
@@ -185,8 +247,45 @@ struct horus *horus_open (int mode) {
         hstates->soft_bits[i] = 0.0;
     }
 
+    hstates->nframes = (hstates->rx_bits_len + hstates->fsk->Nbits - 1) / hstates->fsk->Nbits + 1;
+    hstates->frame_start = (double*)calloc(hstates->nframes, sizeof(double));
+    assert(hstates->frame_start != NULL);
+
+    hstates->push_buf = (COMP*)malloc(sizeof(COMP) * HORUS_DEMOD_NIN_MAX);
+    hstates->push_out = (char*)malloc(horus_get_max_ascii_out_len(hstates) + 1);
+    hstates->dec = horus_input_open(hstates->Fs, HORUS_DEMOD_SAMPLERATE, 0.0f);
+    assert((hstates->push_buf != NULL) && (hstates->push_out != NULL) && (hstates->dec != NULL));
+    hstates->push_len = 0;
+    hstates->callback = NULL;
+    hstates->callback_state = NULL;
+    hstates->input = NULL;
+    hstates->squelch = NULL;
+    hstates->preroll = NULL;
+    hstates->preroll_len = 0;
+    hstates->replay_end = 0;
+
     hstates->crc_ok = 0;
     hstates->total_payload_bits = 0;
+    hstates->found_uw = 0;
+    hstates->good_crc = 0;
+    hstates->errors = 100;
+    memset(&hstates->ldpc, 0, sizeof(hstates->ldpc));
+    hstates->ldpc_decodes = 0;
+    hstates->ldpc_iterations = 0;
+    hstates->sample_pos = 0;
+    hstates->start_time = 0.0;
+    hstates->packet_sample = 0;
+    hstates->packet_found = 0;
+    hstates->latency_samples = 0;
+    hstates->low_latency = 0;
+    hstates->npending = 0;
+
+    for (i=0; i<PERF_STAGES; i++)
+        perf_clear(&hstates->perf[i]);
+    hstates->perf_samples = 0;
+    hstates->perf_extra_ns = 0;
+    hstates->decode_ns = 0;
+    hstates->fsk->perf = hstates->perf;
     
     return hstates;
 }
@@ -195,24 +294,33 @@ void horus_close (struct horus *hstates) {
     assert(hstates != NULL);
     fsk_destroy(hstates->fsk);
     free(hstates->rx_bits);
+    free(hstates->soft_bits);
+    free(hstates->frame_start);
+    free(hstates->push_buf);
+    free(hstates->push_out);
+    horus_input_close(hstates->dec);
+    horus_input_close(hstates->input);
+    horus_set_squelch(hstates, 0);
     free(hstates);
 }
 
+/* less any samples left over from the squelch preroll */
 uint32_t horus_nin(struct horus *hstates) {
     assert(hstates != NULL);
-    int nin = fsk_nin(hstates->fsk);
+    int nin = (fsk_nin(hstates->fsk) - hstates->push_len) * HORUS_DECIMATION;
     assert(nin <= horus_get_max_demod_in(hstates));
     return nin;
 }
 
 /* How to check for two different unique words? */
-int horus_find_uw(struct horus *hstates, int n) {
+static int horus_find_uw_from(struct horus *hstates, int st, int n) {
     int i, j, corr, corr2, mx, mx_ind;
     int rx_bits_mapped[n+hstates->uw_len];
+    uint64_t t0 = perf_now();
     
-    /* map rx_bits to +/-1 for UW search */
-    for(i=0; i<n+hstates->uw_len; i++) {
-        rx_bits_mapped[i] = 2*hstates->rx_bits[i] - 1;
+    /* map rx_bits to +/-1 for UW search, the last match ends at bit n+uw_len-2 */
+    for(i=0; i<n+hstates->uw_len-1; i++) {
+        rx_bits_mapped[i] = 2*hstates->rx_bits[st+i] - 1;
     }
     
     /* look for UW  */
@@ -239,14 +347,20 @@ int horus_find_uw(struct horus *hstates, int n) {
         }
     }
 
+    perf_add(&hstates->perf[PERF_UW], perf_now() - t0);
+
     if (mx < hstates->uw_thresh)
 	    return -1;
 
     if (hstates->verbose) {
-        fprintf(stderr, "  horus_find_uw: mx_ind: %d mx: %d uw_thresh: %d \n",  mx_ind, mx, hstates->uw_thresh);
+        fprintf(stderr, "  horus_find_uw: mx_ind: %d mx: %d uw_thresh: %d \n",  st + mx_ind, mx, hstates->uw_thresh);
     }
 
-    return mx_ind;
+    return st + mx_ind;
+}
+
+int horus_find_uw(struct horus *hstates, int n) {
+    return horus_find_uw_from(hstates, 0, n);
 }
 
 int hex2int(char ch) {
@@ -260,11 +374,12 @@ int hex2int(char ch) {
 }
 
 
-int extract_horus_rtty(struct horus *hstates, char ascii_out[], int uw_loc) {
+/* rx_bits[] starts at the unique word, and holds nbits bits */
+int extract_horus_rtty(struct horus *hstates, char ascii_out[], uint8_t rx_bits[], int nbits) {
     const int nfield = 7;                               /* 7N2 ASCII, ignore MSB for 8N2  */
     int npad = 2 + 1;                                   /* sync bits between characters   */
-    int st = uw_loc;                                    /* first bit of first char        */
-    int en = hstates->max_packet_len - nfield;          /* last bit of max length packet  */
+    int st = 0;                                         /* first bit of first char        */
+    int en = nbits - nfield;                            /* last bit of max length packet  */
 
     int      i, j, nout, crc_ok;
     uint8_t  char_dec;
@@ -283,8 +398,8 @@ int extract_horus_rtty(struct horus *hstates, char ascii_out[], int uw_loc) {
 
         char_dec = 0;
         for(j=0; j<nfield; j++) {
-            assert(hstates->rx_bits[i+j] <= 1);
-            char_dec |= hstates->rx_bits[i+j] * (1<<j);
+            assert(rx_bits[i+j] <= 1);
+            char_dec |= rx_bits[i+j] * (1<<j);
         }
         if (hstates->verbose) {
             fprintf(stderr, "  extract_horus_rtty i: %4d 0x%02x %c ", i, char_dec, char_dec);
@@ -296,7 +411,9 @@ int extract_horus_rtty(struct horus *hstates, char ascii_out[], int uw_loc) {
         /*  if we find a '*' that's the end of the packet for RX CRC calculations */
 
         if (!ptx_crc && (char_dec == 42)) {
+            uint64_t t0 = perf_now();
             rx_crc = horus_l2_gen_crc16((uint8_t*)&ascii_out[2], nout-2); // start after "$$"
+            perf_add(&hstates->perf[PERF_CRC], perf_now() - t0);
             ptx_crc = pout + 1; /* start of tx CRC */
         }
 
@@ -343,10 +460,19 @@ int extract_horus_rtty(struct horus *hstates, char ascii_out[], int uw_loc) {
     return crc_ok;
 }
 
-int extract_horus_binary(struct horus *hstates, char hex_out[], int uw_loc, int payload_size) {
+/* bits from the unique word to the end of a binary packet, LDPC mode
+   decodes the longest whichever unique word matched */
+static int horus_packet_bits(struct horus *hstates, int uw_type) {
+    if ((uw_type == 1) && (hstates->mode == HORUS_MODE_BINARY))
+        return 8 * horus_l2_get_num_tx_data_bytes(HORUS_BINARY_NUM_PAYLOAD_BYTES);
+    return hstates->max_packet_len;
+}
+
+/* rx_bits[] and soft_bits[] start at the unique word */
+int extract_horus_binary(struct horus *hstates, char hex_out[], uint8_t rx_bits[], float soft_bits[], int payload_size) {
     const int nfield = 8;                      /* 8 bit binary                   */
-    int st = uw_loc;
-    int en = uw_loc + hstates->max_packet_len; /* last bit of max length packet  */
+    int st = 0;
+    int en = horus_packet_bits(hstates, payload_size == HORUS_BINARY_NUM_PAYLOAD_BYTES ? 1 : 2);
 
     int      j, b, nout;
     uint8_t  rxpacket[hstates->max_packet_len];
@@ -362,9 +488,9 @@ int extract_horus_binary(struct horus *hstates, char hex_out[], int uw_loc, int
 
         rxbyte = 0;
         for(j=0; j<nfield; j++) {
-            assert(hstates->rx_bits[b+j] <= 1);
+            assert(rx_bits[b+j] <= 1);
             rxbyte <<= 1;
-            rxbyte |= hstates->rx_bits[b+j];
+            rxbyte |= rx_bits[b+j];
         }
         
         /* build up output array */
@@ -382,19 +508,25 @@ int extract_horus_binary(struct horus *hstates, char hex_out[], int uw_loc, int
     }
     
     uint8_t payload_bytes[HORUS_MAX_PAYLOAD_BYTES + 4];
+    uint64_t t0 = perf_now(), t1;
     if (payload_size == HORUS_BINARY_NUM_PAYLOAD_BYTES) {
         horus_l2_decode_rx_packet(payload_bytes, rxpacket, payload_size);
+        hstates->errors = horus_l2_errors(rxpacket + 4, payload_bytes);
     } else {
-        float *softbits = hstates->soft_bits + uw_loc + sizeof(uw_horus_v2);
-	horus_ldpc_decode( payload_bytes, softbits );
-	ldpc_errors( payload_bytes, &rxpacket[4] );
+        float *softbits = soft_bits + sizeof(uw_horus_v2);
+	hstates->ldpc_iterations += horus_ldpc_decode( &hstates->ldpc, payload_bytes, softbits );
+	hstates->ldpc_decodes++;
+	hstates->errors = ldpc_errors( payload_bytes, &rxpacket[4] );
     }
+    t1 = perf_now();
+    perf_add(&hstates->perf[PERF_FEC], t1 - t0);
 
 	/* calculate checksum */
         uint16_t crc_tx, crc_rx;
         crc_rx = horus_l2_gen_crc16(payload_bytes, payload_size - 2);
         crc_tx = (uint16_t)payload_bytes[payload_size - 2] +
                 ((uint16_t)payload_bytes[payload_size - 1]<<8);
+        perf_add(&hstates->perf[PERF_CRC], perf_now() - t1);
 
 	/* Return early if CRC fails */
 	if (crc_tx == crc_rx) {
@@ -424,101 +556,1332 @@ int extract_horus_binary(struct horus *hstates, char hex_out[], int uw_loc, int
     return hstates->crc_ok;
 }
 
-int horus_rx(struct horus *hstates, char ascii_out[], short demod_in[]) {
+/* n samples from samples[start] in any HORUS_FORMAT, shorts are cast to
+   floats, range not normalised */
+static void horus_convert(COMP out[], const void *samples, long start, int n, int format) {
+    const short *s16 = (const short *)samples;
+    const float *f32 = (const float *)samples;
     int i;
-    COMP demod_in_comp[HORUS_LDPC_NIN_MAX];
 
-    assert(hstates != NULL);
+    switch (format) {
+    case HORUS_FORMAT_S16:
+        for (i=0; i<n; i++) {
+            out[i].real = s16[start + i];
+            out[i].imag = 0;
+        }
+        break;
+    case HORUS_FORMAT_S16_IQ:
+        for (i=0; i<n; i++) {
+            out[i].real = s16[(start + i) * 2];
+            out[i].imag = s16[(start + i) * 2 + 1];
+        }
+        break;
+    case HORUS_FORMAT_F32:
+        for (i=0; i<n; i++) {
+            out[i].real = f32[start + i];
+            out[i].imag = 0;
+        }
+        break;
+    case HORUS_FORMAT_F32_IQ:
+        memcpy(out, &f32[start * 2], sizeof(COMP) * n);
+        break;
+    case HORUS_FORMAT_U8_IQ:
+        for (i=0; i<n; i++) {
+            out[i].real = ((const uint8_t *)samples)[(start + i) * 2] - 127.5f;
+            out[i].imag = ((const uint8_t *)samples)[(start + i) * 2 + 1] - 127.5f;
+        }
+        break;
+    }
+}
+
+static struct horus_input *horus_input_open(int Fs_in, int Fs, float shift_hz) {
+    struct horus_input *input;
+
+    input = (struct horus_input *)malloc(sizeof(struct horus_input));
+    if (input == NULL)
+        return NULL;
+    input->dec = decimator_create(Fs_in, Fs, shift_hz);
+    input->out = NULL;
+    if (input->dec != NULL)
+        input->out = (COMP *)malloc(sizeof(COMP) * decimator_max_out(input->dec, HORUS_INPUT_BLOCK));
+    if (input->out == NULL) {
+        horus_input_close(input);
+        return NULL;
+    }
+    return input;
+}
+
+static void horus_input_close(struct horus_input *input) {
+    if (input == NULL)
+        return;
+    if (input->dec != NULL)
+        decimator_destroy(input->dec);
+    free(input->out);
+    free(input);
+}
+
+/* the next block of up to HORUS_INPUT_BLOCK samples from samples[*pos], at the demod rate */
+static int horus_input_block(struct horus_input *input, const void *samples, long *pos, int n, int format) {
+    int k = n - *pos < HORUS_INPUT_BLOCK ? n - *pos : HORUS_INPUT_BLOCK;
 
-    for (i=0; i<hstates->fsk->nin; i++) {
-        demod_in_comp[i].real = demod_in[i];
-        demod_in_comp[i].imag = 0;
+    horus_convert(input->in, samples, *pos, k, format);
+    *pos += k;
+    return decimator_process(input->dec, input->out, input->in, k);
+}
+
+static int horus_squelch_frame(struct horus *hstates, char ascii_out[], COMP demod_in_comp[]);
+
+/* one frame of horus_nin() samples at Fs, taken down to the demod rate */
+static int horus_rx_frame(struct horus *hstates, char ascii_out[], const void *samples, int format) {
+    int nin = horus_nin(hstates);
+    long pos = 0;
+    int k, n = hstates->push_len;
+
+    while (pos < nin) {
+        k = horus_input_block(hstates->dec, samples, &pos, nin, format);
+        memcpy(&hstates->push_buf[n], hstates->dec->out, sizeof(COMP) * k);
+        n += k;
     }
-    return horus_demod_comp(hstates, ascii_out, demod_in_comp);
+    assert(n == hstates->fsk->nin);
+    hstates->push_len = 0;
+    return horus_squelch_frame(hstates, ascii_out, hstates->push_buf);
+}
+
+int horus_rx(struct horus *hstates, char ascii_out[], short demod_in[]) {
+    assert(hstates != NULL);
+    return horus_rx_frame(hstates, ascii_out, demod_in, HORUS_FORMAT_S16);
 }
 
 int horus_rx_comp(struct horus *hstates, char ascii_out[], short demod_in_iq[]) {
-    int i;
-    COMP demod_in_comp[HORUS_LDPC_NIN_MAX];
+    assert(hstates != NULL);
+    return horus_rx_frame(hstates, ascii_out, demod_in_iq, HORUS_FORMAT_S16_IQ);
+}
 
+int horus_demod_comp(struct horus *hstates, char ascii_out[], COMP demod_in_comp[]) {
     assert(hstates != NULL);
+    return horus_rx_frame(hstates, ascii_out, demod_in_comp, HORUS_FORMAT_F32_IQ);
+}
 
-    for (i=0; i<hstates->fsk->nin; i++) {
-        demod_in_comp[i].real = demod_in_iq[i * 2];     // cast shorts to floats
-        demod_in_comp[i].imag = demod_in_iq[i * 2 + 1]; //  range not normalised
+void horus_set_packet_callback(struct horus *hstates, horus_packet_callback callback, void *state) {
+    assert(hstates != NULL);
+    hstates->callback = callback;
+    hstates->callback_state = state;
+}
+
+int horus_set_input_rate(struct horus *hstates, int Fs, float shift_hz) {
+    assert(hstates != NULL);
+    horus_input_close(hstates->input);
+    hstates->input = NULL;
+    if ((Fs == hstates->Fs) && (shift_hz == 0.0f))
+        return 1;
+    hstates->input = horus_input_open(Fs, HORUS_DEMOD_SAMPLERATE, shift_hz);
+    return hstates->input != NULL;
+}
+
+int horus_push_samples(struct horus *hstates, const void *samples, int n, int format) {
+    struct horus_input *input;
+    long pos = 0;
+    int i, k, m, nin, packets = 0;
+
+    assert(hstates != NULL);
+    assert((format >= HORUS_FORMAT_S16) && (format <= HORUS_FORMAT_U8_IQ));
+
+    input = hstates->input ? hstates->input : hstates->dec;
+    while (pos < n) {
+        k = horus_input_block(input, samples, &pos, n, format);
+        for (i=0; i<k; i+=m) {
+            nin = hstates->fsk->nin;
+            m = nin - hstates->push_len;
+            if (m > k - i)
+                m = k - i;
+            memcpy(&hstates->push_buf[hstates->push_len], &input->out[i], sizeof(COMP) * m);
+            hstates->push_len += m;
+            if (hstates->push_len < nin)
+                continue;
+            hstates->push_len = 0;
+
+            if (horus_squelch_frame(hstates, hstates->push_out, hstates->push_buf)) {
+                packets++;
+                if (hstates->callback)
+                    hstates->callback(hstates->callback_state, hstates, hstates->push_out);
+            }
+        }
     }
-    return horus_demod_comp(hstates, ascii_out, demod_in_comp);
+    return packets;
 }
 
-/* Tracking for packets corrupt or misdetected */
-static int found_uw = 0;
-static int good_crc = 0;
-int horus_bad_crc(void) {return found_uw - good_crc;}
+/* Tracking for packets corrupt or misdetected, the counters are atomic
+   so these may be read while another thread decodes */
+int horus_bad_crc(struct horus *hstates) {
+    assert(hstates != NULL);
+    return hstates->found_uw - hstates->good_crc;
+}
 
-int horus_demod_comp(struct horus *hstates, char ascii_out[], COMP demod_in_comp[]) {
-    int i, j, uw_loc, packet_detected;
-    
-    packet_detected = 0;
+/* 100 for a packet received without errors, 0 for one with the most the FEC can correct */
+int horus_quality(struct horus *hstates) {
+    assert(hstates != NULL);
+    return 100 - hstates->errors;
+}
 
+/* shift buffer of bits to make room for the next Nbits from the demod */
+static void horus_shift_bits(struct horus *hstates) {
+    int i, j;
     int Nbits = hstates->fsk->Nbits;
     int rx_bits_len = hstates->rx_bits_len;
-    
-    if (hstates->verbose) {
-    //    fprintf(stderr, "  horus_rx max_packet_len: %d rx_bits_len: %d Nbits: %d nin: %d\n",
-    //            hstates->max_packet_len, rx_bits_len, Nbits, hstates->fsk->nin);
-    }
-    
-    /* shift buffer of bits to make room for new bits */
+
     for(i=0,j=Nbits; j<rx_bits_len; i++,j++) {
         hstates->rx_bits[i] = hstates->rx_bits[j];
         hstates->soft_bits[i] = hstates->soft_bits[j];
     }
+    for (i=0; i<hstates->npending; i++)
+        hstates->pending_loc[i] -= Nbits;
+}
 
-    /* demodulate latest bits and get soft bits for ldpc */
-    fsk2_demod(hstates->fsk, &hstates->rx_bits[rx_bits_len-Nbits], &hstates->soft_bits[rx_bits_len-Nbits], demod_in_comp);
-    // fsk_demod_core(hstates->fsk, &hstates->rx_bits[rx_bits_len-Nbits], &hstates->soft_bits[rx_bits_len-Nbits], demod_in_comp);
+/* after each demod frame of nin samples.  Symbol k of the frame starts
+   (k + 1 + norm_rx_timing) * Ts after the Nmem samples it was taken from.
+   Positions are counted in input samples, HORUS_DECIMATION to each one
+   the demod sees.
+   The start of each frame is kept with its bits, as the timing can slip
+   a symbol where there are no transitions, between a packet and the frame
+   that finds it. */
+static void horus_frame_done(struct horus *hstates, int nin) {
+    struct FSK *fsk = hstates->fsk;
+    int i;
 
+    hstates->sample_pos += (uint64_t)nin * HORUS_DECIMATION;
+    for (i=hstates->nframes-1; i>0; i--)
+        hstates->frame_start[i] = hstates->frame_start[i-1];
+    hstates->frame_start[0] = (double)hstates->sample_pos
+        - (fsk->Nmem - (1.0 + fsk->norm_rx_timing) * fsk->Ts) * HORUS_DECIMATION;
+}
 
-    /* UW search to see if we can find the start of a packet in the buffer */
-    if ((uw_loc = horus_find_uw(hstates, Nbits)) != -1) {
+/* stream index of the first sample of the bit at rx_bits[loc] */
+static uint64_t horus_bit_sample(struct horus *hstates, int loc) {
+    struct FSK *fsk = hstates->fsk;
+    int bits_per_symbol = fsk->Nbits / fsk->Nsym;
+    int before = hstates->rx_bits_len - fsk->Nbits - loc;      /* bits before the newest frame */
+    int frame = (before + fsk->Nbits - 1) / fsk->Nbits;
+    int bit = frame * fsk->Nbits - before;                      /* into that frame              */
+    double s = hstates->frame_start[frame] + (double)bit / bits_per_symbol * fsk->Ts * HORUS_DECIMATION;
+
+    assert((frame >= 0) && (frame < hstates->nframes));
+    return s > 0.0 ? (uint64_t)(s + 0.5) : 0;
+}
 
-        if (hstates->verbose) {
-        //    fprintf(stderr, "  horus_rx uw_loc: %d mode: %d\n", uw_loc, hstates->mode);
-        }
-        
-        /* OK we have found a unique word, and therefore the start of
-           a packet, so lets try to extract valid packets */
+static void horus_packet_time_at(struct horus *hstates, uint64_t sample, uint64_t found, struct horus_packet_time *t) {
+    t->sample = sample;
+    t->found = found;
+    t->time = hstates->start_time + (double)sample / hstates->Fs;
+    t->found_time = hstates->start_time + (double)found / hstates->Fs;
+}
+
+/* UW search to see if we can find the start of a packet in the buffer */
+/* decode a packet, from bits starting at its unique word, which was at input
+   sample sample, and found when found samples were in */
+static int horus_decode_packet(struct horus *hstates, char ascii_out[], uint8_t rx_bits[], float soft_bits[], int nbits, int uw_type,
+                               uint64_t sample, uint64_t found) {
+    int packet_detected = 0;
 
         if (hstates->mode == HORUS_MODE_RTTY) {
-            packet_detected = extract_horus_rtty(hstates, ascii_out, uw_loc);
+            packet_detected = extract_horus_rtty(hstates, ascii_out, rx_bits, nbits);
         }
 
         if (hstates->mode == HORUS_MODE_PITS) {
-            packet_detected = extract_horus_rtty(hstates, ascii_out, uw_loc);
+            packet_detected = extract_horus_rtty(hstates, ascii_out, rx_bits, nbits);
         }
 
 	if (hstates->mode == HORUS_MODE_BINARY) {
-		if (hstates->uw_type == 1) {
-			packet_detected = extract_horus_binary(hstates, ascii_out, uw_loc, HORUS_BINARY_NUM_PAYLOAD_BYTES);
+		if (uw_type == 1) {
+			packet_detected = extract_horus_binary(hstates, ascii_out, rx_bits, soft_bits, HORUS_BINARY_NUM_PAYLOAD_BYTES);
 		} else {
-			packet_detected = extract_horus_binary(hstates, ascii_out, uw_loc, HORUS_MIN_PAYLOAD_BYTES);
-			confirm_good(packet_detected);
+			packet_detected = extract_horus_binary(hstates, ascii_out, rx_bits, soft_bits, HORUS_MIN_PAYLOAD_BYTES);
+			confirm_good(&hstates->ldpc, packet_detected);
 		}
 	}
 
-        if ((hstates->mode == HORUS_MODE_LDPC) && (hstates->uw_type = 2)) {
-		packet_detected = extract_horus_binary(hstates, ascii_out, uw_loc, HORUS_MIN_PAYLOAD_BYTES);
-		confirm_good(packet_detected);
+        if (hstates->mode == HORUS_MODE_LDPC) {
+		packet_detected = extract_horus_binary(hstates, ascii_out, rx_bits, soft_bits, HORUS_MIN_PAYLOAD_BYTES);
+		confirm_good(&hstates->ldpc, packet_detected);
 		// TODO: try MAX_PAYLOAD_BYTES for extended packet type
 	}
-	found_uw++;
-    }
+	hstates->found_uw++;
 
-    if (packet_detected)
-	    good_crc++;
+    if (packet_detected) {
+	    hstates->good_crc++;
+	    hstates->latency_samples += found - sample;
+    }
     return packet_detected;
 }
 
+/* RTTY packets end four characters after the '*' */
+static int horus_rtty_complete(struct horus *hstates, uint8_t rx_bits[], int nbits) {
+    const int nfield = 7;
+    int step = nfield + ((hstates->mode == HORUS_MODE_PITS) ? 4 : 3);
+    int i, j, c;
+
+    for (i=0; i<nbits-nfield; i+=step) {
+        for (c=0, j=0; j<nfield; j++)
+            c |= rx_bits[i+j] << j;
+        if (c == '*')
+            return i + 4*step < nbits - nfield;
+    }
+    return 0;
+}
+
+/* is the packet at pending unique word i all in? */
+static int horus_pending_ready(struct horus *hstates, int i) {
+    int loc = hstates->pending_loc[i];
+    int nbits = hstates->rx_bits_len - loc;
+
+    if (nbits >= hstates->max_packet_len)
+        return 1;
+    if ((hstates->mode == HORUS_MODE_RTTY) || (hstates->mode == HORUS_MODE_PITS))
+        return horus_rtty_complete(hstates, &hstates->rx_bits[loc], nbits);
+    return nbits >= horus_packet_bits(hstates, hstates->pending_type[i]);
+}
+
+static void horus_pending_remove(struct horus *hstates, int i) {
+    hstates->npending--;
+    memmove(&hstates->pending_loc[i], &hstates->pending_loc[i+1], sizeof(int) * (hstates->npending - i));
+    memmove(&hstates->pending_type[i], &hstates->pending_type[i+1], sizeof(int) * (hstates->npending - i));
+}
+
+/* Find the unique word of the next packet to decode, returns its location
+   in rx_bits[], and its type and length, or -1.  Call it with first set
+   after each frame, then again until it returns -1.  Normally a unique
+   word is looked for at the start of the buffer, when the longest packet
+   would be all in.  With low latency the newest bits are searched, and
+   the packet is decoded as soon as its own bits are in.  Every packet
+   that is in is returned after the same frame, as the next would shift
+   its first bits out. */
+static int horus_next_packet(struct horus *hstates, int first, int *uw_type, int *nbits) {
+    int Nbits = hstates->fsk->Nbits;
+    int rx_bits_len = hstates->rx_bits_len;
+    int i, uw_loc;
+
+    if (!hstates->low_latency) {
+        if (!first || ((uw_loc = horus_find_uw(hstates, Nbits)) == -1))
+            return -1;
+        *uw_type = hstates->uw_type;
+        *nbits = hstates->max_packet_len - uw_loc;
+    } else {
+        if (first) {
+            uw_loc = horus_find_uw_from(hstates, rx_bits_len - Nbits - hstates->uw_len + 1, Nbits);
+            if ((uw_loc != -1) && (hstates->npending < HORUS_MAX_PENDING)) {
+                hstates->pending_loc[hstates->npending] = uw_loc;
+                hstates->pending_type[hstates->npending] = hstates->uw_type;
+                hstates->npending++;
+            }
+        }
+
+        for (i=0; i<hstates->npending; i++) {
+            if (hstates->pending_loc[i] < 0)
+                horus_pending_remove(hstates, i--);
+            else if (horus_pending_ready(hstates, i))
+                break;
+        }
+        if (i == hstates->npending)
+            return -1;
+
+        uw_loc = hstates->pending_loc[i];
+        *uw_type = hstates->pending_type[i];
+        *nbits = rx_bits_len - uw_loc;
+        if (*nbits > hstates->max_packet_len)
+            *nbits = hstates->max_packet_len;
+        horus_pending_remove(hstates, i);
+    }
+
+    hstates->packet_sample = horus_bit_sample(hstates, uw_loc);
+    hstates->packet_found = hstates->sample_pos > hstates->replay_end ? hstates->sample_pos : hstates->replay_end;
+    return uw_loc;
+}
+
+static int horus_find_packet(struct horus *hstates, char ascii_out[]) {
+    int uw_loc, uw_type, nbits, first;
+    int packet = 0;
+
+    for (first=1; (uw_loc = horus_next_packet(hstates, first, &uw_type, &nbits)) != -1; first=0) {
+        if (hstates->verbose) {
+        //    fprintf(stderr, "  horus_rx uw_loc: %d mode: %d\n", uw_loc, hstates->mode);
+        }
+
+        /* OK we have found a unique word, and therefore the start of
+           a packet, so lets try to extract valid packets.  One is returned,
+           the rest that are in with it are dropped. */
+
+        if (!packet)
+            packet = horus_decode_packet(hstates, ascii_out, &hstates->rx_bits[uw_loc], &hstates->soft_bits[uw_loc],
+                                         nbits, uw_type, hstates->packet_sample, hstates->packet_found);
+    }
+    return packet;
+}
+
+/* one frame of fsk->nin samples at the demod rate */
+static int horus_demod_frame(struct horus *hstates, char ascii_out[], COMP demod_in_comp[]) {
+    int Nbits = hstates->fsk->Nbits;
+    int rx_bits_len = hstates->rx_bits_len;
+    int nin = hstates->fsk->nin;
+    uint64_t t0 = perf_now();
+    int packet;
+    
+    if (hstates->verbose) {
+    //    fprintf(stderr, "  horus_rx max_packet_len: %d rx_bits_len: %d Nbits: %d nin: %d\n",
+    //            hstates->max_packet_len, rx_bits_len, Nbits, hstates->fsk->nin);
+    }
+    
+    horus_shift_bits(hstates);
+
+    /* demodulate latest bits and get soft bits for ldpc */
+    fsk2_demod(hstates->fsk, &hstates->rx_bits[rx_bits_len-Nbits], &hstates->soft_bits[rx_bits_len-Nbits], demod_in_comp);
+    // fsk_demod_core(hstates->fsk, &hstates->rx_bits[rx_bits_len-Nbits], &hstates->soft_bits[rx_bits_len-Nbits], demod_in_comp);
+    hstates->perf_samples += hstates->fsk->N * HORUS_DECIMATION;
+    horus_frame_done(hstates, nin);
+
+    packet = horus_find_packet(hstates, ascii_out);
+    perf_add(&hstates->perf[PERF_FRAME], perf_now() - t0);
+    return packet;
+}
+
+/* as the signal comes back, forget the bits and estimates from the last one */
+static void horus_squelch_reset(struct horus *hstates) {
+    memset(hstates->rx_bits, 0, hstates->rx_bits_len);
+    memset(hstates->soft_bits, 0, sizeof(float) * hstates->rx_bits_len);
+    hstates->npending = 0;
+    fsk_clear_estimators(hstates->fsk);
+}
+
+/* demod samples the squelch stays open for, until the longest packet is decoded */
+static int horus_squelch_hang(struct horus *hstates) {
+    return horus_get_max_packet_samples(hstates) / HORUS_DECIMATION + hstates->fsk->N;
+}
+
+/* keep n more samples while the squelch is closed, dropping all but the
+   last HORUS_PREROLL_SAMPLES now and then */
+static void horus_preroll_add(struct horus *hstates, COMP in[], int n) {
+    int drop;
+
+    memcpy(&hstates->preroll[hstates->preroll_len], in, sizeof(COMP) * n);
+    hstates->preroll_len += n;
+    if (hstates->preroll_len < 2 * HORUS_PREROLL_SAMPLES)
+        return;
+    drop = hstates->preroll_len - HORUS_PREROLL_SAMPLES;
+    hstates->preroll_len -= drop;
+    memmove(hstates->preroll, &hstates->preroll[drop], sizeof(COMP) * hstates->preroll_len);
+    hstates->sample_pos += (uint64_t)drop * HORUS_DECIMATION;
+    hstates->perf_samples += (uint64_t)drop * HORUS_DECIMATION;
+}
+
+/* one frame of fsk->nin samples through the squelch.  When it opens, the
+   preroll is demodulated, and the samples left over start the next frame. */
+static int horus_squelch_frame(struct horus *hstates, char ascii_out[], COMP demod_in_comp[]) {
+    struct FSK *fsk = hstates->fsk;
+    uint64_t t0, t;
+    int n, open, packet = 0;
+
+    if (hstates->squelch == NULL)
+        return horus_demod_frame(hstates, ascii_out, demod_in_comp);
+
+    t0 = perf_now();
+    open = squelch_process(hstates->squelch, demod_in_comp, fsk->nin);
+    t = perf_now() - t0;
+    perf_add(&hstates->perf[PERF_SQUELCH], t);
+    hstates->perf_extra_ns += t;
+
+    if (open && (hstates->preroll_len == 0))
+        return horus_demod_frame(hstates, ascii_out, demod_in_comp);
+    horus_preroll_add(hstates, demod_in_comp, fsk->nin);
+    if (!open)
+        return 0;
+
+    horus_squelch_reset(hstates);
+    hstates->replay_end = hstates->sample_pos + (uint64_t)hstates->preroll_len * HORUS_DECIMATION;
+    for (n=0; n+fsk->nin<=hstates->preroll_len; n+=fsk->nin) {
+        if (horus_demod_frame(hstates, ascii_out, &hstates->preroll[n]))
+            packet = 1;
+    }
+    hstates->push_len = hstates->preroll_len - n;
+    memcpy(hstates->push_buf, &hstates->preroll[n], sizeof(COMP) * hstates->push_len);
+    hstates->preroll_len = 0;
+    return packet;
+}
+
+int horus_set_squelch(struct horus *hstates, int squelch) {
+    struct FSK *fsk;
+
+    assert(hstates != NULL);
+    fsk = hstates->fsk;
+    if (hstates->squelch != NULL) {
+        squelch_destroy(hstates->squelch);
+        free(hstates->preroll);
+        hstates->sample_pos += (uint64_t)hstates->preroll_len * HORUS_DECIMATION;
+        hstates->squelch = NULL;
+        hstates->preroll = NULL;
+        hstates->preroll_len = 0;
+    }
+    if (!squelch)
+        return 1;
+
+    hstates->squelch = squelch_create(fsk->Fs, fsk->Rs, fsk->est_min, fsk->est_max);
+    hstates->preroll = (COMP*)malloc(sizeof(COMP) * (2 * HORUS_PREROLL_SAMPLES + HORUS_DEMOD_NIN_MAX));
+    if ((hstates->squelch == NULL) || (hstates->preroll == NULL)) {
+        horus_set_squelch(hstates, 0);
+        return 0;
+    }
+    squelch_set_hang(hstates->squelch, horus_squelch_hang(hstates));
+    return 1;
+}
+
+int horus_get_squelch_open(struct horus *hstates) {
+    assert(hstates != NULL);
+    return (hstates->squelch == NULL) || (hstates->preroll_len == 0);
+}
+
+/*---------------------------------------------------------------------------*\
+
+  Multi-mode receiver.  Several modes are decoded from a single input
+  stream, so that Binary, 25 Hz LDPC and RTTY can be received at once.
+  The modes share one frequency estimator, and when the 4FSK tones line
+  up, the integrators of a slow 4FSK mode are summed from the tone
+  integrators of the faster one instead of being downconverted again.
+
+  With horus_multi_set_signals(), the 4FSK modes are decoded from more
+  than one signal in the passband.  Each further signal has its own copy
+  of the 4FSK channels, fed from the same buffer and spectrum, which wait
+  on the last HORUS_PREROLL_SAMPLES like a closed squelch until the
+  estimator finds a signal for them, and go back to waiting some time
+  after it is gone.
+
+\*---------------------------------------------------------------------------*/
+
+struct horus_multi {
+    int           nchan;
+    int           verbose;
+    struct horus *chan[HORUS_MULTI_MAX_CHANNELS];
+    char         *ascii_out[HORUS_MULTI_MAX_CHANNELS];
+    long long     pos[HORUS_MULTI_MAX_CHANNELS];    /* stream index of next sample for each channel */
+    struct FSK   *est;                 /* shared estimator, only the spectrum is used */
+    float         tones[MODE_M_MAX + 1][MODE_M_MAX]; /* latest tone picks, for 2FSK and 4FSK    */
+    int           tones_gen[MODE_M_MAX + 1];         /* bumped every time the tone picks change */
+    int           nin;                 /* fixed number of demod samples per horus_multi_rx() call */
+    COMP         *buf;                 /* demod samples not yet used by every channel          */
+    int           buf_len;
+    int           buf_size;
+    long long     buf_start;           /* stream index of buf[0]                               */
+
+    /* sharing of tone integrators between a fast master and a slow slave channel */
+    int           master;              /* channel index, or -1                                  */
+    int           slave;
+    int           ratio;               /* Rs of master / Rs of slave                            */
+    long long     master_end;          /* stream index after the last master frame              */
+    int           master_gen;          /* tone generation of the last master frame              */
+    int           ring_size;           /* power of 2, indexed by stream index / (Ts/P)          */
+    COMP         *ring[MODE_M_MAX];    /* master integrator outputs                            */
+    long long    *ring_g;
+    int          *ring_gen;
+    COMP         *f_int[MODE_M_MAX];   /* integrator scratch for one frame                      */
+    int           shared_frames;
+    int           slave_frames;
+
+    /* deferred decoding: packets found by their unique word, waiting for horus_multi_decode() */
+    int           deferred;
+    struct horus_frame *frames;
+    int           frame_head;
+    int           frame_tail;
+    int           frames_dropped;
+
+    /* horus_multi_push_samples(), filling nin blocks */
+    COMP         *push_buf;
+    int           push_len;
+    struct horus_input *dec;           /* input to the demod rate, shared by the channels      */
+    struct horus_input *input;
+
+    /* one squelch for all the channels, which keep HORUS_PREROLL_SAMPLES in buf while it is closed */
+    struct squelch *squelch;
+    int           squelch_closed;
+
+    /* 4FSK signals followed, signal 0 is the strongest when the channels are opened, and always followed */
+    int           nmodes;              /* channels of signal 0, the modes asked for             */
+    int           nsignals;
+    int           signal[HORUS_MULTI_MAX_CHANNELS];                /* of each channel            */
+    float         sig_tones[HORUS_MULTI_MAX_SIGNALS][MODE_M_MAX];
+    int           sig_gen[HORUS_MULTI_MAX_SIGNALS];
+    int           sig_seen[HORUS_MULTI_MAX_SIGNALS];   /* frames in a row, followed from HORUS_MULTI_CONFIRM */
+    int           sig_missed[HORUS_MULTI_MAX_SIGNALS]; /* frames since it was last seen                    */
+};
+
+struct horus_multi *horus_multi_open (int nmodes, const int modes[]) {
+    int i, m, n, max_nin;
+    struct FSK *fsk, *mfsk;
+
+    assert((nmodes > 0) && (nmodes <= HORUS_MULTI_MAX_CHANNELS));
+
+    struct horus_multi *hm = (struct horus_multi *)malloc(sizeof(struct horus_multi));
+    assert(hm != NULL);
+
+    hm->nchan = nmodes;
+    hm->nmodes = nmodes;
+    hm->verbose = 0;
+    hm->nin = 0;
+    max_nin = 0;
+    for (i=0; i<nmodes; i++) {
+        hm->chan[i] = horus_open(modes[i]);
+        hm->ascii_out[i] = (char*)malloc(horus_get_max_ascii_out_len(hm->chan[i]));
+        assert(hm->ascii_out[i] != NULL);
+        hm->ascii_out[i][0] = 0;
+        hm->pos[i] = 0;
+        hm->signal[i] = 0;
+
+        /* read in blocks of the fastest frame rate, no slower than any single mode */
+        fsk = hm->chan[i]->fsk;
+        if ((hm->nin == 0) || (fsk->N < hm->nin))
+            hm->nin = fsk->N;
+        if (fsk->N + fsk->Ts / 2 > max_nin)
+            max_nin = fsk->N + fsk->Ts / 2;
+    }
+
+    hm->est = fsk_create(HORUS_DEMOD_SAMPLERATE, HORUS_BINARY_SYMBOLRATE, 4, 1000, 1.2f*HORUS_BINARY_SYMBOLRATE);
+    assert(hm->est != NULL);
+    fsk_set_est_limits(hm->est, hm->est->est_min, HORUS_MAX_FREQUENCY);
+    for (m=0; m<=MODE_M_MAX; m++) {
+        hm->tones_gen[m] = 0;
+        for (i=0; i<MODE_M_MAX; i++)
+            hm->tones[m][i] = 0;
+    }
+
+    /* each channel may lag the newest block by up to a frame, and a slave by a master frame more,
+       or by the preroll while the squelch is closed */
+    hm->buf_size = hm->nin + 2 * max_nin + HORUS_PREROLL_SAMPLES;
+    hm->buf = (COMP*)malloc(sizeof(COMP) * hm->buf_size);
+    assert(hm->buf != NULL);
+    hm->buf_len = 0;
+    hm->buf_start = 0;
+    hm->push_buf = (COMP*)malloc(sizeof(COMP) * hm->nin);
+    hm->dec = horus_input_open(HORUS_BINARY_SAMPLERATE, HORUS_DEMOD_SAMPLERATE, 0.0f);
+    assert((hm->push_buf != NULL) && (hm->dec != NULL));
+    hm->push_len = 0;
+    hm->input = NULL;
+    hm->squelch = NULL;
+    hm->squelch_closed = 0;
+
+    hm->nsignals = 1;
+    for (m=0; m<HORUS_MULTI_MAX_SIGNALS; m++) {
+        for (i=0; i<MODE_M_MAX; i++)
+            hm->sig_tones[m][i] = 0;
+        hm->sig_gen[m] = 0;
+        hm->sig_seen[m] = 0;
+        hm->sig_missed[m] = 0;
+    }
+    hm->sig_seen[0] = HORUS_MULTI_CONFIRM;
+
+    /* the fastest 4FSK mode is master to any slower 4FSK mode at a submultiple of its symbol rate */
+    hm->master = hm->slave = -1;
+    hm->ratio = 0;
+    for (i=0; i<nmodes; i++) {
+        if (hm->chan[i]->mFSK != 4)
+            continue;
+        if ((hm->master == -1) || (hm->chan[i]->Rs > hm->chan[hm->master]->Rs))
+            hm->master = i;
+    }
+    for (i=0; (hm->master != -1) && (i<nmodes); i++) {
+        mfsk = hm->chan[hm->master]->fsk;
+        fsk = hm->chan[i]->fsk;
+        if ((i == hm->master) || (hm->chan[i]->mFSK != 4))
+            continue;
+        if ((fsk->Fs == mfsk->Fs) && (fsk->P == mfsk->P) && (fsk->Rs < mfsk->Rs) && ((mfsk->Rs % fsk->Rs) == 0)) {
+            hm->slave = i;
+            hm->ratio = mfsk->Rs / fsk->Rs;
+            break;
+        }
+    }
+
+    hm->ring_size = 0;
+    hm->ring_g = NULL;
+    hm->ring_gen = NULL;
+    for (m=0; m<MODE_M_MAX; m++)
+        hm->ring[m] = hm->f_int[m] = NULL;
+    hm->master_end = 0;
+    hm->master_gen = -1;
+    hm->shared_frames = hm->slave_frames = 0;
+
+    hm->deferred = 0;
+    hm->frames = NULL;
+    hm->frame_head = hm->frame_tail = 0;
+    hm->frames_dropped = 0;
+
+    if (hm->master != -1) {
+        mfsk = hm->chan[hm->master]->fsk;
+        for (m=0; m<MODE_M_MAX; m++) {
+            hm->f_int[m] = (COMP*)malloc(sizeof(COMP) * (mfsk->Nsym + 1) * mfsk->P);
+            assert(hm->f_int[m] != NULL);
+        }
+    }
+
+    if (hm->slave != -1) {
+        mfsk = hm->chan[hm->master]->fsk;
+        fsk = hm->chan[hm->slave]->fsk;
+
+        /* enough master integrators to cover a whole slave frame, and the master lead */
+        n = (fsk->Nmem + fsk->Ts + 2 * max_nin) / (mfsk->Ts / mfsk->P);
+        for (hm->ring_size = 1; hm->ring_size < n; hm->ring_size <<= 1)
+            ;
+        hm->ring_g = (long long*)malloc(sizeof(long long) * hm->ring_size);
+        hm->ring_gen = (int*)malloc(sizeof(int) * hm->ring_size);
+        assert((hm->ring_g != NULL) && (hm->ring_gen != NULL));
+        for (i=0; i<hm->ring_size; i++) {
+            hm->ring_g[i] = -1;
+            hm->ring_gen[i] = -1;
+        }
+        for (m=0; m<MODE_M_MAX; m++) {
+            hm->ring[m] = (COMP*)malloc(sizeof(COMP) * hm->ring_size);
+            assert(hm->ring[m] != NULL);
+        }
+
+        /* slave frames cannot use the master integrators before the master has produced them,
+           and the slave frame itself may need more of the slave f_int scratch */
+        for (m=0; m<MODE_M_MAX; m++) {
+            free(hm->f_int[m]);
+            n = (fsk->Nsym + 1) * fsk->P;
+            if (n < (mfsk->Nsym + 1) * mfsk->P)
+                n = (mfsk->Nsym + 1) * mfsk->P;
+            hm->f_int[m] = (COMP*)malloc(sizeof(COMP) * n);
+            assert(hm->f_int[m] != NULL);
+        }
+    }
+
+    return hm;
+}
+
+void horus_multi_close (struct horus_multi *hm) {
+    int i, m;
+    assert(hm != NULL);
+
+    if (hm->verbose && (hm->slave != -1)) {
+        fprintf(stderr, "  horus_multi: %d of %d slave frames integrated from master tones\n",
+                hm->shared_frames, hm->slave_frames);
+    }
+    for (i=0; i<hm->nchan; i++) {
+        horus_close(hm->chan[i]);
+        free(hm->ascii_out[i]);
+    }
+    for (m=0; m<MODE_M_MAX; m++) {
+        free(hm->ring[m]);
+        free(hm->f_int[m]);
+    }
+    free(hm->ring_g);
+    free(hm->ring_gen);
+    free(hm->frames);
+    free(hm->buf);
+    free(hm->push_buf);
+    horus_input_close(hm->dec);
+    horus_input_close(hm->input);
+    if (hm->squelch)
+        squelch_destroy(hm->squelch);
+    fsk_destroy(hm->est);
+    free(hm);
+}
+
+uint32_t horus_multi_nin (struct horus_multi *hm) {
+    assert(hm != NULL);
+    return hm->nin * HORUS_DECIMATION;
+}
+
+int horus_multi_get_nchannels (struct horus_multi *hm) {
+    assert(hm != NULL);
+    return hm->nchan;
+}
+
+struct horus *horus_multi_get_channel (struct horus_multi *hm, int chan) {
+    assert(hm != NULL);
+    assert((chan >= 0) && (chan < hm->nchan));
+    return hm->chan[chan];
+}
+
+const char *horus_multi_get_ascii_out (struct horus_multi *hm, int chan) {
+    assert(hm != NULL);
+    assert((chan >= 0) && (chan < hm->nchan));
+    return hm->ascii_out[chan];
+}
+
+void horus_multi_set_start_time (struct horus_multi *hm, double seconds) {
+    int i;
+
+    assert(hm != NULL);
+    for (i=0; i<hm->nchan; i++)
+        horus_set_start_time(hm->chan[i], seconds);
+}
+
+void horus_multi_set_low_latency (struct horus_multi *hm, int low_latency) {
+    int i;
+
+    assert(hm != NULL);
+    for (i=0; i<hm->nchan; i++)
+        horus_set_low_latency(hm->chan[i], low_latency);
+}
+
+/* the shared estimator's, the channels do not keep a spectrum of their own */
+void horus_multi_get_spectrum (struct horus_multi *hm, float spec[], int n, float *f_lo, float *f_hi) {
+    assert(hm != NULL);
+    fsk_get_spectrum(hm->est, spec, n, f_lo, f_hi);
+}
+
+int horus_multi_set_signals (struct horus_multi *hm, int nsignals) {
+    struct horus *from, *hstates;
+    int c, i, s, n4 = 0;
+
+    assert(hm != NULL);
+    assert((hm->nsignals == 1) && (hm->buf_start + hm->buf_len == 0));
+
+    for (c=0; c<hm->nmodes; c++)
+        n4 += hm->chan[c]->mFSK == 4;
+    if ((nsignals < 1) || (nsignals > HORUS_MULTI_MAX_SIGNALS) || (hm->nchan + n4 * (nsignals - 1) > HORUS_MULTI_MAX_CHANNELS))
+        return 0;
+
+    /* copies of the 4FSK channels, set up as they are */
+    for (s=1; s<nsignals; s++) {
+        for (c=0; c<hm->nmodes; c++) {
+            from = hm->chan[c];
+            if (from->mFSK != 4)
+                continue;
+            i = hm->nchan++;
+            hstates = hm->chan[i] = horus_open(from->mode);
+            hm->ascii_out[i] = (char*)malloc(horus_get_max_ascii_out_len(hstates));
+            assert(hm->ascii_out[i] != NULL);
+            hm->ascii_out[i][0] = 0;
+            hm->pos[i] = 0;
+            hm->signal[i] = s;
+            hstates->verbose = from->verbose;
+            hstates->start_time = from->start_time;
+            hstates->low_latency = from->low_latency;
+            hstates->callback = from->callback;
+            hstates->callback_state = from->callback_state;
+        }
+    }
+    hm->nsignals = nsignals;
+    return 1;
+}
+
+void horus_multi_set_verbose (struct horus_multi *hm, int verbose) {
+    int i;
+    assert(hm != NULL);
+    hm->verbose = verbose;
+    for (i=0; i<hm->nchan; i++)
+        horus_set_verbose(hm->chan[i], verbose);
+}
+
+void horus_multi_set_deferred (struct horus_multi *hm, int deferred) {
+    int i;
+    assert(hm != NULL);
+
+    if (deferred && (hm->frames == NULL)) {
+        for (i=0; i<hm->nchan; i++)
+            assert(hm->chan[i]->max_packet_len <= HORUS_FRAME_MAX_BITS);
+        hm->frames = (struct horus_frame*)malloc(sizeof(struct horus_frame) * HORUS_MULTI_MAX_FRAMES);
+        assert(hm->frames != NULL);
+    }
+    hm->deferred = deferred;
+}
+
+int horus_multi_get_frame (struct horus_multi *hm, struct horus_frame *frame) {
+    assert(hm != NULL);
+
+    if (hm->frame_tail == hm->frame_head)
+        return 0;
+    memcpy(frame, &hm->frames[hm->frame_tail % HORUS_MULTI_MAX_FRAMES], sizeof(struct horus_frame));
+    hm->frame_tail++;
+    return 1;
+}
+
+int horus_multi_decode (struct horus_multi *hm, const struct horus_frame *frame, char ascii_out[], struct horus_packet_time *t) {
+    struct horus *hstates;
+    uint64_t t0 = perf_now();
+    int packet;
+
+    assert(hm != NULL);
+    assert((frame->chan >= 0) && (frame->chan < hm->nchan));
+
+    /* the demod thread owns packet_sample and packet_found, the time is the frame's */
+    hstates = hm->chan[frame->chan];
+    if (t)
+        horus_packet_time_at(hstates, frame->sample, frame->found, t);
+    packet = horus_decode_packet(hstates, ascii_out, (uint8_t*)frame->bits, (float*)frame->soft_bits,
+                                 frame->nbits, frame->uw_type, frame->sample, frame->found);
+    hstates->decode_ns += perf_now() - t0;
+    return packet;
+}
+
+/* copy the packets at each unique word, to be decoded later */
+static int horus_multi_defer(struct horus_multi *hm, int c) {
+    struct horus *hstates = hm->chan[c];
+    struct horus_frame *frame;
+    int uw_loc, uw_type, nbits, ncopy, first;
+    int found = 0;
+
+    for (first=1; (uw_loc = horus_next_packet(hstates, first, &uw_type, &nbits)) != -1; first=0) {
+        if (hm->frame_head - hm->frame_tail == HORUS_MULTI_MAX_FRAMES) {
+            hm->frames_dropped++;
+            continue;
+        }
+
+        frame = &hm->frames[hm->frame_head % HORUS_MULTI_MAX_FRAMES];
+        frame->chan = c;
+        frame->uw_type = uw_type;
+        frame->nbits = nbits;
+        frame->sample = hstates->packet_sample;
+        frame->found = hstates->packet_found;
+        ncopy = hstates->rx_bits_len - uw_loc;
+        if (ncopy > hstates->max_packet_len)
+            ncopy = hstates->max_packet_len;
+        memcpy(frame->bits, &hstates->rx_bits[uw_loc], ncopy);
+        memcpy(frame->soft_bits, &hstates->soft_bits[uw_loc], sizeof(float) * ncopy);
+        hm->frame_head++;
+        found = 1;
+    }
+    return found;
+}
+
+/* keep the integrators of a master frame, indexed by the stream index of the end of each window */
+static void horus_multi_store_master(struct horus_multi *hm, long long pos, int nin, int gen) {
+    struct FSK *fsk = hm->chan[hm->master]->fsk;
+    int step = fsk->Ts / fsk->P;
+    long long e0 = pos - (fsk->Nmem - nin) + fsk->Ts;
+    int i, m, slot, tag;
+    long long e;
+
+    if (e0 % step)
+        return;
+
+    for (i=0; i<(fsk->Nsym + 1) * fsk->P; i++) {
+        e = e0 + (long long)i * step;
+        slot = (int)((e / step) & (hm->ring_size - 1));
+        /* windows reaching back into the last frame were downconverted at its tone frequencies */
+        tag = ((e - fsk->Ts < pos) && (gen != hm->master_gen)) ? -1 : gen;
+        for (m=0; m<fsk->mode; m++)
+            hm->ring[m][slot] = hm->f_int[m][i];
+        hm->ring_g[slot] = e / step;
+        hm->ring_gen[slot] = tag;
+    }
+}
+
+/* sum the slave integrators from master windows, returns 0 if the tones did not line up */
+static int horus_multi_sum_slave(struct horus_multi *hm, long long pos, int gen) {
+    struct FSK *mfsk = hm->chan[hm->master]->fsk;
+    struct FSK *fsk = hm->chan[hm->slave]->fsk;
+    int step = mfsk->Ts / mfsk->P;
+    long long e0 = pos - (fsk->Nmem - fsk->nin) + fsk->Ts;
+    int i, k, m, slot;
+    long long e, g;
+
+    if (e0 % step)
+        return 0;
+
+    for (i=0; i<(fsk->Nsym + 1) * fsk->P; i++) {
+        for (m=0; m<fsk->mode; m++)
+            hm->f_int[m][i] = comp0();
+        for (k=0; k<hm->ratio; k++) {
+            e = e0 + (long long)i * (fsk->Ts / fsk->P) - (long long)k * mfsk->Ts;
+            g = e / step;
+            slot = (int)(g & (hm->ring_size - 1));
+            if ((g < 0) || (hm->ring_g[slot] != g) || (hm->ring_gen[slot] != gen))
+                return 0;
+            for (m=0; m<fsk->mode; m++)
+                hm->f_int[m][i] = cadd(hm->f_int[m][i], hm->ring[m][slot]);
+        }
+    }
+    return 1;
+}
+
+/* run one demod frame of channel c from the buffer, returns 1 if a packet was found */
+static int horus_multi_frame(struct horus_multi *hm, int c) {
+    struct horus *hstates = hm->chan[c];
+    struct FSK *fsk = hstates->fsk;
+    int Nbits = fsk->Nbits;
+    int rx_bits_len = hstates->rx_bits_len;
+    int nin = fsk->nin;
+    int M = hstates->mFSK;
+    long long pos = hm->pos[c];
+    COMP *in = &hm->buf[pos - hm->buf_start];
+    uint8_t *rx_bits = &hstates->rx_bits[rx_bits_len - Nbits];
+    float *soft_bits = &hstates->soft_bits[rx_bits_len - Nbits];
+    uint64_t t0 = perf_now();
+    int packet;
+
+    horus_shift_bits(hstates);
+
+    if (c == hm->master) {
+        fsk2_demod_tones(fsk, rx_bits, soft_bits, in, hm->tones[M], hm->f_int);
+        if (hm->slave != -1) {
+            horus_multi_store_master(hm, pos, nin, hm->tones_gen[M]);
+        }
+        hm->master_gen = hm->tones_gen[M];
+        hm->master_end = pos + nin;
+    } else if ((c == hm->slave) && horus_multi_sum_slave(hm, pos, hm->tones_gen[M])) {
+        fsk2_demod_integrated(fsk, rx_bits, soft_bits, in, hm->tones[M], hm->f_int);
+        hm->shared_frames++;
+    } else {
+        fsk2_demod_tones(fsk, rx_bits, soft_bits, in, hm->signal[c] ? hm->sig_tones[hm->signal[c]] : hm->tones[M], NULL);
+    }
+    if (c == hm->slave)
+        hm->slave_frames++;
+
+    hm->pos[c] += nin;
+    horus_frame_done(hstates, nin);
+    hstates->perf_samples += fsk->N * HORUS_DECIMATION;
+
+    if (hm->deferred)
+        packet = horus_multi_defer(hm, c);
+    else
+        packet = horus_find_packet(hstates, hm->ascii_out[c]);
+    perf_add(&hstates->perf[PERF_FRAME], perf_now() - t0);
+    return packet;
+}
+
+/* drop the samples every channel has finished with */
+static void horus_multi_drop(struct horus_multi *hm) {
+    long long oldest = hm->buf_start + hm->buf_len;
+    int c, i;
+
+    for (c=0; c<hm->nchan; c++)
+        if (hm->pos[c] < oldest)
+            oldest = hm->pos[c];
+    if (oldest > hm->buf_start) {
+        i = (int)(oldest - hm->buf_start);
+        memmove(hm->buf, &hm->buf[i], sizeof(COMP) * (hm->buf_len - i));
+        hm->buf_len -= i;
+        hm->buf_start = oldest;
+    }
+}
+
+/* move channel c on to the last HORUS_PREROLL_SAMPLES before end, without demodulating */
+static void horus_multi_hold(struct horus_multi *hm, int c, long long end) {
+    struct horus *hstates = hm->chan[c];
+    int nin = hstates->fsk->nin;
+
+    while (hm->pos[c] + nin <= end - HORUS_PREROLL_SAMPLES) {
+        hm->pos[c] += nin;
+        hstates->sample_pos += (uint64_t)nin * HORUS_DECIMATION;
+        hstates->perf_samples += (uint64_t)nin * HORUS_DECIMATION;
+    }
+}
+
+/* channel c picks up from where it was held, with the bits and estimates of the last signal forgotten */
+static void horus_multi_restart(struct horus_multi *hm, int c, long long end) {
+    struct horus *hstates = hm->chan[c];
+
+    horus_squelch_reset(hstates);
+    hstates->replay_end = hstates->sample_pos + (uint64_t)(end - hm->pos[c]) * HORUS_DECIMATION;
+}
+
+/* Squelch on the newest hm->nin samples.  While it is closed, the channels
+   skip their frames, bar the last HORUS_PREROLL_SAMPLES.  When it opens,
+   they are reset, and the estimator starts again from the preroll, which
+   returns the number of samples it covers. */
+static int horus_multi_squelch(struct horus_multi *hm) {
+    long long end = hm->buf_start + hm->buf_len;
+    uint64_t t0 = perf_now(), t;
+    int c, open;
+
+    open = squelch_process(hm->squelch, &hm->buf[hm->buf_len - hm->nin], hm->nin);
+    t = perf_now() - t0;
+    perf_add(&hm->chan[0]->perf[PERF_SQUELCH], t);
+    hm->chan[0]->perf_extra_ns += t;
+
+    if (!open) {
+        for (c=0; c<hm->nchan; c++)
+            horus_multi_hold(hm, c, end);
+        hm->squelch_closed = 1;
+        horus_multi_drop(hm);
+        return 0;
+    }
+    if (!hm->squelch_closed)
+        return hm->nin;
+
+    hm->squelch_closed = 0;
+    for (c=0; c<hm->nchan; c++)
+        horus_multi_restart(hm, c, end);
+    fsk_clear_estimators(hm->est);
+    return hm->buf_len;
+}
+
+static void horus_multi_set_tones(struct horus_multi *hm, int s, const float f[]) {
+    int i, changed = 0;
+
+    for (i=0; i<4; i++) {
+        if (f[i] != hm->sig_tones[s][i])
+            changed = 1;
+        hm->sig_tones[s][i] = f[i];
+    }
+    hm->sig_gen[s] += changed;
+}
+
+/* Match the 4FSK tone sets in the spectrum to the signals followed, by
+   their lowest tone, strongest first.  Signal 0 takes the strongest set
+   left if it lost its own.  A new set needs HORUS_MULTI_CONFIRM frames in
+   a row before its channels start, so a burst of noise does not start
+   them, and a signal not seen for HORUS_MULTI_SIGNAL_HOLD is dropped.
+   The tones of signal 0 are returned in f_est[]. */
+static void horus_multi_signals(struct horus_multi *hm, float f_est[]) {
+    float f[HORUS_MULTI_MAX_SIGNALS][MODE_M_MAX], score[HORUS_MULTI_MAX_SIGNALS];
+    int taken[HORUS_MULTI_MAX_SIGNALS], claimed[HORUS_MULTI_MAX_SIGNALS];
+    long long end = hm->buf_start + hm->buf_len;
+    int n, k, s, c, i;
+
+    n = fsk_est_tone_sets(hm->est, f, score, hm->nsignals, HORUS_MULTI_DETECT);
+    for (k=0; k<n; k++)
+        taken[k] = 0;
+    for (s=0; s<hm->nsignals; s++)
+        claimed[s] = 0;
+
+    for (k=0; k<n; k++) {
+        for (s=0; s<hm->nsignals; s++) {
+            if (!claimed[s] && hm->sig_seen[s] && (fabsf(f[k][0] - hm->sig_tones[s][0]) <= HORUS_MULTI_SIGNAL_TOL)) {
+                horus_multi_set_tones(hm, s, f[k]);
+                claimed[s] = taken[k] = 1;
+                break;
+            }
+        }
+    }
+    for (k=0; (k<n) && !claimed[0]; k++) {
+        if (!taken[k]) {
+            horus_multi_set_tones(hm, 0, f[k]);
+            claimed[0] = taken[k] = 1;
+        }
+    }
+    for (k=0; k<n; k++) {
+        for (s=1; !taken[k] && (score[k] >= HORUS_MULTI_DETECT) && (s<hm->nsignals); s++) {
+            if (!hm->sig_seen[s]) {
+                horus_multi_set_tones(hm, s, f[k]);
+                claimed[s] = taken[k] = 1;
+            }
+        }
+    }
+
+    for (s=1; s<hm->nsignals; s++) {
+        if (claimed[s]) {
+            hm->sig_missed[s] = 0;
+            if (hm->sig_seen[s] == HORUS_MULTI_CONFIRM)
+                continue;
+            if (++hm->sig_seen[s] < HORUS_MULTI_CONFIRM)
+                continue;
+            for (c=0; c<hm->nchan; c++)
+                if (hm->signal[c] == s)
+                    horus_multi_restart(hm, c, end);
+            if (hm->verbose)
+                fprintf(stderr, "  horus_multi: signal %d at %.0f Hz\n", s, hm->sig_tones[s][0]);
+        } else if (hm->sig_seen[s] < HORUS_MULTI_CONFIRM) {
+            hm->sig_seen[s] = 0;
+        } else if ((long long)++hm->sig_missed[s] * hm->nin > HORUS_MULTI_SIGNAL_HOLD) {
+            hm->sig_seen[s] = 0;
+            if (hm->verbose)
+                fprintf(stderr, "  horus_multi: signal %d lost\n", s);
+        }
+    }
+
+    for (i=0; i<4; i++)
+        f_est[i] = hm->sig_tones[0][i];
+}
+
+/* demodulate the newest hm->nin samples at the end of the buffer */
+static int horus_multi_process(struct horus_multi *hm) {
+    int i, c, m, packets, changed;
+    float f_est[MODE_M_MAX];
+    long long end = hm->buf_start + hm->buf_len;
+    int nest = hm->nin;
+    uint64_t t0, t;
+
+    if (hm->squelch && ((nest = horus_multi_squelch(hm)) == 0))
+        return 0;
+
+    /* one spectrum for every channel, and one set of tones per tone count,
+       charged to the first channel */
+    t0 = perf_now();
+    fsk_est_spectrum(hm->est, &hm->buf[hm->buf_len - nest], nest);
+    for (m=2; m<=MODE_M_MAX; m+=2) {
+        for (c=0; c<hm->nchan; c++)
+            if (hm->chan[c]->mFSK == m)
+                break;
+        if (c == hm->nchan)
+            continue;
+        if ((m == 4) && (hm->nsignals > 1))
+            horus_multi_signals(hm, f_est);
+        else
+            fsk_est_tones(hm->est, f_est, m);
+        changed = 0;
+        for (i=0; i<m; i++) {
+            if (f_est[i] != hm->tones[m][i])
+                changed = 1;
+            hm->tones[m][i] = f_est[i];
+        }
+        hm->tones_gen[m] += changed;
+    }
+    t = perf_now() - t0;
+    perf_add(&hm->chan[0]->perf[PERF_EST], t);
+    hm->chan[0]->perf_extra_ns += t;
+
+    /* master first, so the slave can use its integrators */
+    packets = 0;
+    for (i=-1; i<hm->nchan; i++) {
+        c = (i == -1) ? hm->master : i;
+        if ((c == -1) || ((i != -1) && (c == hm->master)))
+            continue;
+        if (hm->sig_seen[hm->signal[c]] < HORUS_MULTI_CONFIRM) {
+            horus_multi_hold(hm, c, end);
+            continue;
+        }
+        while (hm->pos[c] + (long long)hm->chan[c]->fsk->nin <= end) {
+            if ((c == hm->slave) && (hm->pos[c] + hm->chan[c]->fsk->nin > hm->master_end))
+                break;
+            if (horus_multi_frame(hm, c))
+                packets |= 1 << c;
+        }
+    }
+
+    horus_multi_drop(hm);
+    return packets;
+}
+
+/* the next horus_multi_nin() samples at the input rate */
+static int horus_multi_rx_block(struct horus_multi *hm, const void *samples, int format) {
+    int nin = hm->nin * HORUS_DECIMATION;
+    long pos = 0;
+    int k;
+
+    assert(hm->push_len == 0);
+    while (pos < nin) {
+        k = horus_input_block(hm->dec, samples, &pos, nin, format);
+        assert(hm->buf_len + k <= hm->buf_size);
+        memcpy(&hm->buf[hm->buf_len], hm->dec->out, sizeof(COMP) * k);
+        hm->buf_len += k;
+    }
+    return horus_multi_process(hm);
+}
+
+int horus_multi_rx(struct horus_multi *hm, short demod_in[]) {
+    assert(hm != NULL);
+    return horus_multi_rx_block(hm, demod_in, HORUS_FORMAT_S16);
+}
+
+int horus_multi_rx_comp(struct horus_multi *hm, short demod_in_iq[]) {
+    assert(hm != NULL);
+    return horus_multi_rx_block(hm, demod_in_iq, HORUS_FORMAT_S16_IQ);
+}
+
+int horus_multi_set_squelch(struct horus_multi *hm, int squelch) {
+    struct horus *hstates;
+    int c, Rs = 0, hang = 0;
+
+    assert(hm != NULL);
+    if (hm->squelch) {
+        squelch_destroy(hm->squelch);
+        hm->squelch = NULL;
+        hm->squelch_closed = 0;
+    }
+    if (!squelch)
+        return 1;
+
+    /* the narrowest mode, and the longest packet */
+    for (c=0; c<hm->nchan; c++) {
+        hstates = hm->chan[c];
+        if ((Rs == 0) || (hstates->Rs < Rs))
+            Rs = hstates->Rs;
+        if (horus_squelch_hang(hstates) > hang)
+            hang = horus_squelch_hang(hstates);
+    }
+    hm->squelch = squelch_create(HORUS_DEMOD_SAMPLERATE, Rs, hm->est->est_min, hm->est->est_max);
+    if (hm->squelch == NULL)
+        return 0;
+    squelch_set_hang(hm->squelch, hang);
+    return 1;
+}
+
+int horus_multi_get_squelch_open(struct horus_multi *hm) {
+    assert(hm != NULL);
+    return !hm->squelch_closed;
+}
+
+int horus_multi_set_input_rate(struct horus_multi *hm, int Fs, float shift_hz) {
+    assert(hm != NULL);
+    horus_input_close(hm->input);
+    hm->input = NULL;
+    if ((Fs == HORUS_BINARY_SAMPLERATE) && (shift_hz == 0.0f))
+        return 1;
+    hm->input = horus_input_open(Fs, HORUS_DEMOD_SAMPLERATE, shift_hz);
+    return hm->input != NULL;
+}
+
+int horus_multi_push_samples(struct horus_multi *hm, const void *samples, int n, int format) {
+    struct horus_input *input;
+    long pos = 0;
+    int c, i, k, m, mask, packets = 0;
+
+    assert(hm != NULL);
+    assert((format >= HORUS_FORMAT_S16) && (format <= HORUS_FORMAT_U8_IQ));
+
+    input = hm->input ? hm->input : hm->dec;
+    while (pos < n) {
+        k = horus_input_block(input, samples, &pos, n, format);
+        for (i=0; i<k; i+=m) {
+            m = hm->nin - hm->push_len;
+            if (m > k - i)
+                m = k - i;
+            memcpy(&hm->push_buf[hm->push_len], &input->out[i], sizeof(COMP) * m);
+            hm->push_len += m;
+            if (hm->push_len < hm->nin)
+                continue;
+            hm->push_len = 0;
+
+            assert(hm->buf_len + hm->nin <= hm->buf_size);
+            memcpy(&hm->buf[hm->buf_len], hm->push_buf, sizeof(COMP) * hm->nin);
+            hm->buf_len += hm->nin;
+            mask = horus_multi_process(hm);
+            for (c=0; (c<hm->nchan) && !hm->deferred; c++) {
+                if ((mask & (1 << c)) && hm->chan[c]->callback)
+                    hm->chan[c]->callback(hm->chan[c]->callback_state, hm->chan[c], hm->ascii_out[c]);
+            }
+            packets |= mask;
+        }
+    }
+    return packets;
+}
+
+static const char *perf_names[PERF_STAGES] = {
+    "freq_est", "integrate", "timing", "find_uw", "fec", "crc", "frame", "squelch"
+};
+
+void horus_get_perf_stats(struct horus *hstates, struct horus_perf_stats *stats) {
+    struct perf_timer *t;
+    struct FSK *fsk;
+    uint64_t cpu_ns, frames;
+    int i;
+
+    assert(hstates != NULL);
+    assert(PERF_STAGES == HORUS_PERF_STAGES);
+    assert(PERF_FEC == HORUS_PERF_FEC);
+
+    for (i=0; i<PERF_STAGES; i++) {
+        t = &hstates->perf[i];
+        stats->stage[i].name = perf_names[i];
+        stats->stage[i].count = t->count;
+        stats->stage[i].mean_us = t->count ? 1E-3 * t->total_ns / t->count : 0.0;
+        stats->stage[i].p50_us = 1E-3 * perf_percentile(t, 0.50);
+        stats->stage[i].p99_us = 1E-3 * perf_percentile(t, 0.99);
+        stats->stage[i].max_us = 1E-3 * perf_max(t);
+    }
+
+    cpu_ns = hstates->perf[PERF_FRAME].total_ns + hstates->perf_extra_ns + hstates->decode_ns;
+    stats->audio_s = (float)hstates->perf_samples / hstates->Fs;
+    stats->cpu_s = 1E-9 * cpu_ns;
+    stats->rtf = cpu_ns ? stats->audio_s / stats->cpu_s : 0.0;
+    stats->ldpc_decodes = hstates->ldpc_decodes;
+    stats->ldpc_iterations = hstates->ldpc_decodes ? (float)hstates->ldpc_iterations / hstates->ldpc_decodes : 0.0;
+    stats->latency_s = hstates->good_crc ? (float)hstates->latency_samples / hstates->good_crc / hstates->Fs : 0.0;
+
+    fsk = hstates->fsk;
+    frames = fsk->est_searches + fsk->est_skipped;
+    stats->est_interval = fsk->est_track ? fsk->est_every : 1;
+    stats->est_searched = frames ? (float)fsk->est_searches / frames : 1.0;
+    stats->est_saved_s = fsk->est_searches ? 1E-9 * fsk->est_search_ns * fsk->est_skipped / fsk->est_searches : 0.0;
+}
+
 int horus_get_version(void) {
     return HORUS_API_VERSION;
 }
@@ -559,8 +1922,22 @@ int horus_get_max_ascii_out_len(struct horus *hstates) {
     return 0;
 }
 
+void horus_set_start_time(struct horus *hstates, double seconds) {
+    assert(hstates != NULL);
+    hstates->start_time = seconds;
+}
+
+void horus_get_packet_time(struct horus *hstates, struct horus_packet_time *t) {
+    assert(hstates != NULL);
+    horus_packet_time_at(hstates, hstates->packet_sample, hstates->packet_found, t);
+}
+
+int horus_get_max_packet_samples(struct horus *hstates) {
+    assert(hstates != NULL);
+    return hstates->rx_bits_len / hstates->fsk->Nbits * hstates->fsk->N * HORUS_DECIMATION;
+}
+
 void horus_get_modem_stats(struct horus *hstates, int *sync, float *snr_est) {
-    struct MODEM_STATS stats;
     assert(hstates != NULL);
 
     /* TODO set sync if UW found "recently", but WTF is recently? Maybe need a little state 
@@ -570,8 +1947,7 @@ void horus_get_modem_stats(struct horus *hstates, int *sync, float *snr_est) {
     
     /* SNR scaled from Eb/No est returned by FSK to SNR in each symbol bandwidth*/
 
-    fsk_get_demod_stats(hstates->fsk, &stats);
-    *snr_est = stats.snr_est;
+    *snr_est = hstates->fsk->stats->snr_est;
 }
 
 void horus_get_modem_extended_stats (struct horus *hstates, struct MODEM_STATS *stats) {
@@ -591,11 +1967,39 @@ void horus_get_modem_extended_stats (struct horus *hstates, struct MODEM_STATS *
     }
 }
 
+void horus_get_spectrum(struct horus *hstates, float spec[], int n, float *f_lo, float *f_hi) {
+    assert(hstates != NULL);
+    fsk_get_spectrum(hstates->fsk, spec, n, f_lo, f_hi);
+}
+
 void horus_set_verbose(struct horus *hstates, int verbose) {
     assert(hstates != NULL);
     hstates->verbose = verbose;
 }
 
+int horus_set_engine(struct horus *hstates, int engine) {
+    struct FSK *old, *fsk;
+
+    assert(hstates != NULL);
+    old = hstates->fsk;
+    fsk = fsk_create_engine(old->Fs, old->Rs, old->mode, old->P, old->f1_tx, old->fs_tx,
+                            engine == HORUS_ENGINE_STFT ? FSK_ENGINE_STFT : FSK_ENGINE_MIXER);
+    if (fsk == NULL)
+        return 0;
+    fsk_set_est_limits(fsk, old->est_min, old->est_max);
+    fsk_enable_tracking(fsk, old->est_tracking);
+    fsk->perf = old->perf;
+    fsk_destroy(old);
+    hstates->fsk = fsk;
+    return 1;
+}
+
+void horus_set_low_latency(struct horus *hstates, int low_latency) {
+    assert(hstates != NULL);
+    hstates->low_latency = low_latency;
+    hstates->npending = 0;
+}
+
 int horus_crc_ok(struct horus *hstates) {
     assert(hstates != NULL);
     return hstates->crc_ok;
@@ -31,6 +31,7 @@
 #endif
 
 #ifndef __HORUS_API__
+#define __HORUS_API__
 
 #include <stdint.h>
 #include "comp.h"
@@ -41,6 +42,9 @@
 #define HORUS_MODE_LDPC              2
 #define HORUS_MODE_PITS              3
 
+#define HORUS_ENGINE_MIXER           0
+#define HORUS_ENGINE_STFT            1
+
 struct horus;
 struct MODEM_STATS;
 
@@ -56,12 +60,61 @@ uint32_t      horus_nin   (struct horus *hstates);
 int           horus_rx         (struct horus *hstates, char ascii_out[], short demod_in[]);
 int           horus_rx_comp    (struct horus *hstates, char ascii_out[], short demod_in_iq[]);
 int           horus_demod_comp (struct horus *hstates, char ascii_out[], COMP demod_in_comp[]);
-int           horus_bad_crc    (void);
-int           horus_quality    (void);
+
+/* Streaming input: any number of samples at a time, in any of these
+   formats.  Samples are kept until there are enough for a demod frame,
+   as many frames as they make are run, and each packet received is
+   passed to the callback, if set.  Returns the number of packets.  As
+   with horus_rx(), the level of the samples does not matter. */
+
+#define HORUS_FORMAT_S16             0      /* int16 real                         */
+#define HORUS_FORMAT_S16_IQ          1      /* int16 I,Q pairs                    */
+#define HORUS_FORMAT_F32             2      /* float real                         */
+#define HORUS_FORMAT_F32_IQ          3      /* float I,Q pairs, as COMP           */
+#define HORUS_FORMAT_U8_IQ           4      /* uint8 I,Q pairs, as from rtl_sdr  */
+
+typedef void (*horus_packet_callback)(void *state, struct horus *hstates, const char *ascii_out);
+
+void          horus_set_packet_callback (struct horus *hstates, horus_packet_callback callback, void *state);
+int           horus_push_samples        (struct horus *hstates, const void *samples, int n, int format);
+
+/* Pushed samples at another rate, such as I/Q from an SDR, are shifted by
+   -shift_hz (the offset of the signal from the centre) and converted
+   straight to the demod rate, a quarter of horus_get_Fs(), on the way in.
+   Returns 0 if out of memory. */
+
+int           horus_set_input_rate      (struct horus *hstates, int Fs, float shift_hz);
+
+/* packets that failed their CRC, and the quality of the last, 0 to 100 */
+
+int           horus_bad_crc             (struct horus *hstates);
+int           horus_quality             (struct horus *hstates);
 
 /* set verbose level */
       
 void horus_set_verbose(struct horus *hstates, int verbose);
+
+/* Low latency: look for unique words in the newest bits, and decode each
+   packet as soon as its last bit is in, rather than when the longest
+   packet would be.  Off by default. */
+
+void horus_set_low_latency(struct horus *hstates, int low_latency);
+
+/* Squelch: while there is no signal, only a cheap detector is run on
+   each frame, and the last few seconds of samples are kept.  When a
+   signal shows up, they are demodulated first, so that a packet that
+   started before the detector saw it is not lost.  As with horus_rx(),
+   one packet at most is returned for each call.  Off by default,
+   returns 0 if out of memory. */
+
+int  horus_set_squelch(struct horus *hstates, int squelch);
+int  horus_get_squelch_open(struct horus *hstates);
+
+/* The demod engine, before the first samples: HORUS_ENGINE_MIXER (the
+   default), or HORUS_ENGINE_STFT, see fsk_create_engine() in fsk.h.
+   Returns 0 if out of memory. */
+
+int  horus_set_engine(struct horus *hstates, int engine);
       
 /* functions to get information from API  */
       
@@ -72,6 +125,12 @@ int           horus_get_mFSK                 (struct horus *hstates);
 void          horus_get_modem_stats          (struct horus *hstates, int *sync, float *snr_est);
 void          horus_get_modem_extended_stats (struct horus *hstates, struct MODEM_STATS *stats);
 int           horus_crc_ok                   (struct horus *hstates);
+
+/* The averaged spectrum the tones are searched for in, as n bins from *f_lo
+   to *f_hi Hz, for a display.  Each bin is the largest of the estimator's
+   bins it covers, linear magnitudes.  f_lo and f_hi may be NULL. */
+
+void          horus_get_spectrum             (struct horus *hstates, float spec[], int n, float *f_lo, float *f_hi);
 int           horus_get_total_payload_bits   (struct horus *hstates);
 void          horus_set_total_payload_bits   (struct horus *hstates, int val);
 
@@ -80,6 +139,135 @@ void          horus_set_total_payload_bits   (struct horus *hstates, int val);
 int           horus_get_max_demod_in         (struct horus *hstates);
 int           horus_get_max_ascii_out_len    (struct horus *hstates);
 
+/* Where the last packet was in the input.  Samples are counted from the
+   first one passed in, and times are that plus the start time, which is
+   0 unless set, so seconds into the stream, or since the epoch. */
+
+struct horus_packet_time {
+    uint64_t    sample;             /* first sample of the unique word         */
+    uint64_t    found;              /* samples passed in when it was found     */
+    double      time;               /* of sample                               */
+    double      found_time;         /* of found                                */
+};
+
+void          horus_set_start_time           (struct horus *hstates, double seconds);
+void          horus_get_packet_time          (struct horus *hstates, struct horus_packet_time *t);
+
+/* audio from the start of the longest packet until it is decoded */
+
+int           horus_get_max_packet_samples   (struct horus *hstates);
+
+/* index of the best unique word match in the first n bits of the buffer, or -1 */
+
+int           horus_find_uw                  (struct horus *hstates, int n);
+
+/* Time taken by each stage of the demodulator and decoder.  The
+   percentiles and maximum follow the last thousand or so calls, counts
+   and means are for the whole run.  rtf is the real time factor, seconds
+   of audio demodulated per second of CPU, which includes the audio
+   skipped by the squelch.  With horus_multi, the shared frequency
+   estimator and squelch are charged to the first channel, and it searches
+   every frame. */
+
+#define HORUS_PERF_STAGES 8
+#define HORUS_PERF_FEC    4            /* stage[] of the Golay or LDPC decoder */
+
+struct horus_perf_stage {
+    const char *name;                  /* freq_est, integrate, timing, find_uw, fec, crc, frame, squelch */
+    uint64_t    count;
+    float       mean_us;
+    float       p50_us;
+    float       p99_us;
+    float       max_us;
+};
+
+struct horus_perf_stats {
+    struct horus_perf_stage stage[HORUS_PERF_STAGES];
+    float       audio_s;
+    float       cpu_s;
+    float       rtf;
+    uint64_t    ldpc_decodes;
+    float       ldpc_iterations;    /* mean per LDPC decode */
+    float       latency_s;          /* mean from the unique word to decoding, of good packets */
+    int         est_interval;       /* frames between searches of the spectrum now, 1 unless the tones are followed */
+    float       est_searched;       /* share of the frames the spectrum was searched in */
+    float       est_saved_s;        /* CPU the frames not searched would have taken */
+};
+
+void          horus_get_perf_stats           (struct horus *hstates, struct horus_perf_stats *stats);
+
+/* Multi-mode receiver: several modes decoded from one input stream, sharing
+   one frequency estimator.  Input is passed in blocks of horus_multi_nin()
+   samples, which does not change.  horus_multi_rx() returns a bit mask of
+   the channels that found a packet, get the packet of each channel with
+   horus_multi_get_ascii_out(). */
+
+#define HORUS_MULTI_MAX_CHANNELS 8
+#define HORUS_MULTI_MAX_SIGNALS  4
+
+struct horus_multi;
+
+struct horus_multi *horus_multi_open          (int nmodes, const int modes[]);
+void                horus_multi_close         (struct horus_multi *hm);
+uint32_t            horus_multi_nin           (struct horus_multi *hm);
+int                 horus_multi_rx            (struct horus_multi *hm, short demod_in[]);
+int                 horus_multi_rx_comp       (struct horus_multi *hm, short demod_in_iq[]);
+int                 horus_multi_get_nchannels (struct horus_multi *hm);
+struct horus       *horus_multi_get_channel   (struct horus_multi *hm, int chan);
+const char         *horus_multi_get_ascii_out (struct horus_multi *hm, int chan);
+void                horus_multi_set_verbose   (struct horus_multi *hm, int verbose);
+void                horus_multi_set_start_time(struct horus_multi *hm, double seconds);
+void                horus_multi_set_low_latency(struct horus_multi *hm, int low_latency);
+void                horus_multi_get_spectrum  (struct horus_multi *hm, float spec[], int n, float *f_lo, float *f_hi);
+
+/* Decode up to nsignals 4FSK signals in the passband, rather than the
+   strongest.  Each 4FSK channel is copied for each further signal, and
+   the copies are added after the channels of the modes asked for, set up
+   as they are.  Before the first samples, returns 0 if there would be
+   more than HORUS_MULTI_MAX_CHANNELS. */
+int                 horus_multi_set_signals   (struct horus_multi *hm, int nsignals);
+
+/* one squelch for all the channels, opening for the slowest mode */
+int                 horus_multi_set_squelch   (struct horus_multi *hm, int squelch);
+int                 horus_multi_get_squelch_open(struct horus_multi *hm);
+
+/* any number of samples, as horus_push_samples(), returns the bit mask of
+   the channels that found a packet, which are also passed to the callback
+   of the channel unless deferred */
+int                 horus_multi_push_samples  (struct horus_multi *hm, const void *samples, int n, int format);
+int                 horus_multi_set_input_rate(struct horus_multi *hm, int Fs, float shift_hz);
+
+/* Deferred decoding: horus_multi_rx() only finds the unique words, and
+   returns a bit mask of the channels that found one.  The packets are
+   taken with horus_multi_get_frame() and decoded with horus_multi_decode(),
+   which may run on another thread to the demodulator.  It fills t, if not
+   NULL, with the time of the frame's packet; horus_get_packet_time() is
+   the demodulator's latest unique word, which may be a later one.
+
+   With the decoder on its own thread, horus_bad_crc() and horus_quality()
+   may be called from any thread.  horus_get_packet_time(), the modem stats
+   and the spectrum are the demodulator's, horus_crc_ok() and the payload
+   bits the decoder's.  horus_get_perf_stats() reads the timers of both, so
+   call it once they have stopped. */
+
+#define HORUS_FRAME_MAX_BITS     1024
+#define HORUS_MULTI_MAX_FRAMES   8
+
+struct horus_frame {
+    int     chan;                           /* channel that found the packet      */
+    int     uw_type;                        /* which unique word                  */
+    int     nbits;                          /* bits from the unique word onwards  */
+    uint64_t sample;                        /* as struct horus_packet_time        */
+    uint64_t found;
+    uint8_t bits[HORUS_FRAME_MAX_BITS];
+    float   soft_bits[HORUS_FRAME_MAX_BITS];
+};
+
+void                horus_multi_set_deferred  (struct horus_multi *hm, int deferred);
+int                 horus_multi_get_frame     (struct horus_multi *hm, struct horus_frame *frame);
+int                 horus_multi_decode        (struct horus_multi *hm, const struct horus_frame *frame, char ascii_out[],
+                                               struct horus_packet_time *t);
+
 #endif
 
 #ifdef __cplusplus
@@ -0,0 +1,428 @@
+/*---------------------------------------------------------------------------*\
+
+  FILE........: horus_bench.c
+
+  Microbenchmarks for the DSP and FEC kernels of the Horus modem.
+
+  Every kernel is run on fixed synthetic input, from a seeded generator,
+  so that results can be compared between commits and machines.  Each
+  benchmark has warm-up runs, then a number of timed runs of many calls,
+  and reports the cost of one call from the fastest and the median run.
+  Time is read from the CPU time stamp counter where there is one, else
+  in ns from the monotonic clock.  Results go to stdout as JSON.
+
+    $ make bench
+    $ ./horus_bench [label] > results.json
+
+\*---------------------------------------------------------------------------*/
+
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "horus_api.h"
+#include "fsk.h"
+#include "horus_l2.h"
+#include "golay23.h"
+#include "mpdecode.h"
+#include "phi0.h"
+#include "perf.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define BENCH_CLOCK "tsc"
+static inline uint64_t bench_ticks(void) {
+    _mm_lfence();
+    return __rdtsc();
+}
+#else
+#define BENCH_CLOCK "ns"
+static inline uint64_t bench_ticks(void) {
+    return perf_now();
+}
+#endif
+
+#define BENCH_WARMUP  3             /* untimed runs */
+#define BENCH_RUNS   21             /* timed runs, the median is reported */
+#define BENCH_FRAMES 64             /* modem frames of synthetic signal */
+#define BENCH_SNR_DB 10.0           /* Eb/No of the synthetic signal */
+#define BENCH_FS     12000          /* the demod rate, a quarter of horus_get_Fs() */
+#define BENCH_SEED   0x5eed1234abcdULL
+
+/* a kernel, called with the index of the call within a run */
+typedef void (*bench_fn)(void *ctx, int i);
+
+/*---------------------------------------------------------------------------*\
+                              Test signals
+\*---------------------------------------------------------------------------*/
+
+static uint64_t rng_state = BENCH_SEED;
+
+static uint32_t rng(void) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return (uint32_t)((rng_state * 0x2545F4914F6CDD1DULL) >> 32);
+}
+
+static float uniform(void) {
+    return (rng() + 0.5f) / 4294967296.0f;
+}
+
+static float gaussian(void) {
+    return sqrtf(-2.0f * logf(uniform())) * cosf(2.0f * M_PI * uniform());
+}
+
+/* BENCH_FRAMES frames of random symbols, with noise at BENCH_SNR_DB */
+static COMP *make_signal(int Rs, int M, int *len) {
+    struct FSK *tx = fsk_create(BENCH_FS, Rs, M, 1000, 1.2f * Rs);
+    int nbits = tx->Nbits * BENCH_FRAMES;
+    uint8_t *bits = (uint8_t*)malloc(nbits);
+    float *out = (float*)malloc(sizeof(float) * tx->N);
+    COMP *sig = (COMP*)malloc(sizeof(COMP) * tx->N * BENCH_FRAMES);
+    /* tones of amplitude 1, so Eb = Ts / 2 / bits per symbol, and No = 2 sigma^2 */
+    float sigma = sqrtf((float)tx->Ts / (M == 4 ? 2 : 1) / powf(10.0f, BENCH_SNR_DB / 10.0f) / 4.0f);
+    int f, i;
+
+    assert((bits != NULL) && (out != NULL) && (sig != NULL));
+    for (i=0; i<nbits; i++)
+        bits[i] = rng() & 1;
+    for (f=0; f<BENCH_FRAMES; f++) {
+        fsk_mod(tx, out, &bits[f * tx->Nbits]);
+        for (i=0; i<tx->N; i++) {
+            sig[f * tx->N + i].real = FSK_SCALE * (out[i] + sigma * gaussian());
+            sig[f * tx->N + i].imag = 0;
+        }
+    }
+    *len = tx->N * BENCH_FRAMES;
+
+    free(out);
+    free(bits);
+    fsk_destroy(tx);
+    return sig;
+}
+
+/*---------------------------------------------------------------------------*\
+                                 Kernels
+\*---------------------------------------------------------------------------*/
+
+struct demod_ctx {
+    struct FSK *fsk;
+    COMP       *sig;
+    int         len;
+    int         pos;
+    uint8_t     bits[FSK_DEFAULT_NSYM * 2 * 4];
+    float       sd[FSK_DEFAULT_NSYM * 2 * 4];
+    float       f_est[MODE_M_MAX];
+    int         freqi[MODE_M_MAX];
+};
+
+static void demod_ctx_init(struct demod_ctx *d, int Rs, int M, int P, int engine) {
+    d->fsk = fsk_create_engine(BENCH_FS, Rs, M, P, 1000, 1.2f * Rs, engine);
+    fsk_set_est_limits(d->fsk, d->fsk->est_min, 4000);
+    d->sig = make_signal(Rs, M, &d->len);
+    d->pos = 0;
+    assert(d->fsk->Nbits <= sizeof(d->bits));
+}
+
+static void demod_ctx_free(struct demod_ctx *d) {
+    fsk_destroy(d->fsk);
+    free(d->sig);
+}
+
+/* next nin samples of the signal, going round at the end */
+static COMP *demod_next(struct demod_ctx *d) {
+    COMP *in;
+
+    if (d->pos + d->fsk->nin > d->len)
+        d->pos = 0;
+    in = &d->sig[d->pos];
+    d->pos += d->fsk->nin;
+    return in;
+}
+
+static void bench_fsk2_demod(void *ctx, int i) {
+    struct demod_ctx *d = (struct demod_ctx*)ctx;
+    fsk2_demod(d->fsk, d->bits, d->sd, demod_next(d));
+}
+
+static void bench_freq_est(void *ctx, int i) {
+    struct demod_ctx *d = (struct demod_ctx*)ctx;
+    fsk_demod_freq_est(d->fsk, demod_next(d), d->f_est, d->fsk->mode);
+}
+
+static void bench_comb_filter(void *ctx, int i) {
+    struct demod_ctx *d = (struct demod_ctx*)ctx;
+    comb_filter(d->fsk, d->freqi, d->fsk->fft_est);
+}
+
+struct uw_ctx {
+    struct horus *hstates;
+    int           n;
+};
+
+static void bench_find_uw(void *ctx, int i) {
+    struct uw_ctx *u = (struct uw_ctx*)ctx;
+    horus_find_uw(u->hstates, u->n);
+}
+
+#define GOLAY_WORDS 4096
+
+static int golay_rx[GOLAY_WORDS];
+
+static void bench_golay23_decode(void *ctx, int i) {
+    golay23_decode(golay_rx[i & (GOLAY_WORDS - 1)]);
+}
+
+struct l2_ctx {
+    unsigned char tx[64];
+    unsigned char payload[22];
+    int           nbytes;
+};
+
+static void bench_l2_decode(void *ctx, int i) {
+    struct l2_ctx *l = (struct l2_ctx*)ctx;
+    horus_l2_decode_rx_packet(l->payload, l->tx, sizeof(l->payload));
+}
+
+#define LDPC_BITS    384
+#define LDPC_ESNO_DB -1.0f          /* noisy codeword */
+
+struct ldpc_ctx {
+    struct LDPC ldpc;
+    float       llr[LDPC_BITS];
+    float       in[LDPC_BITS];
+    uint8_t     out[LDPC_BITS];
+    int         iterations;
+};
+
+static void bench_ldpc(void *ctx, int i) {
+    struct ldpc_ctx *l = (struct ldpc_ctx*)ctx;
+    int parity;
+
+    memcpy(l->in, l->llr, sizeof(l->in));
+    l->iterations = run_ldpc_decoder(&l->ldpc, l->out, l->in, &parity);
+}
+
+#define PHI0_POINTS 1024
+
+static float phi0_x[PHI0_POINTS];
+static volatile float phi0_sink;
+
+static void bench_phi0(void *ctx, int i) {
+    phi0_sink = phi0(phi0_x[i & (PHI0_POINTS - 1)]);
+}
+
+struct crc_ctx {
+    unsigned char data[128];
+    int           len;
+};
+
+static volatile unsigned short crc_sink;
+
+static void bench_crc16(void *ctx, int i) {
+    struct crc_ctx *c = (struct crc_ctx*)ctx;
+    crc_sink = horus_l2_gen_crc16(c->data, c->len);
+}
+
+/*---------------------------------------------------------------------------*\
+                                 Harness
+\*---------------------------------------------------------------------------*/
+
+static int nresults = 0;
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+/* time calls calls of fn per run, and print one JSON result, with any extra fields */
+static void bench_extra(const char *name, const char *unit, bench_fn fn, void *ctx, int calls, const char *extra) {
+    double ticks[BENCH_RUNS], ns[BENCH_RUNS];
+    uint64_t t0, n0;
+    int r, i;
+
+    for (r=0; r<BENCH_WARMUP; r++)
+        for (i=0; i<calls; i++)
+            fn(ctx, i);
+
+    for (r=0; r<BENCH_RUNS; r++) {
+        n0 = perf_now();
+        t0 = bench_ticks();
+        for (i=0; i<calls; i++)
+            fn(ctx, i);
+        ticks[r] = (double)(bench_ticks() - t0) / calls;
+        ns[r] = (double)(perf_now() - n0) / calls;
+    }
+    qsort(ticks, BENCH_RUNS, sizeof(double), cmp_double);
+    qsort(ns, BENCH_RUNS, sizeof(double), cmp_double);
+
+    printf("%s    {\"name\": \"%s\", \"unit\": \"%s\", \"calls\": %d, \"runs\": %d, "
+           "\"ticks_min\": %.1f, \"ticks_median\": %.1f, \"ns_min\": %.1f, \"ns_median\": %.1f%s}",
+           nresults++ ? ",\n" : "", name, unit, calls, BENCH_RUNS,
+           ticks[0], ticks[BENCH_RUNS / 2], ns[0], ns[BENCH_RUNS / 2], extra);
+    fflush(stdout);
+}
+
+static void bench(const char *name, const char *unit, bench_fn fn, void *ctx, int calls) {
+    bench_extra(name, unit, fn, ctx, calls, "");
+}
+
+/* the same codeword every call, so the same number of iterations */
+static void bench_ldpc_codeword(const char *name, struct ldpc_ctx *l, int calls) {
+    char extra[64];
+
+    bench_ldpc(l, 0);
+    snprintf(extra, sizeof(extra), ", \"iterations\": %d", l->iterations);
+    bench_extra(name, "codeword", bench_ldpc, l, calls, extra);
+}
+
+static void cpu_name(char *name, int len) {
+    char line[256], *p;
+    FILE *f = fopen("/proc/cpuinfo", "r");
+
+    snprintf(name, len, "unknown");
+    if (f == NULL)
+        return;
+    while (fgets(line, sizeof(line), f)) {
+        if ((strncmp(line, "model name", 10) == 0) && ((p = strchr(line, ':')) != NULL)) {
+            p += 1 + strspn(p + 1, " \t");
+            p[strcspn(p, "\n\"\\")] = 0;
+            snprintf(name, len, "%s", p);
+            break;
+        }
+    }
+    fclose(f);
+}
+
+int main(int argc, char *argv[]) {
+    static const struct { const char *name; int mode; int Rs; int M; int calls; } modes[] = {
+        {"binary", HORUS_MODE_BINARY, 100, 4, 200},
+        {"ldpc",   HORUS_MODE_LDPC,    25, 4,  50},
+        {"rtty",   HORUS_MODE_RTTY,   100, 2, 200},
+    };
+    static const int engine_P[] = {8, 24, 40};
+    struct demod_ctx d;
+    struct uw_ctx u;
+    struct l2_ctx l2;
+    struct ldpc_ctx *ldpc;
+    struct crc_ctx crc;
+    char name[64], cpu[128];
+    uint8_t ibits[128], pbits[256];
+    short *demod_in;
+    char *ascii_out;
+    float sigma, x;
+    int i, j, m, e, len;
+
+    cpu_name(cpu, sizeof(cpu));
+    printf("{\n  \"label\": \"%s\",\n  \"cpu\": \"%s\",\n  \"clock\": \"%s\",\n  \"seed\": \"%llx\",\n  \"results\": [\n",
+           (argc > 1) ? argv[1] : "", cpu, BENCH_CLOCK, (unsigned long long)BENCH_SEED);
+
+    horus_l2_init();
+    golay23_init();
+
+    /* demodulator, per mode, and the estimator parts on the binary mode */
+
+    for (m=0; m<(int)(sizeof(modes)/sizeof(modes[0])); m++) {
+        demod_ctx_init(&d, modes[m].Rs, modes[m].M, 8, FSK_ENGINE_MIXER);
+        snprintf(name, sizeof(name), "fsk2_demod_%s", modes[m].name);
+        bench(name, "frame", bench_fsk2_demod, &d, modes[m].calls);
+        if (modes[m].mode == HORUS_MODE_BINARY) {
+            bench("fsk_demod_freq_est", "frame", bench_freq_est, &d, modes[m].calls);
+            bench("comb_filter", "call", bench_comb_filter, &d, 10000);
+        }
+        demod_ctx_free(&d);
+
+        /* UW search over a buffer of demodulated bits */
+        u.hstates = horus_open(modes[m].mode);
+        demod_ctx_init(&d, modes[m].Rs, modes[m].M, 8, FSK_ENGINE_MIXER);
+        demod_in = (short*)malloc(sizeof(short) * horus_get_max_demod_in(u.hstates));
+        ascii_out = (char*)malloc(horus_get_max_ascii_out_len(u.hstates));
+        assert((demod_in != NULL) && (ascii_out != NULL));
+        for (i=0; i<BENCH_FRAMES; i++) {
+            len = horus_nin(u.hstates);
+            for (j=0; j<len; j++)
+                demod_in[j] = d.sig[(d.pos + j) % d.len].real;
+            d.pos = (d.pos + len) % d.len;
+            horus_rx(u.hstates, ascii_out, demod_in);
+        }
+        u.n = d.fsk->Nbits;
+        snprintf(name, sizeof(name), "horus_find_uw_%s", modes[m].name);
+        bench(name, "call", bench_find_uw, &u, 10000);
+        horus_close(u.hstates);
+        demod_ctx_free(&d);
+        free(demod_in);
+        free(ascii_out);
+    }
+
+    /* the two demod engines on the binary mode, as the integrator offsets P grow */
+
+    for (i=0; i<(int)(sizeof(engine_P)/sizeof(engine_P[0])); i++) {
+        for (e=FSK_ENGINE_MIXER; e<=FSK_ENGINE_STFT; e++) {
+            demod_ctx_init(&d, 100, 4, engine_P[i], e);
+            snprintf(name, sizeof(name), "fsk2_demod_binary_%s_p%d", e == FSK_ENGINE_STFT ? "stft" : "mixer", engine_P[i]);
+            bench(name, "frame", bench_fsk2_demod, &d, 200);
+            demod_ctx_free(&d);
+        }
+    }
+
+    /* Golay (23,12), random codewords with 0 to 3 bit errors */
+
+    for (i=0; i<GOLAY_WORDS; i++) {
+        golay_rx[i] = golay23_encode(rng() & 0xfff);
+        for (j=rng() % 4; j>0; j--)
+            golay_rx[i] ^= 1 << (rng() % 23);
+    }
+    bench("golay23_decode", "codeword", bench_golay23_decode, NULL, GOLAY_WORDS);
+
+    /* Horus binary packet, with 1% of the bits in error */
+
+    for (i=0; i<(int)sizeof(l2.payload); i++)
+        l2.payload[i] = rng();
+    l2.nbytes = horus_l2_encode_tx_packet(l2.tx, l2.payload, sizeof(l2.payload));
+    assert(l2.nbytes <= (int)sizeof(l2.tx));
+    for (i=4*8; i<l2.nbytes*8; i++)
+        if (rng() % 100 == 0)
+            l2.tx[i / 8] ^= 0x80 >> (i % 8);
+    bench("horus_l2_decode_rx_packet", "packet", bench_l2_decode, &l2, 1000);
+
+    /* LDPC (128,384), a clean codeword, and a noisy one that needs iterations */
+
+    ldpc = (struct ldpc_ctx*)malloc(sizeof(struct ldpc_ctx));
+    assert(ldpc != NULL);
+    horus_ldpc_code(&ldpc->ldpc);
+    for (i=0; i<128; i++)
+        ibits[i] = rng() & 1;
+    encode(&ldpc->ldpc, ibits, pbits);
+    for (i=0; i<LDPC_BITS; i++)
+        ldpc->llr[i] = 4.0f * (1 - 2 * (i < 128 ? ibits[i] : pbits[i - 128]));
+    bench_ldpc_codeword("run_ldpc_decoder_clean", ldpc, 200);
+
+    sigma = sqrtf(1.0f / (2.0f * powf(10.0f, LDPC_ESNO_DB / 10.0f)));
+    for (i=0; i<LDPC_BITS; i++) {
+        x = (1 - 2 * (i < 128 ? ibits[i] : pbits[i - 128])) + sigma * gaussian();
+        ldpc->llr[i] = 2.0f * x / (sigma * sigma);
+    }
+    bench_ldpc_codeword("run_ldpc_decoder_noisy", ldpc, 50);
+    free(ldpc);
+
+    /* phi0 over the range the decoder sees */
+
+    for (i=0; i<PHI0_POINTS; i++)
+        phi0_x[i] = 0.005f * expf(8.0f * i / PHI0_POINTS);
+    bench("phi0", "call", bench_phi0, NULL, 100 * PHI0_POINTS);
+
+    /* CRC16 of a binary payload and of an RTTY sentence */
+
+    for (i=0; i<(int)sizeof(crc.data); i++)
+        crc.data[i] = rng();
+    crc.len = 20;
+    bench("horus_l2_gen_crc16_20", "call", bench_crc16, &crc, 100000);
+    crc.len = 80;
+    bench("horus_l2_gen_crc16_80", "call", bench_crc16, &crc, 100000);
+
+    printf("\n  ]\n}\n");
+    return 0;
+}
@@ -16,6 +16,10 @@
 
     $ sox ~/Desktop/4FSK_binary_100Rb_8khzfs.wav -r 48000 -t raw - | ./horus_demod -m binary  - -
 
+  Or straight from an SDR, with the signal 10 kHz above the centre:
+
+    $ rtl_sdr -f 434640000 -s 240000 - | ./horus_demod -m binary -f u8 -r 240000 -s 10000 - -
+
 \*---------------------------------------------------------------------------*/
 
 /*
@@ -38,22 +42,494 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <getopt.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "horus_api.h"
 #include "fsk.h"
 #include "horus_l2.h"
 #include "mpdecode.h"
+#include "stats_stream.h"
+
+#define HORUS_DEMOD_NSPEC 128      /* spectrum bins in the JSON stats */
+
+static int mode_from_name(const char *name) {
+    if ((strcmp(name, "RTTY") == 0) || (strcmp(name, "rtty") == 0))
+        return HORUS_MODE_RTTY;
+    if ((strcmp(name, "BINARY") == 0) || (strcmp(name, "binary") == 0))
+        return HORUS_MODE_BINARY;
+    if ((strcmp(name, "LDPC") == 0) || (strcmp(name, "ldpc") == 0))
+        return HORUS_MODE_LDPC;
+    return -1;
+}
+
+/* one line of JSON with the time taken by each stage */
+
+static void print_perf(struct horus *hstates, int chan) {
+    static const char *mode_names[] = {"binary", "rtty", "ldpc", "pits"};
+    struct horus_perf_stats perf;
+    int i;
+
+    horus_get_perf_stats(hstates, &perf);
+    fprintf(stderr, "{\"perf\": {\"channel\": %d, \"mode\": \"%s\", \"audio_s\": %.1f, \"cpu_s\": %.3f, \"rtf\": %.1f, \"latency_s\": %.2f",
+            chan, mode_names[horus_get_mode(hstates)], perf.audio_s, perf.cpu_s, perf.rtf, perf.latency_s);
+    if (horus_get_mode(hstates) == HORUS_MODE_LDPC)
+        fprintf(stderr, ", \"ldpc_iterations\": %.2f", perf.ldpc_iterations);
+    fprintf(stderr, ", \"est_interval\": %d, \"est_searched\": %.3f, \"est_saved_s\": %.3f",
+            perf.est_interval, perf.est_searched, perf.est_saved_s);
+    for (i=0; i<HORUS_PERF_STAGES; i++) {
+        fprintf(stderr, ", \"%s\": {\"count\": %llu, \"mean_us\": %.1f, \"p50_us\": %.1f, \"p99_us\": %.1f, \"max_us\": %.1f}",
+                perf.stage[i].name, (unsigned long long)perf.stage[i].count, perf.stage[i].mean_us,
+                perf.stage[i].p50_us, perf.stage[i].p99_us, perf.stage[i].max_us);
+    }
+    fprintf(stderr, "}}\n");
+}
+
+/* where the packet started, in samples and seconds, before the packet */
+
+static void print_time(FILE *f, uint64_t sample, double time) {
+    fprintf(f, "%llu %.3f ", (unsigned long long)sample, time);
+}
+
+/* for the push interface, read this many samples at a time */
+
+#define PUSH_READ 4096
+
+struct push_out {
+    FILE *fout;
+    int   timestamps;
+    int   crc_results;
+};
+
+static void push_packet(void *state, struct horus *hstates, const char *ascii_out) {
+    struct push_out *po = (struct push_out *)state;
+    struct horus_packet_time t;
+
+    if (po->timestamps) {
+        horus_get_packet_time(hstates, &t);
+        print_time(po->fout, t.sample, t.time);
+    }
+    fprintf(po->fout, "%s", ascii_out);
+    if (po->crc_results)
+        fprintf(po->fout, horus_crc_ok(hstates) ? "  CRC OK" : "  CRC BAD");
+    fprintf(po->fout, "\n");
+}
+
+/* other input formats and rates, through horus_push_samples() */
+
+static int push_main(int nmodes, int modes[], FILE *fin, FILE *fout, int format, int rate, float shift_hz,
+                     int verbose, int crc_results, int perf_rate, int timestamps, double start_time,
+                     int low_latency, int squelch, int signals) {
+    static const int sample_size[] = {2, 4, 4, 8, 2};   /* by HORUS_FORMAT */
+    struct push_out po = {fout, timestamps, crc_results};
+    struct horus_multi *hm = NULL;
+    struct horus *hstates = NULL;
+    uint8_t *buf;
+    long samples = 0;
+    int c, n, nchan, ok;
+
+    if ((nmodes == 1) && (signals == 1)) {
+        hstates = horus_open(modes[0]);
+        horus_set_verbose(hstates, verbose);
+        horus_set_start_time(hstates, start_time);
+        horus_set_low_latency(hstates, low_latency);
+        horus_set_packet_callback(hstates, push_packet, &po);
+        ok = horus_set_input_rate(hstates, rate, shift_hz) && horus_set_squelch(hstates, squelch);
+    } else {
+        hm = horus_multi_open(nmodes, modes);
+        if (!horus_multi_set_signals(hm, signals)) {
+            fprintf(stderr, "Too many signals for these modes\n");
+            exit(1);
+        }
+        horus_multi_set_verbose(hm, verbose);
+        horus_multi_set_start_time(hm, start_time);
+        horus_multi_set_low_latency(hm, low_latency);
+        for (c=0; c<horus_multi_get_nchannels(hm); c++)
+            horus_set_packet_callback(horus_multi_get_channel(hm, c), push_packet, &po);
+        ok = horus_multi_set_input_rate(hm, rate, shift_hz) && horus_multi_set_squelch(hm, squelch);
+    }
+    nchan = hm ? horus_multi_get_nchannels(hm) : 1;
+    buf = (uint8_t *)malloc(PUSH_READ * sample_size[format]);
+    if (!ok || (buf == NULL)) {
+        fprintf(stderr, "Couldn't convert from %d Hz\n", rate);
+        exit(1);
+    }
+
+    while ((n = fread(buf, sample_size[format], PUSH_READ, fin)) > 0) {
+        if (hstates)
+            horus_push_samples(hstates, buf, n, format);
+        else
+            horus_multi_push_samples(hm, buf, n, format);
+
+        samples += n;
+        if (perf_rate && (samples >= (long)perf_rate * rate)) {
+            for (c=0; c<nchan; c++)
+                print_perf(hstates ? hstates : horus_multi_get_channel(hm, c), c);
+            samples = 0;
+        }
+        if (fin == stdin || fout == stdout){
+            fflush(fin);
+            fflush(fout);
+        }
+    }
+
+    for (c=0; perf_rate && (c<nchan); c++)
+        print_perf(hstates ? hstates : horus_multi_get_channel(hm, c), c);
+    if (hstates)
+        horus_close(hstates);
+    else
+        horus_multi_close(hm);
+    free(buf);
+    return 0;
+}
+
+/* several modes at once, e.g. -m binary,ldpc,rtty, or several signals with -n */
+
+static int multi_main(int nmodes, int modes[], FILE *fin, FILE *fout, int quadrature, int verbose, int crc_results,
+                      int perf_rate, int timestamps, double start_time, int low_latency, int squelch, int signals) {
+    struct horus_packet_time t;
+    struct horus_multi *hm;
+    int c, nchan, packets;
+    long samples = 0;
+
+    hm = horus_multi_open(nmodes, modes);
+    if (!horus_multi_set_signals(hm, signals)) {
+        fprintf(stderr, "Too many signals for these modes\n");
+        exit(1);
+    }
+    nchan = horus_multi_get_nchannels(hm);
+    horus_multi_set_verbose(hm, verbose);
+    horus_multi_set_start_time(hm, start_time);
+    horus_multi_set_low_latency(hm, low_latency);
+    horus_multi_set_squelch(hm, squelch);
+
+    int   nin = horus_multi_nin(hm);
+    int   audiosize = sizeof(short) * (quadrature ? 2 : 1);
+    short demod_in[nin * (quadrature ? 2: 1)];
+
+    while(fread(demod_in, audiosize, nin, fin) == nin) {
+        if (quadrature)
+            packets = horus_multi_rx_comp(hm, demod_in);
+        else
+            packets = horus_multi_rx(hm, demod_in);
+
+        for (c=0; c<nchan; c++) {
+            if ((packets & (1 << c)) == 0)
+                continue;
+            if (timestamps) {
+                horus_get_packet_time(horus_multi_get_channel(hm, c), &t);
+                print_time(fout, t.sample, t.time);
+            }
+            fprintf(fout, "%s", horus_multi_get_ascii_out(hm, c));
+            if (crc_results) {
+                if (horus_crc_ok(horus_multi_get_channel(hm, c))) {
+                    fprintf(fout, "  CRC OK");
+                } else {
+                    fprintf(fout, "  CRC BAD");
+                }
+            }
+            fprintf(fout, "\n");
+        }
+
+        samples += nin;
+        if (perf_rate && (samples >= (long)perf_rate * horus_get_Fs(horus_multi_get_channel(hm, 0)))) {
+            for (c=0; c<nchan; c++)
+                print_perf(horus_multi_get_channel(hm, c), c);
+            samples = 0;
+        }
+
+        if (fin == stdin || fout == stdout){
+            fflush(fin);
+            fflush(fout);
+        }
+    }
+
+    if (perf_rate) {
+        for (c=0; c<nchan; c++)
+            print_perf(horus_multi_get_channel(hm, c), c);
+    }
+    horus_multi_close(hm);
+    return 0;
+}
+
+/* Offline decoding of a recording on several threads.  The file is mapped
+   and cut into chunks, and each chunk is decoded on its own, from early
+   enough for the modem to lock to the first packet that ends in it, to
+   late enough to finish the last one.  The chunks overlap, so packets
+   near the joins are found twice; they are merged in the order they were
+   found, and the second copy dropped. */
+
+#define CHUNK_S         120     /* seconds of audio each chunk reports         */
+#define CHUNK_WARMUP_S  5       /* for the estimators, before the first packet */
+
+struct chunk_packet {
+    long  sample;               /* end of the block that decoded it            */
+    struct horus_packet_time t;
+    int   chan;
+    int   crc_ok;
+    char *ascii_out;
+};
+
+struct chunk {
+    long                 start, end;        /* reports packets found in here   */
+    struct chunk_packet *packets;
+    int                  npackets, size;
+};
+
+/* set up by parallel_main(), then read only, apart from next */
+struct parallel {
+    short        *samples;
+    long          nsamples;                 /* per channel                     */
+    int           quadrature;
+    int           Fs;
+    double        start_time;
+    int           low_latency;
+    int           squelch;
+    int           nmodes;
+    int          *modes;
+    long          overlap;
+    struct chunk *chunks;
+    int           nchunks;
+    _Atomic int   next;
+};
+
+/* t is from a decoder that started at sample pos0 */
+static void chunk_add(struct chunk *c, long sample, int chan, int crc_ok, const char *ascii_out,
+                      struct horus *hstates, long pos0) {
+    struct chunk_packet *p;
+
+    if (c->npackets == c->size) {
+        c->size = c->size ? 2 * c->size : 64;
+        c->packets = (struct chunk_packet *)realloc(c->packets, c->size * sizeof(struct chunk_packet));
+        assert(c->packets != NULL);
+    }
+    p = &c->packets[c->npackets++];
+    p->sample = sample;
+    p->chan = chan;
+    p->crc_ok = crc_ok;
+    p->ascii_out = strdup(ascii_out);
+    horus_get_packet_time(hstates, &p->t);
+    p->t.sample += pos0;
+    p->t.found += pos0;
+}
+
+static void chunk_decode(struct parallel *par, struct chunk *c) {
+    int   step = par->quadrature ? 2 : 1;
+    long  pos = c->start > par->overlap ? c->start - par->overlap : 0;
+    long  end = c->end + par->overlap < par->nsamples ? c->end + par->overlap : par->nsamples;
+    long  pos0 = pos;
+    double start_time = par->start_time + (double)pos0 / par->Fs;
+    int   i, nin, result;
+
+    if (par->nmodes == 1) {
+        struct horus *hstates = horus_open(par->modes[0]);
+        char ascii_out[horus_get_max_ascii_out_len(hstates)];
+
+        assert(hstates != NULL);
+        horus_set_start_time(hstates, start_time);
+        horus_set_low_latency(hstates, par->low_latency);
+        horus_set_squelch(hstates, par->squelch);
+        while (pos + (nin = horus_nin(hstates)) <= end) {
+            if (par->quadrature)
+                result = horus_rx_comp(hstates, ascii_out, &par->samples[pos * step]);
+            else
+                result = horus_rx(hstates, ascii_out, &par->samples[pos * step]);
+            pos += nin;
+            if (result && (pos > c->start))
+                chunk_add(c, pos, 0, horus_crc_ok(hstates), ascii_out, hstates, pos0);
+        }
+        horus_close(hstates);
+    } else {
+        struct horus_multi *hm = horus_multi_open(par->nmodes, par->modes);
+
+        assert(hm != NULL);
+        horus_multi_set_start_time(hm, start_time);
+        horus_multi_set_low_latency(hm, par->low_latency);
+        horus_multi_set_squelch(hm, par->squelch);
+        nin = horus_multi_nin(hm);
+        while (pos + nin <= end) {
+            if (par->quadrature)
+                result = horus_multi_rx_comp(hm, &par->samples[pos * step]);
+            else
+                result = horus_multi_rx(hm, &par->samples[pos * step]);
+            pos += nin;
+            if (pos <= c->start)
+                continue;
+            for (i=0; i<par->nmodes; i++) {
+                if (result & (1 << i))
+                    chunk_add(c, pos, i, horus_crc_ok(horus_multi_get_channel(hm, i)),
+                              horus_multi_get_ascii_out(hm, i), horus_multi_get_channel(hm, i), pos0);
+            }
+        }
+        horus_multi_close(hm);
+    }
+}
+
+static void *parallel_worker(void *arg) {
+    struct parallel *par = (struct parallel *)arg;
+    int c;
+
+    while ((c = atomic_fetch_add(&par->next, 1)) < par->nchunks)
+        chunk_decode(par, &par->chunks[c]);
+    return NULL;
+}
+
+/* by sample, and then by chunk, which qsort() does not keep */
+static int packet_compare(const void *a, const void *b) {
+    const struct chunk_packet *pa = *(const struct chunk_packet * const *)a;
+    const struct chunk_packet *pb = *(const struct chunk_packet * const *)b;
+
+    if (pa->sample != pb->sample)
+        return pa->sample < pb->sample ? -1 : 1;
+    return pa < pb ? -1 : (pa > pb);
+}
+
+static int parallel_main(int nmodes, int modes[], FILE *fin, FILE *fout, int quadrature, int crc_results,
+                         int nthreads, int timestamps, double start_time, int low_latency, int squelch) {
+    struct parallel      par;
+    struct chunk_packet **all;
+    struct stat          st;
+    pthread_t           *threads;
+    struct timespec      t0, t1;
+    long                 chunk_len, max_packet = 0;
+    int                  Fs = 0, i, j, c, n, npackets = 0, duplicate;
+    void                *map;
+
+    if ((fstat(fileno(fin), &st) != 0) || !S_ISREG(st.st_mode)) {
+        fprintf(stderr, "-j needs an input file, not a pipe\n");
+        return 1;
+    }
+    if (st.st_size == 0)
+        return 0;
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(fin), 0);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "Couldn't map input file\n");
+        return 1;
+    }
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    /* Golay tables, before any threads */
+    horus_l2_init();
+
+    memset(&par, 0, sizeof(par));
+    par.samples = (short *)map;
+    par.quadrature = quadrature;
+    par.nsamples = st.st_size / (sizeof(short) * (quadrature ? 2 : 1));
+    par.nmodes = nmodes;
+    par.modes = modes;
+    for (i=0; i<nmodes; i++) {
+        struct horus *hstates = horus_open(modes[i]);
+
+        if (horus_get_max_packet_samples(hstates) > max_packet)
+            max_packet = horus_get_max_packet_samples(hstates);
+        Fs = horus_get_Fs(hstates);
+        horus_close(hstates);
+    }
+    par.overlap = max_packet + (long)CHUNK_WARMUP_S * Fs;
+    par.Fs = Fs;
+    par.start_time = start_time;
+    par.low_latency = low_latency;
+    par.squelch = squelch;
+
+    chunk_len = (long)CHUNK_S * Fs;
+    par.nchunks = (par.nsamples + chunk_len - 1) / chunk_len;
+    par.chunks = (struct chunk *)calloc(par.nchunks, sizeof(struct chunk));
+    assert(par.chunks != NULL);
+    for (c=0; c<par.nchunks; c++) {
+        par.chunks[c].start = c * chunk_len;
+        par.chunks[c].end = c == par.nchunks - 1 ? par.nsamples : (c + 1) * chunk_len;
+    }
+
+    threads = (pthread_t *)calloc(nthreads, sizeof(pthread_t));
+    assert(threads != NULL);
+    for (i=0; i<nthreads; i++)
+        pthread_create(&threads[i], NULL, parallel_worker, &par);
+    for (i=0; i<nthreads; i++)
+        pthread_join(threads[i], NULL);
+    free(threads);
+
+    /* merge, dropping packets already found by the chunk before */
+    for (c=0; c<par.nchunks; c++)
+        npackets += par.chunks[c].npackets;
+    all = (struct chunk_packet **)malloc(sizeof(struct chunk_packet *) * (npackets + 1));
+    assert(all != NULL);
+    for (c=0, n=0; c<par.nchunks; c++) {
+        for (i=0; i<par.chunks[c].npackets; i++)
+            all[n++] = &par.chunks[c].packets[i];
+    }
+    qsort(all, npackets, sizeof(struct chunk_packet *), packet_compare);
+
+    for (i=0, n=0; i<npackets; i++) {
+        duplicate = 0;
+        for (j=n-1; (j >= 0) && (all[j]->sample > all[i]->sample - par.overlap); j--) {
+            if ((all[j]->chan == all[i]->chan) && (strcmp(all[j]->ascii_out, all[i]->ascii_out) == 0)) {
+                duplicate = 1;
+                break;
+            }
+        }
+        if (duplicate)
+            continue;
+        all[n++] = all[i];
+
+        if (timestamps)
+            print_time(fout, all[i]->t.sample, all[i]->t.time);
+        fprintf(fout, "%s", all[i]->ascii_out);
+        if (crc_results)
+            fprintf(fout, all[i]->crc_ok ? "  CRC OK" : "  CRC BAD");
+        fprintf(fout, "\n");
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    fprintf(stderr, "%d packets from %.1f s of audio in %.2f s on %d threads\n", n, (double)par.nsamples / Fs,
+            (t1.tv_sec - t0.tv_sec) + 1E-9 * (t1.tv_nsec - t0.tv_nsec), nthreads);
+
+    for (c=0; c<par.nchunks; c++) {
+        for (i=0; i<par.chunks[c].npackets; i++)
+            free(par.chunks[c].packets[i].ascii_out);
+        free(par.chunks[c].packets);
+    }
+    free(par.chunks);
+    free(all);
+    munmap(map, st.st_size);
+    return 0;
+}
 
 int main(int argc, char *argv[]) {
     struct   horus *hstates;
     struct   MODEM_STATS stats;
     FILE    *fin,*fout;
-    int      i,j,Ndft,mode;
+    int      i,j,mode;
+    float    spec[HORUS_DEMOD_NSPEC];
     int      stats_ctr,stats_loop, stats_rate, verbose, crc_results;
     float    loop_time;
     int      enable_stats = 0;
     int      quadrature = 0;
+    int      modes[HORUS_MULTI_MAX_CHANNELS];
+    int      nmodes = 0;
+    int      perf_rate = 0;
+    int      nthreads = 0;
+    int      timestamps = 0;
+    double   start_time = 0.0;
+    int      low_latency = 0;
+    int      squelch = 0;
+    int      signals = 1;
+    int      rate = 48000;
+    float    shift_hz = 0.0f;
+    char    *format = "s16";
+    int      push_format;
+    struct   horus_packet_time t;
+    long     perf_samples = 0;
+    char    *name;
+    char    *stats_dest = NULL;
+    struct   stats_stream *stats_out = NULL;
 
     stats_loop = 0;
     stats_rate = 8;
@@ -67,25 +543,30 @@ int main(int argc, char *argv[]) {
             {"help",      no_argument,        0, 'h'},
             {"mode",      required_argument,  0, 'm'},
             {"stats",     optional_argument,  0, 't'},
+            {"perf",      optional_argument,  0, 'p'},
+            {"threads",   required_argument,  0, 'j'},
+            {"timestamps",optional_argument,  0, 'T'},
+            {"low-latency",no_argument,       0, 'L'},
+            {"squelch",   no_argument,        0, 'S'},
+            {"format",    required_argument,  0, 'f'},
+            {"rate",      required_argument,  0, 'r'},
+            {"shift",     required_argument,  0, 's'},
+            {"stats-bin", required_argument,  0, 'b'},
+            {"signals",   required_argument,  0, 'n'},
             {0, 0, 0, 0}
         };
         
-        o = getopt_long(argc,argv,"hvcqm:t::",long_opts,&opt_idx);
+        o = getopt_long(argc,argv,"hvcqLSm:t::p::j:T::f:r:s:b:n:",long_opts,&opt_idx);
         
         switch(o) {
             case 'm':
-                if ((strcmp(optarg, "RTTY") == 0) || (strcmp(optarg, "rtty") == 0)) {
-                    mode = HORUS_MODE_RTTY;
-                }
-                if ((strcmp(optarg, "BINARY") == 0) || (strcmp(optarg, "binary") == 0)) {
-                    mode = HORUS_MODE_BINARY;
-                }
-                if ((strcmp(optarg, "LDPC") == 0) || (strcmp(optarg, "ldpc") == 0)) {
-                    mode = HORUS_MODE_LDPC;
-                }
-                if (mode == -1) {
-                    fprintf(stderr, "use -m RTTY or --m binary  or -m ldpc\n");
-                    exit(1);
+                for (name = strtok(optarg, ","); name != NULL; name = strtok(NULL, ",")) {
+                    mode = mode_from_name(name);
+                    if ((mode == -1) || (nmodes == HORUS_MULTI_MAX_CHANNELS)) {
+                        fprintf(stderr, "use -m RTTY or --m binary  or -m ldpc, or a list like -m binary,ldpc\n");
+                        exit(1);
+                    }
+                    modes[nmodes++] = mode;
                 }
                 break;
             case 't':
@@ -97,6 +578,45 @@ int main(int argc, char *argv[]) {
                     }
                 }
                 break;
+            case 'p':
+                perf_rate = 10;
+                if ((optarg != NULL) && (atoi(optarg) > 0)) {
+                    perf_rate = atoi(optarg);
+                }
+                break;
+            case 'j':
+                nthreads = atoi(optarg);
+                if (nthreads < 1)
+                    nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+                break;
+            case 'T':
+                timestamps = 1;
+                if (optarg != NULL)
+                    start_time = atof(optarg);
+                break;
+            case 'L':
+                low_latency = 1;
+                break;
+            case 'S':
+                squelch = 1;
+                break;
+            case 'f':
+                format = optarg;
+                break;
+            case 'r':
+                rate = atoi(optarg);
+                break;
+            case 's':
+                shift_hz = atof(optarg);
+                break;
+            case 'b':
+                stats_dest = optarg;
+                break;
+            case 'n':
+                signals = atoi(optarg);
+                if (signals < 1)
+                    signals = 1;
+                break;
             case 'v':
                 verbose = 1;
             break;    
@@ -123,16 +643,34 @@ int main(int argc, char *argv[]) {
     if( (argc - dx) > 5) {
         fprintf(stderr, "Too many arguments\n");
     helpmsg:
-        fprintf(stderr,"usage: %s -m RTTY|binary [-q] [-v] [-c] [-t [r]] InputModemRawFile OutputAsciiFile\n",argv[0]);
+        fprintf(stderr,"usage: %s -m RTTY|binary [-q] [-v] [-c] [-t [r]] [-p [s]] [-j n] [-T [s]] [-L] [-S] [-f fmt] [-r Hz] [-s Hz] [-b dest] [-n n] InputModemRawFile OutputAsciiFile\n",argv[0]);
         fprintf(stderr,"\n");
-        fprintf(stderr,"InputModemRawFile      48kHz 16bit signed audio signal from radio\n");
+        fprintf(stderr,"InputModemRawFile      48kHz 16bit signed audio signal from radio, unless -f or -r\n");
         fprintf(stderr,"\n");
         fprintf(stderr," -m rtty|binary|ldpc\n");
         fprintf(stderr,"--mode=rtty|binary     RTTY or Binary Horus protcols\n");
         fprintf(stderr,"--mode=ldpc            LDPC FEC testing mode\n");
+        fprintf(stderr," -m binary,ldpc,rtty   decode several modes at once (no stats)\n");
         fprintf(stderr," -t[r] --stats=[r]     Print out modem statistics to stderr in JSON.\n");
         fprintf(stderr,"                       r, if provided, sets the number of modem frames\n"
                        "                       between statistic printouts\n");
+        fprintf(stderr," -b dest --stats-bin=dest\n"
+                       "                       Send modem statistics every frame, as the binary frames\n"
+                       "                       in stats_stream.h, to udp:host:port or a file or FIFO\n");
+        fprintf(stderr," -p[s] --perf=[s]      Print the time taken by each stage to stderr in JSON,\n"
+                       "                       every s seconds of audio (default 10) and at the end\n");
+        fprintf(stderr," -j n --threads=n      decode a recording on n threads, 0 for one per CPU\n"
+                       "                       (no stats or perf)\n");
+        fprintf(stderr," -T[s] --timestamps=[s] Print the first sample of each packet's unique word,\n"
+                       "                       and its time, s seconds (default 0) plus the samples\n"
+                       "                       before it, before the packet\n");
+        fprintf(stderr," -L --low-latency      decode each packet as soon as its last bit is in\n");
+        fprintf(stderr," -S --squelch          only demodulate while there is a signal\n");
+        fprintf(stderr," -n n --signals=n      decode up to n Binary or LDPC signals in the passband,\n"
+                       "                       rather than the strongest (no stats or -j)\n");
+        fprintf(stderr," -f s16|f32|u8         input samples, u8 is always IQ (rtl_sdr) (no stats or -j)\n");
+        fprintf(stderr," -r Hz --rate=Hz       input sample rate (default 48000), converted to 48000\n");
+        fprintf(stderr," -s Hz --shift=Hz      offset of the signal from the centre of IQ input\n");
         fprintf(stderr," -q                    use stereo (IQ) input\n");
         fprintf(stderr," -v                    verbose debug info\n");
         fprintf(stderr," -c                    display CRC results for each packet\n");
@@ -164,14 +702,62 @@ int main(int argc, char *argv[]) {
 
     /* end command line processing */
 
+    if (strcmp(format, "u8") == 0)
+        push_format = HORUS_FORMAT_U8_IQ;
+    else if (strcmp(format, "f32") == 0)
+        push_format = quadrature ? HORUS_FORMAT_F32_IQ : HORUS_FORMAT_F32;
+    else if (strcmp(format, "s16") == 0)
+        push_format = quadrature ? HORUS_FORMAT_S16_IQ : HORUS_FORMAT_S16;
+    else {
+        fprintf(stderr, "use -f s16, -f f32 or -f u8\n");
+        exit(1);
+    }
+    if (((push_format != HORUS_FORMAT_S16) && (push_format != HORUS_FORMAT_S16_IQ)) || (rate != 48000)
+        || (shift_hz != 0.0f)) {
+        if (nmodes == 0)
+            modes[nmodes++] = mode;
+        return push_main(nmodes, modes, fin, fout, push_format, rate, shift_hz, verbose, crc_results,
+                         perf_rate, timestamps, start_time, low_latency, squelch, signals);
+    }
+
+    if (nthreads && (signals > 1)) {
+        fprintf(stderr, "-n cannot be used with -j\n");
+        exit(1);
+    }
+
+    if (nthreads && nmodes) {
+        return parallel_main(nmodes, modes, fin, fout, quadrature, crc_results, nthreads, timestamps, start_time,
+                             low_latency, squelch);
+    }
+
+    if ((nmodes > 1) || (signals > 1)) {
+        if (nmodes == 0)
+            modes[nmodes++] = mode;
+        return multi_main(nmodes, modes, fin, fout, quadrature, verbose, crc_results, perf_rate, timestamps,
+                          start_time, low_latency, squelch, signals);
+    }
+
     hstates = horus_open(mode);
     horus_set_verbose(hstates, verbose);
+    horus_set_start_time(hstates, start_time);
+    horus_set_low_latency(hstates, low_latency);
+    horus_set_squelch(hstates, squelch);
     
     if (hstates == NULL) {
         fprintf(stderr, "Couldn't open Horus API\n");
         exit(1);
     }
     
+    if (stats_dest) {
+        /* a reader going away only loses it the stats */
+        signal(SIGPIPE, SIG_IGN);
+        stats_out = stats_stream_open(stats_dest);
+        if (stats_out == NULL) {
+            fprintf(stderr, "Couldn't open %s for the stats\n", stats_dest);
+            exit(1);
+        }
+    }
+
     if (enable_stats) {
         loop_time = (float)horus_nin(hstates)/horus_get_Fs(hstates);
         stats_loop = (int)(1.0/(stats_rate*loop_time));
@@ -199,15 +785,19 @@ int main(int argc, char *argv[]) {
             result = horus_rx(hstates, ascii_out, demod_in);
 
         if (result) {
-            fprintf(stdout, "%s", ascii_out);
+            if (timestamps) {
+                horus_get_packet_time(hstates, &t);
+                print_time(fout, t.sample, t.time);
+            }
+            fprintf(fout, "%s", ascii_out);
             if (crc_results) {
                 if (horus_crc_ok(hstates)) {
-                    fprintf(stdout, "  CRC OK");
+                    fprintf(fout, "  CRC OK");
                 } else {
-                    fprintf(stdout, "  CRC BAD");
+                    fprintf(fout, "  CRC BAD");
                 }
             }
-            fprintf(stdout, "\n");
+            fprintf(fout, "\n");
         }
         
         if (enable_stats && stats_ctr <= 0) {
@@ -241,39 +831,39 @@ int main(int argc, char *argv[]) {
 	    
 	    fprintf(stderr,"\"samp_fft\":[");
 
-            #ifdef FIXME_LATER
-            /* TODO: need a horus_ function to dig into modem spectrum */
-            
-	    /* Print a sample of the FFT from the freq estimator */
-
-	    Ndft = hstates->fsk->Ndft/2;
-	    for(i=0; i<Ndft; i++){
-		fprintf(stderr,"%f ",(hstates->fsk->fft_est)[i]);
-		if(i<Ndft-1) fprintf(stderr,",");
-	    }
-            #else
-
-            /* All zero dummy data for now */
+	    /* A sample of the spectrum from the freq estimator */
 
- 	    Ndft = 128;
-	    for(i=0; i<Ndft; i++) {
-		fprintf(stderr,"%f ", 0.0);
-		if(i<Ndft-1) fprintf(stderr,",");
+	    horus_get_spectrum(hstates, spec, HORUS_DEMOD_NSPEC, NULL, NULL);
+	    for(i=0; i<HORUS_DEMOD_NSPEC; i++) {
+		fprintf(stderr,"%f ", spec[i]);
+		if(i<HORUS_DEMOD_NSPEC-1) fprintf(stderr,",");
 	    }
-            
-            #endif
 
 	    fprintf(stderr,"]}\n");
             stats_ctr = stats_loop;
         }
         stats_ctr--;
 
+        if (stats_out)
+            stats_stream_send(stats_out, hstates);
+
+        perf_samples += horus_nin(hstates);
+        if (perf_rate && (perf_samples >= (long)perf_rate * horus_get_Fs(hstates))) {
+            print_perf(hstates, 0);
+            perf_samples = 0;
+        }
+
         if (fin == stdin || fout == stdout){
             fflush(fin);
             fflush(fout);
         }
     }
-    
+
+    if (perf_rate) {
+        print_perf(hstates, 0);
+    }
+    if (stats_out)
+        stats_stream_close(stats_out);
     horus_close(hstates);
 
     return 0;
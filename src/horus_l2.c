@@ -64,25 +64,15 @@
 /* Specification includes four preamble bytes, so we can add two of those to the legacy sync word */
 static char uw[] = {0x1b, 0x1b, '$','$'};
 
-/* Track errors as a percentage of the maximum useful: one bit in five  */
-static int static_errors = 100;
-int horus_quality(void) {
-	return 100 - static_errors;
-}
-
-// for Golay we just count corrected bytes, not individual bits
-void calc_errors( uint8_t *input, const uint8_t *output ) {
+/* Errors as a percentage of the maximum useful: one bit in five.
+   For Golay we just count corrected bytes, not individual bits */
+int horus_l2_errors( const uint8_t *input, const uint8_t *output ) {
 	int i, s;
 	s = 0;
 	for (i = 0; i < 20; i++)
 		if (input[i] != output[i])
 			s++;
-	static_errors = s * 5;
-}
-
-// Import error count from LDPC decoder: true count of corrected bits
-void set_error_count(int percentage) {
-	static_errors = percentage;
+	return s * 5;
 }
 
 /*
@@ -467,8 +457,6 @@ void horus_l2_decode_rx_packet(unsigned char *output_payload_data,
             }
         }
     }
-    calc_errors(input_rx_data + sizeof(uw), output_payload_data);
-
     #ifdef DEBUG0
     fprintf(stderr, "\npin - output_payload_data: %ld num_payload_data_bytes: %d\n",
             pout - output_payload_data, num_payload_data_bytes);
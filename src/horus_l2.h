@@ -9,6 +9,8 @@
 #ifndef __HORUS_L2__
 #define __HORUS_L2__
 
+#include <stdint.h>
+
 /* call this first */
 void horus_l2_init(void);
 
@@ -28,10 +30,24 @@ void horus_l2_decode_rx_packet(unsigned char *output_payload_data,
 unsigned short horus_l2_gen_crc16(unsigned char* data_p,
 				  unsigned char length);
 
-void horus_ldpc_decode(uint8_t *payload, float *sd); 
-void ldpc_errors(const uint8_t *packet, uint8_t *rx_bytes);
-void set_error_count(int percentage);
+/* percentage of payload bytes corrected, after horus_l2_decode_rx_packet() */
+int horus_l2_errors(const uint8_t *input, const uint8_t *output);
+
+/* LDPC decoder state, a prediction of the next packet from the last good one */
+#define HORUS_LDPC_PREDICT_BITS (14 * 8)
+
+struct horus_ldpc_state {
+    uint8_t history[HORUS_LDPC_PREDICT_BITS];
+    uint8_t future[HORUS_LDPC_PREDICT_BITS];
+    int     use_history;
+};
+
+struct LDPC;
+void horus_ldpc_code(struct LDPC *ldpc);
+int horus_ldpc_decode(struct horus_ldpc_state *state, uint8_t *payload, float *sd);
+int horus_ldpc_encode_tx_packet(uint8_t *out, const uint8_t *payload);
+int ldpc_errors(const uint8_t *packet, uint8_t *rx_bytes);
 void interleave(unsigned char *inout, int nbytes, int dir);
 void scramble(unsigned char *inout, int nbytes);
-void confirm_good(int ok);
+void confirm_good(struct horus_ldpc_state *state, int ok);
 #endif
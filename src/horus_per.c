@@ -0,0 +1,445 @@
+/*---------------------------------------------------------------------------*\
+
+  FILE........: horus_per.c
+
+  Packet error rate curves for the Horus modes.  Numbered packets from
+  horus_tx.c go through the channel simulator and a horus_push_samples() decoder,
+  over a sweep of Eb/No and fading spreads, and the packets that come
+  out are checked off by their counter.
+
+  Each point is cut into chunks of packets, and each chunk is a job with
+  its own decoder, so the jobs can be shared out between worker threads.
+  A chunk sees the same noise and fading at every Eb/No, so the curves
+  are smooth, and the results do not depend on the number of threads.
+
+    $ ./horus_per -m ldpc --ebno=-1:5:0.5 --fading=0,0.5,1 -n 1000
+
+\*---------------------------------------------------------------------------*/
+
+#include <assert.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "horus_api.h"
+#include "horus_l2.h"
+#include "horus_tx.h"
+#include "channel.h"
+
+#define PER_CHUNK       100             /* packets per job, the LDPC counter is 8 bits */
+#define PER_RMS         6000.0f         /* decoder input level, as horus_sim           */
+#define PER_MAX_FADING  16
+
+/* one Eb/No and fading spread */
+struct per_point {
+    float    ebno_db;
+    float    fading_hz;
+};
+
+/* what a job found, summed over the jobs of a point at the end */
+struct per_result {
+    long     packets;                   /* sent, and counted                    */
+    long     received;                  /* of those, with a good CRC            */
+    long     frames;                    /* unique words found                   */
+    long     bad_crc;                   /* of those, failing their CRC          */
+    long     fec_count;
+    double   fec_us;                    /* total, Golay and LDPC decoding       */
+    long     ldpc_decodes;
+    double   ldpc_iterations;           /* total                                */
+    double   cpu_s;                     /* total, demodulating and decoding     */
+};
+
+/* set up by main(), then read only, apart from next_job */
+struct per {
+    int                   mode;
+    int                   f1, shift;
+    float                 gap_s;
+    struct channel_params channel;      /* the Eb/No and fading come from the point */
+    int                   iq;
+    int                   squelch;
+    int                   low_latency;
+    int                   engine;       /* HORUS_ENGINE_ */
+    long                  packets;      /* per point */
+    int                   nchunks;      /* per point */
+    struct per_point     *points;
+    int                   npoints;
+    struct per_result    *results;      /* per job */
+    _Atomic int           next_job;
+    int                   nsamples;
+    int                   max_out;
+};
+
+/* packets checked off by the decoder callback */
+struct per_rx {
+    int                   mode;
+    int                   npackets;
+    long                  frames;
+    uint8_t               got[PER_CHUNK + 2];
+};
+
+static void per_packet(void *state, struct horus *hstates, const char *ascii_out) {
+    struct per_rx *rx = (struct per_rx *)state;
+    int counter = horus_tx_counter(rx->mode, ascii_out);
+
+    rx->frames++;
+    if ((counter >= 1) && (counter <= rx->npackets))
+        rx->got[counter] = 1;
+}
+
+/* packets 0 and n+1 give the decoder time to start and finish, and are not counted */
+static void per_job(struct per *per, int job, struct horus_tx *tx, COMP *mod, COMP *out) {
+    struct per_point *pt = &per->points[job / per->nchunks];
+    struct per_result *res = &per->results[job];
+    int chunk = job % per->nchunks;
+    struct channel_params cp = per->channel;
+    struct horus_perf_stats perf;
+    struct channel *ch;
+    struct horus *hstates;
+    struct per_rx rx;
+    float gain;
+    long n;
+    int i, p, npackets, Fs = horus_tx_get_Fs(tx);
+
+    npackets = per->packets - (long)chunk * PER_CHUNK;
+    if (npackets > PER_CHUNK)
+        npackets = PER_CHUNK;
+
+    cp.awgn = 1;
+    cp.ebno_db = pt->ebno_db;
+    cp.fading_hz = pt->fading_hz;
+    cp.seed = per->channel.seed + chunk * 0x9e3779b97f4a7c15ULL;
+    ch = channel_create(&cp, Fs, horus_tx_get_power(tx), horus_tx_get_bit_rate(tx));
+    assert(ch != NULL);
+    gain = PER_RMS / channel_get_rms(ch);
+
+    hstates = horus_open(per->mode);
+    assert(hstates != NULL);
+    memset(&rx, 0, sizeof(rx));
+    rx.mode = per->mode;
+    rx.npackets = npackets;
+    i = horus_set_engine(hstates, per->engine);
+    assert(i);
+    horus_set_packet_callback(hstates, per_packet, &rx);
+    horus_set_squelch(hstates, per->squelch);
+    horus_set_low_latency(hstates, per->low_latency);
+
+    for (p = 0; p < npackets + 2; p++) {
+        horus_tx_packet(tx, mod, p, (uint32_t)((double)p * per->nsamples / Fs));
+        n = channel_process(ch, out, mod, per->nsamples, (int64_t)p * per->nsamples, p);
+
+        for (i = 0; i < n; i++) {
+            out[i].real *= gain;
+            out[i].imag = per->iq ? gain * out[i].imag : 0.0f;
+        }
+        horus_push_samples(hstates, out, n, HORUS_FORMAT_F32_IQ);
+    }
+
+    res->packets = npackets;
+    for (p = 1; p <= npackets; p++)
+        res->received += rx.got[p];
+    res->bad_crc = horus_bad_crc(hstates);
+    res->frames = rx.frames + res->bad_crc;
+
+    horus_get_perf_stats(hstates, &perf);
+    res->fec_count = perf.stage[HORUS_PERF_FEC].count;
+    res->fec_us = perf.stage[HORUS_PERF_FEC].mean_us * res->fec_count;
+    res->ldpc_decodes = perf.ldpc_decodes;
+    res->ldpc_iterations = perf.ldpc_iterations * perf.ldpc_decodes;
+    res->cpu_s = perf.cpu_s;
+
+    horus_close(hstates);
+    channel_destroy(ch);
+}
+
+static void *per_worker(void *arg) {
+    struct per *per = (struct per *)arg;
+    struct horus_tx *tx;
+    COMP *mod, *out;
+    int job;
+
+    tx = horus_tx_open(per->mode, per->f1, per->shift, per->gap_s);
+    assert(tx != NULL);
+    mod = (COMP *)malloc(sizeof(COMP) * per->nsamples);
+    out = (COMP *)malloc(sizeof(COMP) * per->max_out);
+    assert((mod != NULL) && (out != NULL));
+
+    while ((job = atomic_fetch_add(&per->next_job, 1)) < per->npoints * per->nchunks)
+        per_job(per, job, tx, mod, out);
+
+    free(mod);
+    free(out);
+    horus_tx_close(tx);
+    return NULL;
+}
+
+static int mode_from_name(const char *name) {
+    if ((strcmp(name, "RTTY") == 0) || (strcmp(name, "rtty") == 0))
+        return HORUS_MODE_RTTY;
+    if ((strcmp(name, "BINARY") == 0) || (strcmp(name, "binary") == 0))
+        return HORUS_MODE_BINARY;
+    if ((strcmp(name, "LDPC") == 0) || (strcmp(name, "ldpc") == 0))
+        return HORUS_MODE_LDPC;
+    return -1;
+}
+
+static double per_seconds(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1E-9;
+}
+
+/* start[:stop[:step]] */
+static int parse_range(const char *s, float *start, float *stop, float *step) {
+    int n = sscanf(s, "%f:%f:%f", start, stop, step);
+
+    if (n < 1)
+        return 0;
+    if (n < 2)
+        *stop = *start;
+    if (n < 3)
+        *step = 1.0f;
+    return (*step > 0.0f) && (*stop >= *start);
+}
+
+static void print_point(FILE *f, const char *mode_name, struct per_point *pt, struct per_result *r, int json) {
+    float per = r->packets ? 1.0f - (float)r->received / r->packets : 0.0f;
+    float fer = r->frames ? (float)r->bad_crc / r->frames : 0.0f;
+    float iterations = r->ldpc_decodes ? r->ldpc_iterations / r->ldpc_decodes : 0.0f;
+    float fec_us = r->fec_count ? r->fec_us / r->fec_count : 0.0f;
+    float cpu_ms = r->packets ? 1E3 * r->cpu_s / r->packets : 0.0f;
+
+    if (json)
+        fprintf(f, "{\"mode\": \"%s\", \"ebno_db\": %.2f, \"fading_hz\": %.2f, \"packets\": %ld, \"received\": %ld, "
+                "\"per\": %.5f, \"frames\": %ld, \"bad_crc\": %ld, \"fer\": %.5f, \"ldpc_iterations\": %.2f, "
+                "\"fec_us\": %.1f, \"cpu_ms_per_packet\": %.3f}\n",
+                mode_name, pt->ebno_db, pt->fading_hz, r->packets, r->received, per, r->frames, r->bad_crc, fer,
+                iterations, fec_us, cpu_ms);
+    else
+        fprintf(f, "%s,%.2f,%.2f,%ld,%ld,%.5f,%ld,%ld,%.5f,%.2f,%.1f,%.3f\n",
+                mode_name, pt->ebno_db, pt->fading_hz, r->packets, r->received, per, r->frames, r->bad_crc, fer,
+                iterations, fec_us, cpu_ms);
+}
+
+int main(int argc, char *argv[]) {
+    struct per         per;
+    struct per_result  sum;
+    struct horus_tx   *tx;
+    pthread_t         *threads;
+    float              fading[PER_MAX_FADING] = {0.0f};
+    float              ebno_start = 0.0f, ebno_stop = 10.0f, ebno_step = 1.0f;
+    int                nfading = 1, nebno, nthreads, json = 0;
+    double             t0, t1;
+    char              *mode_name = NULL, *s;
+    int                i, j, k;
+
+    memset(&per, 0, sizeof(per));
+    per.mode = -1;
+    per.f1 = 1500;
+    per.gap_s = 0.5f;
+    per.packets = 200;
+    per.channel.seed = 1;
+    nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+
+    int o = 0;
+    int opt_idx = 0;
+    while ( o != -1 ) {
+        static struct option long_opts[] = {
+            {"help",      no_argument,        0, 'h'},
+            {"mode",      required_argument,  0, 'm'},
+            {"packets",   required_argument,  0, 'n'},
+            {"threads",   required_argument,  0, 'j'},
+            {"iq",        no_argument,        0, 'q'},
+            {"json",      no_argument,        0, 'J'},
+            {"ebno",      required_argument,  0, 'e'},
+            {"fading",    required_argument,  0, 'F'},
+            {"freq",      required_argument,  0, 'f'},
+            {"drift",     required_argument,  0, 'r'},
+            {"ppm",       required_argument,  0, 'p'},
+            {"delay",     required_argument,  0, 'D'},
+            {"f1",        required_argument,  0, 't'},
+            {"shift",     required_argument,  0, 's'},
+            {"gap",       required_argument,  0, 'g'},
+            {"seed",      required_argument,  0, 'S'},
+            {"squelch",   no_argument,        0, 'Q'},
+            {"low-latency",no_argument,       0, 'L'},
+            {"engine",    required_argument,  0, 'E'},
+            {0, 0, 0, 0}
+        };
+
+        o = getopt_long(argc,argv,"hm:n:j:qJe:F:f:r:p:D:t:s:g:S:QLE:",long_opts,&opt_idx);
+
+        switch(o) {
+            case 'm':
+                per.mode = mode_from_name(optarg);
+                mode_name = optarg;
+                break;
+            case 'n':
+                per.packets = atol(optarg);
+                break;
+            case 'j':
+                nthreads = atoi(optarg);
+                break;
+            case 'q':
+                per.iq = 1;
+                break;
+            case 'J':
+                json = 1;
+                break;
+            case 'e':
+                if (!parse_range(optarg, &ebno_start, &ebno_stop, &ebno_step))
+                    goto helpmsg;
+                break;
+            case 'F':
+                for (nfading = 0, s = optarg; *s && (nfading < PER_MAX_FADING); nfading++) {
+                    fading[nfading] = strtof(s, &s);
+                    if (*s == ',')
+                        s++;
+                }
+                break;
+            case 'f':
+                per.channel.freq_hz = atof(optarg);
+                break;
+            case 'r':
+                per.channel.drift_hz_s = atof(optarg);
+                break;
+            case 'p':
+                per.channel.ppm = atof(optarg);
+                break;
+            case 'D':
+                per.channel.delay_ms = atof(optarg);
+                break;
+            case 't':
+                per.f1 = atoi(optarg);
+                break;
+            case 's':
+                per.shift = atoi(optarg);
+                break;
+            case 'g':
+                per.gap_s = atof(optarg);
+                break;
+            case 'S':
+                per.channel.seed = strtoull(optarg, NULL, 0);
+                break;
+            case 'Q':
+                per.squelch = 1;
+                break;
+            case 'L':
+                per.low_latency = 1;
+                break;
+            case 'E':
+                if (strcmp(optarg, "stft") == 0)
+                    per.engine = HORUS_ENGINE_STFT;
+                else if (strcmp(optarg, "mixer") != 0)
+                    goto helpmsg;
+                break;
+            case 'h':
+            case '?':
+                goto helpmsg;
+                break;
+        }
+    }
+
+    if ((per.mode == -1) || (per.packets < 1) || (nfading < 1) || (argc != optind)) {
+    helpmsg:
+        fprintf(stderr,"usage: %s -m rtty|binary|ldpc [options]\n",argv[0]);
+        fprintf(stderr,"\n");
+        fprintf(stderr,"Prints one line of CSV, or JSON, per point to stdout\n");
+        fprintf(stderr,"\n");
+        fprintf(stderr," -n --packets=n        packets per point (default 200)\n");
+        fprintf(stderr," -j --threads=n        worker threads (default one per CPU)\n");
+        fprintf(stderr," -q --iq               IQ into the decoder, rather than audio\n");
+        fprintf(stderr,"    --json             JSON lines rather than CSV\n");
+        fprintf(stderr,"    --ebno=a:b:step    Eb/No points in dB (default 0:10:1)\n");
+        fprintf(stderr,"    --fading=Hz,...    Doppler spreads, at each Eb/No (default 0, none)\n");
+        fprintf(stderr,"    --freq=Hz          carrier offset\n");
+        fprintf(stderr,"    --drift=Hz/s       carrier drift\n");
+        fprintf(stderr,"    --ppm=ppm          sample clock offset\n");
+        fprintf(stderr,"    --delay=ms         second fading path this much later\n");
+        fprintf(stderr,"    --f1=Hz            lowest tone (default 1500)\n");
+        fprintf(stderr,"    --shift=Hz         tone spacing (default 270, or 425 for RTTY)\n");
+        fprintf(stderr,"    --gap=s            idle between packets (default 0.5)\n");
+        fprintf(stderr,"    --seed=n           for the noise and fading (default 1)\n");
+        fprintf(stderr,"    --squelch          with the decoder's squelch on\n");
+        fprintf(stderr," -L --low-latency      decode each packet as soon as its last bit is in\n");
+        fprintf(stderr,"    --engine=name      demod engine, mixer (default) or stft\n");
+        exit(1);
+    }
+
+    per.channel.real = !per.iq;
+    if (per.shift == 0)
+        per.shift = per.mode == HORUS_MODE_RTTY ? 425 : 270;
+    if (nthreads < 1)
+        nthreads = 1;
+
+    nebno = (int)((ebno_stop - ebno_start) / ebno_step + 1E-3) + 1;
+    per.npoints = nfading * nebno;
+    per.points = (struct per_point *)calloc(per.npoints, sizeof(struct per_point));
+    assert(per.points != NULL);
+    for (i = 0; i < nfading; i++) {
+        for (j = 0; j < nebno; j++) {
+            per.points[i * nebno + j].ebno_db = ebno_start + j * ebno_step;
+            per.points[i * nebno + j].fading_hz = fading[i];
+        }
+    }
+    per.nchunks = (per.packets + PER_CHUNK - 1) / PER_CHUNK;
+    per.results = (struct per_result *)calloc(per.npoints * per.nchunks, sizeof(struct per_result));
+    assert(per.results != NULL);
+
+    /* Golay tables, before any threads */
+    horus_l2_init();
+
+    tx = horus_tx_open(per.mode, per.f1, per.shift, per.gap_s);
+    if (tx == NULL) {
+        fprintf(stderr, "Couldn't open Horus transmitter\n");
+        exit(1);
+    }
+    per.nsamples = horus_tx_nsamples(tx);
+    {
+        struct channel *ch = channel_create(&per.channel, horus_tx_get_Fs(tx), 1.0f, 1);
+        per.max_out = channel_max_out(ch, per.nsamples);
+        channel_destroy(ch);
+    }
+    horus_tx_close(tx);
+
+    t0 = per_seconds();
+    threads = (pthread_t *)calloc(nthreads, sizeof(pthread_t));
+    assert(threads != NULL);
+    for (i = 0; i < nthreads; i++)
+        pthread_create(&threads[i], NULL, per_worker, &per);
+    for (i = 0; i < nthreads; i++)
+        pthread_join(threads[i], NULL);
+    free(threads);
+    t1 = per_seconds();
+
+    if (!json)
+        printf("mode,ebno_db,fading_hz,packets,received,per,frames,bad_crc,fer,ldpc_iterations,fec_us,cpu_ms_per_packet\n");
+    for (i = 0; i < per.npoints; i++) {
+        memset(&sum, 0, sizeof(sum));
+        for (k = 0; k < per.nchunks; k++) {
+            struct per_result *r = &per.results[i * per.nchunks + k];
+
+            sum.packets += r->packets;
+            sum.received += r->received;
+            sum.frames += r->frames;
+            sum.bad_crc += r->bad_crc;
+            sum.fec_count += r->fec_count;
+            sum.fec_us += r->fec_us;
+            sum.ldpc_decodes += r->ldpc_decodes;
+            sum.ldpc_iterations += r->ldpc_iterations;
+            sum.cpu_s += r->cpu_s;
+        }
+        print_point(stdout, mode_name, &per.points[i], &sum, json);
+    }
+
+    fprintf(stderr, "%ld packets at %d points in %.2f s on %d threads\n",
+            per.packets * per.npoints, per.npoints, t1 - t0, nthreads);
+    free(per.points);
+    free(per.results);
+    return 0;
+}
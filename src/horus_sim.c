@@ -0,0 +1,346 @@
+/*---------------------------------------------------------------------------*\
+
+  FILE........: horus_sim.c
+
+  Makes test signals for horus_demod and the gateway: numbered Horus
+  Binary, LDPC or RTTY packets, put through a simulated channel, as 48 kHz
+  16 bit audio or IQ.
+
+  Each packet is made and put through the channel on its own, so the
+  packets are shared out between worker threads, and the main thread
+  writes them out in order.  The output depends on the seed but not on
+  the number of threads.
+
+    $ ./horus_sim -m binary -n 100 --ebno=8 --drift=0.5 --ppm=50 - | ./horus_demod -m binary - -
+
+\*---------------------------------------------------------------------------*/
+
+#include <assert.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "horus_api.h"
+#include "horus_l2.h"
+#include "horus_tx.h"
+#include "channel.h"
+#include "spsc.h"
+
+#define SIM_QUEUE   4                   /* packets waiting to be written, per worker */
+#define SIM_RMS     6000.0f             /* of the complex output, leaves room for fades */
+
+/* set up by main(), then read only */
+struct sim {
+    int                   mode;
+    int                   f1, shift;
+    float                 gap_s;
+    struct channel_params channel;
+    int                   iq;
+    long                  packets;
+    int                   nthreads;
+    int                   nsamples;     /* per packet, into the channel */
+    int                   max_out;      /* per packet, out of the channel */
+};
+
+struct sim_worker {
+    struct sim  *sim;
+    int          id;
+    pthread_t    thread;
+    struct spsc  q;
+    long         clipped;
+};
+
+/* one packet of output, in a queue slot */
+struct sim_block {
+    int   n;
+    short samples[];
+};
+
+static short sim_clip(float x, long *clipped) {
+    if (x > 32767.0f) {
+        (*clipped)++;
+        return 32767;
+    }
+    if (x < -32768.0f) {
+        (*clipped)++;
+        return -32768;
+    }
+    return (short)x;
+}
+
+static void *sim_worker(void *arg) {
+    struct sim_worker *w = (struct sim_worker *)arg;
+    struct sim *sim = w->sim;
+    struct horus_tx *tx;
+    struct channel *ch;
+    struct sim_block *blk;
+    COMP *mod, *out;
+    float gain;
+    long p;
+    int i, n, Fs;
+
+    tx = horus_tx_open(sim->mode, sim->f1, sim->shift, sim->gap_s);
+    assert(tx != NULL);
+    Fs = horus_tx_get_Fs(tx);
+    ch = channel_create(&sim->channel, Fs, horus_tx_get_power(tx), horus_tx_get_bit_rate(tx));
+    assert(ch != NULL);
+    mod = (COMP *)malloc(sizeof(COMP) * sim->nsamples);
+    out = (COMP *)malloc(sizeof(COMP) * sim->max_out);
+    assert((mod != NULL) && (out != NULL));
+    gain = SIM_RMS / channel_get_rms(ch);
+
+    for (p = w->id; p < sim->packets; p += sim->nthreads) {
+        horus_tx_packet(tx, mod, p & 0xffff, (uint32_t)((double)p * sim->nsamples / Fs));
+        n = channel_process(ch, out, mod, sim->nsamples, (int64_t)p * sim->nsamples, p);
+
+        if ((blk = (struct sim_block *)spsc_write_wait(&w->q)) == NULL)
+            break;
+        blk->n = n;
+        for (i=0; i<n; i++) {
+            if (sim->iq) {
+                blk->samples[2*i] = sim_clip(gain * out[i].real, &w->clipped);
+                blk->samples[2*i + 1] = sim_clip(gain * out[i].imag, &w->clipped);
+            } else {
+                blk->samples[i] = sim_clip(gain * out[i].real, &w->clipped);
+            }
+        }
+        spsc_push(&w->q);
+    }
+    spsc_close(&w->q);
+
+    free(mod);
+    free(out);
+    channel_destroy(ch);
+    horus_tx_close(tx);
+    return NULL;
+}
+
+static int mode_from_name(const char *name) {
+    if ((strcmp(name, "RTTY") == 0) || (strcmp(name, "rtty") == 0))
+        return HORUS_MODE_RTTY;
+    if ((strcmp(name, "BINARY") == 0) || (strcmp(name, "binary") == 0))
+        return HORUS_MODE_BINARY;
+    if ((strcmp(name, "LDPC") == 0) || (strcmp(name, "ldpc") == 0))
+        return HORUS_MODE_LDPC;
+    return -1;
+}
+
+static double sim_seconds(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1E-9;
+}
+
+int main(int argc, char *argv[]) {
+    struct sim         sim;
+    struct sim_worker *workers;
+    struct sim_block  *blk;
+    struct horus_tx   *tx;
+    FILE              *fout;
+    float              seconds = 0.0f;
+    double             t0, t1;
+    long               p, clipped = 0, samples = 0;
+    int                i, Fs, ok = 1;
+
+    memset(&sim, 0, sizeof(sim));
+    sim.mode = -1;
+    sim.f1 = 1500;
+    sim.shift = 0;
+    sim.gap_s = 0.5f;
+    sim.packets = 10;
+    sim.nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    sim.channel.seed = 1;
+
+    int o = 0;
+    int opt_idx = 0;
+    while ( o != -1 ) {
+        static struct option long_opts[] = {
+            {"help",      no_argument,        0, 'h'},
+            {"mode",      required_argument,  0, 'm'},
+            {"packets",   required_argument,  0, 'n'},
+            {"seconds",   required_argument,  0, 'd'},
+            {"threads",   required_argument,  0, 'j'},
+            {"iq",        no_argument,        0, 'q'},
+            {"ebno",      required_argument,  0, 'e'},
+            {"freq",      required_argument,  0, 'f'},
+            {"drift",     required_argument,  0, 'r'},
+            {"ppm",       required_argument,  0, 'p'},
+            {"fading",    required_argument,  0, 'F'},
+            {"delay",     required_argument,  0, 'D'},
+            {"f1",        required_argument,  0, 't'},
+            {"shift",     required_argument,  0, 's'},
+            {"gap",       required_argument,  0, 'g'},
+            {"seed",      required_argument,  0, 'S'},
+            {0, 0, 0, 0}
+        };
+
+        o = getopt_long(argc,argv,"hm:n:d:j:qe:f:r:p:F:D:t:s:g:S:",long_opts,&opt_idx);
+
+        switch(o) {
+            case 'm':
+                sim.mode = mode_from_name(optarg);
+                break;
+            case 'n':
+                sim.packets = atol(optarg);
+                break;
+            case 'd':
+                seconds = atof(optarg);
+                break;
+            case 'j':
+                sim.nthreads = atoi(optarg);
+                break;
+            case 'q':
+                sim.iq = 1;
+                break;
+            case 'e':
+                sim.channel.awgn = 1;
+                sim.channel.ebno_db = atof(optarg);
+                break;
+            case 'f':
+                sim.channel.freq_hz = atof(optarg);
+                break;
+            case 'r':
+                sim.channel.drift_hz_s = atof(optarg);
+                break;
+            case 'p':
+                sim.channel.ppm = atof(optarg);
+                break;
+            case 'F':
+                sim.channel.fading_hz = atof(optarg);
+                break;
+            case 'D':
+                sim.channel.delay_ms = atof(optarg);
+                break;
+            case 't':
+                sim.f1 = atoi(optarg);
+                break;
+            case 's':
+                sim.shift = atoi(optarg);
+                break;
+            case 'g':
+                sim.gap_s = atof(optarg);
+                break;
+            case 'S':
+                sim.channel.seed = strtoull(optarg, NULL, 0);
+                break;
+            case 'h':
+            case '?':
+                goto helpmsg;
+                break;
+        }
+    }
+
+    if ((sim.mode == -1) || ((argc - optind) != 1)) {
+    helpmsg:
+        fprintf(stderr,"usage: %s -m rtty|binary|ldpc [options] OutputModemRawFile\n",argv[0]);
+        fprintf(stderr,"\n");
+        fprintf(stderr,"OutputModemRawFile     48kHz 16bit signed audio, or IQ with -q\n");
+        fprintf(stderr,"\n");
+        fprintf(stderr," -n --packets=n        number of packets (default 10)\n");
+        fprintf(stderr," -d --seconds=s        or enough packets for s seconds\n");
+        fprintf(stderr," -j --threads=n        worker threads (default one per CPU)\n");
+        fprintf(stderr," -q --iq               stereo (IQ) output\n");
+        fprintf(stderr,"    --ebno=dB          add noise for this Eb/No (default none)\n");
+        fprintf(stderr,"    --freq=Hz          carrier offset\n");
+        fprintf(stderr,"    --drift=Hz/s       carrier drift\n");
+        fprintf(stderr,"    --ppm=ppm          sample clock offset\n");
+        fprintf(stderr,"    --fading=Hz        Watterson fading with this Doppler spread\n");
+        fprintf(stderr,"    --delay=ms         and a second path this much later\n");
+        fprintf(stderr,"    --f1=Hz            lowest tone (default 1500)\n");
+        fprintf(stderr,"    --shift=Hz         tone spacing (default 270, or 425 for RTTY)\n");
+        fprintf(stderr,"    --gap=s            idle between packets (default 0.5)\n");
+        fprintf(stderr,"    --seed=n           for the noise and fading (default 1)\n");
+        exit(1);
+    }
+
+    sim.channel.real = !sim.iq;
+    if (sim.shift == 0)
+        sim.shift = sim.mode == HORUS_MODE_RTTY ? 425 : 270;
+    if (sim.nthreads < 1)
+        sim.nthreads = 1;
+
+    if (strcmp(argv[optind],"-")==0) {
+        fout = stdout;
+    } else {
+        fout = fopen(argv[optind],"wb");
+    }
+    if (fout == NULL) {
+        fprintf(stderr,"Couldn't open output file\n");
+        exit(1);
+    }
+
+    /* Golay tables, before any threads */
+    horus_l2_init();
+
+    tx = horus_tx_open(sim.mode, sim.f1, sim.shift, sim.gap_s);
+    if (tx == NULL) {
+        fprintf(stderr, "Couldn't open Horus transmitter\n");
+        exit(1);
+    }
+    Fs = horus_tx_get_Fs(tx);
+    sim.nsamples = horus_tx_nsamples(tx);
+    horus_tx_close(tx);
+    if (seconds > 0.0f)
+        sim.packets = (long)(seconds * Fs + sim.nsamples - 1) / sim.nsamples;
+
+    {
+        struct channel *ch = channel_create(&sim.channel, Fs, 1.0f, 1);
+        sim.max_out = channel_max_out(ch, sim.nsamples);
+        channel_destroy(ch);
+    }
+
+    /* start the workers */
+
+    t0 = sim_seconds();
+    workers = (struct sim_worker *)calloc(sim.nthreads, sizeof(struct sim_worker));
+    assert(workers != NULL);
+    for (i=0; i<sim.nthreads; i++) {
+        workers[i].sim = &sim;
+        workers[i].id = i;
+        if (!spsc_init(&workers[i].q, SIM_QUEUE,
+                       sizeof(struct sim_block) + sizeof(short) * (sim.iq ? 2 : 1) * sim.max_out)) {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+        pthread_create(&workers[i].thread, NULL, sim_worker, &workers[i]);
+    }
+
+    /* write the packets out in order */
+
+    for (p=0; p<sim.packets; p++) {
+        struct spsc *q = &workers[p % sim.nthreads].q;
+
+        if ((blk = (struct sim_block *)spsc_read_wait(q)) == NULL) {
+            ok = 0;
+            break;
+        }
+        if (fwrite(blk->samples, sizeof(short) * (sim.iq ? 2 : 1), blk->n, fout) != blk->n) {
+            fprintf(stderr, "Write error\n");
+            ok = 0;
+            break;
+        }
+        samples += blk->n;
+        spsc_pop(q);
+    }
+
+    for (i=0; i<sim.nthreads; i++)
+        spsc_close(&workers[i].q);
+    for (i=0; i<sim.nthreads; i++) {
+        pthread_join(workers[i].thread, NULL);
+        clipped += workers[i].clipped;
+        spsc_free(&workers[i].q);
+    }
+    free(workers);
+    if (fout != stdout)
+        fclose(fout);
+    t1 = sim_seconds();
+
+    fprintf(stderr, "%ld packets, %.1f s of audio in %.2f s (%.0fx real time) on %d threads, %ld samples clipped\n",
+            p, (double)samples / Fs, t1 - t0, (double)samples / Fs / (t1 - t0), sim.nthreads, clipped);
+    return ok ? 0 : 1;
+}
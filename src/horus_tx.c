@@ -0,0 +1,233 @@
+/*---------------------------------------------------------------------------*\
+
+  FILE........: horus_tx.c
+
+  Horus transmitter, see horus_tx.h.  Packet lengths do not depend on
+  their contents (the RTTY sentence is fixed width), so every packet is
+  the same number of samples, and a packet can be made from its number
+  alone, in any order, on any thread.
+
+\*---------------------------------------------------------------------------*/
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "horus_tx.h"
+#include "horus_api.h"
+#include "horus_l2.h"
+#include "predict.h"
+#include "fsk.h"
+#include "comp_prim.h"
+
+#define HORUS_TX_FS             48000
+#define HORUS_TX_MAX_BYTES      64      /* longest packet, with its UW and parity      */
+#define HORUS_TX_PREAMBLE       0x1b    /* <ESC>, also sent while idle                  */
+#define HORUS_TX_BINARY_BYTES   22
+#define HORUS_TX_RTTY_CALLSIGN  "HORUSSIM"
+#define HORUS_TX_RTTY_PREAMBLE  "$$"    /* the CRC starts after the UW */
+#define HORUS_TX_RTTY_BITS      10      /* 7N2 */
+
+struct horus_tx {
+    int          mode;
+    struct FSK  *fsk;
+    int          Rs;
+    int          bits_per_symbol;
+    int          gap_bits;
+    int          nbits;                 /* per packet, a whole number of modem frames */
+    uint8_t     *bits;
+};
+
+static int horus_tx_add_bytes(uint8_t bits[], const uint8_t bytes[], int n) {
+    int i;
+
+    for (i=0; i<n*8; i++)
+        bits[i] = (bytes[i >> 3] >> (7 - (i & 7))) & 1;
+    return n*8;
+}
+
+/* start bit, 7 data bits LSB first, two stop bits */
+static int horus_tx_add_rtty(uint8_t bits[], const char *s) {
+    int i, n = 0;
+
+    for (; *s; s++) {
+        bits[n++] = 0;
+        for (i=0; i<7; i++)
+            bits[n++] = (*s >> i) & 1;
+        bits[n++] = 1;
+        bits[n++] = 1;
+    }
+    return n;
+}
+
+static void horus_tx_put16(uint8_t *p, uint16_t x) {
+    p[0] = x & 0xff;
+    p[1] = x >> 8;
+}
+
+/* legacy 22 byte packet, little endian as struct TBinaryPacket in global.h */
+static void horus_tx_binary_payload(uint8_t p[], uint16_t counter, uint32_t seconds) {
+    struct GPSdata gps;
+    float lat, lon;
+    uint16_t crc;
+
+    fake_gps(&gps, seconds);
+    lat = gps.Latitude;
+    lon = gps.Longitude;
+    p[0] = 1;
+    horus_tx_put16(&p[1], counter);
+    p[3] = (seconds / 3600) % 24;
+    p[4] = (seconds / 60) % 60;
+    p[5] = seconds % 60;
+    memcpy(&p[6], &lat, 4);
+    memcpy(&p[10], &lon, 4);
+    horus_tx_put16(&p[14], gps.Altitude);
+    p[16] = gps.Speed;
+    p[17] = gps.Satellites;
+    p[18] = gps.Temp;
+    p[19] = gps.Voltage * 51.0f;
+    crc = horus_l2_gen_crc16(p, HORUS_TX_BINARY_BYTES - 2);
+    horus_tx_put16(&p[20], crc);
+}
+
+/* packet bits, without the idle */
+static int horus_tx_packet_bits(struct horus_tx *tx, uint8_t bits[], uint16_t counter, uint32_t seconds) {
+    uint8_t payload[HORUS_TX_BINARY_BYTES], packet[HORUS_TX_MAX_BYTES];
+    uint8_t preamble[] = {HORUS_TX_PREAMBLE, HORUS_TX_PREAMBLE, HORUS_TX_PREAMBLE, HORUS_TX_PREAMBLE};
+    char sentence[100], data[90];
+    struct GPSdata gps;
+    int n = 0, len;
+
+    switch (tx->mode) {
+    case HORUS_MODE_BINARY:
+        /* the UW starts with the other two preamble bytes */
+        n += horus_tx_add_bytes(&bits[n], preamble, 2);
+        horus_tx_binary_payload(payload, counter, seconds);
+        len = horus_l2_encode_tx_packet(packet, payload, HORUS_TX_BINARY_BYTES);
+        assert(len <= HORUS_TX_MAX_BYTES);
+        n += horus_tx_add_bytes(&bits[n], packet, len);
+        break;
+    case HORUS_MODE_LDPC:
+        n += horus_tx_add_bytes(&bits[n], preamble, 4);
+        fake_packet16(payload, counter);
+        len = horus_ldpc_encode_tx_packet(packet, payload);
+        n += horus_tx_add_bytes(&bits[n], packet, len);
+        break;
+    case HORUS_MODE_RTTY:
+        fake_gps(&gps, seconds);
+        snprintf(data, sizeof(data), "%s,%05u,%02u:%02u:%02u,%+09.5f,%+010.5f,%05d,%02u,%+03d",
+                 HORUS_TX_RTTY_CALLSIGN, counter, (seconds / 3600) % 24, (seconds / 60) % 60, seconds % 60,
+                 gps.Latitude, gps.Longitude, gps.Altitude, gps.Satellites, gps.Temp);
+        snprintf(sentence, sizeof(sentence), "%s%s*%04X\n", HORUS_TX_RTTY_PREAMBLE, data,
+                 horus_l2_gen_crc16((uint8_t*)data, strlen(data)));
+        n += horus_tx_add_rtty(&bits[n], sentence);
+        break;
+    }
+    return n;
+}
+
+struct horus_tx *horus_tx_open(int mode, int f1, int shift, float gap_s) {
+    struct horus_tx *tx;
+    uint8_t bits[HORUS_TX_MAX_BYTES * 8 + 100 * HORUS_TX_RTTY_BITS];
+    int nbits, Nbits;
+
+    assert((mode == HORUS_MODE_BINARY) || (mode == HORUS_MODE_LDPC) || (mode == HORUS_MODE_RTTY));
+    tx = (struct horus_tx *)calloc(1, sizeof(struct horus_tx));
+    if (tx == NULL)
+        return NULL;
+
+    tx->mode = mode;
+    if (mode == HORUS_MODE_RTTY) {
+        tx->Rs = 100;
+        tx->bits_per_symbol = 1;
+        tx->gap_bits = gap_s * tx->Rs;
+    } else {
+        tx->Rs = mode == HORUS_MODE_LDPC ? 25 : 100;
+        tx->bits_per_symbol = 2;
+        tx->gap_bits = (int)(gap_s * tx->Rs * 2 / 8) * 8;
+    }
+    tx->fsk = fsk_create(HORUS_TX_FS, tx->Rs, 1 << tx->bits_per_symbol, f1, shift);
+    if (tx->fsk == NULL) {
+        free(tx);
+        return NULL;
+    }
+
+    Nbits = tx->fsk->Nbits;
+    nbits = horus_tx_packet_bits(tx, bits, 0, 0) + tx->gap_bits;
+    tx->nbits = (nbits + Nbits - 1) / Nbits * Nbits;
+    tx->bits = (uint8_t *)malloc(tx->nbits);
+    if (tx->bits == NULL) {
+        horus_tx_close(tx);
+        return NULL;
+    }
+    return tx;
+}
+
+void horus_tx_close(struct horus_tx *tx) {
+    fsk_destroy(tx->fsk);
+    free(tx->bits);
+    free(tx);
+}
+
+int horus_tx_get_Fs(struct horus_tx *tx) {
+    return HORUS_TX_FS;
+}
+
+int horus_tx_get_bit_rate(struct horus_tx *tx) {
+    return tx->Rs * tx->bits_per_symbol;
+}
+
+/* fsk_mod_c() tones have an amplitude of 2 */
+float horus_tx_get_power(struct horus_tx *tx) {
+    return 4.0f;
+}
+
+int horus_tx_nsamples(struct horus_tx *tx) {
+    return tx->nbits / tx->fsk->Nbits * tx->fsk->N;
+}
+
+int horus_tx_packet(struct horus_tx *tx, COMP out[], uint16_t counter, uint32_t seconds) {
+    int i, n, Nbits = tx->fsk->Nbits;
+
+    n = horus_tx_packet_bits(tx, tx->bits, counter, seconds);
+    assert(n <= tx->nbits);
+
+    /* idle is preamble bytes, or RTTY stop bits */
+    for (i=n; i<tx->nbits; i++) {
+        if (tx->mode == HORUS_MODE_RTTY)
+            tx->bits[i] = 1;
+        else
+            tx->bits[i] = (HORUS_TX_PREAMBLE >> (7 - ((i - n) & 7))) & 1;
+    }
+
+    /* each packet starts at the same phase, so it does not depend on the one before */
+    tx->fsk->tx_phase_c = comp_exp_j(0);
+    for (i=0; i<tx->nbits; i+=Nbits)
+        fsk_mod_c(tx->fsk, &out[i / Nbits * tx->fsk->N], &tx->bits[i]);
+    return horus_tx_nsamples(tx);
+}
+
+int horus_tx_counter(int mode, const char *ascii_out) {
+    unsigned int lo, hi, m;
+
+    switch (mode) {
+    case HORUS_MODE_BINARY:
+        /* hex, little endian after the payload ID */
+        if (sscanf(ascii_out, "%*2x%2x%2x", &lo, &hi) != 2)
+            return -1;
+        return lo | (hi << 8);
+    case HORUS_MODE_LDPC:
+        /* Gray coded byte after the payload ID */
+        if (sscanf(ascii_out, "%*2x%2x", &lo) != 1)
+            return -1;
+        for (m = lo >> 1; m; m >>= 1)
+            lo ^= m;
+        return lo;
+    case HORUS_MODE_RTTY:
+        if (sscanf(ascii_out, HORUS_TX_RTTY_PREAMBLE HORUS_TX_RTTY_CALLSIGN ",%5u", &lo) != 1)
+            return -1;
+        return lo;
+    }
+    return -1;
+}
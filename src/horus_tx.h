@@ -0,0 +1,36 @@
+/*---------------------------------------------------------------------------*\
+
+  FILE........: horus_tx.h
+
+  Horus transmitter, the other end of horus_api.h.  Builds numbered
+  Binary, LDPC or RTTY packets from the fake flight in predict.c, and
+  modulates each one, with its preamble and the idle that follows, into
+  a fixed number of 48 kHz complex samples.
+
+\*---------------------------------------------------------------------------*/
+
+#ifndef __HORUS_TX__
+#define __HORUS_TX__
+
+#include <stdint.h>
+#include "comp.h"
+
+struct horus_tx;
+
+/* mode is HORUS_MODE_BINARY, _LDPC or _RTTY, tones f1, f1+shift, ..., gap_s of idle after each packet */
+struct horus_tx *horus_tx_open(int mode, int f1, int shift, float gap_s);
+void             horus_tx_close(struct horus_tx *tx);
+
+int   horus_tx_get_Fs(struct horus_tx *tx);
+int   horus_tx_get_bit_rate(struct horus_tx *tx);
+float horus_tx_get_power(struct horus_tx *tx);      /* of the complex output */
+int   horus_tx_nsamples(struct horus_tx *tx);       /* per packet, always the same */
+
+/* packet number counter, sent at time seconds, into horus_tx_nsamples() samples */
+int   horus_tx_packet(struct horus_tx *tx, COMP out[], uint16_t counter, uint32_t seconds);
+
+/* counter of a packet from horus_rx(), 16 bits for Binary and RTTY, 8 for
+   LDPC, or -1 if the packet did not come from here */
+int   horus_tx_counter(int mode, const char *ascii_out);
+
+#endif
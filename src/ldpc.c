@@ -84,8 +84,8 @@ void bitwise_deinterleave(uint8_t *inout, int nbytes)
     memcpy(inout, out, nbytes);
 }
 
-/* Compare detected bits to corrected bits */
-void ldpc_errors( const uint8_t *outbytes, uint8_t *rx_bytes ) {
+/* Compare detected bits to corrected bits, returns a percentage */
+int ldpc_errors( const uint8_t *outbytes, uint8_t *rx_bytes ) {
 	int	length = DATA_BYTES + PARITY_BYTES;
 	uint8_t temp[length];
 	int	i, percentage, count = 0;
@@ -109,28 +109,25 @@ void ldpc_errors( const uint8_t *outbytes, uint8_t *rx_bytes ) {
 	percentage = (count * 5 * 100) / BITS_PER_PACKET;
 	if (percentage > 100)
 		percentage = 100;
-	set_error_count( percentage );
+	return percentage;
 }
 
-#define PREDICTBYTES 14
-static uint8_t history[PREDICTBYTES * 8];
-static uint8_t future[PREDICTBYTES * 8];
-static int use_history = 0;
-int known[PREDICTBYTES] = {8, 7, 8,4, 8,8,3, 8,8,3, 8,3, 8, 8}; // Expected unchanged bits
+#define PREDICTBYTES (HORUS_LDPC_PREDICT_BITS / 8)
+static const int known[PREDICTBYTES] = {8, 7, 8,4, 8,8,3, 8,8,3, 8,3, 8, 8}; // Expected unchanged bits
 
-void confirm_good(int ok) {
+void confirm_good(struct horus_ldpc_state *state, int ok) {
 	int i;
 	if (ok) {
-		use_history = 5;
+		state->use_history = 5;
 		for ( i = 0; i < PREDICTBYTES*8; i++ )
-			history[i] = future[i];
+			state->history[i] = state->future[i];
 	} else {
-		if (use_history)
-			use_history--;
+		if (state->use_history)
+			state->use_history--;
 	}
 }
 
-void predict(float *softbits) {
+static void predict(const uint8_t *history, float *softbits) {
 	int i, j;
 	float data;
 	float weight; // predicted data
@@ -148,13 +145,52 @@ void predict(float *softbits) {
 }
 
 
-/* LDPC decode */
-void horus_ldpc_decode(uint8_t *payload, float *sd) {
+/* the (128,384) code used by Horus */
+void horus_ldpc_code(struct LDPC *ldpc) {
+	ldpc->max_iter = MAX_ITER;
+	ldpc->dec_type = 0;
+	ldpc->q_scale_factor = 1;
+	ldpc->r_scale_factor = 1;
+	ldpc->CodeLength = CODELENGTH;
+	ldpc->NumberParityBits = NUMBERPARITYBITS;
+	ldpc->NumberRowsHcols = NUMBERROWSHCOLS;
+	ldpc->max_row_weight = MAX_ROW_WEIGHT;
+	ldpc->max_col_weight = MAX_COL_WEIGHT;
+	ldpc->H_rows = H_rows;
+	ldpc->H_cols = H_cols;
+}
+
+/* UW, then the codeword interleaved and scrambled as for Golay, returns bytes in out */
+int horus_ldpc_encode_tx_packet(uint8_t *out, const uint8_t *payload) {
+	static const uint8_t uw[] = { 0x96, 0x69, 0x69, 0x96 };
+	uint8_t ibits[DATA_BYTES * 8], pbits[NUMBERPARITYBITS];
+	uint8_t *codeword = out + sizeof(uw);
+	struct LDPC ldpc;
+	int i, bit;
+
+	for (i = 0; i < DATA_BYTES * 8; i++)
+		ibits[i] = (payload[i >> 3] >> (7 - (i & 7))) & 1;
+	horus_ldpc_code(&ldpc);
+	encode(&ldpc, ibits, pbits);
+
+	memcpy(out, uw, sizeof(uw));
+	memset(codeword, 0, DATA_BYTES + PARITY_BYTES);
+	for (i = 0; i < BITS_PER_PACKET; i++) {
+		bit = i < DATA_BYTES * 8 ? ibits[i] : pbits[i - DATA_BYTES * 8];
+		codeword[i >> 3] |= bit << (7 - (i & 7));
+	}
+	interleave(codeword, DATA_BYTES + PARITY_BYTES, 0);
+	scramble(codeword, DATA_BYTES + PARITY_BYTES);
+	return sizeof(uw) + DATA_BYTES + PARITY_BYTES;
+}
+
+/* LDPC decode, returns the number of iterations */
+int horus_ldpc_decode(struct horus_ldpc_state *state, uint8_t *payload, float *sd) {
 	float sum, mean, sumsq, estEsN0, x;
 	float llr[BITS_PER_PACKET];
 	float temp[BITS_PER_PACKET];
 	uint8_t outbits[BITS_PER_PACKET];
-	int b, i, parityCC;
+	int b, i, iter, parityCC;
 	struct LDPC ldpc;
 
 	/* normalise bitstream to log-like */
@@ -177,23 +213,13 @@ void horus_ldpc_decode(uint8_t *payload, float *sd) {
 	deinterleave(temp, llr);
 
 	/* correct errors */
-	ldpc.max_iter = MAX_ITER;
-	ldpc.dec_type = 0;
-	ldpc.q_scale_factor = 1;
-	ldpc.r_scale_factor = 1;
-	ldpc.CodeLength = CODELENGTH;
-	ldpc.NumberParityBits = NUMBERPARITYBITS;
-	ldpc.NumberRowsHcols = NUMBERROWSHCOLS;
-	ldpc.max_row_weight = MAX_ROW_WEIGHT;
-	ldpc.max_col_weight = MAX_COL_WEIGHT;
-	ldpc.H_rows = H_rows;
-	ldpc.H_cols = H_cols;
-
-	if (use_history)
-		predict(llr);
-	i = run_ldpc_decoder(&ldpc, outbits, llr, &parityCC);
+	horus_ldpc_code(&ldpc);
+
+	if (state->use_history)
+		predict(state->history, llr);
+	iter = run_ldpc_decoder(&ldpc, outbits, llr, &parityCC);
 	for ( i = 0; i < PREDICTBYTES*8; i++ )
-		future[i] = outbits[i];
+		state->future[i] = outbits[i];
 
 	/* convert MSB bits to a packet of bytes */    
 	for (b = 0; b < DATA_BYTES + PARITY_BYTES; b++) {
@@ -202,4 +228,5 @@ void horus_ldpc_decode(uint8_t *payload, float *sd) {
 			rxbyte |= outbits[b*8+i] << (7 - i);
 		payload[b] = rxbyte;
 	}
+	return iter;
 }
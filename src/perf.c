@@ -0,0 +1,75 @@
+/*---------------------------------------------------------------------------*\
+
+  FILE........: perf.c
+
+  Stage timers, see perf.h
+
+\*---------------------------------------------------------------------------*/
+
+#include <string.h>
+
+#include "perf.h"
+
+/* bin of a time: the octave, then the next PERF_SUB_BITS bits below the top one */
+static int perf_bin(uint64_t ns) {
+    int octave;
+
+    if (ns < (1 << PERF_SUB_BITS))
+        return (int)ns;
+    octave = 63 - __builtin_clzll(ns);
+    return ((octave - PERF_SUB_BITS + 1) << PERF_SUB_BITS) + (int)((ns >> (octave - PERF_SUB_BITS)) & ((1 << PERF_SUB_BITS) - 1));
+}
+
+/* largest time that falls in a bin */
+static uint64_t perf_bin_top(int bin) {
+    int octave = (bin >> PERF_SUB_BITS) + PERF_SUB_BITS - 1;
+    uint64_t sub = bin & ((1 << PERF_SUB_BITS) - 1);
+
+    if (bin < (1 << PERF_SUB_BITS))
+        return bin;
+    return (((1 << PERF_SUB_BITS) + sub + 1) << (octave - PERF_SUB_BITS)) - 1;
+}
+
+void perf_clear(struct perf_timer *t) {
+    memset(t, 0, sizeof(struct perf_timer));
+}
+
+void perf_add(struct perf_timer *t, uint64_t ns) {
+    int i;
+
+    t->count++;
+    t->total_ns += ns;
+    if (ns > t->max_ns)
+        t->max_ns = ns;
+    t->hist[perf_bin(ns)]++;
+
+    if (++t->window == PERF_WINDOW) {
+        for (i=0; i<PERF_BINS; i++)
+            t->hist[i] >>= 1;
+        t->window = 0;
+        t->last_max_ns = t->max_ns;
+        t->max_ns = 0;
+    }
+}
+
+/* time that a fraction p of recent calls took no longer than */
+uint64_t perf_percentile(const struct perf_timer *t, float p) {
+    uint64_t n = 0, seen = 0, max = perf_max(t);
+    int i;
+
+    for (i=0; i<PERF_BINS; i++)
+        n += t->hist[i];
+    if (n == 0)
+        return 0;
+
+    for (i=0; i<PERF_BINS; i++) {
+        seen += t->hist[i];
+        if (seen >= p * n)
+            return (perf_bin_top(i) < max) ? perf_bin_top(i) : max;
+    }
+    return max;
+}
+
+uint64_t perf_max(const struct perf_timer *t) {
+    return (t->max_ns > t->last_max_ns) ? t->max_ns : t->last_max_ns;
+}
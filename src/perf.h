@@ -0,0 +1,56 @@
+/*---------------------------------------------------------------------------*\
+
+  FILE........: perf.h
+
+  Low overhead stage timers for the modem.  Each timer keeps a running
+  total, and a histogram of the time per call with four bins per octave,
+  which is halved every PERF_WINDOW calls so that the percentiles follow
+  recent frames rather than the whole run.
+
+\*---------------------------------------------------------------------------*/
+
+#ifndef __PERF_H
+#define __PERF_H
+
+#include <stdint.h>
+#include <time.h>
+
+#define PERF_SUB_BITS 2                         /* 4 bins per octave, within 19% */
+#define PERF_BINS     (64 << PERF_SUB_BITS)
+#define PERF_WINDOW   1024
+
+/* stages of the demodulator and decoder that are timed */
+
+enum {
+    PERF_EST,                                   /* freq_est, or following the tones  */
+    PERF_INTEGRATE,                             /* downconvert and integrate         */
+    PERF_TIMING,                                /* timing recovery and decisions     */
+    PERF_UW,                                    /* horus_find_uw()                   */
+    PERF_FEC,                                   /* Golay or LDPC decode              */
+    PERF_CRC,
+    PERF_FRAME,                                 /* a whole demod frame               */
+    PERF_SQUELCH,                               /* signal detector, every frame      */
+    PERF_STAGES
+};
+
+struct perf_timer {
+    uint64_t count;
+    uint64_t total_ns;
+    uint64_t max_ns;                            /* this window and the one before    */
+    uint64_t last_max_ns;
+    uint32_t window;                            /* calls since the histogram halved  */
+    uint32_t hist[PERF_BINS];
+};
+
+static inline uint64_t perf_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void     perf_clear(struct perf_timer *t);
+void     perf_add(struct perf_timer *t, uint64_t ns);
+uint64_t perf_percentile(const struct perf_timer *t, float p);
+uint64_t perf_max(const struct perf_timer *t);
+
+#endif
@@ -5,6 +5,8 @@
 #include <string.h>
 #include <math.h>
 
+#include "predict.h"
+
 //void interleave(unsigned char *inout, int nbytes);
 //void scramble(unsigned char *inout, int nbytes);
 //int ldpc_encode_tx_packet(unsigned char *out, unsigned char *in);
@@ -45,11 +47,11 @@ uint8_t   User;		// Temp / Sats
 	// Temperature	6 bits MSB => (+30 to -32)
 	// Satellites	2 bits LSB => 0,4,8,12 is good enough
 uint16_t  Checksum;	// CRC16-CCITT Checksum.
-} FSK;	// 16 data bytes, for (128,384) LDPC FEC
+};	// 16 data bytes, for (128,384) LDPC FEC
 	// (50 bytes at 100Hz 4fsk => 2 seconds)
 
 #define PREDICTBYTES 14
-int known[PREDICTBYTES] = {8, 8, 8,4, 8,8,3, 8,8,3, 8,3, 8, 8}; // Expected unchanged bits
+static int known[PREDICTBYTES] = {8, 8, 8,4, 8,8,3, 8,8,3, 8,3, 8, 8}; // Expected unchanged bits
 
 void predict(float *softbits, uint8_t *last ) {
 	int i, j;
@@ -70,28 +72,19 @@ void predict(float *softbits, uint8_t *last ) {
 }
 
 // Fake data
-struct GPSdata {
-	float Latitude;
-	float Longitude;
-	int32_t Altitude;
-	uint8_t Satellites;
-	int8_t  Temp;
-	int16_t Speed;
-	float Voltage;
-} GPS;
-
-static void makeGPS(uint16_t faketime) {
+void fake_gps(struct GPSdata *gps, uint16_t faketime) {
 	float position;
 
+	memset(gps, 0, sizeof(*gps));
 	position = 51.0f + 0.5f * cosf((float)faketime/2000.0f);
-	GPS.Latitude = position;
+	gps->Latitude = position;
 	position = 0.1f - 0.5f * sinf((float)faketime/3000.0f);
-	GPS.Longitude = position;
+	gps->Longitude = position;
 	position = 500.0f +  200.0f * sinf((float)faketime/300.0f);
-	GPS.Altitude = (int32_t)position;
-	GPS.Satellites = (uint8_t)(position / 60.0f);
-	GPS.Voltage = 3.5f - (float)faketime / (60.0f * 60 * 6);
-	GPS.Temp = 30 - faketime / (60 * 6);
+	gps->Altitude = (int32_t)position;
+	gps->Satellites = (uint8_t)(position / 60.0f);
+	gps->Voltage = 3.5f - (float)faketime / (60.0f * 60 * 6);
+	gps->Temp = 30 - faketime / (60 * 6);
 }
 
 // pack position +/- 180.xx into 24 bits
@@ -100,29 +93,29 @@ static int32_t float_int32(float pos) {
 	return (int32_t)(pos * 1.0e7f);
 }
 
-static void fill_FSK() {
+static void fill_FSK(struct BinaryPacket16 *FSK, uint16_t counter) {
+	struct GPSdata GPS;
 	int32_t position, user, sats, temp, volts;
-	static uint16_t counter = 0;
 
-	FSK.PayloadID = 0;
-	FSK.Counter = (uint8_t)counter++;
-	FSK.Biseconds = (uint16_t)(counter * 11);
+	FSK->PayloadID = 0;
+	FSK->Counter = (uint8_t)counter++;
+	FSK->Biseconds = (uint16_t)(counter * 11);
 
-	makeGPS(counter * 22);
+	fake_gps(&GPS, counter * 22);
 	position = float_int32(GPS.Longitude);
-	FSK.Longitude[0] = 0xFF & (position >> 8);
-	FSK.Longitude[1] = 0xFF & (position >>16);
-	FSK.Longitude[2] = 0xFF & (position >>24);
+	FSK->Longitude[0] = 0xFF & (position >> 8);
+	FSK->Longitude[1] = 0xFF & (position >>16);
+	FSK->Longitude[2] = 0xFF & (position >>24);
 	position = float_int32(GPS.Latitude);
-	FSK.Latitude[0] = 0xFF & (position >> 8);
-	FSK.Latitude[1] = 0xFF & (position >>16);
-	FSK.Latitude[2] = 0xFF & (position >>24);
-	FSK.Altitude = (uint16_t)GPS.Altitude;
+	FSK->Latitude[0] = 0xFF & (position >> 8);
+	FSK->Latitude[1] = 0xFF & (position >>16);
+	FSK->Latitude[2] = 0xFF & (position >>24);
+	FSK->Altitude = (uint16_t)GPS.Altitude;
 
 	// (1.5v to 3.5v, for RS41) so scale 5.0V => 255
 	volts = (int32_t)(GPS.Voltage * 51.0f);
 	if (volts > 255) volts = 255;
-	FSK.Voltage = (uint8_t)volts;
+	FSK->Voltage = (uint8_t)volts;
 
 	// Six bit temperature, +31C to -32C in 1C steps
 	temp = (int32_t)GPS.Temp;
@@ -138,7 +131,7 @@ static void fill_FSK() {
 	user |= (uint8_t)sats;
 	// 2 bits offset 0
 
-	FSK.User = user;
+	FSK->User = user;
 }
 
 // UKHAS checksum calculator
@@ -169,19 +162,27 @@ static void arrayToGray(uint8_t *loc, uint8_t len)
 	}
 }
 
+// Gray coded packet, safe to call from several threads
+void fake_packet16(uint8_t *packet, uint16_t counter) {
+	struct BinaryPacket16 FSK;
+
+	fill_FSK(&FSK, counter);
+	arrayToGray((uint8_t*)&FSK, sizeof(FSK) - 2);
+	FSK.Checksum = (uint16_t)array_CRC16_checksum((char*)&FSK, sizeof(FSK) - 2);
+	memcpy(packet, &FSK, sizeof(FSK));
+}
+
 // convert Bytes to Bits, MSB
-uint8_t PayloadBits[sizeof(FSK) * 8];
+static uint8_t PayloadBits[sizeof(struct BinaryPacket16) * 8];
 uint8_t *getGPS(void) {
+	static uint16_t counter = 0;
+	uint8_t packet[sizeof(struct BinaryPacket16)];
 	uint8_t i, j;
-	uint8_t *ptr;
 
-	fill_FSK();
-	arrayToGray((uint8_t*)&FSK, sizeof(FSK) - 2);
-	FSK.Checksum = (uint16_t)array_CRC16_checksum((char*)&FSK, sizeof(FSK) - 2);
-	// packet_length = ldpc_encode_tx_packet((uint8_t*)txbuff, (uint8_t*)&FSK);
+	fake_packet16(packet, counter++);
+	// packet_length = ldpc_encode_tx_packet((uint8_t*)txbuff, packet);
 	for(i=0; i<sizeof(PayloadBits); i++) {
-		ptr = (uint8_t *)&FSK; 
-		j = ptr[i >> 3];
+		j = packet[i >> 3];
 		PayloadBits[i] = 1 & (j >> (7-i));
 	}
 	return PayloadBits;
@@ -0,0 +1,27 @@
+/* Fake GPS generator and Gray code prediction, see predict.c */
+
+#ifndef __PREDICT__
+#define __PREDICT__
+
+#include <stdint.h>
+
+struct GPSdata {
+	float Latitude;
+	float Longitude;
+	int32_t Altitude;
+	uint8_t Satellites;
+	int8_t  Temp;
+	int16_t Speed;
+	float Voltage;
+};
+
+/* a slow, repeatable flight, faketime in seconds */
+void fake_gps(struct GPSdata *gps, uint16_t faketime);
+
+/* 16 byte packet number counter, as sent with (128,384) LDPC FEC */
+void fake_packet16(uint8_t *packet, uint16_t counter);
+
+uint8_t *getGPS(void);
+void predict(float *softbits, uint8_t *last);
+
+#endif
@@ -0,0 +1,298 @@
+/*
+  Durable upload queue, see spool.h
+
+  The file is a header followed by a ring of fixed size records, indexed by
+  sequence number modulo the number of records.  Records between head and
+  tail are the queue; a record is only valid when its stored sequence number
+  matches its position, so a record torn by a crash is skipped on replay.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "spool.h"
+
+#define SPOOL_MAGIC   0x4c505348	/* "HSPL" */
+#define SPOOL_VERSION 1
+
+enum { SPOOL_FREE = 0, SPOOL_PENDING, SPOOL_DONE };
+
+struct spool_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t record_size;
+	uint32_t records;
+	uint32_t head;		/* oldest record that may still be pending */
+	uint32_t tail;		/* sequence number of the next record */
+	uint32_t dropped;	/* pending records overwritten when full */
+	uint8_t  pad[228];
+};
+
+struct spool_record {
+	uint32_t seq;
+	uint16_t state;
+	uint16_t attempts;
+	int64_t  created;
+	int64_t  next_try;
+	uint32_t length;
+	uint32_t pad;
+	char     text[SPOOL_TEXT_SIZE];
+};
+
+struct spool {
+	int fd;
+	size_t size;
+	uint8_t *map;
+	struct spool_header *hdr;
+	struct spool_record *rec;
+	uint32_t records;
+	uint8_t *inflight;	/* not kept on disk, so in flight uploads are replayed */
+	int pending;
+};
+
+/* schedule write back of a changed part of the map */
+static void spool_sync( struct spool *sp, void *start, size_t length ) {
+	long page = sysconf( _SC_PAGESIZE );
+	uintptr_t from = (uintptr_t)start & ~( page - 1 );
+
+	if ( sp->fd >= 0 )
+		msync( (void *)from, (uintptr_t)start + length - from, MS_ASYNC );
+}
+
+/* record for a sequence number, or NULL if it has been overwritten */
+static struct spool_record *spool_record( struct spool *sp, uint32_t seq ) {
+	struct spool_record *r = &sp->rec[seq % sp->records];
+
+	if ( ( seq < sp->hdr->head ) || ( seq >= sp->hdr->tail ) || ( r->seq != seq ) )
+		return NULL;
+	return r;
+}
+
+/* move head past records that are no longer pending */
+static void spool_trim( struct spool *sp ) {
+	struct spool_header *hdr = sp->hdr;
+	struct spool_record *r;
+
+	while ( hdr->head < hdr->tail ) {
+		r = &sp->rec[hdr->head % sp->records];
+		if ( ( r->seq == hdr->head ) && ( r->state == SPOOL_PENDING ) )
+			break;
+		hdr->head++;
+	}
+}
+
+struct spool *spool_open( const char *filename, int records ) {
+	struct spool *sp;
+	struct stat st;
+	uint32_t seq;
+	int flags;
+
+	if ( records < 16 )
+		records = 16;
+
+	sp = (struct spool *)calloc( 1, sizeof( struct spool ) );
+	if ( !sp )
+		return NULL;
+
+	sp->records = records;
+	sp->size = sizeof( struct spool_header ) + records * sizeof( struct spool_record );
+	sp->inflight = (uint8_t *)calloc( records, 1 );
+	sp->fd = -1;
+	flags = MAP_PRIVATE | MAP_ANONYMOUS;
+
+	if ( filename && filename[0] ) {
+		sp->fd = open( filename, O_RDWR | O_CREAT, 0644 );
+		if ( ( sp->fd < 0 ) || fstat( sp->fd, &st ) ) {
+			goto fail;
+		}
+		/* a spool of another size is started again */
+		if ( ( st.st_size != sp->size ) && ( ftruncate( sp->fd, 0 ) || ftruncate( sp->fd, sp->size ) ) ) {
+			goto fail;
+		}
+		flags = MAP_SHARED;
+	}
+
+	sp->map = (uint8_t *)mmap( NULL, sp->size, PROT_READ | PROT_WRITE, flags, sp->fd, 0 );
+	if ( ( sp->map == MAP_FAILED ) || !sp->inflight ) {
+		sp->map = NULL;
+		goto fail;
+	}
+	sp->hdr = (struct spool_header *)sp->map;
+	sp->rec = (struct spool_record *)( sp->map + sizeof( struct spool_header ) );
+
+	if ( ( sp->hdr->magic != SPOOL_MAGIC ) || ( sp->hdr->version != SPOOL_VERSION )
+			|| ( sp->hdr->record_size != sizeof( struct spool_record ) ) || ( sp->hdr->records != records )
+			|| ( sp->hdr->head == 0 ) || ( sp->hdr->head > sp->hdr->tail )
+			|| ( sp->hdr->tail - sp->hdr->head > records ) ) {
+		memset( sp->map, 0, sp->size );
+		sp->hdr->magic = SPOOL_MAGIC;
+		sp->hdr->version = SPOOL_VERSION;
+		sp->hdr->record_size = sizeof( struct spool_record );
+		sp->hdr->records = records;
+		sp->hdr->head = sp->hdr->tail = 1;
+		spool_sync( sp, sp->map, sp->size );
+	}
+
+	/* replay: everything still pending is due now */
+	spool_trim( sp );
+	for ( seq = sp->hdr->head; seq < sp->hdr->tail; seq++ ) {
+		struct spool_record *r = spool_record( sp, seq );
+		if ( r && ( r->state == SPOOL_PENDING ) ) {
+			r->next_try = 0;
+			sp->pending++;
+		}
+	}
+
+	return sp;
+
+fail:
+	if ( sp->fd >= 0 )
+		close( sp->fd );
+	free( sp->inflight );
+	free( sp );
+	return NULL;
+}
+
+void spool_close( struct spool *sp ) {
+	if ( !sp )
+		return;
+	if ( sp->fd >= 0 ) {
+		msync( sp->map, sp->size, MS_SYNC );
+		close( sp->fd );
+	}
+	munmap( sp->map, sp->size );
+	free( sp->inflight );
+	free( sp );
+}
+
+uint32_t spool_append( struct spool *sp, const char *text, time_t created ) {
+	struct spool_header *hdr = sp->hdr;
+	struct spool_record *r;
+	uint32_t seq = hdr->tail;
+	size_t length = strlen( text );
+
+	/* full, overwrite the oldest */
+	if ( hdr->tail - hdr->head >= sp->records ) {
+		r = spool_record( sp, hdr->head );
+		if ( r && ( r->state == SPOOL_PENDING ) ) {
+			hdr->dropped++;
+			sp->pending--;
+		}
+		hdr->head++;
+		spool_trim( sp );
+	}
+
+	if ( length >= SPOOL_TEXT_SIZE )
+		length = SPOOL_TEXT_SIZE - 1;
+
+	/* fill in the record before it becomes valid */
+	r = &sp->rec[seq % sp->records];
+	r->seq = 0;
+	r->state = SPOOL_PENDING;
+	r->attempts = 0;
+	r->created = created;
+	r->next_try = created;
+	r->length = length;
+	memcpy( r->text, text, length );
+	r->text[length] = 0;
+	r->seq = seq;
+	sp->inflight[seq % sp->records] = 0;
+	sp->pending++;
+
+	hdr->tail = seq + 1;
+	spool_sync( sp, r, sizeof( struct spool_record ) );
+	spool_sync( sp, hdr, sizeof( struct spool_header ) );
+	return seq;
+}
+
+int spool_next_due( struct spool *sp, time_t now, uint32_t seq, uint32_t *next ) {
+	struct spool_record *r;
+
+	seq = ( seq < sp->hdr->head ) ? sp->hdr->head : seq + 1;
+	for ( ; seq < sp->hdr->tail; seq++ ) {
+		r = spool_record( sp, seq );
+		if ( r && ( r->state == SPOOL_PENDING ) && !sp->inflight[seq % sp->records] && ( r->next_try <= now ) ) {
+			*next = seq;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+const char *spool_text( struct spool *sp, uint32_t seq ) {
+	struct spool_record *r = spool_record( sp, seq );
+	return r ? r->text : "";
+}
+
+time_t spool_created( struct spool *sp, uint32_t seq ) {
+	struct spool_record *r = spool_record( sp, seq );
+	return r ? (time_t)r->created : 0;
+}
+
+int spool_attempts( struct spool *sp, uint32_t seq ) {
+	struct spool_record *r = spool_record( sp, seq );
+	return r ? r->attempts : 0;
+}
+
+void spool_inflight( struct spool *sp, uint32_t seq ) {
+	if ( spool_record( sp, seq ) )
+		sp->inflight[seq % sp->records] = 1;
+}
+
+void spool_done( struct spool *sp, uint32_t seq ) {
+	struct spool_record *r = spool_record( sp, seq );
+
+	if ( !r || ( r->state != SPOOL_PENDING ) )
+		return;
+	r->state = SPOOL_DONE;
+	sp->inflight[seq % sp->records] = 0;
+	sp->pending--;
+	spool_trim( sp );
+	spool_sync( sp, r, sizeof( struct spool_record ) );
+	spool_sync( sp, sp->hdr, sizeof( struct spool_header ) );
+}
+
+/* retry after 1, 2, 4 .. SPOOL_BACKOFF_MAX seconds, or at once without backoff */
+void spool_failed( struct spool *sp, uint32_t seq, time_t now, int backoff ) {
+	struct spool_record *r = spool_record( sp, seq );
+	int delay = 0;
+
+	if ( !r || ( r->state != SPOOL_PENDING ) )
+		return;
+	sp->inflight[seq % sp->records] = 0;
+	if ( backoff ) {
+		delay = ( r->attempts < 9 ) ? ( 1 << r->attempts ) : SPOOL_BACKOFF_MAX;
+		if ( delay > SPOOL_BACKOFF_MAX )
+			delay = SPOOL_BACKOFF_MAX;
+		if ( r->attempts < 0xffff )
+			r->attempts++;
+	}
+	r->next_try = now + delay;
+	spool_sync( sp, r, sizeof( struct spool_record ) );
+}
+
+int spool_depth( struct spool *sp ) {
+	return sp->pending;
+}
+
+/* seconds since the oldest pending record was received */
+int spool_oldest_age( struct spool *sp, time_t now ) {
+	struct spool_record *r;
+	uint32_t seq;
+
+	for ( seq = sp->hdr->head; seq < sp->hdr->tail; seq++ ) {
+		r = spool_record( sp, seq );
+		if ( r && ( r->state == SPOOL_PENDING ) )
+			return (int)( now - r->created );
+	}
+	return 0;
+}
+
+int spool_dropped( struct spool *sp ) {
+	return sp->hdr->dropped;
+}
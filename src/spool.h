@@ -0,0 +1,41 @@
+/*
+  Durable upload queue.
+
+  Telemetry sentences are appended to a memory mapped ring of fixed size
+  records, and stay there until the upload is confirmed.  Failed uploads
+  are retried with exponential backoff, and anything not sent is replayed
+  when the spool is opened again.  When the ring is full the oldest record
+  is overwritten, so disk use is bounded by the number of records.
+*/
+
+#include <stdint.h>
+#include <time.h>
+
+#define SPOOL_TEXT_SIZE   224	/* longest sentence, including the nul */
+#define SPOOL_BACKOFF_MAX 300	/* seconds */
+
+struct spool;
+
+/* filename NULL keeps the queue in memory only */
+struct spool *spool_open( const char *filename, int records );
+void spool_close( struct spool *sp );
+
+/* returns the sequence number of the new record */
+uint32_t spool_append( struct spool *sp, const char *text, time_t created );
+
+/* next record, after sequence number seq, that is due for upload and not in
+   flight, returns 0 and sets *next if there is one.  Start with seq = 0. */
+int spool_next_due( struct spool *sp, time_t now, uint32_t seq, uint32_t *next );
+const char *spool_text( struct spool *sp, uint32_t seq );
+time_t spool_created( struct spool *sp, uint32_t seq );
+int spool_attempts( struct spool *sp, uint32_t seq );
+
+/* upload state changes, ignored if the record has since been overwritten */
+void spool_inflight( struct spool *sp, uint32_t seq );
+void spool_done( struct spool *sp, uint32_t seq );
+void spool_failed( struct spool *sp, uint32_t seq, time_t now, int backoff );
+
+/* metrics */
+int spool_depth( struct spool *sp );
+int spool_oldest_age( struct spool *sp, time_t now );
+int spool_dropped( struct spool *sp );
@@ -0,0 +1,192 @@
+/*
+  Bounded single producer, single consumer queue, see spsc.h
+
+  head and tail count slots pushed and popped, and only ever increase, so
+  the difference is the depth even when they wrap.  Each is written by one
+  side only; the release store publishes the slot contents to the other.
+  Each slot holds the push time followed by the item.
+
+  A side that has to wait counts itself in waiting, then checks again
+  under the lock before it sleeps.  The other side checks waiting after
+  its store, with a full fence between on both sides, so one of them
+  always sees the other, and the wakeup is not lost.  It is a count as a
+  woken side may not have left yet when the other starts to wait.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "spsc.h"
+
+#define SPSC_STAMP   sizeof( uint64_t )
+
+uint64_t spsc_now_ns( void ) {
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* after head or tail is stored, wake the other side if it waits */
+static void spsc_wake( struct spsc *q ) {
+	atomic_thread_fence( memory_order_seq_cst );
+	if ( atomic_load_explicit( &q->waiting, memory_order_relaxed ) ) {
+		pthread_mutex_lock( &q->lock );
+		pthread_cond_broadcast( &q->cond );
+		pthread_mutex_unlock( &q->lock );
+	}
+}
+
+static void spsc_wait_done( void *arg ) {
+	struct spsc *q = (struct spsc *)arg;
+
+	atomic_fetch_sub_explicit( &q->waiting, 1, memory_order_relaxed );
+	pthread_mutex_unlock( &q->lock );
+}
+
+/* sleep until slot() gives a slot, or the queue is closed.  The gateway
+   cancels its capture thread, which may be waiting here. */
+static void *spsc_wait( struct spsc *q, void *( *slot )( struct spsc * ) ) {
+	void *s;
+
+	pthread_mutex_lock( &q->lock );
+	pthread_cleanup_push( spsc_wait_done, q );
+	atomic_fetch_add_explicit( &q->waiting, 1, memory_order_relaxed );
+	atomic_thread_fence( memory_order_seq_cst );
+	while ( !( s = slot( q ) ) && !spsc_closed( q ) )
+		pthread_cond_wait( &q->cond, &q->lock );
+	pthread_cleanup_pop( 1 );
+	return s;
+}
+
+int spsc_init( struct spsc *q, int slots, size_t item_size ) {
+	uint32_t size = 1;
+
+	while ( size < slots )
+		size <<= 1;
+
+	memset( q, 0, sizeof( struct spsc ) );
+	/* keep the stamps aligned */
+	q->slot_size = SPSC_STAMP + ( ( item_size + SPSC_STAMP - 1 ) & ~( SPSC_STAMP - 1 ) );
+	q->mask = size - 1;
+	pthread_mutex_init( &q->lock, NULL );
+	pthread_cond_init( &q->cond, NULL );
+	q->slots = (uint8_t *)malloc( q->slot_size * size );
+	return q->slots != NULL;
+}
+
+void spsc_free( struct spsc *q ) {
+	free( q->slots );
+	q->slots = NULL;
+	pthread_cond_destroy( &q->cond );
+	pthread_mutex_destroy( &q->lock );
+}
+
+static uint8_t *spsc_slot( struct spsc *q, uint32_t n ) {
+	return &q->slots[( n & q->mask ) * q->slot_size];
+}
+
+void *spsc_write_slot( struct spsc *q ) {
+	uint32_t head = atomic_load_explicit( &q->head, memory_order_relaxed );
+	uint32_t tail = atomic_load_explicit( &q->tail, memory_order_acquire );
+
+	if ( head - tail > q->mask )
+		return NULL;
+	return spsc_slot( q, head ) + SPSC_STAMP;
+}
+
+void spsc_push( struct spsc *q ) {
+	uint32_t head = atomic_load_explicit( &q->head, memory_order_relaxed );
+	uint32_t depth = head + 1 - atomic_load_explicit( &q->tail, memory_order_relaxed );
+	uint64_t now = spsc_now_ns();
+
+	memcpy( spsc_slot( q, head ), &now, SPSC_STAMP );
+	if ( depth > atomic_load_explicit( &q->depth_max, memory_order_relaxed ) )
+		atomic_store_explicit( &q->depth_max, depth, memory_order_relaxed );
+	atomic_store_explicit( &q->head, head + 1, memory_order_release );
+	spsc_wake( q );
+}
+
+void *spsc_write_wait( struct spsc *q ) {
+	void *slot;
+
+	if ( ( slot = spsc_write_slot( q ) ) )
+		return slot;
+
+	atomic_fetch_add_explicit( &q->full, 1, memory_order_relaxed );
+	return spsc_wait( q, spsc_write_slot );
+}
+
+int spsc_put( struct spsc *q, const void *item, size_t size ) {
+	void *slot = spsc_write_slot( q );
+
+	if ( !slot ) {
+		atomic_fetch_add_explicit( &q->full, 1, memory_order_relaxed );
+		return 0;
+	}
+	memcpy( slot, item, size );
+	spsc_push( q );
+	return 1;
+}
+
+void *spsc_read_slot( struct spsc *q ) {
+	uint32_t tail = atomic_load_explicit( &q->tail, memory_order_relaxed );
+	uint32_t head = atomic_load_explicit( &q->head, memory_order_acquire );
+
+	if ( head == tail )
+		return NULL;
+	return spsc_slot( q, tail ) + SPSC_STAMP;
+}
+
+void spsc_pop( struct spsc *q ) {
+	uint32_t tail = atomic_load_explicit( &q->tail, memory_order_relaxed );
+	uint64_t stamp, wait;
+
+	memcpy( &stamp, spsc_slot( q, tail ), SPSC_STAMP );
+	wait = spsc_now_ns() - stamp;
+	atomic_fetch_add_explicit( &q->items, 1, memory_order_relaxed );
+	atomic_fetch_add_explicit( &q->wait_ns, wait, memory_order_relaxed );
+	if ( wait > atomic_load_explicit( &q->wait_max_ns, memory_order_relaxed ) )
+		atomic_store_explicit( &q->wait_max_ns, wait, memory_order_relaxed );
+	atomic_store_explicit( &q->tail, tail + 1, memory_order_release );
+	spsc_wake( q );
+}
+
+void *spsc_read_wait( struct spsc *q ) {
+	void *slot;
+
+	if ( ( slot = spsc_read_slot( q ) ) )
+		return slot;
+	if ( ( slot = spsc_wait( q, spsc_read_slot ) ) )
+		return slot;
+	/* the producer may have pushed before it closed */
+	return spsc_read_slot( q );
+}
+
+/* under the lock, so a side between its check and its sleep still hears it */
+void spsc_close( struct spsc *q ) {
+	atomic_store_explicit( &q->closed, 1, memory_order_release );
+	pthread_mutex_lock( &q->lock );
+	pthread_cond_broadcast( &q->cond );
+	pthread_mutex_unlock( &q->lock );
+}
+
+int spsc_closed( struct spsc *q ) {
+	return atomic_load_explicit( &q->closed, memory_order_acquire );
+}
+
+int spsc_depth( struct spsc *q ) {
+	return atomic_load_explicit( &q->head, memory_order_acquire ) - atomic_load_explicit( &q->tail, memory_order_acquire );
+}
+
+int spsc_size( struct spsc *q ) {
+	return q->mask + 1;
+}
+
+void spsc_get_stats( struct spsc *q, struct spsc_stats *stats ) {
+	stats->items = atomic_load_explicit( &q->items, memory_order_relaxed );
+	stats->wait_ns = atomic_load_explicit( &q->wait_ns, memory_order_relaxed );
+	stats->wait_max_ns = atomic_load_explicit( &q->wait_max_ns, memory_order_relaxed );
+	stats->full = atomic_load_explicit( &q->full, memory_order_relaxed );
+	stats->depth_max = atomic_load_explicit( &q->depth_max, memory_order_relaxed );
+}
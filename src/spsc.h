@@ -0,0 +1,68 @@
+/*
+  Bounded single producer, single consumer queue.
+
+  Connects the stages of the gateway pipeline, each running on its own
+  thread.  Items are copied into fixed size slots, so nothing is allocated
+  once the queue is made.  Each item is stamped when pushed, which gives the
+  time it waited in the queue, and the consumer keeps the counts used to
+  find the slowest stage.  A side that waits sleeps until the other one
+  pushes, pops or closes, so an idle pipeline takes no CPU.
+*/
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+struct spsc_stats {
+	uint64_t items;		/* popped */
+	uint64_t wait_ns;	/* total time items spent queued */
+	uint64_t wait_max_ns;
+	uint64_t full;		/* pushes that found the queue full */
+	int depth_max;
+};
+
+struct spsc {
+	uint8_t *slots;
+	size_t slot_size;
+	uint32_t mask;
+
+	_Alignas(64) _Atomic uint32_t head;	/* next slot to write, producer only */
+	_Alignas(64) _Atomic uint32_t tail;	/* next slot to read, consumer only */
+	_Alignas(64) _Atomic int closed;
+	_Atomic int waiting;			/* sides in spsc_wait() */
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+
+	/* written by one side, read by anyone as a snapshot */
+	_Atomic uint64_t items, wait_ns, wait_max_ns, full;
+	_Atomic int depth_max;
+};
+
+/* slots is rounded up to a power of 2, returns 0 if out of memory */
+int spsc_init( struct spsc *q, int slots, size_t item_size );
+void spsc_free( struct spsc *q );
+
+/* producer: slot to fill, or NULL if full, then spsc_push() to publish it */
+void *spsc_write_slot( struct spsc *q );
+void spsc_push( struct spsc *q );
+/* as spsc_write_slot(), but waits while full, NULL if the queue is closed */
+void *spsc_write_wait( struct spsc *q );
+/* copy an item in, returns 0 if full */
+int spsc_put( struct spsc *q, const void *item, size_t size );
+
+/* consumer: oldest item, or NULL if empty, then spsc_pop() to release it */
+void *spsc_read_slot( struct spsc *q );
+void spsc_pop( struct spsc *q );
+/* as spsc_read_slot(), but waits while empty, NULL once closed and drained */
+void *spsc_read_wait( struct spsc *q );
+
+/* no more items will be pushed, or the consumer should stop waiting */
+void spsc_close( struct spsc *q );
+int spsc_closed( struct spsc *q );
+
+int spsc_depth( struct spsc *q );
+int spsc_size( struct spsc *q );
+void spsc_get_stats( struct spsc *q, struct spsc_stats *stats );
+
+uint64_t spsc_now_ns( void );
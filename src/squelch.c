@@ -0,0 +1,176 @@
+/*---------------------------------------------------------------------------*\
+
+  FILE........: squelch.c
+
+  Signal presence detector, see squelch.h.
+
+  Only one block of Nfft samples in every SQ_STRIDE is transformed,
+  as the signal is there for many blocks and the spectrum is averaged
+  over seconds.  The peak is the largest sum of the bins about Rs wide,
+  and the median of the bins is the noise, as the tones only take a few
+  of them.  Costs under a tenth of the demod it replaces.
+
+\*---------------------------------------------------------------------------*/
+
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fsk.h"
+#include "kiss_fft.h"
+#include "squelch.h"
+
+#define SQ_BIN_HZ       25              /* largest bin width, the slowest mode's Rs    */
+#define SQ_STRIDE       4               /* one block transformed in this many          */
+#define SQ_ALPHA        (1.0f / 32.0f)  /* spectrum averaging, per block               */
+#define SQ_OPEN         0.9f            /* peak over median, less 1, times sqrt(width) */
+#define SQ_CLOSE        0.7f            /* to stay open, less the hang time            */
+
+struct squelch {
+    int          Nfft;
+    int          bin_min, bin_max;      /* of the tones                      */
+    int          width;                 /* bins summed for the peak          */
+    float        open_th, close_th;     /* of the metric                     */
+    kiss_fft_cfg fft_cfg;
+    float       *window;
+    kiss_fft_cpx *in, *out;
+    float       *power;                 /* averaged, bin_min to bin_max      */
+    float       *sorted;                /* scratch for the median            */
+    int          nblocks;
+    int          fill;                  /* samples into the stride           */
+
+    float        metric;
+    int          open;
+    int          hang;
+    int          hang_left;
+};
+
+struct squelch *squelch_create(int Fs, int Rs, int f_min, int f_max) {
+    struct squelch *sq;
+    int Nfft, i;
+
+    assert((Fs > 0) && (Rs > 0) && (f_min >= 0) && (f_max > f_min));
+    sq = (struct squelch *)calloc(1, sizeof(struct squelch));
+    if (sq == NULL)
+        return NULL;
+
+    for (Nfft = 16; Nfft * SQ_BIN_HZ < Fs; Nfft *= 2)
+        ;
+    sq->Nfft = Nfft;
+    sq->bin_min = f_min * Nfft / Fs;
+    sq->bin_max = f_max * Nfft / Fs;
+    if (sq->bin_max > Nfft / 2)
+        sq->bin_max = Nfft / 2;
+    sq->width = (Rs * Nfft + Fs / 2) / Fs + 1;
+    if (sq->width > sq->bin_max - sq->bin_min)
+        sq->width = sq->bin_max - sq->bin_min;
+
+    /* the noise on the sum of width bins goes down as sqrt(width) */
+    sq->open_th = 1.0f + SQ_OPEN / sqrtf(sq->width);
+    sq->close_th = 1.0f + SQ_CLOSE / sqrtf(sq->width);
+
+    sq->fft_cfg = kiss_fft_alloc(Nfft, 0, NULL, NULL);
+    sq->window = (float *)malloc(sizeof(float) * Nfft);
+    sq->in = (kiss_fft_cpx *)malloc(sizeof(kiss_fft_cpx) * Nfft);
+    sq->out = (kiss_fft_cpx *)malloc(sizeof(kiss_fft_cpx) * Nfft);
+    sq->power = (float *)calloc(sq->bin_max - sq->bin_min, sizeof(float));
+    sq->sorted = (float *)malloc(sizeof(float) * (sq->bin_max - sq->bin_min));
+    if (!sq->fft_cfg || !sq->window || !sq->in || !sq->out || !sq->power || !sq->sorted) {
+        squelch_destroy(sq);
+        return NULL;
+    }
+    for (i=0; i<Nfft; i++)
+        sq->window[i] = 0.5f - 0.5f * cosf(2.0f * M_PI * i / Nfft);
+
+    sq->open = 1;
+    return sq;
+}
+
+void squelch_destroy(struct squelch *sq) {
+    free(sq->fft_cfg);
+    free(sq->window);
+    free(sq->in);
+    free(sq->out);
+    free(sq->power);
+    free(sq->sorted);
+    free(sq);
+}
+
+void squelch_set_hang(struct squelch *sq, int samples) {
+    sq->hang = samples;
+    if (sq->open)
+        sq->hang_left = samples;
+}
+
+float squelch_metric(struct squelch *sq) {
+    return sq->metric;
+}
+
+/* a block of Nfft samples in sq->in, into the averaged spectrum */
+static void sq_block(struct squelch *sq) {
+    int nbins = sq->bin_max - sq->bin_min;
+    float a = sq->nblocks ? SQ_ALPHA : 1.0f;
+    float p;
+    int i;
+
+    kiss_fft(sq->fft_cfg, sq->in, sq->out);
+    for (i=0; i<nbins; i++) {
+        p = sq->out[sq->bin_min + i].r * sq->out[sq->bin_min + i].r
+          + sq->out[sq->bin_min + i].i * sq->out[sq->bin_min + i].i;
+        sq->power[i] += a * (p - sq->power[i]);
+    }
+    sq->nblocks++;
+}
+
+static void sq_metric(struct squelch *sq) {
+    int nbins = sq->bin_max - sq->bin_min;
+    float sum, peak, median;
+    int i;
+
+    for (sum=0.0f, i=0; i<sq->width; i++)
+        sum += sq->power[i];
+    for (peak=sum; i<nbins; i++) {
+        sum += sq->power[i] - sq->power[i - sq->width];
+        if (sum > peak)
+            peak = sum;
+    }
+    memcpy(sq->sorted, sq->power, sizeof(float) * nbins);
+    median = fsk_select(sq->sorted, nbins, nbins / 2);
+    sq->metric = median > 0.0f ? peak / (sq->width * median) : 0.0f;
+}
+
+int squelch_process(struct squelch *sq, const COMP in[], int n) {
+    int period = SQ_STRIDE * sq->Nfft;
+    int i, k, m, blocks = sq->nblocks;
+
+    for (k=0; k<n; k+=m) {
+        m = period - sq->fill;
+        if (m > n - k)
+            m = n - k;
+        for (i=0; (i<m) && (sq->fill + i < sq->Nfft); i++) {
+            sq->in[sq->fill + i].r = sq->window[sq->fill + i] * in[k + i].real;
+            sq->in[sq->fill + i].i = sq->window[sq->fill + i] * in[k + i].imag;
+        }
+        if ((sq->fill < sq->Nfft) && (sq->fill + m >= sq->Nfft))
+            sq_block(sq);
+        sq->fill = (sq->fill + m) % period;
+    }
+    if (sq->nblocks != blocks)
+        sq_metric(sq);
+
+    /* open until the spectrum has settled */
+    if (sq->nblocks < 1.0f / SQ_ALPHA) {
+        sq->hang_left = sq->hang;
+    } else if (sq->metric >= sq->open_th) {
+        sq->open = 1;
+        sq->hang_left = sq->hang;
+    } else if (sq->open && (sq->metric >= sq->close_th)) {
+        sq->hang_left = sq->hang;
+    } else if (sq->open) {
+        sq->hang_left -= n;
+        if (sq->hang_left <= 0)
+            sq->open = 0;
+    }
+    return sq->open;
+}
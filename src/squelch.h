@@ -0,0 +1,32 @@
+/*---------------------------------------------------------------------------*\
+
+  FILE........: squelch.h
+
+  Signal presence detector, so the demod can be skipped on an empty
+  channel.  A few short FFTs a second are averaged into a spectrum, and
+  the squelch opens when some band about Rs wide stands above the median
+  of the spectrum.  It closes again once nothing has for the hang time.
+
+\*---------------------------------------------------------------------------*/
+
+#ifndef __SQUELCH__
+#define __SQUELCH__
+
+#include "comp.h"
+
+struct squelch;
+
+/* Rs is the lowest symbol rate to detect, tones between f_min and f_max Hz */
+struct squelch *squelch_create(int Fs, int Rs, int f_min, int f_max);
+void            squelch_destroy(struct squelch *sq);
+
+/* samples the squelch stays open for after the signal has gone */
+void            squelch_set_hang(struct squelch *sq, int samples);
+
+/* n more samples, returns 1 while the squelch is open */
+int             squelch_process(struct squelch *sq, const COMP in[], int n);
+
+/* the latest peak to median ratio, about 1 for noise */
+float           squelch_metric(struct squelch *sq);
+
+#endif
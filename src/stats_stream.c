@@ -0,0 +1,147 @@
+/*---------------------------------------------------------------------------*\
+
+  FILE........: stats_stream.c
+
+  Binary stats frames, see stats_stream.h.
+
+  A UDP destination is a connected socket, so both kinds are written
+  with write().  The descriptor is non-blocking once open, and a short
+  or failed write drops the frame.
+
+\*---------------------------------------------------------------------------*/
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "modem_stats.h"
+#include "stats_stream.h"
+
+struct stats_stream {
+    int      fd;
+    uint32_t seq;
+    uint8_t  frame[STATS_STREAM_BYTES];
+};
+
+static int stats_stream_udp(const char *host_port) {
+    struct addrinfo hints, *res, *ai;
+    char host[256];
+    const char *port;
+    int fd = -1;
+
+    port = strrchr(host_port, ':');
+    if ((port == NULL) || (port - host_port >= (int)sizeof(host)))
+        return -1;
+    memcpy(host, host_port, port - host_port);
+    host[port - host_port] = 0;
+    port++;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    if (getaddrinfo(host, port, &hints, &res) != 0)
+        return -1;
+    for (ai=res; ai; ai=ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0)
+            continue;
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+            break;
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    return fd;
+}
+
+struct stats_stream *stats_stream_open(const char *dest) {
+    struct stats_stream *ss;
+
+    ss = (struct stats_stream *)calloc(1, sizeof(struct stats_stream));
+    if (ss == NULL)
+        return NULL;
+    if (strncmp(dest, "udp:", 4) == 0)
+        ss->fd = stats_stream_udp(dest + 4);
+    else
+        ss->fd = open(dest, O_WRONLY | O_CREAT | O_TRUNC, 0644);  /* waits for the reader of a FIFO */
+    if ((ss->fd < 0) || (fcntl(ss->fd, F_SETFL, fcntl(ss->fd, F_GETFL) | O_NONBLOCK) < 0)) {
+        if (ss->fd >= 0)
+            close(ss->fd);
+        free(ss);
+        return NULL;
+    }
+    return ss;
+}
+
+void stats_stream_close(struct stats_stream *ss) {
+    close(ss->fd);
+    free(ss);
+}
+
+static uint8_t *put_u16(uint8_t *p, uint16_t x) {
+    p[0] = x;
+    p[1] = x >> 8;
+    return p + 2;
+}
+
+static uint8_t *put_u32(uint8_t *p, uint32_t x) {
+    p[0] = x;
+    p[1] = x >> 8;
+    p[2] = x >> 16;
+    p[3] = x >> 24;
+    return p + 4;
+}
+
+static uint8_t *put_f32(uint8_t *p, float f) {
+    uint32_t x;
+
+    memcpy(&x, &f, sizeof(x));
+    return put_u32(p, x);
+}
+
+int stats_stream_send(struct stats_stream *ss, struct horus *hstates) {
+    struct MODEM_STATS stats;
+    float spec[STATS_STREAM_NSPEC], f_lo, f_hi;
+    uint8_t *p = ss->frame;
+    int mfsk = horus_get_mFSK(hstates);
+    int ntr, nsamp, dec, i, j;
+
+    horus_get_modem_extended_stats(hstates, &stats);
+    horus_get_spectrum(hstates, spec, STATS_STREAM_NSPEC, &f_lo, &f_hi);
+
+    /* longer traces are decimated to fit */
+    ntr = stats.neyetr < STATS_STREAM_EYE_TR ? stats.neyetr : STATS_STREAM_EYE_TR;
+    dec = (stats.neyesamp + STATS_STREAM_EYE_SAMP - 1) / STATS_STREAM_EYE_SAMP;
+    dec = dec < 1 ? 1 : dec;
+    nsamp = stats.neyesamp / dec;
+
+    memcpy(p, "HSTS", 4);
+    p += 4;
+    p = put_u16(p, STATS_STREAM_VERSION);
+    p = put_u16(p, STATS_STREAM_BYTES);
+    p = put_u32(p, ss->seq++);
+    *p++ = horus_get_mode(hstates);
+    *p++ = mfsk;
+    *p++ = ntr;
+    *p++ = nsamp;
+    p = put_f32(p, stats.snr_est);
+    p = put_f32(p, stats.clock_offset);
+    p = put_f32(p, stats.foff);
+    p = put_f32(p, stats.rx_timing);
+    for (i=0; i<4; i++)
+        p = put_f32(p, i < mfsk ? stats.f_est[i] : 0.0f);
+    p = put_f32(p, f_lo);
+    p = put_f32(p, f_hi);
+    for (i=0; i<STATS_STREAM_EYE_TR; i++)
+        for (j=0; j<STATS_STREAM_EYE_SAMP; j++)
+            p = put_f32(p, (i < ntr) && (j < nsamp) ? stats.rx_eye[i][j * dec] : 0.0f);
+    for (i=0; i<STATS_STREAM_NSPEC; i++)
+        p = put_f32(p, spec[i]);
+
+    return write(ss->fd, ss->frame, STATS_STREAM_BYTES) == STATS_STREAM_BYTES;
+}
@@ -0,0 +1,58 @@
+/*---------------------------------------------------------------------------*\
+
+  FILE........: stats_stream.h
+
+  Modem stats as fixed size binary frames, one per demod frame, for a
+  GUI or monitor to read from a pipe or UDP at the full frame rate,
+  without the demod spending its time formatting JSON.
+
+  Every frame is STATS_STREAM_BYTES long, all fields little-endian,
+  floats IEEE 754 single:
+
+    offset  size
+         0     4  magic, "HSTS"
+         4     2  version, STATS_STREAM_VERSION
+         6     2  length of the frame in bytes
+         8     4  sequence number, from 0
+        12     1  mode, HORUS_MODE_
+        13     1  number of tones
+        14     1  eye traces, up to STATS_STREAM_EYE_TR
+        15     1  samples per eye trace, up to STATS_STREAM_EYE_SAMP
+        16     4  SNR estimate, dB
+        20     4  clock offset, ppm
+        24     4  frequency offset, Hz
+        28     4  rx timing, samples
+        32    16  4 tone frequencies, Hz, 0 past the number of tones
+        48     4  frequency of the first spectrum bin, Hz
+        52     4  and of the end of the last
+        56  1024  eye, STATS_STREAM_EYE_TR traces of STATS_STREAM_EYE_SAMP,
+                  normalised to 1, unused samples 0
+      1080   512  STATS_STREAM_NSPEC bins of the tone search spectrum,
+                  linear magnitudes
+
+  A frame that cannot be written at once, as when the reader of a pipe
+  falls behind, is dropped rather than holding up the demod.
+
+\*---------------------------------------------------------------------------*/
+
+#ifndef __STATS_STREAM__
+#define __STATS_STREAM__
+
+#include "horus_api.h"
+
+#define STATS_STREAM_VERSION    1
+#define STATS_STREAM_EYE_TR     8
+#define STATS_STREAM_EYE_SAMP   32
+#define STATS_STREAM_NSPEC      128
+#define STATS_STREAM_BYTES      (56 + 4 * (STATS_STREAM_EYE_TR * STATS_STREAM_EYE_SAMP + STATS_STREAM_NSPEC))
+
+struct stats_stream;
+
+/* dest is udp:host:port, or the path of a file or FIFO, NULL on failure */
+struct stats_stream *stats_stream_open(const char *dest);
+void                 stats_stream_close(struct stats_stream *ss);
+
+/* a frame of the latest stats of hstates, returns 0 if it was dropped */
+int                  stats_stream_send(struct stats_stream *ss, struct horus *hstates);
+
+#endif
@@ -2,7 +2,14 @@
 
 char *url_encode( char *str );
 void UpdatePayloadLOG( char *payload );
-void UploadTelemetryPacket( char *Telemetry );
+void LogMessage( const char *format, ... );
+void UploadTelemetryPacket( char *Telemetry, time_t created );
+void UploadTelemetryFlush( int force );
+void UploadInit( void );
+void UploadClean( void );
+int UploadQueueDepth( void );
+int UploadQueueAge( void );
+int UploadDropped( void );
 void base64_encode( uint8_t *data, size_t input_length, size_t *output_length, char *encoded_data );
 
 typedef struct {
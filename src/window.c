@@ -0,0 +1,123 @@
+/*---------------------------------------------------------------------------*\
+
+  FILE........: window.c
+
+  Shared window tables, see window.h.
+
+  Each coefficient is stored twice, once for the real and once for the
+  imaginary part, so windowing a block of COMP samples is one straight
+  run of float multiplies the compiler can vectorise.  The tables are
+  kept in a list under a lock, as the demods of horus_per and the
+  gateway run on several threads.
+
+\*---------------------------------------------------------------------------*/
+
+#include <assert.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "window.h"
+
+struct window {
+    int            type;
+    int            n;
+    int            users;
+    struct window *next;
+    float          w[];                 /* 2n, each coefficient twice */
+};
+
+static struct window  *window_list;
+static pthread_mutex_t window_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* sum of a[k] cos(2 pi k x), for x from 0 to 1 across the window */
+static double window_cos(const double a[], int terms, double x) {
+    double sum = 0.0, sign = 1.0;
+    int k;
+
+    for (k=0; k<terms; k++, sign=-sign)
+        sum += sign * a[k] * cos(2.0 * M_PI * k * x);
+    return sum;
+}
+
+static double window_at(int type, int i, int n) {
+    static const double hann[] = { 0.5, 0.5 };
+    static const double bh[] = { 0.35875, 0.48829, 0.14128, 0.01168 };
+    static const double flat[] = { 0.21557895, 0.41663158, 0.277263158, 0.083578947, 0.006947368 };
+    double x = n > 1 ? (double)i / (n - 1) : 0.5;
+
+    switch (type) {
+    case WINDOW_SINE:            return sin(M_PI * x);
+    case WINDOW_HANN:            return window_cos(hann, 2, x);
+    case WINDOW_BLACKMAN_HARRIS: return window_cos(bh, 4, x);
+    case WINDOW_FLAT_TOP:        return window_cos(flat, 5, x);
+    default:                     return 1.0;
+    }
+}
+
+const struct window *window_get(int type, int n) {
+    struct window *w;
+    int i;
+
+    assert(n > 0);
+    pthread_mutex_lock(&window_lock);
+    for (w=window_list; w; w=w->next)
+        if ((w->type == type) && (w->n == n))
+            break;
+    if (w == NULL) {
+        w = (struct window *)malloc(sizeof(struct window) + sizeof(float) * 2 * n);
+        if (w) {
+            w->type = type;
+            w->n = n;
+            w->users = 0;
+            for (i=0; i<n; i++)
+                w->w[2*i] = w->w[2*i + 1] = window_at(type, i, n);
+            w->next = window_list;
+            window_list = w;
+        }
+    }
+    if (w)
+        w->users++;
+    pthread_mutex_unlock(&window_lock);
+    return w;
+}
+
+void window_put(const struct window *w) {
+    struct window **p;
+
+    if (w == NULL)
+        return;
+    pthread_mutex_lock(&window_lock);
+    for (p=&window_list; *p; p=&(*p)->next) {
+        if (*p == w) {
+            if (--(*p)->users == 0) {
+                *p = w->next;
+                free((void *)w);
+            }
+            break;
+        }
+    }
+    pthread_mutex_unlock(&window_lock);
+}
+
+int window_len(const struct window *w) {
+    return w->n;
+}
+
+void window_apply(const struct window *w, kiss_fft_cpx out[], const COMP in[], int n, int Ndft) {
+    const float *restrict c = w ? w->w : NULL;
+    float *restrict y = (float *)out;
+    const float *restrict x = (const float *)in;
+    int i;
+
+    assert((w == NULL) || (w->n == n));
+    assert(n <= Ndft);
+    if (w) {
+        for (i=0; i<2*n; i++)
+            y[i] = c[i] * x[i];
+    } else {
+        memcpy(out, in, sizeof(COMP) * n);
+    }
+    memset(&out[n], 0, sizeof(kiss_fft_cpx) * (Ndft - n));
+}
@@ -0,0 +1,34 @@
+/*---------------------------------------------------------------------------*\
+
+  FILE........: window.h
+
+  Window tables for FFTs.  Each type and length is computed once, the
+  first time it is asked for, and shared by every user of it until the
+  last one puts it back.
+
+\*---------------------------------------------------------------------------*/
+
+#ifndef __WINDOW__
+#define __WINDOW__
+
+#include "comp.h"
+#include "kiss_fft.h"
+
+#define WINDOW_RECT             0       /* no window, and no table            */
+#define WINDOW_SINE             1       /* sin(pi n/(N-1)), the freq. estimator's own */
+#define WINDOW_HANN             2
+#define WINDOW_BLACKMAN_HARRIS  3       /* 4 term, sidelobes below -92 dB     */
+#define WINDOW_FLAT_TOP         4       /* level within 0.02 dB between bins  */
+
+struct window;
+
+/* the window of n points, NULL if out of memory */
+const struct window *window_get(int type, int n);
+void                 window_put(const struct window *w);
+int                  window_len(const struct window *w);
+
+/* window_len(w) samples into out[], times the window, then zeros up to
+   out[Ndft-1].  With w NULL, n samples are copied as they are. */
+void                 window_apply(const struct window *w, kiss_fft_cpx out[], const COMP in[], int n, int Ndft);
+
+#endif
@@ -0,0 +1,100 @@
+#!/usr/bin/env python3
+#
+#   Telemetry Upload Stand-in Server
+#
+#   A local HTTP server to test the gateway uploader without touching habitat.
+#   Accepts the legacy per-sentence PUT, and the batched JSON array POST
+#   (optionally gzip encoded), and prints each request with the client port,
+#   so reuse of keep-alive connections can be seen.
+#
+#   Usage: python3 upload_stub.py --port=8080
+#   then in gateway.txt:
+#       EnableHabitat=Y
+#       HabitatURL=http://localhost:8080/add_listener/
+#       BatchURL=http://localhost:8080/telemetry
+#       BatchWindow=2000
+#
+#   Released under GNU GPL v3 or later
+#
+
+import argparse
+import base64
+import gzip
+import json
+import sys
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+
+class UploadHandler(BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"   # keep connections open
+    sentences = 0
+    requests = 0
+
+    def _body(self):
+        length = int(self.headers.get("Content-Length", 0))
+        body = self.rfile.read(length)
+        if self.headers.get("Content-Encoding") == "gzip":
+            body = gzip.decompress(body)
+        return json.loads(body)
+
+    def _reply(self, code):
+        reply = b'{"ok": true}'
+        self.send_response(code)
+        self.send_header("Content-Type", "application/json")
+        self.send_header("Content-Length", str(len(reply)))
+        self.end_headers()
+        self.wfile.write(reply)
+
+    def _record(self, docs):
+        UploadHandler.requests += 1
+        UploadHandler.sentences += len(docs)
+        for doc in docs:
+            raw = base64.b64decode(doc["data"]["_raw"]).decode(errors="replace").strip()
+            print("  %s" % raw)
+        print("%s %s port %d: %d sentence(s), %d in %d request(s) so far%s" % (
+            self.command, self.path, self.client_address[1], len(docs),
+            UploadHandler.sentences, UploadHandler.requests,
+            " (gzip)" if self.headers.get("Content-Encoding") == "gzip" else ""))
+        sys.stdout.flush()
+
+    def do_PUT(self):
+        try:
+            self._record([self._body()])
+        except (ValueError, KeyError):
+            return self._reply(400)
+        self._reply(201)
+
+    def do_POST(self):
+        try:
+            docs = self._body()
+            if not isinstance(docs, list):
+                raise ValueError
+            self._record(docs)
+        except (ValueError, KeyError):
+            return self._reply(400)
+        self._reply(201)
+
+    def log_message(self, format, *args):
+        pass
+
+
+class QuietServer(ThreadingHTTPServer):
+    daemon_threads = True
+
+    def handle_error(self, request, client_address):
+        # the gateway drops its keep-alive connections on exit
+        if not isinstance(sys.exc_info()[1], ConnectionError):
+            ThreadingHTTPServer.handle_error(self, request, client_address)
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--port", type=int, default=8080, help="Listen port (default 8080)")
+    args = parser.parse_args()
+
+    server = QuietServer(("localhost", args.port), UploadHandler)
+    print("Listening on port %d" % args.port)
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass